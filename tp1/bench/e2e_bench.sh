@@ -0,0 +1,34 @@
+#!/bin/sh
+# End-to-end benchmark: a replaying writer logging through a reader in benchmark mode.
+# Usage: e2e_bench.sh <build dir> [messages] [rate] [min:max] [signals/s] [fifo|shm] [sync]
+#                     [reader options, e.g. -z]
+# Runs in <build dir>/e2e so the tmp/ and log/ folders of the project are not touched, and
+# leaves the JSON results in <build dir>/bench_e2e.json.
+
+BUILD_DIR=$(cd "$1" && pwd) || exit 1
+MESSAGES=${2:-100000}
+RATE=${3:-50000}
+SIZES=${4:-16:256}
+SIGNALS=${5:-1000}
+TRANSPORT=${6:-fifo}
+SYNC=${7:-none}
+READER_OPTS=$8
+RESULTS=$BUILD_DIR/bench_e2e.json
+
+rm -rf "$BUILD_DIR/e2e" && mkdir -p "$BUILD_DIR/e2e" && cd "$BUILD_DIR/e2e" || exit 1
+
+"$BUILD_DIR/reader.out" -t "$TRANSPORT" -s "$SYNC" -b "$RESULTS" $READER_OPTS > reader.txt &
+READER=$!
+sleep 0.5
+
+"$BUILD_DIR/writer.out" -t "$TRANSPORT" -n "$MESSAGES" -R "$RATE" -z "$SIZES" -k "$SIGNALS" \
+    < /dev/null > writer.txt
+STATUS=$?
+grep -h -e Replayed -e SIGUSR writer.txt
+
+# The FIFO reader serves writers until SIGINT, the shm reader stops when its writer detaches
+sleep 0.5
+kill -INT $READER 2> /dev/null
+wait $READER
+cat "$RESULTS"
+exit $STATUS
@@ -0,0 +1,164 @@
+/**
+ * @file framing_bench.c
+ * @brief Trabajo practico 1. Legacy strstr reader loop vs incremental frame parser.
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - A child process writes DATA/SIGN messages into a pipe, one write per message like the
+ *   writer process. The parent drains the pipe with the legacy loop (one strstr classification
+ *   per read) or with the frame parser, and counts how many messages reach the logs intact.
+ * - Usage: framing_bench.out [messages] [messages per second, 0 = unthrottled]
+ *
+ */
+
+#include <stdio.h>    // printf
+#include <stdlib.h>   // strtoul, rand
+#include <string.h>   // strstr, memchr
+#include <sys/wait.h> // waitpid
+#include <time.h>     // clock_gettime, clock_nanosleep
+#include <unistd.h>   // fork, pipe, read, write
+
+#include "framing.h"
+#include "utils.h"
+
+#define BENCH_DEFAULT_MESSAGES 100000
+#define BENCH_DEFAULT_RATE 50000
+
+/**
+ * @brief Results of one run
+ */
+typedef struct {
+    unsigned long intact; /*!> Messages logged whole and in the right file */
+    unsigned long next;   /*!> Next sequence number expected by the parser */
+    unsigned long bytes;  /*!> Bytes drained from the pipe */
+} bench_result_t;
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Child side: write the message stream at the given rate
+ */
+static void bench_produce(int fd, unsigned long messages, unsigned long rate) {
+    char msg[BUFFER_SIZE];
+    unsigned long burst = (rate > 0) ? (rate / 1000 > 0 ? rate / 1000 : 1) : messages;
+    struct timespec deadline; // Bursts paced on an absolute 1 ms grid
+    int len;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    srand(1);
+    for (unsigned long seq = 0; seq < messages; seq++) {
+        if (seq % 10 == 9) {
+            len = snprintf(msg, sizeof(msg), "SIGN:%lu %d\n", seq, 1 + (int)(seq % 2));
+        } else {
+            int fill = 8 + rand() % 120;
+            len = snprintf(msg, sizeof(msg), "DATA:%lu %.*s\n", seq, fill,
+                           "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx"
+                           "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx");
+        }
+        if (write(fd, msg, len) != len) {
+            perror("Error writing bench pipe");
+            return;
+        }
+        if (rate > 0 && seq % burst == burst - 1) {
+            deadline.tv_nsec += 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+        }
+    }
+}
+
+/**
+ * @brief Legacy reader loop: one read, one strstr classification, one log entry
+ */
+static void bench_legacy(int fd, bench_result_t *result) {
+    char buffer[BUFFER_SIZE + 1];
+    ssize_t bytes_read;
+
+    while ((bytes_read = read(fd, buffer, BUFFER_SIZE)) > 0) {
+        result->bytes += bytes_read;
+        buffer[bytes_read] = '\0';
+        if (strstr(buffer, data_msg_prefix) == NULL && strstr(buffer, sign_msg_prefix) == NULL)
+            continue;
+        // The entry is only right when the read held exactly one whole message
+        char *delim = memchr(buffer, '\n', bytes_read);
+        if (delim == buffer + bytes_read - 1 &&
+            (strncmp(buffer, data_msg_prefix, MSG_PREFIX_LEN) == 0 ||
+             strncmp(buffer, sign_msg_prefix, MSG_PREFIX_LEN) == 0))
+            result->intact++;
+    }
+}
+
+static void bench_frame_handler(frame_type_t type, const char *payload, size_t len, void *ctx) {
+    bench_result_t *result = ctx;
+    unsigned long seq = strtoul(payload, NULL, 10);
+    bool is_sign = (seq % 10 == 9);
+
+    if (seq == result->next && is_sign == (type == FRAME_SIGN))
+        result->intact++;
+    result->next = seq + 1;
+}
+
+/**
+ * @brief Frame parser reader loop
+ */
+static void bench_parser(int fd, bench_result_t *result) {
+    char buffer[READ_BUFFER_SIZE];
+    frame_parser_t parser;
+    ssize_t bytes_read;
+
+    frame_parser_init(&parser);
+    while ((bytes_read = read(fd, buffer, READ_BUFFER_SIZE)) > 0) {
+        result->bytes += bytes_read;
+        frame_parser_feed(&parser, buffer, bytes_read, bench_frame_handler, result);
+    }
+}
+
+static int bench_run(const char *name, void (*consume)(int, bench_result_t *),
+                     unsigned long messages, unsigned long rate) {
+    bench_result_t result = {0, 0, 0};
+    int fds[2];
+    pid_t pid;
+
+    if (pipe(fds) < 0) {
+        perror("Error creating bench pipe");
+        return 1;
+    }
+    double start = bench_now();
+    if ((pid = fork()) < 0) {
+        perror("Error forking producer");
+        return 1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        bench_produce(fds[1], messages, rate);
+        close(fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    consume(fds[0], &result);
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    double elapsed = bench_now() - start;
+
+    printf("%-7s sent %lu, intact %lu, lost/misfiled %lu, %.3f s, %.0f msg/s, %.2f MB/s\n", name,
+           messages, result.intact, messages - result.intact, elapsed, result.intact / elapsed,
+           result.bytes / elapsed / 1e6);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long messages = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_MESSAGES;
+    unsigned long rate = (argc > 2) ? strtoul(argv[2], NULL, 10) : BENCH_DEFAULT_RATE;
+
+    printf("Framing bench: %lu messages at %lu msg/s (0 = unthrottled)\n", messages, rate);
+    if (bench_run("legacy", bench_legacy, messages, rate) != 0 ||
+        bench_run("parser", bench_parser, messages, rate) != 0)
+        return 1;
+    return 0;
+}
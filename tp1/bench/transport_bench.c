@@ -0,0 +1,182 @@
+/**
+ * @file transport_bench.c
+ * @brief Trabajo practico 1. Named FIFO (pipe) vs shared-memory ring transport.
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - A child process sends timestamped DATA frames, one write per frame, through a pipe or
+ *   through the shared-memory ring. The parent parses them with the frame parser and records
+ *   the send-to-parse latency of every frame.
+ * - Each transport runs unthrottled (throughput) and paced (latency at a steady rate).
+ * - Usage: transport_bench.out [messages] [frame size] [paced messages per second]
+ *
+ */
+
+#include <stdio.h>    // printf
+#include <stdlib.h>   // strtoul, qsort, malloc
+#include <string.h>   // memset
+#include <sys/wait.h> // waitpid
+#include <time.h>     // clock_gettime, clock_nanosleep
+#include <unistd.h>   // fork, pipe, read, write
+
+#include "framing.h"
+#include "shm_ring.h"
+
+#define BENCH_DEFAULT_MESSAGES 200000
+#define BENCH_DEFAULT_SIZE 64
+#define BENCH_DEFAULT_RATE 50000
+#define BENCH_SHM_NAME "/tp1_ring_bench"
+#define BENCH_READ_SIZE 4096
+
+/**
+ * @brief Consumer side results
+ */
+typedef struct {
+    unsigned long *latency; /*!> Send-to-parse latency per frame, ns */
+    unsigned long frames;   /*!> Frames received */
+} bench_result_t;
+
+static unsigned long bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static int bench_cmp(const void *a, const void *b) {
+    unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_frame_handler(frame_type_t type, const char *payload, size_t len, void *ctx) {
+    bench_result_t *result = ctx;
+    result->latency[result->frames++] = bench_now_ns() - strtoul(payload, NULL, 10);
+}
+
+/**
+ * @brief Child side: send timestamped frames of the given size at the given rate
+ */
+static void bench_produce(int fd, shm_ring_t *ring, unsigned long messages, size_t size,
+                          unsigned long rate) {
+    char msg[FRAME_MAX_SIZE];
+    unsigned long burst = (rate > 0) ? (rate / 1000 > 0 ? rate / 1000 : 1) : messages;
+    struct timespec deadline;
+
+    memset(msg, 'x', sizeof(msg));
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    for (unsigned long seq = 0; seq < messages; seq++) {
+        int len = snprintf(msg, sizeof(msg), "DATA:%020lu ", bench_now_ns());
+        msg[len] = 'x'; // Overwrite the terminator, pad up to size
+        msg[size - 1] = '\n';
+
+        if (ring == NULL) {
+            if (write(fd, msg, size) != (ssize_t)size) {
+                perror("Error writing bench pipe");
+                return;
+            }
+        } else {
+            size_t sent = 0;
+            while (sent < size) {
+                ssize_t n = shm_ring_write(ring, msg + sent, size - sent);
+                if (n < 0 || (n == 0 && shm_ring_wait_space(ring, -1) < 0)) {
+                    perror("Error writing bench ring");
+                    return;
+                }
+                sent += n;
+            }
+        }
+
+        if (rate > 0 && seq % burst == burst - 1) {
+            deadline.tv_nsec += 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+        }
+    }
+}
+
+static int bench_run(const char *name, bool use_shm, unsigned long messages, size_t size,
+                     unsigned long rate) {
+    bench_result_t result = {malloc(messages * sizeof(unsigned long)), 0};
+    char buffer[BENCH_READ_SIZE];
+    frame_parser_t parser;
+    shm_ring_t ring;
+    ssize_t bytes_read;
+    int fds[2];
+    pid_t pid;
+
+    if (result.latency == NULL) {
+        perror("Error allocating latency samples");
+        return 1;
+    }
+    if (use_shm ? shm_ring_create(&ring, BENCH_SHM_NAME) : pipe(fds)) {
+        perror("Error creating bench transport");
+        return 1;
+    }
+
+    unsigned long start = bench_now_ns();
+    if ((pid = fork()) < 0) {
+        perror("Error forking producer");
+        return 1;
+    }
+    if (pid == 0) {
+        shm_ring_t producer;
+        if (use_shm) {
+            if (shm_ring_attach(&producer, BENCH_SHM_NAME) < 0) {
+                perror("Error attaching bench ring");
+                _exit(1);
+            }
+            bench_produce(-1, &producer, messages, size, rate);
+            shm_ring_close(&producer);
+        } else {
+            close(fds[0]);
+            bench_produce(fds[1], NULL, messages, size, rate);
+            close(fds[1]);
+        }
+        _exit(0);
+    }
+
+    frame_parser_init(&parser);
+    if (!use_shm)
+        close(fds[1]);
+    while ((bytes_read = use_shm ? shm_ring_read(&ring, buffer, BENCH_READ_SIZE)
+                                 : read(fds[0], buffer, BENCH_READ_SIZE)) > 0) {
+        frame_parser_feed(&parser, buffer, bytes_read, bench_frame_handler, &result);
+    }
+    if (use_shm)
+        shm_ring_close(&ring);
+    else
+        close(fds[0]);
+    waitpid(pid, NULL, 0);
+    double elapsed = (bench_now_ns() - start) * 1e-9;
+
+    qsort(result.latency, result.frames, sizeof(unsigned long), bench_cmp);
+    printf("%-5s %-11s %lu/%lu frames, %.0f msg/s, %.2f MB/s, latency p50 %.1f us, "
+           "p99 %.1f us, max %.1f us\n",
+           name, rate > 0 ? "paced" : "unthrottled", result.frames, messages,
+           result.frames / elapsed, result.frames * size / elapsed / 1e6,
+           result.frames ? result.latency[result.frames / 2] / 1e3 : 0.0,
+           result.frames ? result.latency[result.frames * 99 / 100] / 1e3 : 0.0,
+           result.frames ? result.latency[result.frames - 1] / 1e3 : 0.0);
+    free(result.latency);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long messages = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_MESSAGES;
+    size_t size = (argc > 2) ? strtoul(argv[2], NULL, 10) : BENCH_DEFAULT_SIZE;
+    unsigned long rate = (argc > 3) ? strtoul(argv[3], NULL, 10) : BENCH_DEFAULT_RATE;
+
+    if (size < 32 || size > FRAME_MAX_SIZE) {
+        fprintf(stderr, "Frame size must be between 32 and %d bytes\n", FRAME_MAX_SIZE);
+        return 1;
+    }
+
+    printf("Transport bench: %lu frames of %zu bytes, paced at %lu msg/s\n", messages, size, rate);
+    if (bench_run("fifo", false, messages, size, 0) != 0 ||
+        bench_run("shm", true, messages, size, 0) != 0 ||
+        bench_run("fifo", false, messages, size, rate) != 0 ||
+        bench_run("shm", true, messages, size, rate) != 0)
+        return 1;
+    return 0;
+}
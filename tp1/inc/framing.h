@@ -0,0 +1,107 @@
+/**
+ * @file framing.h
+ * @brief Trabajo practico 1. Incremental parser for the named FIFO protocol.
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Frames are delimited by '\n': "DATA:XXXXXXXXXXXX\n", "SIGN:N\n", "RTSG:N:VALUE\n" (real-time
+ *   signal SIGRTMIN+N with its sigqueue value) or "HELO:PID\n" (a writer announcing its own
+ *   channel on the shared FIFO).
+ * - Payloads too long for a frame are sent length-prefixed: "DATL:LEN\n" followed by LEN raw
+ *   bytes (the text and its '\n'). The body is delivered in pieces as FRAME_DATL, parser.body
+ *   holds the bytes still to come. A reader can also move them itself (e.g. splice) and then
+ *   clear parser.body.
+ * - Frame types are listed once in FRAME_TYPE_LIST. The enum, the prefix table and the classifier
+ *   (a switch on the 4 prefix letters packed in a word) are generated from it.
+ * - A single read can hold several frames, and a frame can be split across reads. The parser
+ *   keeps the incomplete tail between calls, so no frame is lost or misfiled.
+ *
+ */
+
+#ifndef INC_FRAMING_H
+#define INC_FRAMING_H
+
+#include <stdbool.h> // bool type
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint32_t
+
+#define FRAME_DELIMITER '\n' /*!> Frame delimiter */
+#define FRAME_PREFIX_LEN 5   /*!> Length of the "DATA:" / "SIGN:" / "HELO:" prefixes */
+#define FRAME_MAX_SIZE 4096  /*!> Max frame size, PIPE_BUF so a frame is written atomically */
+#define FRAME_BODY_MAX (60 * 1024) /*!> Max body of a length-prefixed frame */
+
+/**
+ * @brief Frame types of the FIFO protocol: X(name, prefix letters), the prefix ends with ':'
+ * - DATA: text message
+ * - SIGN: SIGUSR1/SIGUSR2 message
+ * - HELO: writer registration, control channel only
+ * - DATL: length-prefixed text message, payload is a body piece
+ * - RTSG: real-time signal message
+ */
+#define FRAME_TYPE_LIST(X)                                                                         \
+    X(DATA, 'D', 'A', 'T', 'A')                                                                    \
+    X(SIGN, 'S', 'I', 'G', 'N')                                                                    \
+    X(HELO, 'H', 'E', 'L', 'O')                                                                    \
+    X(DATL, 'D', 'A', 'T', 'L')                                                                    \
+    X(RTSG, 'R', 'T', 'S', 'G')
+
+/**
+ * @brief Prefix letters packed in a word, independent of byte order
+ */
+#define FRAME_WORD(a, b, c, d)                                                                     \
+    ((uint32_t)(uint8_t)(a) | (uint32_t)(uint8_t)(b) << 8 | (uint32_t)(uint8_t)(c) << 16 |         \
+     (uint32_t)(uint8_t)(d) << 24)
+
+#define FRAME_ENUM(name, a, b, c, d) FRAME_##name,
+
+/**
+ * @brief Frame types of the FIFO protocol, FRAME_DATA, FRAME_SIGN...
+ */
+typedef enum { FRAME_TYPE_LIST(FRAME_ENUM) FRAME_TYPE_COUNT } frame_type_t;
+
+/**
+ * @brief Callback for every complete frame
+ * @param type: Frame type
+ * @param payload: Frame content without prefix, delimiter included
+ * @param len: Payload length
+ * @param ctx: User context given to frame_parser_feed
+ */
+typedef void (*frame_handler_t)(frame_type_t type, const char *payload, size_t len, void *ctx);
+
+/**
+ * @brief Incremental parser state
+ */
+typedef struct {
+    char buffer[FRAME_MAX_SIZE]; /*!> Incomplete frame carried between reads */
+    size_t len;                  /*!> Bytes held in buffer */
+    bool discard;                /*!> Skipping an oversized frame until next delimiter */
+    size_t body;                 /*!> Body bytes of the current DATL frame still to come */
+    unsigned long frames;        /*!> Frames delivered to the handler */
+    unsigned long dropped;       /*!> Frames dropped (unknown prefix or oversized) */
+} frame_parser_t;
+
+/**
+ * @brief Initialize parser state
+ * @param parser: Parser to initialize
+ */
+void frame_parser_init(frame_parser_t *parser);
+
+/**
+ * @brief Feed a chunk of the byte stream into the parser
+ * @param parser: Parser state
+ * @param data: Bytes read from the transport
+ * @param len: Number of bytes in data
+ * @param handler: Called once per complete frame, in stream order
+ * @param ctx: User context for the handler
+ * @retval Number of frames delivered
+ */
+size_t frame_parser_feed(frame_parser_t *parser, const char *data, size_t len,
+                         frame_handler_t handler, void *ctx);
+
+/**
+ * @brief Message prefix of a frame type
+ * @param type: Frame type
+ * @retval Prefix string ("DATA:", "SIGN:"...)
+ */
+const char *frame_type_prefix(frame_type_t type);
+
+#endif /* INC_FRAMING_H */
@@ -0,0 +1,49 @@
+/**
+ * @file histogram.h
+ * @brief Trabajo practico 1. Log-linear latency histogram.
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Values are grouped by power of two and each power of two is split in HISTOGRAM_SUB_BUCKETS
+ *   linear buckets, so percentiles are exact within 1/HISTOGRAM_SUB_BUCKETS (~3%).
+ * - Recording is O(1) and the memory footprint is fixed, whatever the number of samples.
+ *
+ */
+
+#ifndef INC_HISTOGRAM_H
+#define INC_HISTOGRAM_H
+
+#include <stdint.h> // uint64_t
+
+#define HISTOGRAM_SUB_BITS 5                         /*!> log2 of linear buckets per power of two */
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS) /*!> Covers the whole uint64_t range */
+
+/**
+ * @brief Histogram state
+ */
+typedef struct {
+    uint64_t counts[HISTOGRAM_BUCKETS]; /*!> Samples per bucket */
+    uint64_t count;                     /*!> Number of samples */
+    uint64_t sum;                       /*!> Sum of samples */
+    uint64_t min;                       /*!> Smallest sample */
+    uint64_t max;                       /*!> Largest sample */
+} histogram_t;
+
+/**
+ * @brief Initialize an empty histogram
+ */
+void histogram_init(histogram_t *hist);
+
+/**
+ * @brief Record one sample
+ */
+void histogram_record(histogram_t *hist, uint64_t value);
+
+/**
+ * @brief Value below which the given fraction of samples falls
+ * @param fraction: 0.5 for p50, 0.99 for p99, 0.999 for p999
+ * @retval Upper bound of the bucket holding the percentile, 0 if empty
+ */
+uint64_t histogram_percentile(const histogram_t *hist, double fraction);
+
+#endif /* INC_HISTOGRAM_H */
@@ -0,0 +1,132 @@
+/**
+ * @file log_sink.h
+ * @brief Trabajo practico 1. Asynchronous group-commit log sink.
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - The reader thread pushes entries into a ring buffer and returns immediately. A dedicated
+ *   sink thread drains the ring and writes every stream with one writev per batch.
+ * - When the ring is full the producer waits, entries are never dropped.
+ * - Each stream is a segmented log store (see log_store.h).
+ * - log_sink_splice writes an entry whose body is still in a pipe. It waits until the queued
+ *   entries are written and the sink thread is idle, then moves the body into the log with
+ *   splice from the calling thread: no copy to user space and no thread handoff.
+ *
+ */
+
+#ifndef INC_LOG_SINK_H
+#define INC_LOG_SINK_H
+
+#include <pthread.h>  // pthread_t, pthread_mutex_t, pthread_cond_t
+#include <stdbool.h>  // bool type
+#include <stddef.h>   // size_t
+#include <stdint.h>   // uint64_t
+#include <time.h>     // struct timespec
+
+#include "histogram.h"
+#include "log_store.h"
+
+#define LOG_SINK_RING_SIZE (1 << 20) /*!> Ring buffer size in bytes, power of two */
+#define LOG_SINK_MAX_STREAMS 4       /*!> Max number of log files handled by a sink */
+#define LOG_SINK_IOV_MAX 256         /*!> Max entries gathered in a single writev */
+
+/**
+ * @brief Durability policy
+ */
+typedef enum {
+    LOG_SYNC_NONE = 0, /*!> Never fsync, the kernel flushes the page cache */
+    LOG_SYNC_INTERVAL, /*!> fsync every period milliseconds */
+    LOG_SYNC_ENTRIES,  /*!> fsync every period entries */
+} log_sync_policy_t;
+
+/**
+ * @brief Durability configuration
+ */
+typedef struct {
+    log_sync_policy_t policy; /*!> Durability policy */
+    unsigned long period;     /*!> Milliseconds or entries, depending on the policy */
+} log_sync_t;
+
+/**
+ * @brief Log sink state
+ */
+typedef struct {
+    char ring[LOG_SINK_RING_SIZE];       /*!> Entries waiting to be written */
+    unsigned long head;                  /*!> Ring write position (producer) */
+    unsigned long tail;                  /*!> Ring read position (sink thread) */
+    bool stop;                           /*!> Drain the ring and finish */
+    bool syncing;                        /*!> Sink thread syncing while idle */
+    bool splicing;                       /*!> A producer owns the stores (log_sink_splice) */
+    pthread_mutex_t mutex;               /*!> Protects head, tail, stop, syncing and splicing */
+    pthread_cond_t data_cond;            /*!> Signaled when entries are pushed */
+    pthread_cond_t space_cond;           /*!> Signaled when the ring is drained */
+    pthread_t thread;                    /*!> Sink thread */
+    log_store_t stores[LOG_SINK_MAX_STREAMS]; /*!> Segmented log files */
+    size_t streams;                      /*!> Number of log files */
+    log_sync_t sync;                     /*!> Durability policy */
+    unsigned long unsynced[LOG_SINK_MAX_STREAMS]; /*!> Entries written since last fsync */
+    struct timespec last_sync;           /*!> Time of last fsync (CLOCK_MONOTONIC) */
+    unsigned long entries;               /*!> Entries written */
+    unsigned long batches;               /*!> writev calls */
+    unsigned long syncs;                 /*!> fsync calls */
+    histogram_t *latency;                /*!> Optional, push-to-write latency of stamped entries */
+} log_sink_t;
+
+/**
+ * @brief Parse a durability policy: "none", "interval:MS" or "entries:N"
+ * @param arg: Policy string
+ * @param sync: Parsed policy
+ * @retval 0 on success, -1 on invalid string
+ */
+int log_sync_parse(const char *arg, log_sync_t *sync);
+
+/**
+ * @brief Open the log stores and start the sink thread
+ * @param sink: Sink to initialize
+ * @param paths: One log path per stream
+ * @param streams: Number of streams
+ * @param sync: Durability policy
+ * @param store: Segment rotation configuration
+ * @retval 0 on success, -1 on error (errno set)
+ */
+int log_sink_init(log_sink_t *sink, const char *const paths[], size_t streams, log_sync_t sync,
+                  log_store_config_t store);
+
+/**
+ * @brief Queue an entry, blocks only while the ring is full
+ * @param sink: Log sink
+ * @param stream: Destination stream index
+ * @param data: Entry content
+ * @param len: Entry length
+ * @retval 0 on success, -1 if the sink is stopped
+ */
+int log_sink_push(log_sink_t *sink, size_t stream, const char *data, size_t len);
+
+/**
+ * @brief Queue an entry carrying a CLOCK_MONOTONIC timestamp (ns)
+ * @note Once the entry is written, now - stamp is recorded in sink->latency (if set)
+ * @retval 0 on success, -1 if the sink is stopped
+ */
+int log_sink_push_stamped(log_sink_t *sink, size_t stream, const char *data, size_t len,
+                          uint64_t stamp);
+
+/**
+ * @brief Write an entry whose body is read from a pipe, after every queued entry
+ * @param sink: Log sink
+ * @param stream: Destination stream index
+ * @param head: Entry start
+ * @param head_len: Length of head
+ * @param fd: Pipe holding the rest of the entry (see log_store_splice)
+ * @param len: Body bytes moved from fd straight into the log file
+ * @param stamp: CLOCK_MONOTONIC timestamp for sink->latency, 0 if none
+ * @retval 0 on success, -1 on error (errno set)
+ */
+int log_sink_splice(log_sink_t *sink, size_t stream, const char *head, size_t head_len, int fd,
+                    size_t len, uint64_t stamp);
+
+/**
+ * @brief Write every queued entry, fsync (unless policy is none), stop the thread and close stores
+ * @param sink: Log sink
+ */
+void log_sink_stop(log_sink_t *sink);
+
+#endif /* INC_LOG_SINK_H */
@@ -0,0 +1,128 @@
+/**
+ * @file log_store.h
+ * @brief Trabajo practico 1. Segmented, preallocated and indexed log store.
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - A log path such as "log/log.txt" is stored as numbered segments "log/log.txt.000001",
+ *   "log/log.txt.000002"... plus a sparse index "log/log.txt.idx". The log path itself is a
+ *   symlink to the active segment, so "tail -F log/log.txt" keeps working.
+ * - Segments are preallocated with fallocate (file size unchanged, they stay plain text) and
+ *   rotated when the next entry does not fit or when the rotation period expires. An entry never
+ *   spans two segments. A new segment is started every time the store is opened.
+ * - The index holds one (wall time, segment, offset) record per segment start and, after that,
+ *   per write at least LOG_STORE_INDEX_MS after the previous record. Every entry between two
+ *   records was written in that time span, so a time range query is a binary search on the index
+ *   plus a sequential read of the matching segments, exact to LOG_STORE_INDEX_MS.
+ * - A log file left by an older reader is renamed to segment 0, which is never indexed.
+ *
+ */
+
+#ifndef INC_LOG_STORE_H
+#define INC_LOG_STORE_H
+
+#include <stdbool.h>   // bool type
+#include <stddef.h>    // size_t
+#include <stdint.h>    // int64_t, uint32_t
+#include <sys/types.h> // ssize_t
+#include <sys/uio.h>   // struct iovec
+#include <time.h>      // struct timespec
+
+#define LOG_STORE_PATH_MAX 256              /*!> Max length of a segment path */
+#define LOG_STORE_SEGMENT_SIZE (64UL << 20) /*!> Default segment size, 64 MiB */
+#define LOG_STORE_INDEX_MS 10               /*!> Min time between index records */
+#define LOG_STORE_SEGMENT_FMT "%s.%06u"     /*!> Segment path: log path and number */
+#define LOG_STORE_INDEX_FMT "%s.idx"        /*!> Index path */
+#define LOG_STORE_IOV_MAX 256               /*!> Max entries written in a single writev */
+
+/**
+ * @brief Rotation configuration
+ */
+typedef struct {
+    size_t segment_size;     /*!> Bytes per segment, preallocated */
+    unsigned long rotate_ms; /*!> Rotate after this many milliseconds, 0 = size only */
+} log_store_config_t;
+
+/**
+ * @brief Index record, the entry at (segment, offset) and every later one were written at or
+ *        after time_ns
+ */
+typedef struct {
+    int64_t time_ns;  /*!> CLOCK_REALTIME of the write, ns */
+    uint32_t segment; /*!> Segment number */
+    uint32_t offset;  /*!> Offset of the write in the segment */
+} log_store_index_t;
+
+/**
+ * @brief Log store state
+ */
+typedef struct {
+    char path[LOG_STORE_PATH_MAX]; /*!> Log path, symlink to the active segment */
+    log_store_config_t config;     /*!> Rotation configuration */
+    int fd;                        /*!> Active segment */
+    int index_fd;                  /*!> Index file */
+    uint32_t segment;              /*!> Active segment number */
+    size_t offset;                 /*!> Bytes written to the active segment */
+    struct timespec opened;        /*!> Active segment creation (CLOCK_MONOTONIC) */
+    bool indexed;                  /*!> Active segment has an index record */
+    int64_t last_index_ns;         /*!> Time of the last index record, records never go back */
+    unsigned long rotations;       /*!> Segments closed by rotation */
+} log_store_t;
+
+/**
+ * @brief Parse a rotation configuration: "size:MB", "time:S" or "size:MB,time:S"
+ * @param arg: Configuration string
+ * @param config: Parsed configuration, fields not given keep their value
+ * @retval 0 on success, -1 on invalid string
+ */
+int log_store_config_parse(const char *arg, log_store_config_t *config);
+
+/**
+ * @brief Path of a segment
+ * @retval Length of the path, >= size if truncated
+ */
+int log_store_segment_path(char *buffer, size_t size, const char *path, uint32_t segment);
+
+/**
+ * @brief Open a store and start a new segment after the last indexed one
+ * @param store: Store to initialize
+ * @param path: Log path
+ * @param config: Rotation configuration
+ * @retval 0 on success, -1 on error (errno set)
+ */
+int log_store_open(log_store_t *store, const char *path, const log_store_config_t *config);
+
+/**
+ * @brief Append entries, one per iovec, rotating segments as needed
+ * @param store: Log store
+ * @param iov: Entries
+ * @param count: Number of entries
+ * @retval 0 on success, -1 on error (errno set)
+ */
+int log_store_writev(log_store_t *store, const struct iovec *iov, int count);
+
+/**
+ * @brief Append one entry whose body is moved from a pipe with splice, without copying it
+ * @param store: Log store
+ * @param head: Entry start, written normally
+ * @param head_len: Length of head
+ * @param fd: Pipe holding the rest of the entry, never waited for: a non-blocking pipe must
+ *            already hold len bytes
+ * @param len: Bytes to move from fd
+ * @retval 0 on success, -1 on error (errno set, EPIPE if the pipe was closed before len bytes,
+ *         EAGAIN if a non-blocking pipe had fewer), the entry line is ended anyway
+ */
+int log_store_splice(log_store_t *store, const char *head, size_t head_len, int fd, size_t len);
+
+/**
+ * @brief fdatasync the active segment and the index
+ * @retval 0 on success, -1 on error
+ */
+int log_store_sync(log_store_t *store);
+
+/**
+ * @brief Release the unused preallocated space of the active segment and close the store
+ * @retval 0 on success, -1 on error
+ */
+int log_store_close(log_store_t *store);
+
+#endif /* INC_LOG_STORE_H */
@@ -0,0 +1,93 @@
+/**
+ * @file shm_ring.h
+ * @brief Trabajo practico 1. Shared-memory transport between writer and reader.
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Single-producer/single-consumer byte ring in a POSIX shared memory object. It carries the
+ *   same '\n' delimited DATA/SIGN frames as the named FIFO, the reader parses both the same way.
+ * - Indexes are published with acquire/release atomics. A side only sleeps on a futex when the
+ *   ring is empty (reader) or full (writer), and is woken only if it announced it is waiting.
+ *
+ */
+
+#ifndef INC_SHM_RING_H
+#define INC_SHM_RING_H
+
+#include <stdbool.h>   // bool type
+#include <stddef.h>    // size_t
+#include <stdint.h>    // uint32_t
+#include <sys/types.h> // ssize_t
+
+#define SHM_RING_NAME "/tp1_ring"   /*!> Shared memory object name */
+#define SHM_RING_SIZE (1 << 20)     /*!> Data bytes, power of two */
+#define SHM_RING_CACHE_LINE 64      /*!> Producer and consumer fields live in separate lines */
+
+/**
+ * @brief Ring header, at the start of the shared memory object
+ */
+typedef struct {
+    uint32_t head __attribute__((aligned(SHM_RING_CACHE_LINE))); /*!> Written by producer */
+    uint32_t producer_waiting;  /*!> Producer sleeping on space_seq */
+    uint32_t data_seq;          /*!> Futex word, bumped by the producer to wake the consumer */
+    uint32_t producer_attached; /*!> Futex word, set once the writer maps the ring */
+    uint32_t producer_closed;   /*!> Writer detached, reader gets EOF once empty */
+    uint32_t producer_pid;      /*!> Writer PID, tagged on every log entry */
+    uint32_t tail __attribute__((aligned(SHM_RING_CACHE_LINE))); /*!> Written by consumer */
+    uint32_t consumer_waiting;  /*!> Consumer sleeping on data_seq */
+    uint32_t space_seq;         /*!> Futex word, bumped by the consumer to wake the producer */
+    uint32_t consumer_closed;   /*!> Reader detached, writes fail with EPIPE */
+} shm_ring_hdr_t;
+
+/**
+ * @brief Process-local handle of a mapped ring
+ */
+typedef struct {
+    shm_ring_hdr_t *hdr; /*!> Shared header */
+    char *data;          /*!> Shared data area, SHM_RING_SIZE bytes */
+    const char *name;    /*!> Shared memory object name */
+    bool consumer;       /*!> Handle created by the reader */
+} shm_ring_t;
+
+/**
+ * @brief Reader side: create (or reset) and map the ring
+ * @retval 0 on success, -1 on error (errno set)
+ */
+int shm_ring_create(shm_ring_t *ring, const char *name);
+
+/**
+ * @brief Writer side: map the ring created by the reader and announce the writer
+ * @retval 0 on success, -1 on error (errno ENOENT if the reader is not running)
+ */
+int shm_ring_attach(shm_ring_t *ring, const char *name);
+
+/**
+ * @brief Reader side: block until a writer attached
+ * @retval 0 on success, -1 if interrupted by a signal
+ */
+int shm_ring_wait_producer(shm_ring_t *ring);
+
+/**
+ * @brief Writer side: copy as many bytes as fit, never blocks
+ * @retval Bytes written (0 if full), -1 with errno EPIPE if the reader detached
+ */
+ssize_t shm_ring_write(shm_ring_t *ring, const char *data, size_t len);
+
+/**
+ * @brief Writer side: block until the ring has free space
+ * @param timeout_ms: Max wait, negative waits forever
+ * @retval 0 on success or timeout, -1 if interrupted or the reader detached
+ */
+int shm_ring_wait_space(shm_ring_t *ring, int timeout_ms);
+
+/**
+ * @brief Reader side: block until data is available and copy it
+ * @retval Bytes read, 0 when the writer detached and the ring is empty, -1 if interrupted
+ */
+ssize_t shm_ring_read(shm_ring_t *ring, char *buffer, size_t len);
+
+/**
+ * @brief Detach from the ring, the reader also removes the shared memory object
+ */
+void shm_ring_close(shm_ring_t *ring);
+
+#endif /* INC_SHM_RING_H */
@@ -9,8 +9,9 @@
 #define INC_UTILS_H
 
 #define BUFFER_SIZE 300
+#define READ_BUFFER_SIZE 4096 /*!> Reader chunk size, several frames per read under load */
 #define MSG_PREFIX_LEN 5
-#define MSG_SIGUSR_LEN 8
+#define MSG_SIGUSR_LEN 7
 
 const char *pipe_dir_path = "tmp"; /*!> Directory path for named PIPE */
 const char *log_dir_path = "log";  /*!> Directory path for named PIPE */
@@ -19,9 +20,13 @@ const char *pipe_name = "tmp/named_fifo";
 
 const char *data_log_path = "log/log.txt";
 const char *sign_log_path = "log/signals.txt";
+const char *rtsg_log_path = "log/rtsignals.txt";
 
 const char *data_msg_prefix = "DATA:"; /*!> Data message prefix */
 const char *sign_msg_prefix = "SIGN:"; /*!> Signal message prefix */
+const char *helo_msg_prefix = "HELO:"; /*!> Writer registration message prefix */
+const char *datl_msg_prefix = "DATL:"; /*!> Length-prefixed data message prefix */
+const char *rtsg_msg_prefix = "RTSG:"; /*!> Real-time signal message prefix */
 const char *sigusr1_msg = "SIGN:1\n";  /*!> SIGUSR1 messages to log */
 const char *sigusr2_msg = "SIGN:2\n";  /*!> SIGUSR2 messages to log */
 
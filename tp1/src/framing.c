@@ -0,0 +1,129 @@
+/**
+ * @file framing.c
+ * @brief Trabajo practico 1. Incremental parser for the named FIFO protocol.
+ * @author Gonzalo G. Fernandez
+ *
+ */
+
+#include <stdlib.h> // strtoul
+#include <string.h> // memchr, memcpy
+
+#include "framing.h"
+
+#define FRAME_PREFIX(name, a, b, c, d) [FRAME_##name] = {a, b, c, d, ':', '\0'},
+
+static const char frame_prefixes[FRAME_TYPE_COUNT][FRAME_PREFIX_LEN + 1] = {
+    FRAME_TYPE_LIST(FRAME_PREFIX)};
+
+void frame_parser_init(frame_parser_t *parser) {
+    parser->len = 0;
+    parser->discard = false;
+    parser->body = 0;
+    parser->frames = 0;
+    parser->dropped = 0;
+}
+
+const char *frame_type_prefix(frame_type_t type) { return frame_prefixes[type]; }
+
+#define FRAME_CASE(name, a, b, c, d)                                                               \
+    case FRAME_WORD(a, b, c, d):                                                                   \
+        return FRAME_##name;
+
+/**
+ * @brief Frame type of a prefix in O(1): one switch on the packed prefix letters
+ * @retval Frame type, -1 if unknown
+ */
+static int frame_classify(const char *frame) {
+    if (frame[FRAME_PREFIX_LEN - 1] != ':')
+        return -1;
+    switch (FRAME_WORD(frame[0], frame[1], frame[2], frame[3])) {
+        FRAME_TYPE_LIST(FRAME_CASE)
+    }
+    return -1;
+}
+
+/**
+ * @brief Classify a complete frame and deliver it
+ * @param frame: Complete frame, delimiter included
+ * @param len: Frame length
+ * @retval 1 if delivered, 0 if dropped
+ */
+static size_t frame_dispatch(frame_parser_t *parser, const char *frame, size_t len,
+                             frame_handler_t handler, void *ctx) {
+    // Legacy writers append the string terminator after the frame
+    while (len > 0 && *frame == '\0') {
+        frame++;
+        len--;
+    }
+    if (len <= FRAME_PREFIX_LEN) {
+        if (len > 1) // Empty lines are not counted as dropped
+            parser->dropped++;
+        return 0;
+    }
+
+    int type = frame_classify(frame);
+    if (type < 0) {
+        parser->dropped++;
+        return 0;
+    }
+
+    if (type == FRAME_DATL) {
+        // Only the header: the body follows as raw bytes
+        char *end;
+        unsigned long body = strtoul(frame + FRAME_PREFIX_LEN, &end, 10);
+        if (*end != FRAME_DELIMITER || body == 0 || body > FRAME_BODY_MAX) {
+            parser->dropped++;
+            return 0;
+        }
+        parser->frames++;
+        parser->body = body;
+        return 1;
+    }
+    parser->frames++;
+    handler((frame_type_t)type, frame + FRAME_PREFIX_LEN, len - FRAME_PREFIX_LEN, ctx);
+    return 1;
+}
+
+size_t frame_parser_feed(frame_parser_t *parser, const char *data, size_t len,
+                         frame_handler_t handler, void *ctx) {
+    size_t delivered = 0;
+    const char *end = data + len;
+
+    while (data < end) {
+        if (parser->body > 0) {
+            // Body of a length-prefixed frame, delimiters inside it are not frame boundaries
+            size_t piece = (parser->body < (size_t)(end - data)) ? parser->body : end - data;
+            parser->body -= piece;
+            handler(FRAME_DATL, data, piece, ctx);
+            data += piece;
+            continue;
+        }
+
+        const char *delim = memchr(data, FRAME_DELIMITER, end - data);
+        size_t chunk = (delim != NULL) ? (size_t)(delim - data) + 1 : (size_t)(end - data);
+
+        if (parser->discard) {
+            // Oversized frame: skip everything up to the next delimiter
+            if (delim != NULL)
+                parser->discard = false;
+        } else if (parser->len == 0 && delim != NULL) {
+            // Fast path: the whole frame is inside this chunk, no copy needed
+            delivered += frame_dispatch(parser, data, chunk, handler, ctx);
+        } else if (parser->len + chunk > FRAME_MAX_SIZE) {
+            parser->dropped++;
+            parser->len = 0;
+            parser->discard = (delim == NULL);
+        } else {
+            // Partial frame: accumulate until the delimiter arrives
+            memcpy(parser->buffer + parser->len, data, chunk);
+            parser->len += chunk;
+            if (delim != NULL) {
+                delivered += frame_dispatch(parser, parser->buffer, parser->len, handler, ctx);
+                parser->len = 0;
+            }
+        }
+        data += chunk;
+    }
+
+    return delivered;
+}
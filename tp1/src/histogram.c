@@ -0,0 +1,68 @@
+/**
+ * @file histogram.c
+ * @brief Trabajo practico 1. Log-linear latency histogram.
+ * @author Gonzalo G. Fernandez
+ *
+ */
+
+#include <string.h> // memset
+
+#include "histogram.h"
+
+/**
+ * @brief Bucket of a value: values below HISTOGRAM_SUB_BUCKETS map 1:1, bigger values use
+ *        their power of two and the next HISTOGRAM_SUB_BITS bits
+ */
+static unsigned histogram_bucket(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS)
+        return value;
+    unsigned exponent = 63 - __builtin_clzll(value); // >= HISTOGRAM_SUB_BITS
+    unsigned shift = exponent - HISTOGRAM_SUB_BITS;
+    unsigned sub = (value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+/**
+ * @brief Largest value mapped to a bucket
+ */
+static uint64_t histogram_bucket_max(unsigned bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+        return bucket;
+    unsigned shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t sub = bucket % HISTOGRAM_SUB_BUCKETS;
+    uint64_t base = (HISTOGRAM_SUB_BUCKETS + sub) << shift;
+    return base + ((uint64_t)1 << shift) - 1;
+}
+
+void histogram_init(histogram_t *hist) {
+    memset(hist, 0, sizeof(*hist));
+    hist->min = UINT64_MAX;
+}
+
+void histogram_record(histogram_t *hist, uint64_t value) {
+    hist->counts[histogram_bucket(value)]++;
+    hist->count++;
+    hist->sum += value;
+    if (value < hist->min)
+        hist->min = value;
+    if (value > hist->max)
+        hist->max = value;
+}
+
+uint64_t histogram_percentile(const histogram_t *hist, double fraction) {
+    uint64_t target = (uint64_t)(fraction * hist->count + 0.5);
+    uint64_t seen = 0;
+
+    if (hist->count == 0)
+        return 0;
+    if (target == 0)
+        target = 1;
+    for (unsigned bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        seen += hist->counts[bucket];
+        if (seen >= target) {
+            uint64_t value = histogram_bucket_max(bucket);
+            return value < hist->max ? value : hist->max;
+        }
+    }
+    return hist->max;
+}
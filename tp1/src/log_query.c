@@ -0,0 +1,191 @@
+/**
+ * @file log_query.c
+ * @brief Trabajo practico 1. Time range query over the segmented log store.
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Usage: log_query.out [-t data|sign|rtsg] FROM [TO]
+ *   FROM and TO are epoch seconds (fractions allowed), "YYYY-MM-DD HH:MM:SS" local time or
+ *   "now" (default TO). Prints to stdout every entry written in [FROM, TO].
+ * - The index and the segments are read through mmap. Two binary searches on the index give
+ *   the first and last positions, so only the matching part of the log is touched.
+ *
+ */
+
+#define _GNU_SOURCE // strptime
+
+#include <fcntl.h>    // open
+#include <stdio.h>    // printf, fwrite
+#include <stdlib.h>   // strtod
+#include <string.h>   // strcmp
+#include <sys/mman.h> // mmap, munmap, madvise
+#include <sys/stat.h> // fstat
+#include <time.h>     // strptime, mktime, clock_gettime
+#include <unistd.h>   // close, getopt
+
+#include "log_store.h"
+#include "utils.h"
+
+/**
+ * @brief Read position in the store
+ */
+typedef struct {
+    uint32_t segment; /*!> Segment number */
+    size_t offset;    /*!> Offset in the segment, SIZE_MAX for its end */
+} query_position_t;
+
+/**
+ * @brief Parse a query time
+ * @retval 0 on success, -1 on invalid time
+ */
+int query_parse_time(const char *arg, int64_t *time_ns) {
+    struct tm tm = {0};
+    struct timespec now;
+    char *end;
+    double seconds;
+
+    if (strcmp(arg, "now") == 0) {
+        clock_gettime(CLOCK_REALTIME, &now);
+        *time_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+        return 0;
+    }
+    seconds = strtod(arg, &end);
+    if (end != arg && *end == '\0') {
+        *time_ns = (int64_t)(seconds * 1e9);
+        return 0;
+    }
+    if ((end = strptime(arg, "%Y-%m-%d %H:%M:%S", &tm)) == NULL)
+        end = strptime(arg, "%Y-%m-%dT%H:%M:%S", &tm);
+    if (end == NULL || *end != '\0')
+        return -1;
+    tm.tm_isdst = -1;
+    *time_ns = (int64_t)mktime(&tm) * 1000000000LL;
+    return 0;
+}
+
+/**
+ * @brief Number of index records written at or before time_ns
+ */
+size_t query_upper_bound(const log_store_index_t *index, size_t count, int64_t time_ns) {
+    size_t low = 0, high = count;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (index[mid].time_ns <= time_ns)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+/**
+ * @brief Print the bytes of a segment in [from, to)
+ * @retval Bytes printed
+ */
+size_t query_print_segment(const char *path, uint32_t segment, size_t from, size_t to) {
+    char segment_path[LOG_STORE_PATH_MAX];
+    struct stat st;
+    char *data;
+    int fd;
+
+    log_store_segment_path(segment_path, sizeof(segment_path), path, segment);
+    if ((fd = open(segment_path, O_RDONLY)) < 0) {
+        perror("Error opening log segment");
+        return 0;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size <= from) {
+        close(fd);
+        return 0;
+    }
+    if (to > (size_t)st.st_size)
+        to = st.st_size;
+    if ((data = mmap(NULL, to, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        perror("Error mapping log segment");
+        close(fd);
+        return 0;
+    }
+    madvise(data + (from & ~4095UL), to - (from & ~4095UL), MADV_SEQUENTIAL);
+    fwrite(data + from, 1, to - from, stdout);
+    munmap(data, to);
+    close(fd);
+    return to - from;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = data_log_path;
+    char index_path[LOG_STORE_PATH_MAX + sizeof(".idx")];
+    log_store_index_t *index;
+    query_position_t first, last;
+    int64_t from, to;
+    size_t count, begin, end, bytes = 0;
+    struct stat st;
+    int fd, opt;
+
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        if (opt == 't' && strcmp(optarg, "data") == 0) {
+            path = data_log_path;
+            continue;
+        }
+        if (opt == 't' && strcmp(optarg, "sign") == 0) {
+            path = sign_log_path;
+            continue;
+        }
+        if (opt == 't' && strcmp(optarg, "rtsg") == 0) {
+            path = rtsg_log_path;
+            continue;
+        }
+        optind = argc + 1; // Invalid option
+        break;
+    }
+    if (optind >= argc || argc - optind > 2 || query_parse_time(argv[optind], &from) < 0 ||
+        query_parse_time(optind + 1 < argc ? argv[optind + 1] : "now", &to) < 0) {
+        fprintf(stderr, "Usage: %s [-t data|sign|rtsg] FROM [TO]\n", argv[0]);
+        fprintf(stderr, "  FROM, TO: epoch seconds, \"YYYY-MM-DD HH:MM:SS\" or now\n");
+        return 1;
+    }
+
+    snprintf(index_path, sizeof(index_path), LOG_STORE_INDEX_FMT, path);
+    if ((fd = open(index_path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        perror("Error opening log index");
+        return 1;
+    }
+    count = st.st_size / sizeof(log_store_index_t);
+    if (count == 0 || from > to) {
+        close(fd);
+        return 0;
+    }
+    if ((index = mmap(NULL, count * sizeof(*index), PROT_READ, MAP_PRIVATE, fd, 0)) ==
+        MAP_FAILED) {
+        perror("Error mapping log index");
+        close(fd);
+        return 1;
+    }
+    close(fd);
+
+    // Start at the last record before FROM, stop at the first record after TO
+    begin = query_upper_bound(index, count, from);
+    end = query_upper_bound(index, count, to);
+    if (end > 0) {
+        first.segment = index[begin > 0 ? begin - 1 : 0].segment;
+        first.offset = index[begin > 0 ? begin - 1 : 0].offset;
+        if (end < count) {
+            last.segment = index[end].segment;
+            last.offset = index[end].offset;
+        } else {
+            last.segment = index[count - 1].segment;
+            last.offset = SIZE_MAX;
+        }
+
+        for (uint32_t segment = first.segment; segment <= last.segment; segment++) {
+            size_t seg_from = (segment == first.segment) ? first.offset : 0;
+            size_t seg_to = (segment == last.segment) ? last.offset : SIZE_MAX;
+            bytes += query_print_segment(path, segment, seg_from, seg_to);
+        }
+    }
+    fflush(stdout);
+    fprintf(stderr, "%zu bytes, %zu of %zu index records in range\n", bytes,
+            end - (begin > 0 ? begin - 1 : 0), count);
+
+    munmap(index, count * sizeof(*index));
+    return 0;
+}
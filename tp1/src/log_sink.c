@@ -0,0 +1,379 @@
+/**
+ * @file log_sink.c
+ * @brief Trabajo practico 1. Asynchronous group-commit log sink.
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Ring records are 8 byte aligned: a log_sink_record_t header followed by the entry. A record
+ *   never wraps, the end of the ring is filled with a padding record instead.
+ * - The sink thread writes straight from the ring (writev), so each entry is copied once.
+ *
+ */
+
+#include <errno.h>   // errno, error code names
+#include <stdint.h>  // uint16_t
+#include <stdio.h>   // perror
+#include <stdlib.h>  // strtoul
+#include <string.h>  // memcpy, strncmp
+#include <sys/uio.h> // struct iovec
+
+#include "log_sink.h"
+
+#define LOG_SINK_RING_MASK (LOG_SINK_RING_SIZE - 1)
+#define LOG_SINK_PAD 0xFFFF                        /*!> Stream id of padding records */
+#define LOG_SINK_ALIGN(len) (((len) + 7) & ~(size_t)7) /*!> Record alignment */
+
+/**
+ * @brief Ring record header
+ */
+typedef struct {
+    uint16_t stream; /*!> Destination stream or LOG_SINK_PAD */
+    uint16_t len;    /*!> Entry length (record length for padding) */
+    uint32_t unused; /*!> Keeps stamp 8 byte aligned */
+    uint64_t stamp;  /*!> Push time for latency measurement, 0 if none */
+} log_sink_record_t;
+
+int log_sync_parse(const char *arg, log_sync_t *sync) {
+    char *end;
+
+    if (strcmp(arg, "none") == 0) {
+        sync->policy = LOG_SYNC_NONE;
+        sync->period = 0;
+        return 0;
+    }
+    if (strncmp(arg, "interval:", 9) == 0) {
+        sync->policy = LOG_SYNC_INTERVAL;
+        arg += 9;
+    } else if (strncmp(arg, "entries:", 8) == 0) {
+        sync->policy = LOG_SYNC_ENTRIES;
+        arg += 8;
+    } else {
+        return -1;
+    }
+    sync->period = strtoul(arg, &end, 10);
+    return (*end != '\0' || sync->period == 0) ? -1 : 0;
+}
+
+static unsigned long log_sink_elapsed_ms(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/**
+ * @brief fsync every stream with unsynced entries
+ */
+static void log_sink_sync(log_sink_t *sink) {
+    for (size_t i = 0; i < sink->streams; i++) {
+        if (sink->unsynced[i] == 0)
+            continue;
+        if (log_store_sync(&sink->stores[i]) < 0)
+            perror("Error syncing log file");
+        sink->unsynced[i] = 0;
+        sink->syncs++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &sink->last_sync);
+}
+
+/**
+ * @brief Append a batch of entries to a stream
+ */
+static void log_sink_writev(log_sink_t *sink, size_t stream, struct iovec *iov, int count) {
+    sink->batches++;
+    if (log_store_writev(&sink->stores[stream], iov, count) < 0)
+        perror("Error encountered when writing log file");
+}
+
+static uint64_t log_sink_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @brief fsync if the durability policy asks for it after a write
+ */
+static void log_sink_apply_policy(log_sink_t *sink) {
+    if (sink->sync.policy == LOG_SYNC_ENTRIES) {
+        for (size_t i = 0; i < sink->streams; i++) {
+            if (sink->unsynced[i] >= sink->sync.period) {
+                log_sink_sync(sink);
+                break;
+            }
+        }
+    } else if (sink->sync.policy == LOG_SYNC_INTERVAL &&
+               log_sink_elapsed_ms(&sink->last_sync) >= sink->sync.period) {
+        log_sink_sync(sink);
+    }
+}
+
+/**
+ * @brief Record the latency of the stamped entries of a written batch
+ */
+static void log_sink_record_latency(log_sink_t *sink, unsigned long begin, unsigned long end) {
+    uint64_t now_ns = log_sink_now_ns();
+
+    while (begin != end) {
+        log_sink_record_t *record = (log_sink_record_t *)(sink->ring + (begin & LOG_SINK_RING_MASK));
+        if (record->stream == LOG_SINK_PAD) {
+            begin += record->len;
+            continue;
+        }
+        if (record->stamp != 0)
+            histogram_record(sink->latency, now_ns - record->stamp);
+        begin += LOG_SINK_ALIGN(sizeof(log_sink_record_t) + record->len);
+    }
+}
+
+/**
+ * @brief Write the ring region [begin, end) with one writev per stream
+ */
+static void log_sink_write_batch(log_sink_t *sink, unsigned long begin, unsigned long end) {
+    unsigned long start = begin;
+    struct iovec iov[LOG_SINK_MAX_STREAMS][LOG_SINK_IOV_MAX];
+    int count[LOG_SINK_MAX_STREAMS] = {0};
+
+    while (begin != end) {
+        log_sink_record_t *record = (log_sink_record_t *)(sink->ring + (begin & LOG_SINK_RING_MASK));
+        if (record->stream == LOG_SINK_PAD) {
+            begin += record->len;
+            continue;
+        }
+
+        size_t stream = record->stream;
+        if (count[stream] == LOG_SINK_IOV_MAX) {
+            log_sink_writev(sink, stream, iov[stream], count[stream]);
+            count[stream] = 0;
+        }
+        iov[stream][count[stream]].iov_base = record + 1;
+        iov[stream][count[stream]].iov_len = record->len;
+        count[stream]++;
+        sink->unsynced[stream]++;
+        sink->entries++;
+        begin += LOG_SINK_ALIGN(sizeof(log_sink_record_t) + record->len);
+    }
+
+    for (size_t i = 0; i < sink->streams; i++) {
+        if (count[i] > 0)
+            log_sink_writev(sink, i, iov[i], count[i]);
+    }
+
+    if (sink->latency != NULL)
+        log_sink_record_latency(sink, start, end);
+    log_sink_apply_policy(sink);
+}
+
+/**
+ * @brief Sink thread: wait for entries, write them in batches, apply the durability policy
+ */
+static void *log_sink_thread(void *args) {
+    log_sink_t *sink = args;
+    unsigned long begin, end;
+    bool stop;
+    struct timespec deadline;
+
+    while (1) {
+        pthread_mutex_lock(&sink->mutex);
+        while ((sink->head == sink->tail && !sink->stop) || sink->splicing) {
+            bool dirty = false;
+            for (size_t i = 0; i < sink->streams; i++)
+                dirty = dirty || sink->unsynced[i] > 0;
+
+            if (sink->sync.policy == LOG_SYNC_INTERVAL && dirty && !sink->splicing) {
+                // Idle with unsynced entries: wake up when the interval expires
+                deadline = sink->last_sync;
+                deadline.tv_sec += sink->sync.period / 1000;
+                deadline.tv_nsec += (sink->sync.period % 1000) * 1000000;
+                if (deadline.tv_nsec >= 1000000000) {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000;
+                }
+                if (pthread_cond_timedwait(&sink->data_cond, &sink->mutex, &deadline) ==
+                    ETIMEDOUT && !sink->splicing) {
+                    sink->syncing = true;
+                    pthread_mutex_unlock(&sink->mutex);
+                    log_sink_sync(sink);
+                    pthread_mutex_lock(&sink->mutex);
+                    sink->syncing = false;
+                    pthread_cond_signal(&sink->space_cond);
+                }
+            } else {
+                pthread_cond_wait(&sink->data_cond, &sink->mutex);
+            }
+        }
+        begin = sink->tail;
+        end = sink->head;
+        stop = sink->stop;
+        pthread_mutex_unlock(&sink->mutex);
+
+        if (begin == end && stop)
+            break;
+
+        // The producer only writes outside [tail, head), the batch is read without the lock
+        log_sink_write_batch(sink, begin, end);
+
+        pthread_mutex_lock(&sink->mutex);
+        sink->tail = end;
+        pthread_cond_signal(&sink->space_cond);
+        pthread_mutex_unlock(&sink->mutex);
+    }
+
+    if (sink->sync.policy != LOG_SYNC_NONE)
+        log_sink_sync(sink);
+    return NULL;
+}
+
+int log_sink_init(log_sink_t *sink, const char *const paths[], size_t streams, log_sync_t sync,
+                  log_store_config_t store) {
+    pthread_condattr_t condattr;
+    int rcode;
+
+    if (streams > LOG_SINK_MAX_STREAMS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sink->head = 0;
+    sink->tail = 0;
+    sink->stop = false;
+    sink->syncing = false;
+    sink->splicing = false;
+    sink->streams = streams;
+    sink->sync = sync;
+    sink->entries = 0;
+    sink->batches = 0;
+    sink->syncs = 0;
+    sink->latency = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &sink->last_sync);
+
+    for (size_t i = 0; i < streams; i++) {
+        sink->unsynced[i] = 0;
+        if (log_store_open(&sink->stores[i], paths[i], &store) < 0) {
+            rcode = errno;
+            while (i-- > 0)
+                log_store_close(&sink->stores[i]);
+            errno = rcode;
+            return -1;
+        }
+    }
+
+    // Interval deadlines are computed on the monotonic clock
+    pthread_mutex_init(&sink->mutex, NULL);
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sink->data_cond, &condattr);
+    pthread_cond_init(&sink->space_cond, NULL);
+    pthread_condattr_destroy(&condattr);
+
+    if ((rcode = pthread_create(&sink->thread, NULL, log_sink_thread, sink)) != 0) {
+        for (size_t i = 0; i < streams; i++)
+            log_store_close(&sink->stores[i]);
+        errno = rcode;
+        return -1;
+    }
+    return 0;
+}
+
+int log_sink_push(log_sink_t *sink, size_t stream, const char *data, size_t len) {
+    return log_sink_push_stamped(sink, stream, data, len, 0);
+}
+
+int log_sink_push_stamped(log_sink_t *sink, size_t stream, const char *data, size_t len,
+                          uint64_t stamp) {
+    size_t need = LOG_SINK_ALIGN(sizeof(log_sink_record_t) + len);
+    log_sink_record_t *record;
+
+    if (len > UINT16_MAX || stream >= sink->streams) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&sink->mutex);
+    while (1) {
+        size_t offset = sink->head & LOG_SINK_RING_MASK;
+        size_t contiguous = LOG_SINK_RING_SIZE - offset;
+        size_t total = need + (contiguous < need ? contiguous : 0);
+
+        if (sink->stop) {
+            pthread_mutex_unlock(&sink->mutex);
+            errno = EPIPE;
+            return -1;
+        }
+        if (LOG_SINK_RING_SIZE - (sink->head - sink->tail) >= total) {
+            if (contiguous < need) {
+                // Not enough room before the end of the ring: pad and wrap
+                record = (log_sink_record_t *)(sink->ring + offset);
+                record->stream = LOG_SINK_PAD;
+                record->len = contiguous;
+                sink->head += contiguous;
+            }
+            break;
+        }
+        pthread_cond_wait(&sink->space_cond, &sink->mutex);
+    }
+
+    record = (log_sink_record_t *)(sink->ring + (sink->head & LOG_SINK_RING_MASK));
+    record->stream = stream;
+    record->len = len;
+    record->stamp = stamp;
+    memcpy(record + 1, data, len);
+    sink->head += need;
+    pthread_cond_signal(&sink->data_cond);
+    pthread_mutex_unlock(&sink->mutex);
+    return 0;
+}
+
+int log_sink_splice(log_sink_t *sink, size_t stream, const char *head, size_t head_len, int fd,
+                    size_t len, uint64_t stamp) {
+    int rcode, error;
+
+    if (stream >= sink->streams) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Take over the stores once every queued entry is written and the sink thread is idle
+    pthread_mutex_lock(&sink->mutex);
+    while ((sink->tail != sink->head || sink->syncing || sink->splicing) && !sink->stop)
+        pthread_cond_wait(&sink->space_cond, &sink->mutex);
+    if (sink->stop) {
+        pthread_mutex_unlock(&sink->mutex);
+        errno = EPIPE;
+        return -1;
+    }
+    sink->splicing = true;
+    pthread_mutex_unlock(&sink->mutex);
+
+    rcode = log_store_splice(&sink->stores[stream], head, head_len, fd, len);
+    error = errno;
+    sink->batches++;
+    sink->entries++;
+    sink->unsynced[stream]++;
+    if (sink->latency != NULL && stamp != 0)
+        histogram_record(sink->latency, log_sink_now_ns() - stamp);
+    log_sink_apply_policy(sink);
+
+    pthread_mutex_lock(&sink->mutex);
+    sink->splicing = false;
+    pthread_cond_signal(&sink->data_cond); // Entries may have been pushed meanwhile
+    pthread_cond_signal(&sink->space_cond);
+    pthread_mutex_unlock(&sink->mutex);
+    errno = error;
+    return rcode;
+}
+
+void log_sink_stop(log_sink_t *sink) {
+    pthread_mutex_lock(&sink->mutex);
+    sink->stop = true;
+    pthread_cond_signal(&sink->data_cond);
+    pthread_mutex_unlock(&sink->mutex);
+
+    pthread_join(sink->thread, NULL);
+
+    for (size_t i = 0; i < sink->streams; i++) {
+        if (log_store_close(&sink->stores[i]) < 0)
+            perror("Error closing log file");
+    }
+    pthread_mutex_destroy(&sink->mutex);
+    pthread_cond_destroy(&sink->data_cond);
+    pthread_cond_destroy(&sink->space_cond);
+}
@@ -0,0 +1,316 @@
+/**
+ * @file log_store.c
+ * @brief Trabajo practico 1. Segmented, preallocated and indexed log store.
+ * @author Gonzalo G. Fernandez
+ *
+ */
+
+#define _GNU_SOURCE // fallocate, splice
+
+#include <errno.h>    // errno, error code names
+#include <fcntl.h>    // open, fallocate, splice
+#include <stdio.h>    // perror, snprintf
+#include <stdlib.h>   // strtoul
+#include <string.h>   // strlen, strncmp, strrchr, memcpy
+#include <sys/stat.h> // lstat
+#include <unistd.h>   // write, pread, ftruncate, fdatasync, symlink
+
+#include "log_store.h"
+
+int log_store_config_parse(const char *arg, log_store_config_t *config) {
+    char *end;
+    unsigned long value;
+
+    while (*arg != '\0') {
+        bool size = (strncmp(arg, "size:", 5) == 0);
+        if (!size && strncmp(arg, "time:", 5) != 0)
+            return -1;
+        value = strtoul(arg + 5, &end, 10);
+        if (end == arg + 5 || value == 0 || (*end != ',' && *end != '\0'))
+            return -1;
+        if (size) {
+            if (value >= 4096) // Offsets in the index are 32 bit
+                return -1;
+            config->segment_size = value << 20;
+        } else {
+            config->rotate_ms = value * 1000;
+        }
+        arg = (*end == ',') ? end + 1 : end;
+    }
+    return 0;
+}
+
+int log_store_segment_path(char *buffer, size_t size, const char *path, uint32_t segment) {
+    return snprintf(buffer, size, LOG_STORE_SEGMENT_FMT, path, segment);
+}
+
+/**
+ * @brief Close a segment, giving back the preallocated space past the written data
+ */
+static int log_store_release(int fd, size_t offset) {
+    int rcode = 0;
+
+    if (ftruncate(fd, offset) < 0)
+        rcode = -1;
+    if (close(fd) < 0)
+        rcode = -1;
+    return rcode;
+}
+
+/**
+ * @brief Create (or reopen) a segment, preallocate it and make it the active one
+ * @retval 0 on success, -1 on error (errno set)
+ */
+static int log_store_start_segment(log_store_t *store, uint32_t segment) {
+    char segment_path[LOG_STORE_PATH_MAX], link_path[LOG_STORE_PATH_MAX + sizeof(".tmp")];
+    const char *name;
+    off_t size;
+    int fd;
+
+    // No O_APPEND, splice rejects append mode files. The store is the only writer.
+    log_store_segment_path(segment_path, sizeof(segment_path), store->path, segment);
+    if ((fd = open(segment_path, O_WRONLY | O_CREAT | O_CLOEXEC, 0666)) < 0)
+        return -1;
+    if ((size = lseek(fd, 0, SEEK_END)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    // Reserve the whole segment up front, the file size stays at the written length
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, store->config.segment_size) < 0 &&
+        errno != EOPNOTSUPP)
+        perror("Error preallocating log segment");
+
+    // Point the log path to the new segment: symlink under a temporary name, then rename
+    name = strrchr(segment_path, '/');
+    name = (name != NULL) ? name + 1 : segment_path;
+    snprintf(link_path, sizeof(link_path), "%s.tmp", store->path);
+    unlink(link_path);
+    if (symlink(name, link_path) < 0 || rename(link_path, store->path) < 0)
+        perror("Error linking active log segment");
+
+    if (store->fd >= 0 && log_store_release(store->fd, store->offset) < 0)
+        perror("Error closing log segment");
+
+    store->fd = fd;
+    store->segment = segment;
+    store->offset = size;
+    store->indexed = false;
+    clock_gettime(CLOCK_MONOTONIC, &store->opened);
+    return 0;
+}
+
+static unsigned long log_store_elapsed_ms(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/**
+ * @brief Add an index record for the next write if the segment is new or enough time passed
+ */
+static void log_store_index(log_store_t *store) {
+    struct timespec now;
+    log_store_index_t record;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    record.time_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+    if (store->indexed && record.time_ns - store->last_index_ns < LOG_STORE_INDEX_MS * 1000000LL)
+        return;
+
+    // The index must stay sorted for the binary search, even if the wall clock goes back
+    if (record.time_ns < store->last_index_ns)
+        record.time_ns = store->last_index_ns;
+    record.segment = store->segment;
+    record.offset = store->offset;
+    if (write(store->index_fd, &record, sizeof(record)) != sizeof(record)) {
+        perror("Error writing log index");
+        return;
+    }
+    store->indexed = true;
+    store->last_index_ns = record.time_ns;
+}
+
+/**
+ * @brief writev handling short writes
+ * @retval 0 on success, -1 on error
+ */
+static int log_store_write_all(int fd, const struct iovec *entries, int count) {
+    struct iovec local[LOG_STORE_IOV_MAX];
+    struct iovec *iov = local;
+    ssize_t written;
+
+    memcpy(local, entries, count * sizeof(struct iovec));
+    while (count > 0) {
+        if ((written = writev(fd, iov, count)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+int log_store_open(log_store_t *store, const char *path, const log_store_config_t *config) {
+    char buffer[LOG_STORE_PATH_MAX];
+    log_store_index_t last;
+    struct stat st;
+    off_t size;
+
+    if (strlen(path) + sizeof(".000000") > LOG_STORE_PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(store->path, path);
+    store->config = *config;
+    store->fd = -1;
+    store->offset = 0;
+    store->last_index_ns = 0;
+    store->rotations = 0;
+
+    // A plain log file written before segmentation is kept as segment 0
+    if (lstat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+        log_store_segment_path(buffer, sizeof(buffer), path, 0);
+        if (rename(path, buffer) < 0)
+            return -1;
+    }
+
+    snprintf(buffer, sizeof(buffer), LOG_STORE_INDEX_FMT, path);
+    if ((store->index_fd = open(buffer, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0666)) < 0)
+        return -1;
+
+    // Continue after the last indexed segment, dropping a record torn by a crash
+    store->segment = 0;
+    size = lseek(store->index_fd, 0, SEEK_END);
+    if (size % sizeof(last) != 0)
+        ftruncate(store->index_fd, size - size % sizeof(last));
+    size -= size % sizeof(last);
+    if (size > 0 && pread(store->index_fd, &last, sizeof(last), size - sizeof(last)) ==
+                        sizeof(last)) {
+        store->segment = last.segment;
+        store->last_index_ns = last.time_ns;
+    }
+
+    if (log_store_start_segment(store, store->segment + 1) < 0) {
+        close(store->index_fd);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Close the active segment and start the next one
+ * @retval 0 on success, -1 on error (errno set)
+ */
+static int log_store_rotate(log_store_t *store) {
+    if (log_store_start_segment(store, store->segment + 1) < 0)
+        return -1;
+    store->rotations++;
+    return 0;
+}
+
+/**
+ * @brief Rotate if the rotation period of a non-empty segment expired
+ * @retval 0 on success, -1 on error (errno set)
+ */
+static int log_store_check_time(log_store_t *store) {
+    if (store->config.rotate_ms > 0 && store->offset > 0 &&
+        log_store_elapsed_ms(&store->opened) >= store->config.rotate_ms)
+        return log_store_rotate(store);
+    return 0;
+}
+
+int log_store_writev(log_store_t *store, const struct iovec *iov, int count) {
+    if (log_store_check_time(store) < 0)
+        return -1;
+
+    while (count > 0) {
+        // Entries that fit in the active segment, an entry never spans two segments
+        size_t room = (store->config.segment_size > store->offset)
+                          ? store->config.segment_size - store->offset
+                          : 0;
+        size_t bytes = 0;
+        int n = 0;
+        while (n < count && n < LOG_STORE_IOV_MAX && bytes + iov[n].iov_len <= room)
+            bytes += iov[n++].iov_len;
+
+        if (n == 0 && store->offset > 0) {
+            if (log_store_rotate(store) < 0)
+                return -1;
+            continue;
+        }
+        if (n == 0) // Entry bigger than a segment, alone in its own segment
+            bytes = iov[n++].iov_len;
+
+        log_store_index(store);
+        if (log_store_write_all(store->fd, iov, n) < 0)
+            return -1;
+        store->offset += bytes;
+        iov += n;
+        count -= n;
+    }
+    return 0;
+}
+
+int log_store_splice(log_store_t *store, const char *head, size_t head_len, int fd, size_t len) {
+    struct iovec iov = {(void *)head, head_len};
+    ssize_t moved;
+
+    if (log_store_check_time(store) < 0)
+        return -1;
+    if (store->offset > 0 && store->offset + head_len + len > store->config.segment_size &&
+        log_store_rotate(store) < 0)
+        return -1;
+
+    log_store_index(store);
+    if (head_len > 0 && log_store_write_all(store->fd, &iov, 1) < 0)
+        return -1;
+    store->offset += head_len;
+
+    while (len > 0) {
+        moved = splice(fd, NULL, store->fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved > 0) {
+            store->offset += moved;
+            len -= moved;
+        } else if (moved < 0 && errno == EINTR) {
+            continue;
+        } else {
+            // Body cut short (or not all in the pipe yet, EAGAIN): end the line so the log
+            // stays readable
+            if (moved == 0)
+                errno = EPIPE;
+            if (write(store->fd, "\n", 1) == 1)
+                store->offset++;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int log_store_sync(log_store_t *store) {
+    int rcode = 0;
+
+    if (fdatasync(store->fd) < 0)
+        rcode = -1;
+    if (fdatasync(store->index_fd) < 0)
+        rcode = -1;
+    return rcode;
+}
+
+int log_store_close(log_store_t *store) {
+    int rcode = log_store_release(store->fd, store->offset);
+
+    if (close(store->index_fd) < 0)
+        rcode = -1;
+    store->fd = -1;
+    return rcode;
+}
@@ -3,40 +3,617 @@
  * @brief Trabajo practico 1. Sistemas Operativos de Proposito General.
  * @author Gonzalo G. Fernandez
  * @note
+ * - Usage: reader.out [-s none|interval:MS|entries:N] [-r size:MB,time:S] [-t fifo|shm] [-v]
+ *                   [-z] [-b results.json]
+ *   -s: log durability policy (default none). -r: log segment rotation (default 64 MB segments,
+ *   no time rotation). -t: transport (default named FIFO). -v: echo every message.
+ *   -z: zero-copy, the bodies of long "DATL:" messages still in the FIFO are moved into the log
+ *   with splice instead of being read (FIFO transport only). A body is first spliced into a
+ *   private pipe of its channel as it arrives, without blocking the event loop, and into the log
+ *   once complete.
+ *   -b: benchmark mode. DATA payloads stamped by a replaying writer ("@NS ")
+ *   are timed from enqueue to log write, and throughput and latency percentiles are written as
+ *   JSON to results.json at exit.
+ * - FIFO transport: many writers at once. Each writer sends "HELO:PID" on the shared FIFO and
+ *   then writes through its own FIFO (pipe_name.PID), so frames never interleave. All channels
+ *   are multiplexed with epoll; writers attach and detach while the reader keeps running. An
+ *   invalid PID or one already attached is refused.
+ * - Every log entry is tagged with the writer PID: "[PID] payload". PID 0 means a frame sent
+ *   straight to the shared FIFO by a writer that did not register.
+ * - Frames are routed by type through reader_routes: DATA and DATL to log/log.txt, SIGN to
+ *   log/signals.txt, RTSG (real-time signals, "N:VALUE") to log/rtsignals.txt.
  *
  */
 
+#define _GNU_SOURCE // splice, pipe2, F_SETPIPE_SZ
+
 #include <errno.h>    // errno, error code names
-#include <fcntl.h>    // open
+#include <fcntl.h>    // open, splice, F_SETPIPE_SZ
+#include <limits.h>   // INT_MAX
 #include <signal.h>   // sigaction
+#include <stdbool.h>  // bool type
 #include <stdio.h>    // printf
-#include <string.h>   // strlen, strcpy, strstr
+#include <stdlib.h>   // malloc, free, strtol
+#include <string.h>   // strlen, strcmp
+#include <sys/epoll.h> // epoll_create1, epoll_ctl, epoll_wait
+#include <sys/resource.h> // getrusage
 #include <sys/stat.h> // mknod
-#include <unistd.h>   // write
+#include <time.h>     // clock_gettime
+#include <unistd.h>   // write, getopt, pipe2
 
+#include "framing.h"
+#include "histogram.h"
+#include "log_sink.h"
+#include "shm_ring.h"
 #include "utils.h"
 
-FILE *pdata_log; /*!> Data logging file pointer */
-FILE *psign_log; /*!> Data logging file pointer */
+#define READER_MAX_WRITERS 1024 /*!> Max writer channels attached at once */
+#define READER_MAX_EVENTS 64
+#define READER_SPLICE_MIN 4096 /*!> Smallest body left in the FIFO worth a splice */
+#define READER_TAG_SIZE 16     /*!> "[PID] " */
+
+/**
+ * @brief Benchmark mode counters
+ */
+typedef struct {
+    const char *path;       /*!> JSON results file, NULL when not benchmarking */
+    histogram_t latency;    /*!> Enqueue to log write latency, ns */
+    unsigned long messages; /*!> DATA frames */
+    unsigned long bytes;    /*!> DATA payload bytes */
+    unsigned long signals;  /*!> SIGN frames */
+    uint64_t first_ns;      /*!> First frame arrival */
+    uint64_t last_ns;       /*!> Last frame arrival */
+} reader_bench_t;
+
+/**
+ * @brief Log streams, one log store each
+ */
+typedef enum {
+    LOG_STREAM_DATA = 0, /*!> DATA and DATL messages, log/log.txt */
+    LOG_STREAM_SIGN,     /*!> SIGUSR1/SIGUSR2 messages, log/signals.txt */
+    LOG_STREAM_RTSG,     /*!> Real-time signal messages, log/rtsignals.txt */
+    LOG_STREAMS
+} log_stream_t;
+
+/**
+ * @brief Input channel: the shared FIFO or one writer's own FIFO
+ */
+typedef struct {
+    int fd;                                       /*!> Read end */
+    pid_t pid;                                    /*!> Writer PID, 0 for the shared FIFO */
+    size_t index;                                 /*!> Position in channels[] */
+    frame_parser_t parser;                        /*!> Frames of different writers never mix */
+    char tag[READER_TAG_SIZE];                    /*!> "[PID] " log entry prefix */
+    size_t tag_len;                               /*!> Length of tag */
+    char entry[READER_TAG_SIZE + FRAME_BODY_MAX]; /*!> DATL entry received so far */
+    size_t entry_len;                             /*!> Bytes held in entry, 0 if none */
+    int splice_pipe[2];                           /*!> Spliced body, -1 until the first one */
+    size_t splice_len;                            /*!> Body bytes spliced, 0 if no splice */
+    size_t splice_left;                           /*!> Body bytes still in the FIFO */
+    uint64_t splice_stamp;                        /*!> Benchmark stamp of the spliced entry */
+} reader_channel_t;
+
+log_sink_t log_sink;                  /*!> Asynchronous sink for log.txt and signals.txt */
+volatile sig_atomic_t sigint_flag = 0; /*!> Flag for SIGINT signal */
+
+int epoll_fd;                                       /*!> Event loop */
+reader_channel_t *channels[READER_MAX_WRITERS + 1]; /*!> Shared FIFO and attached writers */
+size_t channel_count = 0;                           /*!> Entries used in channels[] */
+unsigned long dropped = 0;                          /*!> Malformed frames of closed channels */
+char buffer[READ_BUFFER_SIZE];                      /*!> Read buffer */
+reader_bench_t bench = {.path = NULL};              /*!> Benchmark mode state */
+bool echo = false;                                  /*!> Print every message */
+bool zero_copy = false;                             /*!> splice long message bodies */
 
 /**
  * @brief Signal handler
  * @param signo: Number of signal received
+ * @note The blocking read is interrupted (no SA_RESTART), main flushes the logs and exits.
  */
 void signal_handler(int signo) {
     if (signo == SIGINT) {
-        // Close file pointers
-        fclose(pdata_log);
-        fclose(psign_log);
+        sigint_flag = 1;
+    }
+}
+
+void reader_attach(pid_t pid);
+void reader_handle_entry(reader_channel_t *channel, frame_type_t type, const char *payload,
+                         size_t len);
+void reader_handle_body(reader_channel_t *channel, frame_type_t type, const char *payload,
+                        size_t len);
+void reader_handle_helo(reader_channel_t *channel, frame_type_t type, const char *payload,
+                        size_t len);
+
+/**
+ * @brief Route of a frame type: its handler and the log stream it is written to
+ */
+typedef struct {
+    void (*handle)(reader_channel_t *channel, frame_type_t type, const char *payload, size_t len);
+    log_stream_t stream; /*!> Log stream of the messages */
+} reader_route_t;
+
+/**
+ * @brief Dispatch table indexed by frame type, every type in FRAME_TYPE_LIST needs a route
+ */
+const reader_route_t reader_routes[FRAME_TYPE_COUNT] = {
+    [FRAME_DATA] = {reader_handle_entry, LOG_STREAM_DATA},
+    [FRAME_SIGN] = {reader_handle_entry, LOG_STREAM_SIGN},
+    [FRAME_HELO] = {reader_handle_helo, LOG_STREAM_DATA},
+    [FRAME_DATL] = {reader_handle_body, LOG_STREAM_DATA},
+    [FRAME_RTSG] = {reader_handle_entry, LOG_STREAM_RTSG},
+};
+
+/**
+ * @brief Benchmark mode: count a message
+ * @param type: Frame type
+ * @param payload: Message start, "@NS ..." if stamped by a replaying writer
+ * @param len: Message length
+ * @retval Writer enqueue stamp, 0 if none
+ */
+uint64_t reader_bench_count(frame_type_t type, const char *payload, size_t len) {
+    struct timespec now;
+    uint64_t stamp = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    bench.last_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    if (bench.first_ns == 0)
+        bench.first_ns = bench.last_ns;
+
+    if (reader_routes[type].stream != LOG_STREAM_DATA) {
+        bench.signals++;
+    } else {
+        bench.messages++;
+        bench.bytes += len;
+        if (payload[0] == '@')
+            stamp = strtoull(payload + 1, NULL, 10);
+    }
+    return stamp;
+}
+
+/**
+ * @brief Write the benchmark results as JSON
+ */
+void reader_bench_report(void) {
+    const histogram_t *latency = &bench.latency;
+    double elapsed = (bench.last_ns - bench.first_ns) * 1e-9;
+    struct rusage usage;
+    FILE *fp;
+
+    getrusage(RUSAGE_SELF, &usage); // Reader and sink threads
+
+    if ((fp = fopen(bench.path, "w")) == NULL) {
+        perror("Error opening benchmark results");
+        return;
+    }
+    fprintf(fp,
+            "{\n"
+            "  \"messages\": %lu,\n"
+            "  \"bytes\": %lu,\n"
+            "  \"signals\": %lu,\n"
+            "  \"dropped\": %lu,\n"
+            "  \"elapsed_s\": %.6f,\n"
+            "  \"msgs_per_s\": %.1f,\n"
+            "  \"bytes_per_s\": %.1f,\n"
+            "  \"log_writes\": %lu,\n"
+            "  \"log_fsyncs\": %lu,\n"
+            "  \"cpu_user_s\": %.3f,\n"
+            "  \"cpu_sys_s\": %.3f,\n"
+            "  \"latency_ns\": {\"samples\": %lu, \"min\": %lu, \"p50\": %lu, \"p99\": %lu, "
+            "\"p999\": %lu, \"max\": %lu, \"mean\": %.1f}\n"
+            "}\n",
+            bench.messages, bench.bytes, bench.signals, dropped, elapsed,
+            elapsed > 0 ? bench.messages / elapsed : 0.0,
+            elapsed > 0 ? bench.bytes / elapsed : 0.0, log_sink.batches, log_sink.syncs,
+            usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6,
+            usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6,
+            (unsigned long)latency->count,
+            (unsigned long)(latency->count > 0 ? latency->min : 0),
+            (unsigned long)histogram_percentile(latency, 0.5),
+            (unsigned long)histogram_percentile(latency, 0.99),
+            (unsigned long)histogram_percentile(latency, 0.999), (unsigned long)latency->max,
+            latency->count > 0 ? (double)latency->sum / latency->count : 0.0);
+    fclose(fp);
+    printf("Benchmark results written to %s\n", bench.path);
+}
+
+/**
+ * @brief Echo (verbose mode) and queue a complete log entry
+ * @param channel: Channel the message arrived on
+ * @param type: Frame type, its route selects the log stream
+ * @param entry: "[PID] payload"
+ * @param entry_len: Entry length
+ */
+void reader_log(reader_channel_t *channel, frame_type_t type, const char *entry,
+                size_t entry_len) {
+    const char *payload = entry + channel->tag_len;
+    size_t len = entry_len - channel->tag_len;
+    uint64_t stamp = (bench.path != NULL) ? reader_bench_count(type, payload, len) : 0;
+
+    if (echo)
+        printf("%s%s%.*s", channel->tag, frame_type_prefix(type), (int)len, payload);
+    if (log_sink_push_stamped(&log_sink, reader_routes[type].stream, entry, entry_len, stamp) < 0) {
+        perror("Error encountered when queuing log entry");
+    }
+}
+
+/**
+ * @brief Log a complete message in the log stream of its type
+ */
+void reader_handle_entry(reader_channel_t *channel, frame_type_t type, const char *payload,
+                         size_t len) {
+    char entry[FRAME_MAX_SIZE + READER_TAG_SIZE];
+
+    memcpy(entry, channel->tag, channel->tag_len);
+    memcpy(entry + channel->tag_len, payload, len);
+    reader_log(channel, type, entry, channel->tag_len + len);
+}
+
+/**
+ * @brief Gather the pieces of a DATL body, log the message once the whole body arrived
+ */
+void reader_handle_body(reader_channel_t *channel, frame_type_t type, const char *payload,
+                        size_t len) {
+    if (channel->entry_len == 0) {
+        memcpy(channel->entry, channel->tag, channel->tag_len);
+        channel->entry_len = channel->tag_len;
+    }
+    memcpy(channel->entry + channel->entry_len, payload, len);
+    channel->entry_len += len;
+    if (channel->parser.body == 0) {
+        reader_log(channel, FRAME_DATA, channel->entry, channel->entry_len);
+        channel->entry_len = 0;
+    }
+}
+
+/**
+ * @brief Writer registration, only valid on the shared FIFO
+ * @note The payload must be a positive PID not attached yet, anything else is refused: every
+ *       attach takes a channel slot.
+ */
+void reader_handle_helo(reader_channel_t *channel, frame_type_t type, const char *payload,
+                        size_t len) {
+    char number[16], *end;
+    long pid;
+
+    if (channel->pid != 0)
+        return;
+    // The payload ends with the delimiter, not NUL terminated
+    if (len > 0 && payload[len - 1] == FRAME_DELIMITER)
+        len--;
+    if (len == 0 || len >= sizeof(number)) {
+        fprintf(stderr, "Invalid registration %s%.*s\n", frame_type_prefix(type), (int)len,
+                payload);
+        return;
+    }
+    memcpy(number, payload, len);
+    number[len] = '\0';
+    errno = 0;
+    pid = strtol(number, &end, 10);
+    if (errno != 0 || *end != '\0' || pid <= 0 || pid > INT_MAX) {
+        fprintf(stderr, "Invalid registration %s%s\n", frame_type_prefix(type), number);
+        return;
+    }
+    for (size_t i = 0; i < channel_count; i++) {
+        if (channels[i]->pid == (pid_t)pid) {
+            fprintf(stderr, "Writer %ld already attached, registration ignored\n", pid);
+            return;
+        }
+    }
+    reader_attach(pid);
+}
+
+/**
+ * @brief Frame parser callback: one table lookup routes the frame to its handler
+ * @param type: Frame type
+ * @param payload: Frame content without prefix, or a piece of a DATL body
+ * @param len: Payload length
+ * @param ctx: Channel the frame arrived on
+ */
+void reader_dispatch(frame_type_t type, const char *payload, size_t len, void *ctx) {
+    reader_routes[type].handle(ctx, type, payload, len);
+}
+
+/**
+ * @brief Zero-copy mode: write a spliced entry, from the channel pipe into the log
+ * @note With the write end closed first, a body cut short by its writer is logged as far as it
+ *       got (log_store_splice ends the line)
+ */
+void reader_splice_finish(reader_channel_t *channel) {
+    if (log_sink_splice(&log_sink, LOG_STREAM_DATA, channel->entry, channel->entry_len,
+                        channel->splice_pipe[0], channel->splice_len + channel->splice_left,
+                        channel->splice_stamp) < 0 &&
+        errno != EPIPE) {
+        perror("Error encountered when splicing log entry");
+    }
+    channel->splice_len = 0;
+    channel->splice_left = 0;
+    channel->entry_len = 0;
+}
+
+/**
+ * @brief Zero-copy mode: splice what has arrived of the body, log it once complete
+ * @retval 0 when the entry is logged, 1 if the rest of the body has not arrived yet
+ */
+int reader_splice_resume(reader_channel_t *channel) {
+    while (channel->splice_left > 0) {
+        ssize_t moved = splice(channel->fd, NULL, channel->splice_pipe[1], NULL,
+                               channel->splice_left, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved > 0) {
+            channel->splice_len += moved;
+            channel->splice_left -= moved;
+        } else if (moved < 0 && errno == EINTR) {
+            continue;
+        } else if (moved < 0 && errno == EAGAIN) {
+            return 1; // The writer has not written the rest of the body yet, resumed on EPOLLIN
+        } else {
+            // Writer gone in the middle of the body
+            if (moved < 0)
+                perror("Error splicing named pipe");
+            close(channel->splice_pipe[1]);
+            reader_splice_finish(channel);
+            close(channel->splice_pipe[0]);
+            channel->splice_pipe[0] = channel->splice_pipe[1] = -1;
+            return 0;
+        }
+    }
+    reader_splice_finish(channel);
+    return 0;
+}
+
+/**
+ * @brief Zero-copy mode: take the rest of a DATL body out of the parser and splice it
+ * @retval 0 when the entry is logged, 1 if the rest of the body has not arrived yet, -1 if the
+ *         channel pipe can't be set up (the body is read as usual)
+ */
+int reader_splice(reader_channel_t *channel) {
+    size_t len = channel->parser.body;
+
+    // The channel pipe holds a whole body, the log splice never waits for the writer
+    if (channel->splice_pipe[0] < 0 &&
+        (pipe2(channel->splice_pipe, O_NONBLOCK | O_CLOEXEC) < 0 ||
+         (fcntl(channel->splice_pipe[1], F_GETPIPE_SZ) < FRAME_BODY_MAX &&
+          fcntl(channel->splice_pipe[1], F_SETPIPE_SZ, FRAME_BODY_MAX) < 0))) {
+        perror("Error creating splice pipe");
+        if (channel->splice_pipe[0] >= 0) {
+            close(channel->splice_pipe[0]);
+            close(channel->splice_pipe[1]);
+        }
+        channel->splice_pipe[0] = channel->splice_pipe[1] = -1;
+        return -1;
+    }
+
+    if (channel->entry_len == 0) {
+        memcpy(channel->entry, channel->tag, channel->tag_len);
+        channel->entry_len = channel->tag_len;
+    }
+    channel->splice_stamp = 0;
+    if (bench.path != NULL)
+        channel->splice_stamp = reader_bench_count(FRAME_DATA, channel->entry + channel->tag_len,
+                                                   channel->entry_len - channel->tag_len + len);
+    if (echo)
+        printf("%s%s<%zu bytes>\n", channel->tag, frame_type_prefix(FRAME_DATA),
+               channel->entry_len - channel->tag_len + len);
+
+    channel->parser.body = 0;
+    channel->splice_len = 0;
+    channel->splice_left = len;
+    return reader_splice_resume(channel);
+}
+
+/**
+ * @brief Initialize a channel
+ */
+void reader_channel_init(reader_channel_t *channel, int fd, pid_t pid) {
+    channel->fd = fd;
+    channel->pid = pid;
+    channel->tag_len = snprintf(channel->tag, sizeof(channel->tag), "[%d] ", pid);
+    channel->entry_len = 0;
+    channel->splice_pipe[0] = channel->splice_pipe[1] = -1;
+    channel->splice_len = 0;
+    channel->splice_left = 0;
+    frame_parser_init(&channel->parser);
+}
+
+/**
+ * @brief Add a channel to the event loop
+ * @retval 0 on success, -1 on error
+ */
+int reader_add_channel(int fd, pid_t pid) {
+    reader_channel_t *channel;
+    struct epoll_event ev;
+
+    if (channel_count == READER_MAX_WRITERS + 1 || (channel = malloc(sizeof(*channel))) == NULL) {
+        fprintf(stderr, "Too many writers, refusing %d\n", pid);
+        return -1;
     }
+    reader_channel_init(channel, fd, pid);
+    channel->index = channel_count;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = channel;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("Error polling channel");
+        free(channel);
+        return -1;
+    }
+    channels[channel_count++] = channel;
+    return 0;
 }
 
-int main(void) {
-    char buffer[BUFFER_SIZE];
-    char *buffer_content = (buffer + MSG_PREFIX_LEN); // Pointer to message without prefix
-    int return_code, fd;
+/**
+ * @brief Open the FIFO of a writer that sent "HELO:PID"
+ */
+void reader_attach(pid_t pid) {
+    char path[64];
+    int fd;
+
+    snprintf(path, sizeof(path), "%s.%d", pipe_name, pid);
+    // Non-blocking open of the read end never waits, the writer is blocked opening its end
+    if ((fd = open(path, O_RDONLY | O_NONBLOCK)) < 0) {
+        perror("Error opening writer channel");
+        return;
+    }
+    if (reader_add_channel(fd, pid) < 0) {
+        close(fd);
+        return;
+    }
+    printf("Writer %d attached (%zu writers)\n", pid, channel_count - 1);
+}
+
+/**
+ * @brief Remove a channel from the event loop and release it
+ */
+void reader_detach(reader_channel_t *channel) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, channel->fd, NULL);
+    if (channel->splice_pipe[0] >= 0) {
+        // Log what arrived of a body still being spliced
+        close(channel->splice_pipe[1]);
+        if (channel->splice_left > 0)
+            reader_splice_finish(channel);
+        close(channel->splice_pipe[0]);
+    }
+    close(channel->fd);
+    dropped += channel->parser.dropped;
+
+    // Keep channels[] compact: move the last channel into the free slot
+    channels[channel->index] = channels[--channel_count];
+    channels[channel->index]->index = channel->index;
+    if (channel->pid != 0)
+        printf("Writer %d detached (%zu writers)\n", channel->pid, channel_count - 1);
+    free(channel);
+}
+
+/**
+ * @brief Read everything available on a channel
+ * @retval 0 if the channel is still open, -1 when the writer closed it
+ */
+int reader_drain(reader_channel_t *channel) {
     ssize_t bytes_read;
-    FILE *plog;
+
+    // A body being spliced comes first, the next bytes in the FIFO are part of it
+    if (channel->splice_left > 0 && reader_splice_resume(channel) > 0)
+        return 0;
+    while ((bytes_read = read(channel->fd, buffer, READ_BUFFER_SIZE)) > 0) {
+        /* A read can hold several frames or only part of one, the parser splits them */
+        frame_parser_feed(&channel->parser, buffer, bytes_read, reader_dispatch, channel);
+        if (zero_copy && channel->parser.body >= READER_SPLICE_MIN &&
+            reader_splice(channel) > 0)
+            return 0;
+    }
+    if (bytes_read == 0)
+        return -1;
+    if (errno != EAGAIN && errno != EINTR) {
+        perror("Error reading named pipe");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief FIFO transport loop: serve every attached writer until SIGINT
+ * @retval 0 on success, 1 on error
+ */
+int reader_fifo_loop(void) {
+    struct epoll_event events[READER_MAX_EVENTS];
+    int keepalive_fd, fd;
+
+    if ((epoll_fd = epoll_create1(0)) < 0) {
+        perror("Error creating event loop");
+        return 1;
+    }
+
+    // The reader also holds a write end, the shared FIFO never reports EOF between writers
+    if ((fd = open(pipe_name, O_RDONLY | O_NONBLOCK)) < 0 ||
+        (keepalive_fd = open(pipe_name, O_WRONLY | O_NONBLOCK)) < 0) {
+        perror("Error opening named pipe");
+        return 1;
+    }
+    if (reader_add_channel(fd, 0) < 0)
+        return 1;
+
+    while (!sigint_flag) {
+        int nfds = epoll_wait(epoll_fd, events, READER_MAX_EVENTS, -1);
+        if (nfds < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("Error waiting for events");
+            break;
+        }
+        for (int i = 0; i < nfds; i++) {
+            reader_channel_t *channel = events[i].data.ptr;
+            if (reader_drain(channel) < 0 && channel->pid != 0)
+                reader_detach(channel);
+        }
+    }
+
+    while (channel_count > 0)
+        reader_detach(channels[channel_count - 1]);
+    close(keepalive_fd);
+    close(epoll_fd);
+    return 0;
+}
+
+/**
+ * @brief Shared-memory transport loop: single writer, until it detaches or SIGINT
+ * @retval 0 on success, 1 on error
+ */
+int reader_shm_loop(void) {
+    reader_channel_t channel;
+    shm_ring_t ring;
+    ssize_t bytes_read;
+
+    if (shm_ring_create(&ring, SHM_RING_NAME) < 0) {
+        perror("Error creating shared memory ring");
+        return 1;
+    }
+    if (shm_ring_wait_producer(&ring) < 0) {
+        shm_ring_close(&ring);
+        return 1;
+    }
+    reader_channel_init(&channel, -1, ring.hdr->producer_pid);
+    printf("Writer %d attached\n", channel.pid);
+
+    while (!sigint_flag && (bytes_read = shm_ring_read(&ring, buffer, READ_BUFFER_SIZE)) > 0) {
+        frame_parser_feed(&channel.parser, buffer, bytes_read, reader_dispatch, &channel);
+    }
+
+    shm_ring_close(&ring);
+    dropped += channel.parser.dropped;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int return_code, opt;
+    log_sync_t log_sync = {LOG_SYNC_NONE, 0};
+    log_store_config_t log_store = {LOG_STORE_SEGMENT_SIZE, 0};
+    const char *log_paths[LOG_STREAMS];
+    bool use_shm = false; // Shared-memory ring instead of the named FIFO
+
+    log_paths[LOG_STREAM_DATA] = data_log_path;
+    log_paths[LOG_STREAM_SIGN] = sign_log_path;
+    log_paths[LOG_STREAM_RTSG] = rtsg_log_path;
+
+    while ((opt = getopt(argc, argv, "s:r:t:b:vz")) != -1) {
+        if (opt == 's' && log_sync_parse(optarg, &log_sync) == 0)
+            continue;
+        if (opt == 'r' && log_store_config_parse(optarg, &log_store) == 0)
+            continue;
+        if (opt == 'b' || opt == 'v' || opt == 'z') {
+            bench.path = (opt == 'b') ? optarg : bench.path;
+            echo = echo || opt == 'v';
+            zero_copy = zero_copy || opt == 'z';
+            continue;
+        }
+        if (opt == 't' && (strcmp(optarg, "fifo") == 0 || strcmp(optarg, "shm") == 0)) {
+            use_shm = (strcmp(optarg, "shm") == 0);
+            continue;
+        }
+        fprintf(stderr,
+                "Usage: %s [-s none|interval:MS|entries:N] [-r size:MB,time:S] [-t fifo|shm] "
+                "[-v] [-z] [-b results.json]\n",
+                argv[0]);
+        return 1;
+    }
 
     printf("Reader process initializaton. PID %d\n", getpid());
 
@@ -54,14 +631,15 @@ int main(void) {
         return 1; // Exit with error
     }
 
-    /* Logging files setup */
-    pdata_log = fopen(data_log_path, "a"); // Open data log file in append mode
-    psign_log = fopen(sign_log_path, "a"); // Open signals log file in append mode
-
-    if (pdata_log == NULL || psign_log == NULL) {
-        printf("Error open logging files.\n");
+    /* Logging files setup, segmented stores written by the log sink thread */
+    if (log_sink_init(&log_sink, log_paths, LOG_STREAMS, log_sync, log_store) < 0) {
+        perror("Error open logging files");
         return 1;
     }
+    if (bench.path != NULL) {
+        histogram_init(&bench.latency);
+        log_sink.latency = &bench.latency;
+    }
 
     // Named pipe permissions 6:110 rw-
     return_code = mknod(pipe_name, S_IFIFO | 0666, 0);
@@ -80,51 +658,19 @@ int main(void) {
     sigemptyset(&hsigint.sa_mask);
     sigaction(SIGINT, &hsigint, NULL);
 
-    /* Open named pipe. Blocks until reader is found */
-    // TODO: A timeout can be implemented
-    printf("Waiting for writer...\n");
-    if ((fd = open(pipe_name, O_RDONLY)) < 0) {
-        perror("Error opening named pipe");
-        return 1;
-    }
-
-    /**
-     * Open syscalls returned without error,
-     * meaning other process is attached to named pipe in read only mode
-     */
-    printf("Got a writer\n");
-
-    size_t write_chk; // Aux var to check bytes written
-
-    /* Reader loop */
-    do {
-        /* Read named pipe into local buffer */
-        if ((bytes_read = read(fd, buffer, BUFFER_SIZE)) < 0) {
-            perror("Error reading named pipe");
-            continue;
-        }
-
-        buffer[bytes_read] = '\0';
-        printf("Read %ld bytes: %s", bytes_read, buffer);
+    printf("Waiting for writers...\n");
+    return_code = use_shm ? reader_shm_loop() : reader_fifo_loop();
 
-        if (NULL != strstr(buffer, data_msg_prefix)) {
-            plog = pdata_log;
-        } else if (NULL != strstr(buffer, sign_msg_prefix)) {
-            plog = psign_log;
-        } else {
-            continue;
-        }
-        write_chk = fwrite(buffer_content, sizeof(char), strlen(buffer_content), plog);
-        if (write_chk < strlen(buffer_content)) {
-            perror("Error encountered when writing log file");
-        }
-
-    } while (bytes_read > 0);
-
-    // Close file pointers
-    if (fclose(pdata_log) != 0 || fclose(psign_log) != 0) {
-        perror("Error closing log file");
+    if (dropped > 0) {
+        printf("Dropped %lu malformed messages\n", dropped);
     }
 
-    return 0;
+    // Write pending entries and close log files
+    log_sink_stop(&log_sink);
+    printf("Logged %lu entries in %lu writes, %lu fsyncs\n", log_sink.entries, log_sink.batches,
+           log_sink.syncs);
+    if (bench.path != NULL)
+        reader_bench_report();
+
+    return return_code;
 }
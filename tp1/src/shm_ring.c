@@ -0,0 +1,191 @@
+/**
+ * @file shm_ring.c
+ * @brief Trabajo practico 1. Shared-memory transport between writer and reader.
+ * @author Gonzalo G. Fernandez
+ *
+ */
+
+#include <errno.h>         // errno, error code names
+#include <fcntl.h>         // O_* constants
+#include <limits.h>        // INT_MAX
+#include <linux/futex.h>   // FUTEX_WAIT, FUTEX_WAKE
+#include <string.h>        // memcpy, memset
+#include <sys/mman.h>      // shm_open, mmap
+#include <sys/syscall.h>   // SYS_futex
+#include <time.h>          // struct timespec
+#include <unistd.h>        // ftruncate, close, syscall, getpid
+
+#include "shm_ring.h"
+
+#define SHM_RING_MASK (SHM_RING_SIZE - 1)
+#define SHM_RING_MAP_SIZE (sizeof(shm_ring_hdr_t) + SHM_RING_SIZE)
+
+static int futex_wait(uint32_t *addr, uint32_t val, const struct timespec *timeout) {
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr) { syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0); }
+
+static uint32_t load_acquire(uint32_t *addr) { return __atomic_load_n(addr, __ATOMIC_ACQUIRE); }
+
+static void store_release(uint32_t *addr, uint32_t val) {
+    __atomic_store_n(addr, val, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Wake the other side: bump its futex word so a wait about to start returns at once
+ */
+static void shm_ring_wake(uint32_t *seq) {
+    __atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+    futex_wake(seq);
+}
+
+/**
+ * @brief Map the shared memory object
+ */
+static int shm_ring_map(shm_ring_t *ring, const char *name, int flags) {
+    int fd = shm_open(name, flags, 0666);
+    if (fd < 0)
+        return -1;
+    if ((flags & O_CREAT) && ftruncate(fd, SHM_RING_MAP_SIZE) < 0) {
+        close(fd);
+        return -1;
+    }
+    void *addr = mmap(NULL, SHM_RING_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // The mapping keeps the object referenced
+    if (addr == MAP_FAILED)
+        return -1;
+
+    ring->hdr = addr;
+    ring->data = (char *)addr + sizeof(shm_ring_hdr_t);
+    ring->name = name;
+    return 0;
+}
+
+int shm_ring_create(shm_ring_t *ring, const char *name) {
+    if (shm_ring_map(ring, name, O_RDWR | O_CREAT) < 0)
+        return -1;
+    memset(ring->hdr, 0, sizeof(shm_ring_hdr_t));
+    ring->consumer = true;
+    return 0;
+}
+
+int shm_ring_attach(shm_ring_t *ring, const char *name) {
+    if (shm_ring_map(ring, name, O_RDWR) < 0)
+        return -1;
+    ring->consumer = false;
+    if (__atomic_exchange_n(&ring->hdr->producer_pid, getpid(), __ATOMIC_SEQ_CST) != 0) {
+        munmap(ring->hdr, SHM_RING_MAP_SIZE);
+        errno = EBUSY; // Single producer ring
+        return -1;
+    }
+    store_release(&ring->hdr->producer_attached, 1);
+    futex_wake(&ring->hdr->producer_attached);
+    return 0;
+}
+
+int shm_ring_wait_producer(shm_ring_t *ring) {
+    while (load_acquire(&ring->hdr->producer_attached) == 0) {
+        if (futex_wait(&ring->hdr->producer_attached, 0, NULL) < 0 && errno == EINTR)
+            return -1;
+    }
+    return 0;
+}
+
+ssize_t shm_ring_write(shm_ring_t *ring, const char *data, size_t len) {
+    shm_ring_hdr_t *hdr = ring->hdr;
+    uint32_t head = hdr->head; // Only this process writes head
+    uint32_t free_bytes = SHM_RING_SIZE - (head - load_acquire(&hdr->tail));
+
+    if (load_acquire(&hdr->consumer_closed)) {
+        errno = EPIPE;
+        return -1;
+    }
+    if (len > free_bytes)
+        len = free_bytes;
+    if (len == 0)
+        return 0;
+
+    // Copy in up to two pieces, the data area wraps around
+    size_t offset = head & SHM_RING_MASK;
+    size_t first = (len < SHM_RING_SIZE - offset) ? len : SHM_RING_SIZE - offset;
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, data + first, len - first);
+    store_release(&hdr->head, head + len);
+
+    // Wake the reader only if it announced it is sleeping
+    if (__atomic_load_n(&hdr->consumer_waiting, __ATOMIC_SEQ_CST))
+        shm_ring_wake(&hdr->data_seq);
+    return len;
+}
+
+int shm_ring_wait_space(shm_ring_t *ring, int timeout_ms) {
+    shm_ring_hdr_t *hdr = ring->hdr;
+    struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    uint32_t seq = __atomic_load_n(&hdr->space_seq, __ATOMIC_SEQ_CST);
+
+    if (hdr->head - load_acquire(&hdr->tail) < SHM_RING_SIZE)
+        return 0;
+    __atomic_store_n(&hdr->producer_waiting, 1, __ATOMIC_SEQ_CST);
+    // Check again after announcing, the reader may have freed space in between
+    if (hdr->head - __atomic_load_n(&hdr->tail, __ATOMIC_SEQ_CST) == SHM_RING_SIZE &&
+        !__atomic_load_n(&hdr->consumer_closed, __ATOMIC_SEQ_CST)) {
+        if (futex_wait(&hdr->space_seq, seq, timeout_ms < 0 ? NULL : &timeout) < 0 &&
+            errno == EINTR) {
+            __atomic_store_n(&hdr->producer_waiting, 0, __ATOMIC_SEQ_CST);
+            return -1;
+        }
+    }
+    __atomic_store_n(&hdr->producer_waiting, 0, __ATOMIC_SEQ_CST);
+    if (load_acquire(&hdr->consumer_closed)) {
+        errno = EPIPE;
+        return -1;
+    }
+    return 0;
+}
+
+ssize_t shm_ring_read(shm_ring_t *ring, char *buffer, size_t len) {
+    shm_ring_hdr_t *hdr = ring->hdr;
+    uint32_t tail = hdr->tail; // Only this process writes tail
+    uint32_t head;
+
+    while ((head = load_acquire(&hdr->head)) == tail) {
+        uint32_t seq = __atomic_load_n(&hdr->data_seq, __ATOMIC_SEQ_CST);
+        if (load_acquire(&hdr->producer_closed))
+            return 0;
+        __atomic_store_n(&hdr->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+        // Check again after announcing, the writer may have published in between
+        if (__atomic_load_n(&hdr->head, __ATOMIC_SEQ_CST) == tail &&
+            !__atomic_load_n(&hdr->producer_closed, __ATOMIC_SEQ_CST)) {
+            if (futex_wait(&hdr->data_seq, seq, NULL) < 0 && errno == EINTR) {
+                __atomic_store_n(&hdr->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+                return -1;
+            }
+        }
+        __atomic_store_n(&hdr->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+    }
+
+    if (len > head - tail)
+        len = head - tail;
+    size_t offset = tail & SHM_RING_MASK;
+    size_t first = (len < SHM_RING_SIZE - offset) ? len : SHM_RING_SIZE - offset;
+    memcpy(buffer, ring->data + offset, first);
+    memcpy(buffer + first, ring->data, len - first);
+    store_release(&hdr->tail, tail + len);
+
+    if (__atomic_load_n(&hdr->producer_waiting, __ATOMIC_SEQ_CST))
+        shm_ring_wake(&hdr->space_seq);
+    return len;
+}
+
+void shm_ring_close(shm_ring_t *ring) {
+    if (ring->consumer) {
+        store_release(&ring->hdr->consumer_closed, 1);
+        shm_ring_wake(&ring->hdr->space_seq);
+        shm_unlink(ring->name);
+    } else {
+        store_release(&ring->hdr->producer_closed, 1);
+        shm_ring_wake(&ring->hdr->data_seq);
+    }
+    munmap(ring->hdr, SHM_RING_MAP_SIZE);
+}
@@ -3,49 +3,752 @@
  * @brief Trabajo practico 1. Sistemas Operativos de Proposito General.
  * @author Gonzalo G. Fernandez
  * @note
- * - If a signal is received before getting a reader, the program exits with error.
+ * - Single event loop (epoll) over stdin, a signalfd for SIGUSR1/SIGUSR2/SIGRTMIN..SIGRTMAX,
+ *   another one for SIGINT/SIGTERM and the FIFO writability. Nothing is written from signal
+ *   context.
+ * - Frames are queued and written in chunks of at most PIPE_BUF bytes that end on a frame
+ *   boundary, so a frame is never torn even with other writers on the same FIFO.
+ * - Standard signals raised while one is already pending are merged by the kernel. When the
+ *   sender uses sigqueue with an integer payload counting from 1, gaps in the sequence are
+ *   reported as coalesced. Only delivered signals are forwarded, one SIGN message each: the
+ *   payload is chosen by the sender, it can't make the writer forward more.
+ * - Real-time signals are queued by the kernel, one per sigqueue call, and each one is forwarded
+ *   as "RTSG:N:VALUE" (SIGRTMIN+N, sigqueue integer value, 0 for kill). While WRITER_RT_QUEUE
+ *   are waiting for room in the output queue the signalfd is not read, so they stay queued in
+ *   the kernel (up to RLIMIT_SIGPENDING, then sigqueue fails with EAGAIN at the sender).
+ *   SIGINT/SIGTERM have their own signalfd, always read: a backpressured FIFO never delays a
+ *   stop. On exit the queued frames get WRITER_DRAIN_MS to reach the reader, what is left is
+ *   reported as unsent.
+ * - On the FIFO transport the writer registers with "HELO:PID" and then writes to its own
+ *   FIFO (pipe_name.PID), so several writers can log through one reader.
+ * - Usage: writer.out [-t fifo|shm] [-n count [-R rate] [-z min:max] [-c corpus] [-k sigrate]
+ *                                  [-q rtrate]]
+ *   -t: transport (default named FIFO). The shared-memory ring has no fd to poll: while it is
+ *   full the loop retries every WRITER_SHM_RETRY_MS.
+ *   -n: non-interactive replay of count DATA messages instead of reading stdin, at rate msg/s
+ *   (0 = as fast as possible), payload sizes uniform in [min, max] (up to FRAME_BODY_MAX, long
+ *   payloads are sent as length-prefixed "DATL:" messages), text taken from the lines
+ *   of the corpus file. Every payload starts with "@NS " (CLOCK_MONOTONIC enqueue time) so the
+ *   reader can measure latency. -k raises sigrate SIGUSR1/SIGUSR2 per second at the writer
+ *   itself (sigqueue, numbered) while replaying, -q raises rtrate real-time signals per second
+ *   cycling over SIGRTMIN..SIGRTMAX, with a sequence number as value.
  *
  */
 
-#include <errno.h>    // errno, error code names
-#include <fcntl.h>    // open
-#include <signal.h>   // sigaction
-#include <stdbool.h>  // bool type
-#include <stdio.h>    // printf
-#include <string.h>   // strlen, strcpy
-#include <sys/stat.h> // mknod
-#include <unistd.h>   // write, getpid
+#include <errno.h>       // errno, error code names
+#include <fcntl.h>       // open, fcntl
+#include <limits.h>      // PIPE_BUF
+#include <poll.h>        // poll
+#include <signal.h>      // sigaction, sigprocmask
+#include <stdbool.h>     // bool type
+#include <stdint.h>      // uint32_t, UINT32_MAX, uint64_t
+#include <stdio.h>       // printf, getline
+#include <stdlib.h>      // strtoul, rand, realloc
+#include <string.h>      // strlen, strcmp, memcpy, memchr, memmove
+#include <sys/epoll.h>   // epoll_create1, epoll_ctl, epoll_wait
+#include <sys/signalfd.h> // signalfd
+#include <sys/stat.h>    // mknod
+#include <sys/timerfd.h> // timerfd_create, timerfd_settime
+#include <time.h>        // clock_gettime
+#include <unistd.h>      // write, getpid, getopt, usleep
 
+#include "framing.h"
+#include "shm_ring.h"
 #include "utils.h"
 
-int fd;                 /*!> File descriptor for PIPE */
-bool open_pipe = false; /*!> Flag to indicate open PIPE */
+#define WRITER_QUEUE_SIZE (64 * 1024) /*!> Frames waiting for the FIFO to be writable */
+#define WRITER_MAX_EVENTS 4
+#define STDIN_LINE_MAX (BUFFER_SIZE - MSG_PREFIX_LEN - 2) /*!> Longer lines are split */
+#define WRITER_SHM_RETRY_MS 1 /*!> Retry period while the shared-memory ring is full */
+#define REPLAY_TICK_NS 1000000     /*!> Replay pacing period, 1 ms */
+#define REPLAY_PAYLOAD_MAX (FRAME_BODY_MAX - 1) /*!> Largest replayed payload */
+#define WRITER_RT_QUEUE 4096     /*!> Real-time signals waiting for output queue room */
+#define WRITER_SIGINFO_BATCH 32  /*!> signalfd entries read at once */
+#define WRITER_DRAIN_MS 2000     /*!> Longest wait for the reader at exit */
 
 /**
- * @brief Signal handler
- * @param signo: Number of signal received
+ * @brief Per-signal counters
  */
-void signal_handler(int signo) {
-    // Chack if open PIPE
-    if (!open_pipe)
+typedef struct {
+    unsigned long received;  /*!> Deliveries read from the signalfd */
+    unsigned long coalesced; /*!> Signals merged by the kernel (sigqueue sequence gaps) */
+    unsigned long forwarded; /*!> SIGN messages queued to the FIFO */
+    unsigned long pending;   /*!> SIGN messages waiting for queue room */
+    pid_t last_pid;          /*!> Last sigqueue sender */
+    int last_seq;            /*!> Last sigqueue sequence number */
+} sign_stats_t;
+
+/**
+ * @brief Real-time signal waiting to be forwarded
+ */
+typedef struct {
+    int number; /*!> Signal number minus SIGRTMIN */
+    int value;  /*!> sigqueue integer value */
+} rt_signal_t;
+
+int fd;       /*!> File descriptor for PIPE */
+int epoll_fd; /*!> Event loop */
+int sig_fd;   /*!> signalfd for SIGUSR1, SIGUSR2 and real-time signals */
+int stop_fd;  /*!> signalfd for SIGINT and SIGTERM */
+
+bool use_shm = false; /*!> Shared-memory ring instead of the named FIFO */
+shm_ring_t ring;      /*!> Shared-memory transport */
+
+char out_queue[WRITER_QUEUE_SIZE]; /*!> Frames not yet written to the PIPE */
+size_t out_head = 0;               /*!> First unwritten byte in out_queue */
+size_t out_len = 0;                /*!> End of queued bytes in out_queue */
+
+char stdin_buffer[READ_BUFFER_SIZE]; /*!> stdin bytes not yet framed */
+size_t stdin_len = 0;                /*!> Bytes held in stdin_buffer */
+bool stdin_eof = false;              /*!> stdin closed */
+bool stdin_is_file = false;          /*!> Regular file, not pollable, always readable */
+
+/**
+ * @brief Non-interactive replay configuration and progress
+ */
+typedef struct {
+    bool enabled;           /*!> Replay instead of reading stdin */
+    unsigned long count;    /*!> DATA messages to send */
+    unsigned long rate;     /*!> DATA messages per second, 0 = as fast as possible */
+    unsigned long sig_rate; /*!> SIGUSR1 + SIGUSR2 raised per second */
+    unsigned long rt_rate;  /*!> Real-time signals raised per second */
+    size_t min_size;        /*!> Smallest payload */
+    size_t max_size;        /*!> Largest payload */
+    char **corpus;          /*!> Text lines used as payload */
+    size_t corpus_lines;    /*!> Number of corpus lines */
+    unsigned long sent;     /*!> DATA messages queued */
+    unsigned long signals;  /*!> Signals raised */
+    unsigned long rt_signals; /*!> Real-time signals raised */
+    int sig_seq[2];         /*!> sigqueue sequence per signal */
+    uint64_t start_ns;      /*!> Replay start */
+    int timer_fd;           /*!> Pacing timer */
+} replay_t;
+
+sign_stats_t sign_stats[2]; /*!> SIGUSR1 and SIGUSR2 counters */
+bool stop = false;          /*!> SIGINT or SIGTERM received */
+
+rt_signal_t rt_queue[WRITER_RT_QUEUE]; /*!> Real-time signals not yet queued as RTSG frames */
+unsigned long rt_head = 0;             /*!> Next real-time signal to forward */
+unsigned long rt_tail = 0;             /*!> End of rt_queue */
+unsigned long rt_received = 0;         /*!> Real-time signals read from the signalfd */
+unsigned long rt_forwarded = 0;        /*!> RTSG messages queued to the FIFO */
+
+char *replay_default_corpus[] = {
+    "Sistemas Operativos de Proposito General",
+    "the quick brown fox jumps over the lazy dog",
+    "0123456789abcdefghijklmnopqrstuvwxyz",
+};
+
+replay_t replay = {
+    .enabled = false,
+    .min_size = 16,
+    .max_size = 128,
+    .corpus = replay_default_corpus,
+    .corpus_lines = sizeof(replay_default_corpus) / sizeof(replay_default_corpus[0]),
+    .timer_fd = -1,
+};
+
+/**
+ * @brief Reserve room at the end of the output queue
+ * @param len: Bytes needed
+ * @retval Pointer to write the frame, NULL if the queue is full
+ */
+char *writer_reserve(size_t len) {
+    if (WRITER_QUEUE_SIZE - out_len < len && out_head > 0) {
+        // Compact: move unwritten bytes to the front
+        memmove(out_queue, out_queue + out_head, out_len - out_head);
+        out_len -= out_head;
+        out_head = 0;
+    }
+    if (WRITER_QUEUE_SIZE - out_len < len)
+        return NULL;
+    char *frame = out_queue + out_len;
+    out_len += len;
+    return frame;
+}
+
+/**
+ * @brief Queue a "DATA:" frame, the delimiter is added
+ * @retval true if queued, false if the queue is full
+ */
+bool writer_queue_data(const char *line, size_t len) {
+    char header[MSG_PREFIX_LEN + 16];
+    size_t header_len = MSG_PREFIX_LEN;
+
+    if (MSG_PREFIX_LEN + len + 1 > PIPE_BUF) {
+        // Too long for an atomic frame: "DATL:LEN\n" and the line as body
+        header_len = snprintf(header, sizeof(header), "%s%zu\n", datl_msg_prefix, len + 1);
+    } else {
+        memcpy(header, data_msg_prefix, MSG_PREFIX_LEN);
+    }
+
+    char *frame = writer_reserve(header_len + len + 1);
+    if (frame == NULL)
+        return false;
+    memcpy(frame, header, header_len);
+    memcpy(frame + header_len, line, len);
+    frame[header_len + len] = '\n';
+    return true;
+}
+
+/**
+ * @brief Move pending SIGN messages into the output queue
+ */
+void writer_queue_signals(void) {
+    const char *msgs[2] = {sigusr1_msg, sigusr2_msg};
+
+    for (int i = 0; i < 2; i++) {
+        char *frame;
+        while (sign_stats[i].pending > 0 && (frame = writer_reserve(MSG_SIGUSR_LEN)) != NULL) {
+            memcpy(frame, msgs[i], MSG_SIGUSR_LEN);
+            sign_stats[i].pending--;
+            sign_stats[i].forwarded++;
+        }
+    }
+
+    while (rt_head != rt_tail) {
+        rt_signal_t *rt = &rt_queue[rt_head % WRITER_RT_QUEUE];
+        char msg[MSG_PREFIX_LEN + 32];
+        int len = snprintf(msg, sizeof(msg), "%s%d:%d\n", rtsg_msg_prefix, rt->number, rt->value);
+        char *frame = writer_reserve(len);
+        if (frame == NULL)
+            break;
+        memcpy(frame, msg, len);
+        rt_head++;
+        rt_forwarded++;
+    }
+}
+
+/**
+ * @brief Frame buffered stdin lines, as long as the output queue has room
+ */
+void writer_queue_stdin(void) {
+    size_t start = 0;
+
+    while (start < stdin_len) {
+        const char *line = stdin_buffer + start;
+        size_t avail = stdin_len - start;
+        char *delim = memchr(line, '\n', avail);
+        size_t len, consumed;
+
+        if (delim != NULL && (size_t)(delim - line) <= STDIN_LINE_MAX) {
+            len = delim - line;
+            consumed = len + 1;
+        } else if (avail >= STDIN_LINE_MAX || (delim == NULL && stdin_eof)) {
+            // Line too long (split like fgets did) or last line without delimiter
+            len = (avail < STDIN_LINE_MAX) ? avail : STDIN_LINE_MAX;
+            consumed = len;
+        } else {
+            break; // Wait for the rest of the line
+        }
+
+        if (!writer_queue_data(line, len))
+            break;
+        printf("Queued %zu bytes: DATA:%.*s\n", MSG_PREFIX_LEN + len + 1, (int)len, line);
+        start += consumed;
+    }
+
+    memmove(stdin_buffer, stdin_buffer + start, stdin_len - start);
+    stdin_len -= start;
+}
+
+/**
+ * @brief Write queued frames, in chunks of up to PIPE_BUF that end on a frame boundary
+ * @retval 0 on success or FIFO full, -1 on error (reader gone)
+ */
+int writer_flush(void) {
+    if (use_shm && out_head < out_len) {
+        // Single producer ring: no other writer can interleave, partial writes are fine
+        ssize_t bytes_wrote = shm_ring_write(&ring, out_queue + out_head, out_len - out_head);
+        if (bytes_wrote < 0) {
+            perror("Error writing shared memory ring");
+            return -1;
+        }
+        out_head += bytes_wrote;
+        if (out_head < out_len)
+            return 0;
+    }
+
+    while (out_head < out_len) {
+        size_t len = out_len - out_head;
+        if (len > PIPE_BUF) {
+            // Writes up to PIPE_BUF are atomic: cut at the last delimiter before the limit. A
+            // DATL body has no delimiter to cut at, this writer's own FIFO keeps it in one piece
+            const char *chunk = out_queue + out_head;
+            size_t limit = len;
+            len = PIPE_BUF;
+            while (len > 0 && chunk[len - 1] != '\n')
+                len--;
+            if (len == 0)
+                len = limit;
+        }
+
+        ssize_t bytes_wrote = write(fd, out_queue + out_head, len);
+        if (bytes_wrote < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                return 0;
+            perror("Error writing named pipe");
+            return -1;
+        }
+        out_head += bytes_wrote;
+    }
+    out_head = 0;
+    out_len = 0;
+    return 0;
+}
+
+/**
+ * @brief Read stdin into the line buffer
+ */
+void writer_read_stdin(void) {
+    ssize_t bytes_read = read(STDIN_FILENO, stdin_buffer + stdin_len, READ_BUFFER_SIZE - stdin_len);
+
+    if (bytes_read < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return;
+        perror("Error with string from stdin");
+        stdin_eof = true;
+    } else if (bytes_read == 0) {
+        stdin_eof = true;
+    } else {
+        stdin_len += bytes_read;
+    }
+}
+
+/**
+ * @brief Read every queued signal from the signalfd and update counters
+ */
+void writer_read_signals(void) {
+    struct signalfd_siginfo info[WRITER_SIGINFO_BATCH];
+    ssize_t bytes_read;
+
+    // Real-time signals left in the kernel queue while there is no room to keep them
+    while (WRITER_RT_QUEUE - (rt_tail - rt_head) >= WRITER_SIGINFO_BATCH &&
+           (bytes_read = read(sig_fd, info, sizeof(info))) > 0) {
+        for (size_t i = 0; i < bytes_read / sizeof(info[0]); i++) {
+            if ((int)info[i].ssi_signo >= SIGRTMIN && (int)info[i].ssi_signo <= SIGRTMAX) {
+                // Never merged by the kernel: forward each one with its value
+                rt_signal_t *rt = &rt_queue[rt_tail++ % WRITER_RT_QUEUE];
+                rt->number = info[i].ssi_signo - SIGRTMIN;
+                rt->value = (info[i].ssi_code == SI_QUEUE) ? info[i].ssi_int : 0;
+                rt_received++;
+                continue;
+            }
+
+            sign_stats_t *stats = &sign_stats[info[i].ssi_signo == SIGUSR1 ? 0 : 1];
+            stats->received++;
+            if (info[i].ssi_code == SI_QUEUE) {
+                // sigqueue sequence numbers (from 1 per sender) reveal signals merged while
+                // pending. The value is the sender's, only reported: one SIGN per delivery
+                int seq = info[i].ssi_int;
+                if (stats->last_pid != (pid_t)info[i].ssi_pid) {
+                    stats->last_pid = info[i].ssi_pid;
+                    stats->last_seq = 0;
+                }
+                if (seq > stats->last_seq + 1)
+                    stats->coalesced += (long)seq - stats->last_seq - 1;
+                stats->last_seq = seq;
+            }
+            stats->pending++;
+        }
+    }
+}
+
+uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @brief Load the replay corpus, one payload text per non-empty line
+ * @retval 0 on success, -1 on error
+ */
+int replay_load_corpus(const char *path) {
+    FILE *fp = fopen(path, "r");
+    char *line = NULL, **lines = NULL;
+    size_t capacity = 0, count = 0;
+    ssize_t len;
+
+    if (fp == NULL) {
+        perror("Error opening corpus");
+        return -1;
+    }
+    while ((len = getline(&line, &capacity, fp)) >= 0) {
+        if (len > 0 && line[len - 1] == '\n')
+            line[--len] = '\0';
+        if (len == 0)
+            continue;
+        if ((lines = realloc(lines, (count + 1) * sizeof(char *))) == NULL ||
+            (lines[count++] = strdup(line)) == NULL) {
+            perror("Error loading corpus");
+            fclose(fp);
+            return -1;
+        }
+    }
+    free(line);
+    fclose(fp);
+    if (count == 0) {
+        fprintf(stderr, "Empty corpus %s\n", path);
+        return -1;
+    }
+    replay.corpus = lines;
+    replay.corpus_lines = count;
+    return 0;
+}
+
+/**
+ * @brief Queue the DATA messages and raise the signals due at this point of the replay
+ */
+void replay_tick(void) {
+    static char payload[REPLAY_PAYLOAD_MAX];
+    uint64_t now = monotonic_ns();
+    uint64_t elapsed = now - replay.start_ns;
+    unsigned long target = replay.count;
+
+    if (!replay.enabled || replay.sent == replay.count)
         return;
+    if (replay.rate > 0 && (uint64_t)replay.rate * elapsed / 1000000000ULL < target)
+        target = (uint64_t)replay.rate * elapsed / 1000000000ULL;
+
+    while (replay.sent < target) {
+        const char *text = replay.corpus[replay.sent % replay.corpus_lines];
+        size_t text_len = strlen(text);
+        size_t size = replay.min_size;
+        if (replay.max_size > replay.min_size)
+            size += rand() % (replay.max_size - replay.min_size + 1);
+
+        // "@NS " enqueue stamp, then corpus text repeated up to the chosen size
+        size_t len = snprintf(payload, sizeof(payload), "@%llu ", (unsigned long long)now);
+        while (len < size) {
+            size_t piece = (size - len < text_len) ? size - len : text_len;
+            memcpy(payload + len, text, piece);
+            len += piece;
+        }
+        if (!writer_queue_data(payload, len))
+            break;
+        replay.sent++;
+    }
+
+    unsigned long sig_target = (uint64_t)replay.sig_rate * elapsed / 1000000000ULL;
+    while (replay.signals < sig_target) {
+        int i = replay.signals++ % 2;
+        union sigval value = {.sival_int = ++replay.sig_seq[i]};
+        sigqueue(getpid(), i == 0 ? SIGUSR1 : SIGUSR2, value);
+    }
+    sig_target = (uint64_t)replay.rt_rate * elapsed / 1000000000ULL;
+    while (replay.rt_signals < sig_target) {
+        union sigval value = {.sival_int = replay.rt_signals + 1};
+        if (sigqueue(getpid(), SIGRTMIN + replay.rt_signals % (SIGRTMAX - SIGRTMIN + 1), value) <
+            0)
+            break; // RLIMIT_SIGPENDING reached, retry on next tick
+        replay.rt_signals++;
+    }
 
-    switch (signo) {
-    case SIGUSR1:
-        write(fd, sigusr1_msg, MSG_SIGUSR_LEN);
-        break;
-    case SIGUSR2:
-        write(fd, sigusr2_msg, MSG_SIGUSR_LEN);
-    default:
-        break;
+    if (replay.sent == replay.count) {
+        printf("Replayed %lu messages, %lu signals and %lu real-time signals in %.3f s\n",
+               replay.sent, replay.signals, replay.rt_signals,
+               (monotonic_ns() - replay.start_ns) * 1e-9);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, replay.timer_fd, NULL);
+        close(replay.timer_fd);
     }
 }
 
-int main(void) {
-    char buffer[BUFFER_SIZE];
-    int return_code;
-    ssize_t bytes_wrote;
-    unsigned int prefix_len = strlen(data_msg_prefix);
+/**
+ * @brief Start the replay pacing timer
+ * @retval 0 on success, -1 on error
+ */
+int replay_start(void) {
+    struct itimerspec period = {{0, REPLAY_TICK_NS}, {0, REPLAY_TICK_NS}};
+    struct epoll_event ev = {0};
+
+    if ((replay.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+        timerfd_settime(replay.timer_fd, 0, &period, NULL) < 0) {
+        perror("Error creating replay timer");
+        return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = replay.timer_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, replay.timer_fd, &ev);
+    replay.start_ns = monotonic_ns();
+    srand(replay.start_ns);
+    return 0;
+}
+
+/**
+ * @brief Register the events each fd is waiting for
+ */
+void writer_update_events(void) {
+    struct epoll_event ev = {0};
+    static uint32_t fifo_events = 0, stdin_events = EPOLLIN; // UINT32_MAX: stdin removed
+    static uint32_t sig_events = EPOLLIN;
+
+    ev.events = (WRITER_RT_QUEUE - (rt_tail - rt_head) >= WRITER_SIGINFO_BATCH) ? EPOLLIN : 0;
+    if (ev.events != sig_events) {
+        ev.data.fd = sig_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, sig_fd, &ev);
+        sig_events = ev.events;
+    }
+
+    ev.events = (out_head < out_len) ? EPOLLOUT : 0;
+    if (!use_shm && ev.events != fifo_events) {
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+        fifo_events = ev.events;
+    }
+
+    if (stdin_is_file || stdin_events == UINT32_MAX)
+        return;
+    if (stdin_eof) {
+        // EOF stays readable forever, stop polling stdin
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+        stdin_events = UINT32_MAX;
+        return;
+    }
+    ev.events = (stdin_len < READ_BUFFER_SIZE) ? EPOLLIN : 0;
+    if (ev.events != stdin_events) {
+        ev.data.fd = STDIN_FILENO;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, STDIN_FILENO, &ev);
+        stdin_events = ev.events;
+    }
+}
+
+/**
+ * @brief Frames in the output queue, a frame partly written counts as one
+ */
+unsigned long writer_queued_frames(void) {
+    unsigned long frames = 0;
+    size_t pos = out_head;
+
+    while (pos < out_len) {
+        const char *frame = out_queue + pos;
+        const char *delim = memchr(frame, '\n', out_len - pos);
+        size_t len = (delim != NULL) ? (size_t)(delim - frame) + 1 : out_len - pos;
+        if (strncmp(frame, datl_msg_prefix, MSG_PREFIX_LEN) == 0 && delim != NULL)
+            len += strtoul(frame + MSG_PREFIX_LEN, NULL, 10); // The body follows the header
+        pos += len;
+        frames++;
+    }
+    return frames;
+}
+
+/**
+ * @brief Shutdown: write whatever is still queued, late signals included, waiting at most
+ *        WRITER_DRAIN_MS for the reader to make room
+ * @retval 0 if everything was written, 1 on error or timeout (what is left is reported at exit)
+ */
+int writer_drain(void) {
+    uint64_t deadline = monotonic_ns() + WRITER_DRAIN_MS * 1000000ULL;
+
+    writer_read_signals();
+    writer_queue_signals();
+    while (1) {
+        uint64_t now;
+        if (writer_flush() < 0)
+            return 1;
+        if (out_head == out_len) {
+            // Signals still pending fit now that the queue is empty
+            writer_queue_signals();
+            if (out_head == out_len)
+                return 0;
+            continue;
+        }
+        if ((now = monotonic_ns()) >= deadline) {
+            fprintf(stderr, "Reader not taking frames, giving up after %d ms\n", WRITER_DRAIN_MS);
+            return 1;
+        }
+        int timeout = (deadline - now) / 1000000 + 1;
+        if (use_shm) {
+            if (shm_ring_wait_space(&ring, timeout) < 0 && errno != EINTR)
+                return 1;
+        } else {
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            if (poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+                return 1;
+        }
+    }
+}
+
+/**
+ * @brief Event loop: runs until SIGINT/SIGTERM or until stdin is closed and everything is written
+ * @retval 0 on success, 1 on error
+ */
+int writer_loop(void) {
+    struct epoll_event events[WRITER_MAX_EVENTS];
+    struct epoll_event ev = {0};
+
+    if ((epoll_fd = epoll_create1(0)) < 0) {
+        perror("Error creating event loop");
+        return 1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = sig_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sig_fd, &ev);
+    ev.data.fd = stop_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev);
+    if (!use_shm) {
+        ev.events = 0;
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+    if (replay.enabled) {
+        // stdin is not read while replaying
+        stdin_eof = true;
+        if (replay_start() < 0)
+            return 1;
+    } else {
+        ev.events = EPOLLIN;
+        ev.data.fd = STDIN_FILENO;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) < 0) {
+            if (errno != EPERM) {
+                perror("Error polling stdin");
+                return 1;
+            }
+            stdin_is_file = true; // Regular files can't be polled, they never block
+        }
+    }
+
+    while (!stop) {
+        writer_queue_signals();
+        writer_queue_stdin();
+        replay_tick();
+        if (stdin_eof && stdin_len == 0 && out_head == out_len && replay.sent == replay.count)
+            break;
+        writer_update_events();
+
+        bool stdin_ready = stdin_is_file && !stdin_eof && stdin_len < READ_BUFFER_SIZE;
+        int timeout = -1;
+        if (stdin_ready)
+            timeout = 0;
+        else if (use_shm && out_head < out_len)
+            timeout = WRITER_SHM_RETRY_MS;
+        int nfds = epoll_wait(epoll_fd, events, WRITER_MAX_EVENTS, timeout);
+        if (nfds < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("Error waiting for events");
+            return 1;
+        }
+
+        for (int i = 0; i < nfds; i++) {
+            if (events[i].data.fd == sig_fd) {
+                writer_read_signals();
+            } else if (events[i].data.fd == stop_fd) {
+                struct signalfd_siginfo info;
+                while (read(stop_fd, &info, sizeof(info)) > 0)
+                    stop = true;
+            } else if (events[i].data.fd == replay.timer_fd) {
+                uint64_t expirations;
+                read(replay.timer_fd, &expirations, sizeof(expirations));
+            } else if (events[i].data.fd == STDIN_FILENO) {
+                writer_read_stdin();
+            } else if (events[i].events & EPOLLERR) {
+                printf("Reader closed the named pipe\n");
+                return 1;
+            } else if (writer_flush() < 0) {
+                return 1;
+            }
+        }
+        if (stdin_ready)
+            writer_read_stdin();
+        if (use_shm && writer_flush() < 0)
+            return 1;
+    }
+
+    return writer_drain();
+}
+
+/**
+ * @brief Register with the reader and switch to a private channel
+ * @note Sends "HELO:PID" on the shared FIFO, then opens pipe_name.PID. The open blocks until
+ *       the reader opens the read end, afterwards the path is no longer needed.
+ * @retval 0 on success, -1 on error
+ */
+int writer_attach_channel(void) {
+    char path[64], helo[32];
+    int channel_fd, len;
+
+    snprintf(path, sizeof(path), "%s.%d", pipe_name, getpid());
+    if (mknod(path, S_IFIFO | 0666, 0) < 0 && errno != EEXIST) {
+        perror("Error creating writer channel");
+        return -1;
+    }
+
+    // Shorter than PIPE_BUF, never interleaved with other writers' registrations
+    len = snprintf(helo, sizeof(helo), "%s%d\n", helo_msg_prefix, getpid());
+    if (write(fd, helo, len) != len) {
+        perror("Error registering with reader");
+        unlink(path);
+        return -1;
+    }
+    if ((channel_fd = open(path, O_WRONLY)) < 0) {
+        perror("Error opening writer channel");
+        unlink(path);
+        return -1;
+    }
+    unlink(path);
+    close(fd);
+    fd = channel_fd;
+    return 0;
+}
+
+/**
+ * @brief Map the shared-memory ring created by the reader, wait for it if not running yet
+ * @retval 0 on success, -1 on error
+ */
+int writer_attach_shm(void) {
+    while (shm_ring_attach(&ring, SHM_RING_NAME) < 0) {
+        if (errno != ENOENT) {
+            perror("Error attaching shared memory ring");
+            return -1;
+        }
+        usleep(100000);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int return_code, opt;
+    sigset_t sigset;
+
+    while ((opt = getopt(argc, argv, "t:n:R:z:c:k:q:")) != -1) {
+        bool valid = true;
+        switch (opt) {
+        case 't':
+            valid = (strcmp(optarg, "fifo") == 0 || strcmp(optarg, "shm") == 0);
+            use_shm = (strcmp(optarg, "shm") == 0);
+            break;
+        case 'n':
+            replay.enabled = true;
+            replay.count = strtoul(optarg, NULL, 10);
+            break;
+        case 'R':
+            replay.rate = strtoul(optarg, NULL, 10);
+            break;
+        case 'z':
+            valid = (sscanf(optarg, "%zu:%zu", &replay.min_size, &replay.max_size) == 2 &&
+                     replay.min_size <= replay.max_size && replay.max_size <= REPLAY_PAYLOAD_MAX);
+            break;
+        case 'c':
+            valid = (replay_load_corpus(optarg) == 0);
+            break;
+        case 'k':
+            replay.sig_rate = strtoul(optarg, NULL, 10);
+            break;
+        case 'q':
+            replay.rt_rate = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            valid = false;
+        }
+        if (!valid) {
+            fprintf(stderr,
+                    "Usage: %s [-t fifo|shm] [-n count [-R rate] [-z min:max] [-c corpus] "
+                    "[-k sigrate] [-q rtrate]]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
 
     printf("Writer process initializaton. PID %d\n", getpid());
 
@@ -67,57 +770,68 @@ int main(void) {
         return 1; // Exit with error
     }
 
-    /* Signal handle */
-    struct sigaction hsiguser1;
-    struct sigaction hsiguser2;
-
-    hsiguser1.sa_handler = signal_handler;
-    hsiguser1.sa_flags = SA_RESTART;
-    hsiguser2.sa_handler = signal_handler;
-    hsiguser2.sa_flags = SA_RESTART;
-
-    sigemptyset(&hsiguser1.sa_mask);
-    sigemptyset(&hsiguser2.sa_mask);
-    sigaction(SIGUSR1, &hsiguser1, NULL);
-    sigaction(SIGUSR2, &hsiguser2, NULL);
+    /* Signal handle: SIGUSR1/SIGUSR2 and real-time signals are blocked and read from a signalfd */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGUSR1);
+    sigaddset(&sigset, SIGUSR2);
+    for (int signo = SIGRTMIN; signo <= SIGRTMAX; signo++)
+        sigaddset(&sigset, signo);
+    if (sigprocmask(SIG_BLOCK, &sigset, NULL) < 0) {
+        perror("Error blocking signals");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN); // A closed reader is reported as EPIPE
 
     /* Open named pipe. Blocks until reader is found */
     // TODO: A timeout can be implemented
     printf("Waiting for reader...\n");
-    if ((fd = open(pipe_name, O_WRONLY)) < 0) {
+    if (use_shm) {
+        if (writer_attach_shm() < 0)
+            return 1;
+    } else if ((fd = open(pipe_name, O_WRONLY)) < 0) {
         perror("Error opening named pipe");
         return 1;
+    } else if (writer_attach_channel() < 0) {
+        return 1;
+    } else {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+
+    /* From now on SIGINT/SIGTERM are also handled in the loop, to write queued frames */
+    if ((sig_fd = signalfd(-1, &sigset, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+        perror("Error creating signalfd");
+        return 1;
     }
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGINT);
+    sigaddset(&sigset, SIGTERM);
+    sigprocmask(SIG_BLOCK, &sigset, NULL);
+    if ((stop_fd = signalfd(-1, &sigset, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+        perror("Error creating signalfd");
+        return 1;
+    }
+
     /**
      * Open syscalls returned without error,
      * meaning other process is attached to named pipe in read only mode
      */
     printf("Got a reader. Type some stuff:\n");
-    open_pipe = true;
 
-    /* Writer loop */
-    while (1) {
-        /* Add buffer prefix */
-        strcpy(buffer, data_msg_prefix);
-        /* Get text from stdin (console) */
-        if (fgets(buffer + prefix_len, BUFFER_SIZE - prefix_len, stdin) == NULL) {
-            /* Handle errors with stdin capture */
-            if (errno == EINTR) {
-                /* The system call can be interrupted by SIGUSR1 and SIGUSR2 signals */
-                perror("Interupted stdin capture");
-                continue;
-            }
-            perror("Error with string from stdin");
-            return 1;
-        }
+    return_code = writer_loop();
 
-        /* Write buffer to named pipe */
-        if ((bytes_wrote = write(fd, buffer, strlen(buffer))) < 0) {
-            perror("Error writing named pipe");
-            continue;
-        }
-        printf("Wrote %ld bytes: %s", bytes_wrote, buffer);
-    }
+    printf("SIGUSR1: received %lu, coalesced %lu, forwarded %lu\n", sign_stats[0].received,
+           sign_stats[0].coalesced, sign_stats[0].forwarded);
+    printf("SIGUSR2: received %lu, coalesced %lu, forwarded %lu\n", sign_stats[1].received,
+           sign_stats[1].coalesced, sign_stats[1].forwarded);
+    printf("SIGRTMIN..SIGRTMAX: received %lu, forwarded %lu\n", rt_received, rt_forwarded);
+    printf("Unsent at exit: %lu frames (%zu bytes), %lu SIGN, %lu RTSG\n", writer_queued_frames(),
+           out_len - out_head, sign_stats[0].pending + sign_stats[1].pending, rt_tail - rt_head);
 
-    return 0;
+    fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) & ~O_NONBLOCK);
+    if (use_shm)
+        shm_ring_close(&ring);
+    else
+        close(fd);
+    return return_code;
 }
@@ -28,9 +28,11 @@ def rcvThread(sock,states):
 		print("LLEGO:"+data.decode("utf-8"))
 		data = data.decode("utf-8").split("OUT:")
 		for d in data:
-			if len(d)>=3:
+			# "X,Y": X de uno o mas digitos, solo hay 3 salidas
+			d = d.split(",")
+			if len(d)>=2 and d[0].isdigit() and len(d[1])>=1 and int(d[0])<len(states):
 				inNumber = d[0]
-				inValue = d[2]
+				inValue = d[1][0]
 				states[int(inNumber)]=int(inValue)
 				printStates(states)
 
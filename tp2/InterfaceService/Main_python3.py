@@ -4,37 +4,15 @@ import time
 import threading
 import datetime
 import os.path
-
-def checkFile(outNumber):
-	try:
-		path = "/tmp/out"+str(outNumber)+".txt"
-		if os.path.exists(path)==False:
-			fp = open(path,"w+")
-			fp.write("0")
-			fp.close()
-	except Exception as e:
-		print(e)
-
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), "../SerialService"))
+from lamptable import LampTable
 
 def writeOutState(outNumber,state):
-	outNumber = outNumber + 1
-	fp = open("/tmp/out"+str(outNumber)+".txt","w+")
-	if int(state)==1:
-		fp.write("1")
-	else:
-		fp.write("0")
-	fp.close()
+	table.set(outNumber,int(state)==1)
 	return True
 
 def readOutState(outNumber):
-	fp = open("/tmp/out"+str(outNumber)+".txt","r")
-	val = fp.read()
-	if val[0]=="1":
-		val=True
-	else:
-		val=False
-	fp.close()
-	return val
+	return table.get(outNumber-1)[0]==1
 
 
 def rcvThread(sock):
@@ -48,9 +26,11 @@ def rcvThread(sock):
 		print("LLEGO:"+data.decode("utf-8"))
 		data = data.decode("utf-8").split("SW:")
 		for d in data:
-			if len(d)>=3:
+			# "X,Y": X de uno o mas digitos
+			d = d.split(",")
+			if len(d)>=2 and d[0].isdigit() and len(d[1])>=1:
 				inNumber = d[0]
-				inValue = d[2]
+				inValue = d[1][0]
 				print("Nuevo estado de salida "+str(inNumber)+" valor:"+str(inValue))
 				writeOutState(int(inNumber),str(inValue))
 
@@ -58,10 +38,7 @@ def rcvThread(sock):
 	socketOk=False
 
 socketOk=True
-
-checkFile(1)
-checkFile(2)
-checkFile(3)
+table = LampTable()
 
 while True:
 	try:
@@ -79,8 +56,10 @@ while True:
 		out1Old=False
 		out2Old=False
 
+		changes = table.changes()
 		while socketOk:
-			time.sleep(1)
+			# Wakes on a lamp change, the timeout checks the connection
+			changes = table.wait(changes,1000)
 			out0 = readOutState(1)
 			if out0!=out0Old:
 				out0Old=out0
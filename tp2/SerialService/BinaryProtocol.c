@@ -0,0 +1,191 @@
+/**
+ * @brief Serial service compact binary protocol
+ * @author Gonzalo G. Fernandez
+ *
+ */
+
+#include "BinaryProtocol.h"
+#include <string.h> // memchr, memmove
+
+#define BINARY_TYPE_OUT 1 /*!> HDR type of FRAME_OUT */
+#define BINARY_TYPE_SW 2  /*!> HDR type of FRAME_SW */
+
+static uint16_t crc16_table[256]; /*!> CRC-16/CCITT-FALSE, one entry per byte value */
+static bool crc16_ready = false;  /*!> crc16_table built */
+
+static void binary_crc16_init(void) {
+    for (unsigned i = 0; i < 256; i++) {
+        uint16_t crc = i << 8;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        crc16_table[i] = crc;
+    }
+    crc16_ready = true;
+}
+
+uint16_t binary_crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xFFFF;
+
+    if (!crc16_ready)
+        binary_crc16_init();
+    while (0 < len--)
+        crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ *data++];
+    return crc;
+}
+
+void binary_parser_init(binary_parser_t *parser) {
+    if (!crc16_ready)
+        binary_crc16_init();
+    parser->len = 0;
+    parser->synced = false;
+    parser->seq = 0;
+    parser->frames = 0;
+    parser->updates = 0;
+    parser->errors = 0;
+    parser->lost = 0;
+}
+
+/**
+ * @brief Drop the first skip buffered bytes and restart at the next SOF already buffered
+ */
+static void binary_parser_skip(binary_parser_t *parser, size_t skip) {
+    uint8_t *sof = memchr(parser->buffer + skip, BINARY_SOF, parser->len - skip);
+
+    if (NULL == sof) {
+        parser->len = 0;
+        return;
+    }
+    parser->len -= sof - parser->buffer;
+    memmove(parser->buffer, sof, parser->len);
+}
+
+/**
+ * @brief Deliver the updates of a complete, valid frame
+ * @retval Updates delivered
+ */
+static size_t binary_parser_deliver(binary_parser_t *parser, frame_handler_t handler,
+                                    void *ctx) {
+    const uint8_t *buffer = parser->buffer;
+    unsigned k = buffer[1] & 0x0F;
+    unsigned base = buffer[3] | buffer[4] << 8;
+    const uint8_t *mask = buffer + BINARY_HEADER_SIZE;
+    frame_t frame = {0};
+    size_t delivered = 0;
+
+    if (parser->synced && buffer[2] != parser->seq)
+        parser->lost += (uint8_t)(buffer[2] - parser->seq);
+    parser->seq = buffer[2] + 1;
+    parser->synced = true;
+    parser->frames++;
+
+    frame.type = (BINARY_TYPE_OUT == buffer[1] >> 6) ? FRAME_OUT : FRAME_SW;
+    for (unsigned i = 0; i < k; i++) {
+        for (uint8_t bits = mask[i]; 0 != bits; bits &= bits - 1) {
+            unsigned bit = __builtin_ctz(bits);
+            frame.channel = (base + i) * 8 + bit;
+            frame.value = (mask[k + i] >> bit) & 1;
+            handler(&frame, ctx);
+            delivered++;
+        }
+    }
+    parser->updates += delivered;
+    return delivered;
+}
+
+size_t binary_parser_feed(binary_parser_t *parser, const char *data, size_t len,
+                          frame_handler_t handler, void *ctx) {
+    const char *end = data + len;
+    size_t delivered = 0;
+
+    while (data < end) {
+        // Outside a frame: jump to the next SOF
+        if (0 == parser->len) {
+            const char *sof = memchr(data, BINARY_SOF, end - data);
+            if (NULL == sof)
+                break;
+            data = sof;
+        }
+        parser->buffer[parser->len++] = *data++;
+
+        // Check what is buffered, a resync may leave whole frames to check again
+        while (1 < parser->len) {
+            uint8_t hdr = parser->buffer[1];
+            unsigned type = hdr >> 6, k = hdr & 0x0F;
+            size_t size = BINARY_HEADER_SIZE + 2 * k + BINARY_CRC_SIZE;
+
+            if ((BINARY_TYPE_OUT != type && BINARY_TYPE_SW != type) || 0 != (hdr & 0x30) ||
+                0 == k || BINARY_MASK_MAX < k) {
+                parser->errors++;
+                binary_parser_skip(parser, 1);
+                continue;
+            }
+            if (parser->len < size)
+                break;
+            if (binary_crc16(parser->buffer + 1, size - 1 - BINARY_CRC_SIZE) !=
+                (parser->buffer[size - 2] | parser->buffer[size - 1] << 8)) {
+                parser->errors++;
+                binary_parser_skip(parser, 1);
+                continue;
+            }
+            delivered += binary_parser_deliver(parser, handler, ctx);
+            // Bytes after the frame are left when it came out of a resync
+            binary_parser_skip(parser, size);
+        }
+    }
+    return delivered;
+}
+
+/**
+ * @brief Write one frame for the updates of a channel group
+ * @retval Bytes written
+ */
+static size_t binary_encode_frame(frame_type_t type, unsigned group, uint64_t mask,
+                                  uint64_t values, uint8_t seq, uint8_t *out) {
+    unsigned lo = __builtin_ctzll(mask) / 8, hi = (63 - __builtin_clzll(mask)) / 8;
+    unsigned k = hi - lo + 1, base = group * BINARY_MASK_MAX + lo;
+    size_t size = BINARY_HEADER_SIZE + 2 * k;
+    uint16_t crc;
+
+    out[0] = BINARY_SOF;
+    out[1] = (FRAME_OUT == type ? BINARY_TYPE_OUT : BINARY_TYPE_SW) << 6 | k;
+    out[2] = seq;
+    out[3] = base & 0xFF;
+    out[4] = base >> 8;
+    for (unsigned i = 0; i < k; i++) {
+        out[BINARY_HEADER_SIZE + i] = mask >> (8 * (lo + i));
+        out[BINARY_HEADER_SIZE + k + i] = values >> (8 * (lo + i));
+    }
+    crc = binary_crc16(out + 1, size - 1);
+    out[size] = crc & 0xFF;
+    out[size + 1] = crc >> 8;
+    return size + BINARY_CRC_SIZE;
+}
+
+size_t binary_encode(const frame_t *updates, size_t count, uint8_t *seq, char *out) {
+    uint8_t *start = (uint8_t *)out, *pos = start;
+    uint64_t mask = 0, values = 0;
+    unsigned group = 0;
+    frame_type_t type = FRAME_OUT;
+
+    for (size_t i = 0; i < count; i++) {
+        const frame_t *update = &updates[i];
+        uint64_t bit = (uint64_t)1 << (update->channel % 64);
+
+        if (BINARY_CHANNEL_MAX < update->channel)
+            continue;
+        // A frame holds one state per channel of a single group and type
+        if (0 != mask && (update->channel / 64 != group || update->type != type || mask & bit)) {
+            pos += binary_encode_frame(type, group, mask, values, (*seq)++, pos);
+            mask = 0;
+            values = 0;
+        }
+        group = update->channel / 64;
+        type = update->type;
+        mask |= bit;
+        if (update->value)
+            values |= bit;
+    }
+    if (0 != mask)
+        pos += binary_encode_frame(type, group, mask, values, (*seq)++, pos);
+    return pos - start;
+}
@@ -0,0 +1,81 @@
+/**
+ * @brief Serial service compact binary protocol
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Negotiation: a peer that speaks the binary protocol sends the ASCII frame ">BIN:V,1\r\n"
+ *   (version V). The service answers ">BIN:V,1\r\n" and both ends switch to binary right after
+ *   those frames, or ">BIN:V,0\r\n" when it does not support V and both stay in ASCII. The
+ *   service never starts the negotiation, so peers that only know ASCII see no change.
+ * - Frame: SOF | HDR | SEQ | BASE (2, little endian) | MASK (k) | VALUE (k) | CRC (2)
+ *   HDR holds the frame type (bits 7-6, 1 = OUT, 2 = SW) and k (bits 3-0, 1 to 8). Bit b of
+ *   MASK byte i updates channel (BASE + i) * 8 + b to bit b of VALUE byte i, so one frame sets
+ *   up to 64 channels. CRC is CRC-16/CCITT-FALSE over HDR to the last VALUE byte.
+ * - SEQ counts frames per stream. The receiver counts the frames missing between two SEQ.
+ * - A frame with a bad header or CRC is dropped and the parser resyncs on the next SOF byte.
+ *
+ */
+
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+#include "FrameParser.h"
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uint8_t, uint16_t
+
+#define BINARY_VERSION 1                   /*!> Protocol version announced in ">BIN:V,Y" */
+#define BINARY_SOF 0xA5                    /*!> Start of frame */
+#define BINARY_HEADER_SIZE 5               /*!> SOF, HDR, SEQ and BASE */
+#define BINARY_MASK_MAX 8                  /*!> Max MASK bytes, 64 channels per frame */
+#define BINARY_CRC_SIZE 2                  /*!> CRC bytes */
+#define BINARY_CHANNEL_MAX (65536 * 8 - 1) /*!> Highest channel a frame can address */
+
+/*!> Longest frame, 64 channels */
+#define BINARY_FRAME_MAX (BINARY_HEADER_SIZE + 2 * BINARY_MASK_MAX + BINARY_CRC_SIZE)
+/*!> Frame of a single update, the most bytes an update can take */
+#define BINARY_UPDATE_MAX (BINARY_HEADER_SIZE + 2 + BINARY_CRC_SIZE)
+
+/**
+ * @brief Incremental binary parser state
+ */
+typedef struct {
+    uint8_t buffer[BINARY_FRAME_MAX]; /*!> Frame being parsed */
+    size_t len;                       /*!> Bytes held in buffer */
+    bool synced;                      /*!> A frame was received, seq is valid */
+    uint8_t seq;                      /*!> SEQ expected in the next frame */
+    unsigned long frames;             /*!> Valid frames */
+    unsigned long updates;            /*!> Channel updates delivered */
+    unsigned long errors;             /*!> Frames dropped, bad header or CRC */
+    unsigned long lost;               /*!> Frames missing according to SEQ */
+} binary_parser_t;
+
+/**
+ * @brief CRC-16/CCITT-FALSE
+ */
+uint16_t binary_crc16(const uint8_t *data, size_t len);
+
+/**
+ * @brief Initialize parser state
+ */
+void binary_parser_init(binary_parser_t *parser);
+
+/**
+ * @brief Feed a chunk of the byte stream into the parser
+ * @param handler Called once per channel update, in stream order. The frame has no data.
+ * @retval Number of channel updates delivered
+ */
+size_t binary_parser_feed(binary_parser_t *parser, const char *data, size_t len,
+                          frame_handler_t handler, void *ctx);
+
+/**
+ * @brief Encode channel updates, consecutive updates of the same 64 channel group share a frame
+ * @note Channels above BINARY_CHANNEL_MAX are skipped
+ * @param updates Updates of a single frame type, in order
+ * @param count Number of updates
+ * @param seq SEQ of the first frame, updated for the next one
+ * @param out Output, room for count * BINARY_UPDATE_MAX bytes
+ * @retval Bytes written
+ */
+size_t binary_encode(const frame_t *updates, size_t count, uint8_t *seq, char *out);
+
+#endif /* BINARY_PROTOCOL_H */
@@ -0,0 +1,186 @@
+/**
+ * @brief Serial service channel registry: output states and metadata of every lamp
+ * @author Gonzalo G. Fernandez
+ *
+ */
+
+#include "ChannelRegistry.h"
+#include <errno.h>  // errno
+#include <stdio.h>  // fopen, fgets, sscanf
+#include <stdlib.h> // calloc, free
+#include <string.h> // memcpy, memset, strdup
+
+#define CHANNEL_DEFAULT_DESCRIPTION "Luz Living"
+
+int channel_registry_init(channel_registry_t *registry, unsigned count) {
+    *registry = (channel_registry_t){.count = count, .words = CHANNEL_REGISTRY_WORDS(count)};
+    if (0 == count || CHANNEL_REGISTRY_MAX < count)
+        return -1;
+    registry->state = calloc(registry->words, sizeof(uint64_t));
+    registry->known = calloc(registry->words, sizeof(uint64_t));
+    registry->info = calloc(count, sizeof(channel_info_t));
+    registry->descriptions = calloc(1, sizeof(char *));
+    if (NULL == registry->state || NULL == registry->known || NULL == registry->info ||
+        NULL == registry->descriptions ||
+        NULL == (registry->descriptions[0] = strdup(CHANNEL_DEFAULT_DESCRIPTION))) {
+        channel_registry_free(registry);
+        return -1;
+    }
+    registry->description_count = 1;
+    return 0;
+}
+
+void channel_registry_free(channel_registry_t *registry) {
+    for (unsigned i = 0; NULL != registry->descriptions && i < registry->description_count; i++)
+        free(registry->descriptions[i]);
+    free(registry->descriptions);
+    free(registry->state);
+    free(registry->known);
+    free(registry->info);
+    *registry = (channel_registry_t){0};
+}
+
+/**
+ * @brief Index of a description, added if new
+ * @retval Index, -1 on error
+ */
+static int channel_registry_intern(channel_registry_t *registry, const char *description) {
+    char **grown;
+    unsigned i;
+
+    for (i = 0; i < registry->description_count; i++) {
+        if (0 == strcmp(registry->descriptions[i], description))
+            return i;
+    }
+    if (CHANNEL_DESCRIPTIONS_MAX <= i) {
+        errno = ENOSPC;
+        return -1;
+    }
+    grown = realloc(registry->descriptions, (i + 1) * sizeof(char *));
+    if (NULL == grown)
+        return -1;
+    registry->descriptions = grown;
+    registry->descriptions[i] = strdup(description);
+    if (NULL == registry->descriptions[i])
+        return -1;
+    registry->description_count++;
+    return i;
+}
+
+int channel_registry_load(channel_registry_t *registry, const char *path) {
+    char line[512], description[512];
+    FILE *file = fopen(path, "r");
+    int ret = 0;
+
+    if (NULL == file)
+        return -1;
+    while (0 == ret && NULL != fgets(line, sizeof(line), file)) {
+        unsigned first, last, type;
+        int index, end = 0;
+        line[strcspn(line, "\r\n")] = '\0';
+        if ('\0' == line[0] || '#' == line[0])
+            continue;
+        // "first-last,type,description" or "first,type,description"
+        if (3 != sscanf(line, "%u-%u,%u,%n", &first, &last, &type, &end) &&
+            2 == sscanf(line, "%u,%u,%n", &first, &type, &end))
+            last = first;
+        // Descriptions go to the device list JSON as they are, no escapes
+        if (0 == end || 1 > first || first > last || registry->count < last ||
+            CHANNEL_BLIND < type || NULL != strpbrk(line + end, "\"\\")) {
+            errno = EINVAL;
+            ret = -1;
+            break;
+        }
+        snprintf(description, sizeof(description), "%s", line + end);
+        index = channel_registry_intern(registry, description);
+        if (0 > index) {
+            ret = -1;
+            break;
+        }
+        for (unsigned channel = first - 1; channel < last; channel++)
+            registry->info[channel] = (channel_info_t){.type = type, .description = index};
+    }
+    if (0 == ret && ferror(file)) {
+        errno = EIO;
+        ret = -1;
+    }
+    fclose(file);
+    return ret;
+}
+
+int channel_registry_get(const channel_registry_t *registry, unsigned channel) {
+    uint64_t bit = 1ULL << (channel % 64);
+
+    if (registry->count <= channel || !(registry->known[channel / 64] & bit))
+        return -1;
+    return (registry->state[channel / 64] & bit) ? 1 : 0;
+}
+
+bool channel_registry_set(channel_registry_t *registry, unsigned channel, int value) {
+    uint64_t bit = 1ULL << (channel % 64), *state, *known;
+
+    if (registry->count <= channel)
+        return false;
+    registry->updates++;
+    state = &registry->state[channel / 64];
+    known = &registry->known[channel / 64];
+    if ((*known & bit) && !(*state & bit) == !value)
+        return false;
+    *state = value ? *state | bit : *state & ~bit;
+    *known |= bit;
+    registry->changes++;
+    return true;
+}
+
+size_t channel_registry_set_range(channel_registry_t *registry, unsigned first, unsigned last,
+                                  int value, uint64_t *changed) {
+    size_t count = 0;
+
+    if (NULL != changed)
+        memset(changed, 0, registry->words * sizeof(uint64_t));
+    if (first > last || registry->count <= first)
+        return 0;
+    if (registry->count <= last)
+        last = registry->count - 1;
+    registry->bulk++;
+    for (size_t word = first / 64; word <= last / 64; word++) {
+        uint64_t mask = ~0ULL, target, diff;
+        if (word == first / 64)
+            mask &= ~0ULL << (first % 64);
+        if (word == last / 64)
+            mask &= ~0ULL >> (63 - last % 64);
+        target = value ? mask : 0;
+        // Changed: a different state, or none known yet
+        diff = ((registry->state[word] ^ target) | ~registry->known[word]) & mask;
+        registry->state[word] = (registry->state[word] & ~mask) | target;
+        registry->known[word] |= mask;
+        if (NULL != changed)
+            changed[word] = diff;
+        count += __builtin_popcountll(diff);
+    }
+    registry->changes += count;
+    return count;
+}
+
+unsigned channel_registry_next(const uint64_t *bits, unsigned from, unsigned end) {
+    while (from < end) {
+        uint64_t word = bits[from / 64] >> (from % 64);
+        if (0 != word) {
+            from += __builtin_ctzll(word);
+            return (from < end) ? from : end;
+        }
+        from = (from / 64 + 1) * 64;
+    }
+    return end;
+}
+
+void channel_registry_snapshot(const channel_registry_t *registry, uint64_t *state,
+                               uint64_t *known) {
+    memcpy(state, registry->state, registry->words * sizeof(uint64_t));
+    memcpy(known, registry->known, registry->words * sizeof(uint64_t));
+}
+
+const char *channel_registry_description(const channel_registry_t *registry, unsigned channel) {
+    return registry->descriptions[(registry->count > channel) ? registry->info[channel].description
+                                                              : 0];
+}
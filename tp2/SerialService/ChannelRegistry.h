@@ -0,0 +1,119 @@
+/**
+ * @brief Serial service channel registry: output states and metadata of every lamp
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - The registry owns the requested state of channels 0 to count - 1 (lamp N is channel N - 1),
+ *   from a handful of lamps up to CHANNEL_REGISTRY_MAX. States are a bitset, one bit per channel,
+ *   with a second bitset for the channels whose state is known: 64k channels take 16 KiB, a
+ *   snapshot is a copy of both.
+ * - Bulk operations (a range, every channel off) work a 64 bit word at a time: each word of the
+ *   range is masked, compared and written once, and the channels whose state changed come back
+ *   as a bitset, so the caller only forwards those. Cost is O(words + changes), not O(channels).
+ * - Metadata (type, description) is only read to list the devices, it lives in a separate cold
+ *   array (4 bytes per channel) so the hot bitsets stay compact. Descriptions are shared
+ *   strings, indexed from the cold array. A metadata file sets them, one line per channel or
+ *   range: "first[-last],type,description" with lamps numbered from 1, e.g.
+ *   "1-1000,0,Luz Living". Channels not in the file are type 0 lamps, "Luz Living".
+ *
+ */
+
+#ifndef CHANNEL_REGISTRY_H
+#define CHANNEL_REGISTRY_H
+
+#include "BinaryProtocol.h" // BINARY_CHANNEL_MAX
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+#define CHANNEL_REGISTRY_MAX (BINARY_CHANNEL_MAX + 1)       /*!> Channels a registry can hold */
+#define CHANNEL_REGISTRY_WORDS(count) (((count) + 63) / 64) /*!> Bitset words of count channels */
+#define CHANNEL_DESCRIPTIONS_MAX 65536                      /*!> Distinct descriptions */
+
+/**
+ * @brief Channel types, as the web shows them
+ */
+typedef enum {
+    CHANNEL_LAMP = 0,  /*!> Lamp */
+    CHANNEL_BLIND = 1, /*!> Window blind */
+} channel_type_t;
+
+/**
+ * @brief Channel metadata, cold
+ */
+typedef struct {
+    uint8_t type;         /*!> channel_type_t */
+    uint16_t description; /*!> Index in the registry descriptions */
+} channel_info_t;
+
+/**
+ * @brief Registry state
+ */
+typedef struct {
+    unsigned count;             /*!> Channels, 0 to count - 1 */
+    size_t words;               /*!> Length of the bitsets */
+    uint64_t *state;            /*!> Requested state, bit per channel */
+    uint64_t *known;            /*!> State was requested or restored, bit per channel */
+    channel_info_t *info;       /*!> Metadata per channel */
+    char **descriptions;        /*!> Shared descriptions, 0 is the default */
+    unsigned description_count; /*!> Length of descriptions */
+    unsigned long updates;      /*!> Single channel updates */
+    unsigned long bulk;         /*!> Range updates */
+    unsigned long changes;      /*!> Channels whose state changed */
+} channel_registry_t;
+
+/**
+ * @brief Allocate a registry of count channels, every state unknown
+ * @retval 0 on success, -1 on error (count out of range or no memory)
+ */
+int channel_registry_init(channel_registry_t *registry, unsigned count);
+
+/**
+ * @brief Free the registry
+ */
+void channel_registry_free(channel_registry_t *registry);
+
+/**
+ * @brief Read channel metadata from a file, see the format above
+ * @retval 0 on success, -1 on error (errno set, EINVAL for a malformed line)
+ */
+int channel_registry_load(channel_registry_t *registry, const char *path);
+
+/**
+ * @brief State of a channel
+ * @retval 0 or 1, -1 if unknown or out of range
+ */
+int channel_registry_get(const channel_registry_t *registry, unsigned channel);
+
+/**
+ * @brief Set the state of a channel
+ * @retval true if the state changed (or was unknown), false otherwise or out of range
+ */
+bool channel_registry_set(channel_registry_t *registry, unsigned channel, int value);
+
+/**
+ * @brief Set the state of channels first to last, both included (clipped to the registry)
+ * @param changed Bitset of registry->words words, bits of the channels that changed are set,
+ *                the others cleared. NULL if not needed.
+ * @retval Channels that changed
+ */
+size_t channel_registry_set_range(channel_registry_t *registry, unsigned first, unsigned last,
+                                  int value, uint64_t *changed);
+
+/**
+ * @brief Next channel set in a bitset
+ * @retval First channel from from to end - 1 with its bit set, end if none
+ */
+unsigned channel_registry_next(const uint64_t *bits, unsigned from, unsigned end);
+
+/**
+ * @brief Copy the state and known bitsets, registry->words words each
+ */
+void channel_registry_snapshot(const channel_registry_t *registry, uint64_t *state,
+                               uint64_t *known);
+
+/**
+ * @brief Description of a channel
+ */
+const char *channel_registry_description(const channel_registry_t *registry, unsigned channel);
+
+#endif /* CHANNEL_REGISTRY_H */
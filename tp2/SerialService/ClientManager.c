@@ -0,0 +1,165 @@
+/**
+ * @brief Serial service TCP clients with non-blocking bounded send queues
+ * @author Gonzalo G. Fernandez
+ *
+ */
+
+#define _GNU_SOURCE // memrchr
+
+#include "ClientManager.h"
+#include <errno.h>      // errno
+#include <stdlib.h>     // malloc, free
+#include <string.h>     // memcpy, memrchr
+#include <sys/socket.h> // send
+#include <sys/uio.h>    // writev
+#include <unistd.h>     // close
+
+client_t *client_create(int fd) {
+    client_t *client = malloc(sizeof(client_t));
+
+    if (NULL == client)
+        return NULL;
+    client->fd = fd;
+    client->state = CLIENT_OPEN;
+    client->index = -1;
+    client->head = 0;
+    client->count = 0;
+    client->sent = 0;
+    client->dropped = 0;
+    client->waiting = false;
+    frame_parser_init(&client->parser);
+    binary_parser_init(&client->binary_parser);
+    client->binary = false;
+    client->bytes = 0;
+    client->latency = NULL;
+    return client;
+}
+
+void client_destroy(client_t *client) {
+    close(client->fd);
+    free(client);
+}
+
+bool client_pending(const client_t *client) { return 0 < client->count; }
+
+/**
+ * @brief Data stamped at stamp is fully handed to the socket
+ */
+static void client_sent(client_t *client, uint64_t stamp) {
+    if (0 != stamp && NULL != client->latency)
+        metrics_histogram_add(client->latency, metrics_now() - stamp);
+}
+
+/**
+ * @brief Make room for one message in a full queue
+ * @note The oldest message may be half sent, it is kept so the stream stays frame aligned
+ */
+static void client_drop_oldest(client_t *client) {
+    unsigned next = (client->head + 1) % CLIENT_QUEUE_DEPTH;
+
+    if (0 < client->sent) // keep the half sent message in place of the next one
+        memcpy(&client->queue[next], &client->queue[client->head], sizeof(client_msg_t));
+    client->head = next;
+    client->count--;
+    client->dropped++;
+}
+
+/**
+ * @brief Append a message to the queue
+ * @retval 0 on success, -1 if the queue is full and the client must be disconnected
+ */
+static int client_enqueue(client_t *client, const char *data, size_t len, uint64_t stamp,
+                          client_overflow_t policy) {
+    while (0 < len) {
+        size_t chunk = (len < CLIENT_MSG_SIZE) ? len : CLIENT_MSG_SIZE;
+        const char *cut;
+        client_msg_t *msg;
+
+        // Whole frames per message when the data does not fit in one
+        if (chunk < len && NULL != (cut = memrchr(data, '\n', chunk)))
+            chunk = cut + 1 - data;
+
+        if (CLIENT_QUEUE_DEPTH == client->count) {
+            if (CLIENT_DISCONNECT == policy)
+                return -1;
+            client_drop_oldest(client);
+        }
+        msg = &client->queue[(client->head + client->count) % CLIENT_QUEUE_DEPTH];
+        memcpy(msg->data, data, chunk);
+        msg->len = chunk;
+        msg->stamp = (chunk == len) ? stamp : 0;
+        client->count++;
+        data += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/**
+ * @brief Pop the queued messages fully written, remember how much of the next one was
+ */
+static void client_consume(client_t *client, size_t written) {
+    client->bytes += written;
+    written += client->sent;
+    while (0 < client->count && written >= client->queue[client->head].len) {
+        written -= client->queue[client->head].len;
+        client_sent(client, client->queue[client->head].stamp);
+        client->head = (client->head + 1) % CLIENT_QUEUE_DEPTH;
+        client->count--;
+    }
+    client->sent = written;
+}
+
+int client_send(client_t *client, const char *data, size_t len, uint64_t stamp,
+                client_overflow_t policy) {
+    ssize_t written = 0;
+
+    // Keep the order: only write directly when nothing is waiting
+    if (0 == client->count) {
+        written = send(client->fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (0 > written) {
+            if (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)
+                return -1;
+            written = 0;
+        }
+        if ((size_t)written == len) {
+            client->bytes += written;
+            client_sent(client, stamp);
+            return 0;
+        }
+    }
+
+    // Queue the whole message, a partial send is accounted as sent bytes of its head so the
+    // overflow policy never drops the rest of a frame already on the wire
+    if (0 > client_enqueue(client, data, len, stamp, policy))
+        return -1;
+    client_consume(client, written);
+    return 0;
+}
+
+int client_flush(client_t *client) {
+    struct iovec iov[CLIENT_QUEUE_DEPTH];
+    ssize_t written;
+
+    while (0 < client->count) {
+        for (unsigned i = 0; i < client->count; i++) {
+            client_msg_t *msg = &client->queue[(client->head + i) % CLIENT_QUEUE_DEPTH];
+            iov[i].iov_base = msg->data;
+            iov[i].iov_len = msg->len;
+        }
+        iov[0].iov_base = (char *)iov[0].iov_base + client->sent;
+        iov[0].iov_len -= client->sent;
+
+        written = writev(client->fd, iov, client->count);
+        if (0 > written) {
+            if (EINTR == errno)
+                continue;
+            if (EAGAIN == errno || EWOULDBLOCK == errno)
+                return 0;
+            return -1;
+        }
+
+        client_consume(client, written);
+    }
+    return 0;
+}
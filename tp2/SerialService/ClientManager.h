@@ -0,0 +1,104 @@
+/**
+ * @brief Serial service TCP clients with non-blocking bounded send queues
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Data for a client is sent right away when its socket has room. What does not fit is queued
+ *   and written when the socket becomes writable, so a slow client never blocks the others.
+ * - Each queue holds up to CLIENT_QUEUE_DEPTH messages. When it is full the overflow policy
+ *   either drops the oldest queued message or asks the caller to disconnect the client. Data is
+ *   queued in messages cut after a '\n', so dropping one never leaves half a frame behind.
+ * - The time from the data receive stamp to the moment its last byte is handed to the socket is
+ *   added to the client latency histogram, if any.
+ *
+ */
+
+#ifndef CLIENT_MANAGER_H
+#define CLIENT_MANAGER_H
+
+#include "BinaryProtocol.h"
+#include "FrameParser.h"
+#include "Metrics.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CLIENT_MSG_SIZE 128   /*!> Max bytes per queued message */
+#define CLIENT_QUEUE_DEPTH 64 /*!> Messages queued per client before overflow */
+
+/**
+ * @brief What to do when a client send queue is full
+ */
+typedef enum {
+    CLIENT_DROP_OLDEST, /*!> Drop the oldest message not yet being sent */
+    CLIENT_DISCONNECT,  /*!> Disconnect the slow client */
+} client_overflow_t;
+
+/**
+ * @brief Client connection lifecycle
+ */
+typedef enum {
+    CLIENT_OPEN,    /*!> In the event loop, read and written */
+    CLIENT_CLOSING, /*!> Out of the event loop, the fd is closed at a safe point */
+} client_state_t;
+
+/**
+ * @brief Queued message
+ */
+typedef struct {
+    size_t len;                 /*!> Message length */
+    char data[CLIENT_MSG_SIZE]; /*!> Message bytes */
+    uint64_t stamp;             /*!> Receive time of the data (ns), last message of a send only */
+} client_msg_t;
+
+/**
+ * @brief Client connection
+ */
+typedef struct {
+    int fd;                                 /*!> Connection socket, non-blocking */
+    client_state_t state;                   /*!> Lifecycle state */
+    int index;                              /*!> Position in the caller client list */
+    client_msg_t queue[CLIENT_QUEUE_DEPTH]; /*!> Messages waiting for the socket */
+    unsigned head;                          /*!> Oldest queued message */
+    unsigned count;                         /*!> Queued messages */
+    size_t sent;                            /*!> Bytes of the oldest message already sent */
+    unsigned long dropped;                  /*!> Messages dropped by the overflow policy */
+    bool waiting;                           /*!> Caller waits for the socket to be writable */
+    frame_parser_t parser;                  /*!> Frames received from the client */
+    binary_parser_t binary_parser;          /*!> Frames received after binary negotiation */
+    bool binary;                            /*!> Client negotiated the binary protocol */
+    unsigned long bytes;                    /*!> Bytes handed to the socket */
+    metrics_histogram_t *latency;           /*!> Send latency histogram, NULL for none */
+} client_t;
+
+/**
+ * @brief Allocate a client for an accepted connection
+ * @retval Client, NULL on error
+ */
+client_t *client_create(int fd);
+
+/**
+ * @brief Close the connection and free the client
+ */
+void client_destroy(client_t *client);
+
+/**
+ * @brief Send data to a client, queuing what the socket does not take
+ * @param stamp Receive time of the data (ns) for the latency histogram, 0 for none
+ * @param policy Overflow policy when the queue is full
+ * @retval 0 on success (sent, queued or dropped), -1 if the client must be disconnected
+ */
+int client_send(client_t *client, const char *data, size_t len, uint64_t stamp,
+                client_overflow_t policy);
+
+/**
+ * @brief Write queued messages, the socket is writable
+ * @retval 0 on success, -1 if the client must be disconnected
+ */
+int client_flush(client_t *client);
+
+/**
+ * @brief Client has queued messages, wait for the socket to be writable
+ */
+bool client_pending(const client_t *client);
+
+#endif /* CLIENT_MANAGER_H */
@@ -0,0 +1,138 @@
+/**
+ * @brief Serial service bridge to the lamp state files (/tmp/outN.txt)
+ * @author Gonzalo G. Fernandez
+ *
+ */
+
+#include "FileBridge.h"
+#include <errno.h>       // errno
+#include <fcntl.h>       // open
+#include <stdbool.h>
+#include <stdio.h>       // snprintf, sscanf, rename
+#include <stdlib.h>      // free
+#include <string.h>      // memset, strdup
+#include <sys/inotify.h> // inotify_init1, inotify_add_watch
+#include <unistd.h>      // read, close
+
+/**
+ * @brief Lamp number of a file name
+ * @retval 1 to FILE_BRIDGE_LAMPS, 0 for any other file (temporary files included)
+ */
+static unsigned file_bridge_lamp(const char *name) {
+    unsigned lamp;
+    int end = 0;
+
+    if (1 != sscanf(name, "out%u.txt%n", &lamp, &end) || 0 == end || '\0' != name[end])
+        return 0;
+    return (1 <= lamp && FILE_BRIDGE_LAMPS >= lamp) ? lamp : 0;
+}
+
+int file_bridge_open(file_bridge_t *bridge, const char *dir) {
+    *bridge = (file_bridge_t){.fd = -1};
+    memset(bridge->forwarded, -1, sizeof(bridge->forwarded));
+    bridge->dir = strdup(dir);
+    if (NULL == bridge->dir)
+        return -1;
+    bridge->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    // Written files are read once closed, renamed ones once in place
+    if (0 > bridge->fd || 0 > inotify_add_watch(bridge->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        file_bridge_close(bridge);
+        return -1;
+    }
+    bridge->dirty = ~0ULL; // Existing files
+    return bridge->fd;
+}
+
+void file_bridge_close(file_bridge_t *bridge) {
+    if (0 <= bridge->fd)
+        close(bridge->fd);
+    free(bridge->dir);
+    bridge->dir = NULL;
+    bridge->fd = -1;
+}
+
+/**
+ * @brief Mark the files of the pending inotify events as changed
+ */
+static void file_bridge_events(file_bridge_t *bridge) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while (0 < (len = read(bridge->fd, buffer, sizeof(buffer)))) {
+        for (char *p = buffer; p < buffer + len;) {
+            struct inotify_event *event = (struct inotify_event *)p;
+            unsigned lamp = (0 < event->len) ? file_bridge_lamp(event->name) : 0;
+            if (event->mask & IN_Q_OVERFLOW) { // Events lost, read every file again
+                bridge->dirty = ~0ULL;
+            } else if (0 < lamp) {
+                bridge->dirty |= 1ULL << (lamp - 1);
+                bridge->events++;
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+/**
+ * @brief State in a lamp file
+ * @retval 0 or 1, -1 if missing or not a state
+ */
+static int file_bridge_state(const file_bridge_t *bridge, unsigned lamp) {
+    char path[4096], state;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/out%u.txt", bridge->dir, lamp);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (0 > fd)
+        return -1;
+    if (1 != read(fd, &state, 1))
+        state = '\0';
+    close(fd);
+    return ('0' == state || '1' == state) ? state - '0' : -1;
+}
+
+size_t file_bridge_read(file_bridge_t *bridge, frame_t *updates, size_t max) {
+    size_t count = 0;
+
+    file_bridge_events(bridge);
+    for (unsigned lamp = 1; lamp <= FILE_BRIDGE_LAMPS && count < max && bridge->dirty; lamp++) {
+        int value;
+        if (!(bridge->dirty & (1ULL << (lamp - 1))))
+            continue;
+        bridge->dirty &= ~(1ULL << (lamp - 1));
+        value = file_bridge_state(bridge, lamp);
+        if (0 > value || value == bridge->forwarded[lamp - 1])
+            continue;
+        bridge->forwarded[lamp - 1] = value;
+        updates[count++] = (frame_t){.type = FRAME_OUT, .channel = lamp - 1, .value = value};
+        bridge->updates++;
+    }
+    return count;
+}
+
+int file_bridge_write(file_bridge_t *bridge, unsigned channel, int value) {
+    char path[4096], tmp[4096 + 4];
+    bool written;
+    int fd;
+
+    if (FILE_BRIDGE_LAMPS <= channel)
+        return -1;
+    snprintf(path, sizeof(path), "%s/out%u.txt", bridge->dir, channel + 1);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (0 > fd) {
+        bridge->errors++;
+        return -1;
+    }
+    written = 1 == write(fd, value ? "1" : "0", 1);
+    written = 0 == close(fd) && written;
+    if (!written || 0 > rename(tmp, path)) {
+        int error = errno;
+        unlink(tmp);
+        bridge->errors++;
+        errno = error;
+        return -1;
+    }
+    bridge->writes++;
+    return 0;
+}
@@ -0,0 +1,65 @@
+/**
+ * @brief Serial service bridge to the lamp state files (/tmp/outN.txt)
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - The web and lampShim (see LampTable.h) keep the state of lamp N in the file outN.txt of a
+ *   directory, "1" or "0". The bridge watches the directory with inotify: a file closed after a
+ *   write or renamed into place is read at once and its state becomes an output update of
+ *   channel N - 1, as the InterfaceService polling loop did once a second.
+ * - Switch updates go the other way: switch X writes its state to out(X + 1).txt, written aside
+ *   and renamed over the old file so readers never see it empty. The bridge reads that change
+ *   back like any other, so a switch drives its lamp as with InterfaceService.
+ * - Only changes are forwarded: each file remembers the last state it forwarded. A file that is
+ *   not "0" or "1" (being written without rename) is skipped until its next write.
+ *
+ */
+
+#ifndef FILE_BRIDGE_H
+#define FILE_BRIDGE_H
+
+#include "FrameParser.h"
+#include <stddef.h> // size_t
+#include <stdint.h> // int8_t
+
+#define FILE_BRIDGE_LAMPS 64 /*!> Files watched, out1.txt to out64.txt */
+
+/**
+ * @brief Bridge state
+ */
+typedef struct {
+    char *dir;                           /*!> Directory of the files */
+    int fd;                              /*!> inotify file descriptor, -1 when closed */
+    int8_t forwarded[FILE_BRIDGE_LAMPS]; /*!> Last state forwarded per file, -1 none */
+    uint64_t dirty;                      /*!> Files changed since the last read, bit per file */
+    unsigned long events;                /*!> File changes notified */
+    unsigned long updates;               /*!> Output updates forwarded */
+    unsigned long writes;                /*!> Switch states written */
+    unsigned long errors;                /*!> Files that could not be written */
+} file_bridge_t;
+
+/**
+ * @brief Start watching a directory, every existing file is read by the next file_bridge_read
+ * @retval inotify fd (non-blocking, for the event loop), -1 on error (errno set)
+ */
+int file_bridge_open(file_bridge_t *bridge, const char *dir);
+
+/**
+ * @brief Stop watching
+ */
+void file_bridge_close(file_bridge_t *bridge);
+
+/**
+ * @brief Read the pending file changes
+ * @param updates Output updates (FRAME_OUT) of the files that changed state
+ * @param max Length of updates, files left are read on the next call
+ * @retval Updates written to updates
+ */
+size_t file_bridge_read(file_bridge_t *bridge, frame_t *updates, size_t max);
+
+/**
+ * @brief Write a switch state to the file of its lamp
+ * @retval 0 on success, -1 on error or channel without file
+ */
+int file_bridge_write(file_bridge_t *bridge, unsigned channel, int value);
+
+#endif /* FILE_BRIDGE_H */
@@ -0,0 +1,166 @@
+/**
+ * @brief Serial service incremental parser for the serial and TCP frames
+ * @author Gonzalo G. Fernandez
+ *
+ */
+
+#include "FrameParser.h"
+#include <string.h> // memchr
+
+/**
+ * @brief Position in the frame grammar ">TAG:X,Y\r\n"
+ */
+enum {
+    PARSE_IDLE,    /*!> Waiting for '>' */
+    PARSE_TAG,     /*!> "OUT:" or "SW:" */
+    PARSE_CHANNEL, /*!> Channel digits up to ',' */
+    PARSE_VALUE,   /*!> '0' or '1' */
+    PARSE_CR,      /*!> '\r' or '\n' */
+    PARSE_LF,      /*!> '\n' */
+};
+
+static const char frame_tags[][5] = {"OUT:", "SW:", "BIN:"}; /*!> Tags by frame_type_t */
+
+void frame_parser_init(frame_parser_t *parser) {
+    parser->state = PARSE_IDLE;
+    parser->len = 0;
+    parser->digits = 0;
+    parser->stopped = false;
+    parser->frame.stamp = 0;
+    parser->frames = 0;
+    parser->errors = 0;
+    parser->skipped = 0;
+}
+
+/**
+ * @brief Start a frame on '>'
+ */
+static void frame_parser_start(frame_parser_t *parser) {
+    parser->state = PARSE_TAG;
+    parser->buffer[0] = FRAME_START;
+    parser->len = 1;
+    parser->frame.channel = 0;
+    parser->digits = 0;
+}
+
+/**
+ * @brief Drop the frame being parsed, byte c does not fit the grammar
+ */
+static void frame_parser_error(frame_parser_t *parser, char c) {
+    parser->errors++;
+    if (FRAME_START == c) {
+        frame_parser_start(parser);
+    } else {
+        parser->state = PARSE_IDLE;
+        parser->skipped++;
+    }
+}
+
+void frame_parser_stop(frame_parser_t *parser) { parser->stopped = true; }
+
+size_t frame_parser_feed(frame_parser_t *parser, const char *data, size_t len,
+                         frame_handler_t handler, void *ctx) {
+    const char *begin = data, *end = data + len;
+
+    while (data < end && !parser->stopped) {
+        char c;
+
+        // Outside a frame: jump to the next start byte
+        if (PARSE_IDLE == parser->state) {
+            const char *start = memchr(data, FRAME_START, end - data);
+            if (NULL == start) {
+                parser->skipped += end - data;
+                break;
+            }
+            parser->skipped += start - data;
+            frame_parser_start(parser);
+            data = start + 1;
+            continue;
+        }
+
+        c = *data++;
+        switch (parser->state) {
+        case PARSE_TAG:
+            if (1 == parser->len) { // First tag letter selects the frame type
+                if ('O' == c)
+                    parser->frame.type = FRAME_OUT;
+                else if ('S' == c)
+                    parser->frame.type = FRAME_SW;
+                else if ('B' == c)
+                    parser->frame.type = FRAME_BIN;
+                else {
+                    frame_parser_error(parser, c);
+                    continue;
+                }
+            } else if (c != frame_tags[parser->frame.type][parser->len - 1]) {
+                frame_parser_error(parser, c);
+                continue;
+            }
+            if (':' == c)
+                parser->state = PARSE_CHANNEL;
+            break;
+        case PARSE_CHANNEL:
+            if ('0' <= c && '9' >= c && FRAME_CHANNEL_DIGITS > parser->digits) {
+                parser->frame.channel = parser->frame.channel * 10 + (c - '0');
+                parser->digits++;
+            } else if (',' == c && 0 < parser->digits) {
+                parser->state = PARSE_VALUE;
+            } else {
+                frame_parser_error(parser, c);
+                continue;
+            }
+            break;
+        case PARSE_VALUE:
+            if ('0' != c && '1' != c) {
+                frame_parser_error(parser, c);
+                continue;
+            }
+            parser->frame.value = c - '0';
+            parser->state = PARSE_CR;
+            break;
+        case PARSE_CR:
+            if ('\r' == c) {
+                parser->state = PARSE_LF;
+                break;
+            }
+            // Bare '\n' terminator
+            // fall through
+        case PARSE_LF:
+            if ('\n' != c) {
+                frame_parser_error(parser, c);
+                continue;
+            }
+            parser->buffer[parser->len++] = c;
+            parser->frame.data = parser->buffer;
+            parser->frame.len = parser->len;
+            parser->state = PARSE_IDLE;
+            parser->frames++;
+            handler(&parser->frame, ctx);
+            continue;
+        }
+        parser->buffer[parser->len++] = c;
+    }
+    return data - begin;
+}
+
+size_t frame_encode(const frame_t *frame, char *out) {
+    char digits[FRAME_CHANNEL_DIGITS + 1];
+    const char *tag = frame_tags[frame->type];
+    unsigned channel = frame->channel;
+    size_t len = 0, n = 0;
+
+    out[len++] = FRAME_START;
+    while ('\0' != *tag)
+        out[len++] = *tag++;
+    do {
+        digits[n++] = '0' + channel % 10;
+        channel /= 10;
+    } while (0 < channel && n < sizeof(digits));
+    while (0 < n)
+        out[len++] = digits[--n];
+    out[len++] = ',';
+    out[len++] = '0' + frame->value;
+    out[len++] = '\r';
+    out[len++] = '\n';
+    return len;
+}
@@ -0,0 +1,100 @@
+/**
+ * @brief Serial service incremental parser for the serial and TCP frames
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Frames: ">OUT:X,Y\r\n" (set output X to Y), ">SW:X,Y\r\n" (switch X pressed, new state Y)
+ *   and ">BIN:X,Y\r\n" (binary protocol version X negotiation, see BinaryProtocol.h). X is a
+ *   decimal number of up to FRAME_CHANNEL_DIGITS digits, Y is 0 or 1. A bare "\n" is accepted
+ *   as terminator.
+ * - The handler can stop the parser (frame_parser_stop) when the rest of the stream is not in
+ *   this protocol any more, e.g. after a binary protocol negotiation.
+ * - A single read can hold several frames, and a frame can be split across reads. The parser
+ *   keeps the incomplete frame between calls.
+ * - Any byte that does not fit the frame grammar drops the frame being parsed (counted as an
+ *   error) and the parser resyncs on the next '>', so garbage never reaches the peers.
+ *
+ */
+
+#ifndef FRAME_PARSER_H
+#define FRAME_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+#define FRAME_START '>'        /*!> First byte of every frame */
+#define FRAME_CHANNEL_DIGITS 6 /*!> Max digits of a channel number, -L goes up to 524288 */
+#define FRAME_MAX_SIZE 16      /*!> Longest frame: ">OUT:" 6 digits ",Y\r\n" */
+
+/**
+ * @brief Frame types
+ */
+typedef enum {
+    FRAME_OUT, /*!> ">OUT:X,Y", set output, client to serial */
+    FRAME_SW,  /*!> ">SW:X,Y", switch event, serial to client */
+    FRAME_BIN, /*!> ">BIN:X,Y", binary protocol negotiation */
+} frame_type_t;
+
+/**
+ * @brief Validated frame
+ */
+typedef struct {
+    frame_type_t type; /*!> Frame type */
+    unsigned channel;  /*!> Channel number X */
+    int value;         /*!> State Y, 0 or 1 */
+    const char *data;  /*!> Frame bytes, terminator included */
+    size_t len;        /*!> Length of data */
+    uint64_t stamp;    /*!> Receive time (ns), set by the service, 0 from the parsers */
+} frame_t;
+
+/**
+ * @brief Callback for every complete frame
+ * @param frame Frame, valid only during the call
+ * @param ctx User context given to frame_parser_feed
+ */
+typedef void (*frame_handler_t)(const frame_t *frame, void *ctx);
+
+/**
+ * @brief Incremental parser state
+ */
+typedef struct {
+    int state;                   /*!> Position in the frame grammar */
+    char buffer[FRAME_MAX_SIZE]; /*!> Frame being parsed */
+    size_t len;                  /*!> Bytes held in buffer */
+    frame_t frame;               /*!> Fields parsed so far */
+    unsigned digits;             /*!> Channel digits parsed */
+    bool stopped;                /*!> Handler stopped the parser */
+    unsigned long frames;        /*!> Frames delivered to the handler */
+    unsigned long errors;        /*!> Frames dropped, not matching the grammar */
+    unsigned long skipped;       /*!> Bytes outside any frame */
+} frame_parser_t;
+
+/**
+ * @brief Initialize parser state
+ */
+void frame_parser_init(frame_parser_t *parser);
+
+/**
+ * @brief Feed a chunk of the byte stream into the parser
+ * @param data Bytes read from the serial port or a client
+ * @param len Number of bytes in data
+ * @param handler Called once per valid frame, in stream order
+ * @param ctx User context for the handler
+ * @retval Bytes consumed, less than len only if the handler stopped the parser
+ */
+size_t frame_parser_feed(frame_parser_t *parser, const char *data, size_t len,
+                         frame_handler_t handler, void *ctx);
+
+/**
+ * @brief Stop the parser from a handler, frame_parser_feed returns after the current frame
+ */
+void frame_parser_stop(frame_parser_t *parser);
+
+/**
+ * @brief Write a frame in ASCII
+ * @param out Output, room for FRAME_MAX_SIZE bytes
+ * @retval Bytes written
+ */
+size_t frame_encode(const frame_t *frame, char *out);
+
+#endif /* FRAME_PARSER_H */
@@ -0,0 +1,340 @@
+/**
+ * @brief Serial service HTTP connections: request parsing, responses and event streams
+ * @author Gonzalo G. Fernandez
+ *
+ */
+
+#define _GNU_SOURCE // memmem, strncasecmp
+
+#include "HttpServer.h"
+#include <errno.h>    // errno
+#include <fcntl.h>    // open
+#include <stdio.h>    // snprintf
+#include <stdlib.h>   // malloc, free, strtoul
+#include <string.h>   // memcpy, memmem, strchr
+#include <strings.h>  // strncasecmp
+#include <sys/stat.h> // fstat
+#include <sys/uio.h>  // writev
+#include <unistd.h>   // read, close
+
+#define HTTP_OUT_KEEP 65536 /*!> Output buffer kept once drained, larger ones are freed */
+
+http_conn_t *http_conn_create(int fd) {
+    http_conn_t *conn = calloc(1, sizeof(http_conn_t));
+
+    if (NULL == conn)
+        return NULL;
+    conn->fd = fd;
+    conn->index = -1;
+    return conn;
+}
+
+void http_conn_destroy(http_conn_t *conn) {
+    close(conn->fd);
+    metrics_text_free(&conn->out);
+    free(conn);
+}
+
+bool http_conn_pending(const http_conn_t *conn) { return conn->out_sent < conn->out.len; }
+
+int http_conn_read(http_conn_t *conn) {
+    ssize_t len;
+
+    while (conn->in_len < HTTP_REQUEST_MAX) {
+        len = read(conn->fd, conn->in + conn->in_len, HTTP_REQUEST_MAX - conn->in_len);
+        if (0 < len) {
+            conn->in_len += len;
+            continue;
+        }
+        if (0 > len && (EAGAIN == errno || EINTR == errno))
+            return 0;
+        return -1; // Closed by the peer, or failed
+    }
+    return 0;
+}
+
+/**
+ * @brief Header line value, if the line is that header
+ * @retval Value without leading blanks, NULL for another header
+ */
+static const char *http_header(const char *line, const char *name) {
+    size_t len = strlen(name);
+
+    if (0 != strncasecmp(line, name, len) || ':' != line[len])
+        return NULL;
+    line += len + 1;
+    while (' ' == *line || '\t' == *line)
+        line++;
+    return line;
+}
+
+int http_request_parse(http_conn_t *conn, http_request_t *request) {
+    char *end, *line, *next, *target, *version, *query;
+    unsigned long content_length = 0;
+    int connection = 0; // Connection header: 1 keep-alive, -1 close, 0 none
+    size_t head_len;
+
+    conn->in[conn->in_len] = '\0';
+    end = memmem(conn->in, conn->in_len, "\r\n\r\n", 4);
+    if (NULL == end)
+        return (HTTP_REQUEST_MAX == conn->in_len) ? -1 : 0;
+    head_len = end + 4 - conn->in;
+    *request = (http_request_t){.query = ""};
+
+    // Headers the service cares about, the request line is the first one
+    *end = '\0';
+    line = strstr(conn->in, "\r\n");
+    for (line = (NULL != line) ? line + 2 : end; line < end; line = next + 2) {
+        const char *value;
+        next = strstr(line, "\r\n");
+        if (NULL == next)
+            next = end; // Last header, ended by the "\r\n\r\n" cut
+        *next = '\0';
+        if (NULL != (value = http_header(line, "Content-Length"))) {
+            content_length = strtoul(value, NULL, 10);
+        } else if (NULL != (value = http_header(line, "Connection"))) {
+            if (0 == strncasecmp(value, "close", 5))
+                connection = -1;
+            else if (0 == strncasecmp(value, "keep-alive", 10))
+                connection = 1;
+        } else if (NULL != (value = http_header(line, "Content-Type"))) {
+            request->form = 0 == strncasecmp(value, "application/x-www-form-urlencoded", 33);
+        }
+        *next = '\r';
+    }
+    *end = '\r';
+    if (content_length > HTTP_REQUEST_MAX - head_len)
+        return -1;
+    if (head_len + content_length > conn->in_len)
+        return 0; // Body not all here yet
+
+    // Request line: method, target and version, split in place
+    line = conn->in;
+    *strstr(line, "\r\n") = '\0';
+    target = strchr(line, ' ');
+    version = (NULL != target) ? strchr(target + 1, ' ') : NULL;
+    if (NULL == version || '/' != target[1] || 0 != strncmp(version + 1, "HTTP/1.", 7))
+        return -1;
+    *target++ = '\0';
+    *version++ = '\0';
+    request->method = (0 == strcmp(line, "GET") || 0 == strcmp(line, "HEAD")) ? HTTP_GET
+                      : (0 == strcmp(line, "POST"))                          ? HTTP_POST
+                                                                             : HTTP_OTHER;
+    request->head = 0 == strcmp(line, "HEAD");
+    // HTTP/1.0 closes unless asked otherwise, HTTP/1.1 keeps the connection
+    request->keep_alive = connection ? 0 < connection : 0 != strcmp(version, "HTTP/1.0");
+    query = strchr(target, '?');
+    if (NULL != query) {
+        *query++ = '\0';
+        request->query = query;
+    }
+    request->path = target;
+
+    request->body = conn->in + head_len;
+    request->body_len = content_length;
+    conn->request_len = head_len + content_length;
+    // The body is terminated on a copy of the next request first byte, restored when done
+    conn->next = conn->in[conn->request_len];
+    conn->in[conn->request_len] = '\0';
+    return 1;
+}
+
+void http_request_done(http_conn_t *conn) {
+    conn->in[conn->request_len] = conn->next;
+    conn->in_len -= conn->request_len;
+    memmove(conn->in, conn->in + conn->request_len, conn->in_len);
+    conn->request_len = 0;
+}
+
+static int http_hex(char c) {
+    if ('0' <= c && '9' >= c)
+        return c - '0';
+    if ('a' <= (c | 0x20) && 'f' >= (c | 0x20))
+        return (c | 0x20) - 'a' + 10;
+    return -1;
+}
+
+const char *http_param(const char *query, const char *name, char *value, size_t size) {
+    size_t len = strlen(name), i = 0;
+
+    while (NULL != query && '\0' != *query) {
+        if (0 == strncmp(query, name, len) && '=' == query[len]) {
+            for (query += len + 1; '\0' != *query && '&' != *query && i + 1 < size; query++) {
+                if ('%' == *query && 0 <= http_hex(query[1]) && 0 <= http_hex(query[2])) {
+                    value[i++] = http_hex(query[1]) << 4 | http_hex(query[2]);
+                    query += 2;
+                } else {
+                    value[i++] = ('+' == *query) ? ' ' : *query;
+                }
+            }
+            value[i] = '\0';
+            return value;
+        }
+        query = strchr(query, '&');
+        if (NULL != query)
+            query++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Append to the unsent output
+ * @retval 0 on success, -1 on allocation error
+ */
+static int http_append(http_conn_t *conn, const char *data, size_t len) {
+    metrics_text_t *out = &conn->out;
+
+    if (out->len + len > out->size) {
+        size_t size = (out->size < 4096) ? 4096 : out->size;
+        char *grown;
+        while (size < out->len + len)
+            size *= 2;
+        grown = realloc(out->data, size);
+        if (NULL == grown)
+            return -1;
+        out->data = grown;
+        out->size = size;
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+    return 0;
+}
+
+/**
+ * @brief Write header and body, appending what the socket does not take
+ * @retval 0 on success, -1 if the connection must be closed
+ */
+static int http_send(http_conn_t *conn, const char *header, size_t header_len, const char *body,
+                     size_t body_len) {
+    struct iovec iov[2] = {{(void *)header, header_len}, {(void *)body, body_len}};
+    ssize_t written = 0;
+
+    // Nothing waiting: straight to the socket, no copy
+    if (!http_conn_pending(conn)) {
+        written = writev(conn->fd, iov, 2);
+        if (0 > written) {
+            if (EAGAIN != errno && EINTR != errno)
+                return -1;
+            written = 0;
+        }
+    }
+    if ((size_t)written < header_len &&
+        0 > http_append(conn, header + written, header_len - written))
+        return -1;
+    written = ((size_t)written > header_len) ? written - (ssize_t)header_len : 0;
+    if ((size_t)written < body_len && 0 > http_append(conn, body + written, body_len - written))
+        return -1;
+    return 0;
+}
+
+static const char *http_reason(int status) {
+    switch (status) {
+    case 200:
+        return "OK";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    default:
+        return "Service Unavailable";
+    }
+}
+
+int http_respond(http_conn_t *conn, const http_request_t *request, int status, const char *type,
+                 const char *body, size_t len) {
+    bool keep_alive = NULL != request && request->keep_alive;
+    char header[256];
+    int header_len;
+
+    header_len = snprintf(header, sizeof(header),
+                          "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                          "Cache-Control: no-cache\r\nConnection: %s\r\n\r\n",
+                          status, http_reason(status), (NULL != type) ? type : "text/plain",
+                          len, keep_alive ? "keep-alive" : "close");
+    conn->requests++;
+    if (!keep_alive)
+        conn->closing = true;
+    if (NULL != request && request->head)
+        len = 0;
+    return http_send(conn, header, header_len, body, len);
+}
+
+/**
+ * @brief Content type of a file, from its extension
+ */
+static const char *http_file_type(const char *path) {
+    static const char *types[][2] = {
+        {".html", "text/html; charset=utf-8"}, {".css", "text/css"},
+        {".js", "application/javascript"},     {".json", "application/json"},
+        {".png", "image/png"},                 {".ico", "image/x-icon"},
+    };
+    const char *ext = strrchr(path, '.');
+
+    for (size_t i = 0; NULL != ext && i < sizeof(types) / sizeof(types[0]); i++) {
+        if (0 == strcmp(ext, types[i][0]))
+            return types[i][1];
+    }
+    return "application/octet-stream";
+}
+
+int http_respond_file(http_conn_t *conn, const http_request_t *request, const char *path) {
+    struct stat st;
+    char *data = NULL;
+    ssize_t len = -1;
+    int fd, ret;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (0 <= fd && 0 == fstat(fd, &st) && S_ISREG(st.st_mode) && HTTP_FILE_MAX >= st.st_size &&
+        NULL != (data = malloc(st.st_size + 1)))
+        len = read(fd, data, st.st_size);
+    if (0 <= fd)
+        close(fd);
+    if (0 > len) {
+        free(data);
+        return http_respond(conn, request, 404, NULL, "Not found\n", 10);
+    }
+    ret = http_respond(conn, request, 200, http_file_type(path), data, len);
+    free(data);
+    return ret;
+}
+
+int http_stream_start(http_conn_t *conn) {
+    static const char header[] = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                                 "Cache-Control: no-cache\r\nConnection: keep-alive\r\n\r\n"
+                                 "retry: 1000\n\n";
+
+    conn->stream = true;
+    conn->requests++;
+    return http_send(conn, header, sizeof(header) - 1, NULL, 0);
+}
+
+int http_event_format(metrics_text_t *text, const char *event, const char *data) {
+    return metrics_printf(text, "event: %s\ndata: %s\n\n", event, data);
+}
+
+int http_stream_send(http_conn_t *conn, const char *event, size_t len) {
+    if (conn->out.len - conn->out_sent > HTTP_OUTPUT_MAX)
+        return -1;
+    return http_send(conn, event, len, NULL, 0);
+}
+
+int http_conn_flush(http_conn_t *conn) {
+    ssize_t written;
+
+    while (http_conn_pending(conn)) {
+        written = write(conn->fd, conn->out.data + conn->out_sent, conn->out.len - conn->out_sent);
+        if (0 > written) {
+            if (EAGAIN == errno || EINTR == errno)
+                return 0;
+            return -1;
+        }
+        conn->out_sent += written;
+    }
+    conn->out.len = 0;
+    conn->out_sent = 0;
+    if (HTTP_OUT_KEEP < conn->out.size) // A file answer, not kept around
+        metrics_text_free(&conn->out);
+    return 0;
+}
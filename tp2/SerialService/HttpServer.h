@@ -0,0 +1,149 @@
+/**
+ * @brief Serial service HTTP connections: request parsing, responses and event streams
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Non-blocking HTTP/1.1 connections for the event loop: requests are parsed from what has
+ *   arrived (several at once when pipelined, a split one waits for the rest), responses are
+ *   written at once and what the socket does not take waits for it to be writable.
+ * - Connections are kept alive unless the client asks otherwise (HTTP/1.0 or
+ *   "Connection: close"), so a browser or a load generator does not pay a connect per request.
+ * - A connection can become a server-sent events stream (text/event-stream): it stays open and
+ *   gets one event per state change. A stream whose unsent output grows past HTTP_OUTPUT_MAX
+ *   asks the caller to close it, a stalled browser never holds the service memory.
+ * - Only what the service needs: no chunked request bodies, no ranges, requests up to
+ *   HTTP_REQUEST_MAX bytes.
+ *
+ */
+
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include "Metrics.h" // metrics_text_t
+#include <stdbool.h>
+#include <stddef.h> // size_t
+
+#define HTTP_REQUEST_MAX 8192     /*!> Request line, headers and body */
+#define HTTP_OUTPUT_MAX (1 << 20) /*!> Unsent output of a connection before it is closed */
+#define HTTP_FILE_MAX (4 << 20)   /*!> Largest static file served */
+
+/**
+ * @brief Request methods
+ */
+typedef enum {
+    HTTP_GET,   /*!> GET or HEAD */
+    HTTP_POST,  /*!> POST */
+    HTTP_OTHER, /*!> Anything else, not allowed */
+} http_method_t;
+
+/**
+ * @brief Parsed request, pointing into the connection input
+ */
+typedef struct {
+    http_method_t method; /*!> Method */
+    bool head;            /*!> HEAD request, the response has no body */
+    const char *path;     /*!> Path without the query, '\0' terminated */
+    const char *query;    /*!> Query string without '?', "" if none */
+    const char *body;     /*!> Body, '\0' terminated */
+    size_t body_len;      /*!> Length of body */
+    bool form;            /*!> Body is application/x-www-form-urlencoded */
+    bool keep_alive;      /*!> Connection stays open after the response */
+} http_request_t;
+
+/**
+ * @brief HTTP connection
+ */
+typedef struct {
+    int fd;                        /*!> Connection socket, non-blocking */
+    char in[HTTP_REQUEST_MAX + 1]; /*!> Received bytes not yet handled */
+    size_t in_len;                 /*!> Length of in */
+    size_t request_len;            /*!> Bytes of in taken by the parsed request */
+    char next;                     /*!> Byte after the parsed request, see HttpServer.c */
+    metrics_text_t out;            /*!> Output the socket did not take yet */
+    size_t out_sent;               /*!> Bytes of out already written */
+    bool stream;                   /*!> Server-sent events stream */
+    bool closing;                  /*!> Close once the output is written */
+    bool waiting;                  /*!> Caller waits for the socket to be writable */
+    int index;                     /*!> Position in the caller stream list, -1 for none */
+    unsigned long requests;        /*!> Requests answered */
+} http_conn_t;
+
+/**
+ * @brief Allocate a connection for an accepted socket
+ * @retval Connection, NULL on error
+ */
+http_conn_t *http_conn_create(int fd);
+
+/**
+ * @brief Close the socket and free the connection
+ */
+void http_conn_destroy(http_conn_t *conn);
+
+/**
+ * @brief Read what the socket has
+ * @retval 0 on success, -1 if the peer closed or the connection failed
+ */
+int http_conn_read(http_conn_t *conn);
+
+/**
+ * @brief Parse the next complete request of the input
+ * @retval 1 if parsed (call http_request_done once answered), 0 if incomplete, -1 if malformed
+ *         or too long (the connection must be answered 400 and closed)
+ */
+int http_request_parse(http_conn_t *conn, http_request_t *request);
+
+/**
+ * @brief Drop the answered request from the input
+ */
+void http_request_done(http_conn_t *conn);
+
+/**
+ * @brief Value of a parameter in a query string or form body, URL decoded
+ * @retval value, NULL if missing
+ */
+const char *http_param(const char *query, const char *name, char *value, size_t size);
+
+/**
+ * @brief Answer a request
+ * @param type Content type, NULL for text/plain
+ * @retval 0 on success, -1 if the connection must be closed
+ */
+int http_respond(http_conn_t *conn, const http_request_t *request, int status, const char *type,
+                 const char *body, size_t len);
+
+/**
+ * @brief Answer a request with a file, 404 if missing
+ * @retval 0 on success, -1 if the connection must be closed
+ */
+int http_respond_file(http_conn_t *conn, const http_request_t *request, const char *path);
+
+/**
+ * @brief Answer a request with the head of a server-sent events stream
+ * @retval 0 on success, -1 if the connection must be closed
+ */
+int http_stream_start(http_conn_t *conn);
+
+/**
+ * @brief Format a server-sent event, once for every stream
+ * @param data Event data, a single line
+ * @retval 0 on success, -1 on allocation error
+ */
+int http_event_format(metrics_text_t *text, const char *event, const char *data);
+
+/**
+ * @brief Send a formatted event on a stream
+ * @retval 0 on success, -1 if the stream must be closed (too much unsent output)
+ */
+int http_stream_send(http_conn_t *conn, const char *event, size_t len);
+
+/**
+ * @brief Write the pending output, the socket is writable
+ * @retval 0 on success, -1 if the connection must be closed
+ */
+int http_conn_flush(http_conn_t *conn);
+
+/**
+ * @brief Connection has unsent output, wait for the socket to be writable
+ */
+bool http_conn_pending(const http_conn_t *conn);
+
+#endif /* HTTP_SERVER_H */
@@ -0,0 +1,439 @@
+/**
+ * @brief Serial service I/O engines: receives and sends of the serial port and client sockets
+ * @author Gonzalo G. Fernandez
+ *
+ */
+
+#define _GNU_SOURCE // syscall
+
+#include "IoEngine.h"
+#include <errno.h>       // errno
+#include <poll.h>        // POLLIN
+#include <stdlib.h>      // calloc, malloc, free
+#include <string.h>      // memset
+#include <sys/epoll.h>   // EPOLLIN
+#include <sys/mman.h>    // mmap, munmap
+#include <sys/socket.h>  // send
+#include <sys/syscall.h> // SYS_io_uring_setup, SYS_io_uring_enter, SYS_io_uring_register
+#include <unistd.h>      // read, write, close, syscall
+
+// Internal operations, after the io_op_t ones
+#define IO_OP_POLL 2   /*!> Multishot poll of a tty */
+#define IO_OP_CANCEL 3 /*!> Cancel of an unwatched fd */
+
+// Submission user_data: operation + 1 (0 is never a watch), generation and fd
+#define IO_DATA(op, generation, fd)                                                              \
+    ((uint64_t)((op) + 1) << 56 | (uint64_t)(generation) << 24 | (uint64_t)(fd))
+#define IO_DATA_OP(data) ((int)((data) >> 56) - 1)
+#define IO_DATA_GENERATION(data) ((uint32_t)((data) >> 24))
+#define IO_DATA_FD(data) ((int)((data) & 0xffffff))
+#define IO_FD_MAX (1 << 24) /*!> fds that fit in user_data */
+
+/**
+ * @brief Read a readable fd, the read/write engine receive
+ */
+static void io_rw_read(io_engine_t *engine, int fd) {
+    io_event_t event = {.op = IO_RECV, .fd = fd, .data = engine->rx};
+    ssize_t n = read(fd, engine->rx, sizeof(engine->rx));
+
+    engine->syscalls++;
+    if (0 > n) {
+        if (EAGAIN == errno || EINTR == errno)
+            return;
+        // a tty reports the other end hung up (pty master closed, adapter unplugged) with EIO
+        n = (EIO == errno) ? 0 : -errno;
+    }
+    event.res = n;
+    engine->receives++;
+    engine->handler(&event, engine->ctx);
+}
+
+static int io_rw_send(io_engine_t *engine, int fd, bool socket, const char *data, size_t len) {
+    engine->syscalls++;
+    engine->sends++;
+    // the peer may be gone, report EPIPE instead of raising SIGPIPE
+    if (socket)
+        return send(fd, data, len, MSG_NOSIGNAL);
+    return write(fd, data, len);
+}
+
+static int io_rw_init(io_engine_t *engine) {
+    engine->rx_events = EPOLLIN;
+    return 0;
+}
+
+static void io_rw_free(io_engine_t *engine) { (void)engine; }
+
+static int io_rw_watch(io_engine_t *engine, int fd, bool socket) {
+    (void)engine;
+    (void)fd;
+    (void)socket;
+    return 0;
+}
+
+static void io_rw_unwatch(io_engine_t *engine, int fd) {
+    (void)engine;
+    (void)fd;
+}
+
+static void io_rw_complete(io_engine_t *engine) { (void)engine; }
+
+static int io_rw_submit(io_engine_t *engine) {
+    (void)engine;
+    return 0;
+}
+
+static const io_engine_ops_t io_rw_ops = {
+    .name = "rw",
+    .init = io_rw_init,
+    .free = io_rw_free,
+    .watch = io_rw_watch,
+    .unwatch = io_rw_unwatch,
+    .read = io_rw_read,
+    .send = io_rw_send,
+    .complete = io_rw_complete,
+    .submit = io_rw_submit,
+};
+
+static int io_ring_enter(io_engine_t *engine, unsigned submit, unsigned wait, unsigned flags) {
+    int ret;
+
+    do {
+        engine->syscalls++;
+        engine->submits++;
+        ret = syscall(SYS_io_uring_enter, engine->fd, submit, wait, flags, NULL, 0);
+    } while (0 > ret && EINTR == errno);
+    return ret;
+}
+
+static int io_ring_submit(io_engine_t *engine) {
+    io_ring_t *ring = &engine->ring;
+    int ret;
+
+    if (0 == ring->queued)
+        return 0;
+    ret = io_ring_enter(engine, ring->queued, 0, 0);
+    if (0 > ret)
+        return -1;
+    ring->queued -= ret;
+    return 0;
+}
+
+/**
+ * @brief Queue a submission, sent with the next io_ring_submit (now if the queue is full)
+ * @retval 0 on success, -1 on error
+ */
+static int io_ring_queue(io_engine_t *engine, const struct io_uring_sqe *sqe) {
+    io_ring_t *ring = &engine->ring;
+    unsigned tail = *ring->sq_tail, index = tail & ring->sq_mask;
+
+    if (ring->sq_entries == tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) &&
+        (0 > io_ring_submit(engine) ||
+         ring->sq_entries == tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE))) {
+        errno = EBUSY;
+        return -1;
+    }
+    ring->sqes[index] = *sqe;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+    return 0;
+}
+
+/**
+ * @brief Give a receive buffer back to the kernel
+ */
+static void io_ring_give(io_ring_t *ring, unsigned bid) {
+    // Field by field: the ring tail overlays the resv field of the first entry
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail & (IO_ENGINE_BUFFERS - 1)];
+
+    buf->addr = (uintptr_t)(ring->buffers + (size_t)bid * IO_ENGINE_BUFFER_SIZE);
+    buf->len = IO_ENGINE_BUFFER_SIZE;
+    buf->bid = bid;
+    __atomic_store_n(&ring->buf_ring->tail, ++ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Queue the receive of a watched fd: a multishot receive, or a multishot poll for a tty
+ */
+static int io_ring_arm(io_engine_t *engine, uint64_t data) {
+    struct io_uring_sqe sqe = {.fd = IO_DATA_FD(data), .user_data = data};
+
+    if (IO_RECV == IO_DATA_OP(data)) {
+        sqe.opcode = IORING_OP_RECV;
+        sqe.ioprio = IORING_RECV_MULTISHOT;
+        sqe.flags = IOSQE_BUFFER_SELECT;
+        sqe.buf_group = 0;
+    } else {
+        sqe.opcode = IORING_OP_POLL_ADD;
+        sqe.len = IORING_POLL_ADD_MULTI;
+        sqe.poll32_events = POLLIN;
+    }
+    return io_ring_queue(engine, &sqe);
+}
+
+/**
+ * @brief Hand a completion to the handler, unless it belongs to an fd no longer watched
+ */
+static void io_ring_event(io_engine_t *engine, const struct io_uring_cqe *cqe) {
+    io_ring_t *ring = &engine->ring;
+    uint64_t data = cqe->user_data;
+    int fd = IO_DATA_FD(data);
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+    io_event_t event = {.op = IO_DATA_OP(data), .fd = fd, .res = cqe->res};
+
+    switch (IO_DATA_OP(data)) {
+    case IO_SEND:
+        if (0 != engine->watch[fd] &&
+            IO_DATA_GENERATION(engine->watch[fd]) == IO_DATA_GENERATION(data))
+            engine->handler(&event, engine->ctx);
+        break;
+    case IO_OP_POLL:
+        if (data != engine->watch[fd])
+            break;
+        if (0 > cqe->res) {
+            event.op = IO_RECV;
+            engine->receives++;
+            engine->handler(&event, engine->ctx);
+        } else {
+            io_rw_read(engine, fd); // POLLHUP too, the read tells the end of stream
+        }
+        if (data == engine->watch[fd] && !more)
+            io_ring_arm(engine, data);
+        break;
+    case IO_RECV:
+        if (data == engine->watch[fd]) {
+            if (-ENOBUFS == cqe->res) {
+                engine->starved++;
+            } else {
+                if (cqe->flags & IORING_CQE_F_BUFFER)
+                    event.data = ring->buffers + (size_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) *
+                                                     IO_ENGINE_BUFFER_SIZE;
+                engine->receives++;
+                engine->handler(&event, engine->ctx);
+            }
+            // Stopped while the stream goes on (every buffer was in use): armed again
+            if (data == engine->watch[fd] && !more && (0 < cqe->res || -ENOBUFS == cqe->res))
+                io_ring_arm(engine, data);
+        }
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+            io_ring_give(ring, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        break;
+    default: // Cancels
+        break;
+    }
+}
+
+static void io_ring_complete(io_engine_t *engine) {
+    io_ring_t *ring = &engine->ring;
+
+    do {
+        unsigned head = *ring->cq_head;
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe cqe = ring->cqes[head & ring->cq_mask];
+            // Released before the handler, which may queue more work
+            __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+            engine->completions++;
+            io_ring_event(engine, &cqe);
+        }
+        // Completions the ring had no room for wait in the kernel until asked for
+    } while ((__atomic_load_n(ring->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) &&
+             0 <= io_ring_enter(engine, 0, 0, IORING_ENTER_GETEVENTS));
+}
+
+static void io_ring_read(io_engine_t *engine, int fd) {
+    // Receives come as completions
+    (void)engine;
+    (void)fd;
+}
+
+static int io_ring_send(io_engine_t *engine, int fd, bool socket, const char *data, size_t len) {
+    struct io_uring_sqe sqe = {
+        .opcode = IORING_OP_SEND,
+        .fd = fd,
+        .addr = (uintptr_t)data,
+        .len = len,
+        .msg_flags = MSG_NOSIGNAL,
+        .user_data = IO_DATA(IO_SEND, IO_DATA_GENERATION(engine->watch[fd]), fd),
+    };
+
+    if (!socket)
+        return io_rw_send(engine, fd, socket, data, len);
+    if (0 > io_ring_queue(engine, &sqe))
+        return -1;
+    engine->sends++;
+    return IO_ENGINE_QUEUED;
+}
+
+static int io_ring_watch(io_engine_t *engine, int fd, bool socket) {
+    (void)socket;
+    return io_ring_arm(engine, engine->watch[fd]);
+}
+
+static void io_ring_unwatch(io_engine_t *engine, int fd) {
+    struct io_uring_sqe sqe = {
+        .opcode = IORING_OP_ASYNC_CANCEL,
+        .fd = fd,
+        .cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL,
+        .user_data = IO_DATA(IO_OP_CANCEL, 0, fd),
+    };
+
+    // Now, not with the iteration: the cancel looks the fd up and the caller may close it first
+    if (0 == io_ring_queue(engine, &sqe))
+        io_ring_submit(engine);
+}
+
+static void io_ring_free(io_engine_t *engine) {
+    io_ring_t *ring = &engine->ring;
+
+    if (0 <= engine->fd)
+        close(engine->fd); // Cancels what is in flight and drops the buffer ring
+    if (NULL != ring->rings)
+        munmap(ring->rings, ring->rings_size);
+    if (NULL != ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+    if (NULL != ring->buf_ring)
+        munmap(ring->buf_ring, IO_ENGINE_BUFFERS * sizeof(struct io_uring_buf));
+    free(ring->buffers);
+    *ring = (io_ring_t){0};
+    engine->fd = -1;
+}
+
+static int io_ring_init(io_engine_t *engine) {
+    io_ring_t *ring = &engine->ring;
+    struct io_uring_params params = {
+        .flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER,
+        .cq_entries = IO_ENGINE_CQ_ENTRIES,
+    };
+    struct io_uring_buf_reg reg = {.ring_entries = IO_ENGINE_BUFFERS, .bgid = 0};
+    size_t sq_size, cq_size;
+    char *rings;
+    void *map;
+
+    engine->fd = syscall(SYS_io_uring_setup, IO_ENGINE_ENTRIES, &params);
+    if (0 > engine->fd)
+        return -1;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    // Both rings in one mapping, the entries in another
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->rings_size = (sq_size > cq_size) ? sq_size : cq_size;
+    map = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               engine->fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == map)
+        return -1;
+    ring->rings = rings = map;
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    map = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               engine->fd, IORING_OFF_SQES);
+    if (MAP_FAILED == map)
+        return -1;
+    ring->sqes = map;
+    ring->sq_head = (unsigned *)(rings + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(rings + params.sq_off.tail);
+    ring->sq_flags = (unsigned *)(rings + params.sq_off.flags);
+    ring->sq_array = (unsigned *)(rings + params.sq_off.array);
+    ring->sq_mask = *(unsigned *)(rings + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->cq_head = (unsigned *)(rings + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(rings + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(rings + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(rings + params.cq_off.cqes);
+
+    // Provided buffers: a page aligned ring of entries pointing to the buffers
+    map = mmap(NULL, IO_ENGINE_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == map)
+        return -1;
+    ring->buf_ring = map;
+    ring->buffers = malloc((size_t)IO_ENGINE_BUFFERS * IO_ENGINE_BUFFER_SIZE);
+    if (NULL == ring->buffers)
+        return -1;
+    reg.ring_addr = (uintptr_t)ring->buf_ring;
+    if (0 > syscall(SYS_io_uring_register, engine->fd, IORING_REGISTER_PBUF_RING, &reg, 1))
+        return -1;
+    for (unsigned bid = 0; bid < IO_ENGINE_BUFFERS; bid++)
+        io_ring_give(ring, bid);
+    engine->rx_events = 0;
+    return 0;
+}
+
+static const io_engine_ops_t io_ring_ops = {
+    .name = "uring",
+    .init = io_ring_init,
+    .free = io_ring_free,
+    .watch = io_ring_watch,
+    .unwatch = io_ring_unwatch,
+    .read = io_ring_read,
+    .send = io_ring_send,
+    .complete = io_ring_complete,
+    .submit = io_ring_submit,
+};
+
+int io_engine_init(io_engine_t *engine, io_engine_kind_t kind, int fd_max, io_handler_t handler,
+                   void *ctx) {
+    *engine = (io_engine_t){
+        .ops = (IO_ENGINE_URING == kind) ? &io_ring_ops : &io_rw_ops,
+        .handler = handler,
+        .ctx = ctx,
+        .fd = -1,
+        .fd_max = (IO_FD_MAX < fd_max) ? IO_FD_MAX : fd_max,
+    };
+    engine->watch = calloc(engine->fd_max, sizeof(uint64_t));
+    if (NULL == engine->watch || 0 > engine->ops->init(engine)) {
+        int error = errno;
+        io_engine_free(engine);
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+void io_engine_free(io_engine_t *engine) {
+    if (NULL != engine->ops)
+        engine->ops->free(engine);
+    free(engine->watch);
+    engine->watch = NULL;
+}
+
+int io_engine_watch(io_engine_t *engine, int fd, bool socket) {
+    if (0 > fd || engine->fd_max <= fd) {
+        errno = EBADF;
+        return -1;
+    }
+    engine->generation++;
+    engine->watch[fd] = IO_DATA(socket ? IO_RECV : IO_OP_POLL, engine->generation, fd);
+    if (0 > engine->ops->watch(engine, fd, socket)) {
+        engine->watch[fd] = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void io_engine_unwatch(io_engine_t *engine, int fd) {
+    if (0 > fd || engine->fd_max <= fd || 0 == engine->watch[fd])
+        return;
+    engine->watch[fd] = 0;
+    engine->ops->unwatch(engine, fd);
+}
+
+void io_engine_read(io_engine_t *engine, int fd) {
+    if (0 <= fd && engine->fd_max > fd && 0 != engine->watch[fd])
+        engine->ops->read(engine, fd);
+}
+
+int io_engine_send(io_engine_t *engine, int fd, bool socket, const char *data, size_t len) {
+    if (0 > fd || engine->fd_max <= fd) {
+        errno = EBADF;
+        return -1;
+    }
+    return engine->ops->send(engine, fd, socket, data, len);
+}
+
+void io_engine_complete(io_engine_t *engine) { engine->ops->complete(engine); }
+
+int io_engine_submit(io_engine_t *engine) { return engine->ops->submit(engine); }
@@ -0,0 +1,183 @@
+/**
+ * @brief Serial service I/O engines: receives and sends of the serial port and client sockets
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - One interface, two backends behind an ops table. The caller watches an fd to receive from
+ *   it and gets every receive as an io_event_t through its handler. A send either completes at
+ *   once (the bytes written come back) or later (IO_ENGINE_QUEUED, then an IO_SEND event), so
+ *   the data must stay untouched until it completes. One send in flight per fd.
+ * - Read/write engine (IO_ENGINE_RW): the caller waits for EPOLLIN (rx_events) and calls
+ *   io_engine_read, one read per readiness; sends are a send or write at once. One syscall per
+ *   call, as the service always did.
+ * - io_uring engine (IO_ENGINE_URING, raw syscalls, no liburing): a watched socket has a
+ *   multishot receive that keeps filling buffers of a provided buffer ring registered with the
+ *   kernel (IORING_REGISTER_PBUF_RING), so data arrives without a syscall per read. Every
+ *   receive re-armed and every send of an event loop iteration go out in one io_uring_enter
+ *   (io_engine_submit). The ring fd (engine->fd) goes in the caller event loop: readable means
+ *   completions to reap with io_engine_complete, from shared memory without a syscall. Sends
+ *   copy the data: frames are a few bytes, a zero copy send (the only one taking registered
+ *   buffers) pins pages and completes twice for nothing.
+ * - A tty has no multishot read: it gets a multishot poll and a read per readiness, and its
+ *   sends are writes at once, a non-blocking tty write through the ring only fails with EAGAIN.
+ * - Watching an fd gives it a new generation: completions of an fd unwatched, or of the
+ *   previous connection on a reused fd, are dropped, never handed to the caller.
+ *
+ */
+
+#ifndef IO_ENGINE_H
+#define IO_ENGINE_H
+
+#include <linux/io_uring.h> // io_uring_sqe, io_uring_cqe, io_uring_buf_ring
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+#define IO_ENGINE_ENTRIES 256      /*!> Submission queue entries */
+#define IO_ENGINE_CQ_ENTRIES 4096  /*!> Completion queue entries, a multishot receive has many */
+#define IO_ENGINE_BUFFERS 512      /*!> Provided receive buffers, a power of 2 */
+#define IO_ENGINE_BUFFER_SIZE 4096 /*!> Bytes of a receive buffer */
+#define IO_ENGINE_QUEUED (-2)      /*!> io_engine_send: completes later, as an IO_SEND event */
+
+/**
+ * @brief Engine backends
+ */
+typedef enum {
+    IO_ENGINE_RW,    /*!> read/write, one syscall per call */
+    IO_ENGINE_URING, /*!> io_uring */
+} io_engine_kind_t;
+
+/**
+ * @brief Event operations
+ */
+typedef enum {
+    IO_RECV, /*!> Data received, res bytes at data; 0 end of stream, -errno on error */
+    IO_SEND, /*!> Queued send done, res bytes written (maybe fewer than asked) or -errno */
+} io_op_t;
+
+/**
+ * @brief Completed operation, data only valid during the handler
+ */
+typedef struct {
+    io_op_t op;       /*!> Operation */
+    int fd;           /*!> File descriptor */
+    int res;          /*!> Result, see io_op_t */
+    const char *data; /*!> Received bytes (IO_RECV) */
+} io_event_t;
+
+/**
+ * @brief Handler of the completed operations
+ */
+typedef void (*io_handler_t)(const io_event_t *event, void *ctx);
+
+typedef struct io_engine io_engine_t;
+
+/**
+ * @brief Backend operations, the io_engine_ functions without their checks
+ */
+typedef struct {
+    const char *name; /*!> Backend name, "rw" or "uring" */
+    int (*init)(io_engine_t *engine);
+    void (*free)(io_engine_t *engine);
+    int (*watch)(io_engine_t *engine, int fd, bool socket);
+    void (*unwatch)(io_engine_t *engine, int fd);
+    void (*read)(io_engine_t *engine, int fd);
+    int (*send)(io_engine_t *engine, int fd, bool socket, const char *data, size_t len);
+    void (*complete)(io_engine_t *engine);
+    int (*submit)(io_engine_t *engine);
+} io_engine_ops_t;
+
+/**
+ * @brief io_uring rings and provided receive buffers
+ */
+typedef struct {
+    void *rings;                        /*!> Submission and completion rings, one mapping */
+    size_t rings_size;                  /*!> Length of rings */
+    struct io_uring_sqe *sqes;          /*!> Submission queue entries */
+    size_t sqes_size;                   /*!> Length of sqes */
+    unsigned *sq_head;                  /*!> Submission queue head, moved by the kernel */
+    unsigned *sq_tail;                  /*!> Submission queue tail */
+    unsigned *sq_flags;                 /*!> IORING_SQ_ flags */
+    unsigned *sq_array;                 /*!> Submission queue indexes of sqes */
+    unsigned sq_mask;                   /*!> Submission queue index mask */
+    unsigned sq_entries;                /*!> Submission queue length */
+    unsigned *cq_head;                  /*!> Completion queue head */
+    unsigned *cq_tail;                  /*!> Completion queue tail, moved by the kernel */
+    unsigned cq_mask;                   /*!> Completion queue index mask */
+    struct io_uring_cqe *cqes;          /*!> Completion queue entries */
+    unsigned queued;                    /*!> Entries queued, not submitted yet */
+    struct io_uring_buf_ring *buf_ring; /*!> Provided receive buffers ring */
+    char *buffers;                      /*!> IO_ENGINE_BUFFERS of IO_ENGINE_BUFFER_SIZE */
+    uint16_t buf_tail;                  /*!> Next buffer ring entry to give back */
+} io_ring_t;
+
+/**
+ * @brief Engine state
+ */
+struct io_engine {
+    const io_engine_ops_t *ops;     /*!> Backend */
+    io_handler_t handler;           /*!> Completed operations handler */
+    void *ctx;                      /*!> Handler context */
+    int fd;                         /*!> Completion fd for the event loop, -1 for none (rw) */
+    uint32_t rx_events;             /*!> Event loop events of a watched fd, 0 if none needed */
+    int fd_max;                     /*!> Length of watch */
+    uint64_t *watch;                /*!> Receive of each watched fd, 0 if not watched */
+    uint32_t generation;            /*!> Last generation given to a watched fd */
+    io_ring_t ring;                 /*!> io_uring state */
+    char rx[IO_ENGINE_BUFFER_SIZE]; /*!> Buffer of the reads */
+    unsigned long syscalls;         /*!> read, write, send and io_uring_enter calls */
+    unsigned long submits;          /*!> io_uring_enter calls */
+    unsigned long receives;         /*!> Receives handed to the handler */
+    unsigned long sends;            /*!> Sends */
+    unsigned long completions;      /*!> Completions reaped, dropped ones included */
+    unsigned long starved;          /*!> Receives stopped, every provided buffer in use */
+};
+
+/**
+ * @brief Set up an engine
+ * @param fd_max Highest fd to watch plus one
+ * @retval 0 on success, -1 on error (errno set, io_uring not allowed or no memory)
+ */
+int io_engine_init(io_engine_t *engine, io_engine_kind_t kind, int fd_max, io_handler_t handler,
+                   void *ctx);
+
+/**
+ * @brief Release the engine, operations in flight are dropped
+ */
+void io_engine_free(io_engine_t *engine);
+
+/**
+ * @brief Start receiving from an fd, until the end of stream, an error or io_engine_unwatch
+ * @param socket Stream socket, a tty otherwise
+ * @retval 0 on success, -1 on error
+ */
+int io_engine_watch(io_engine_t *engine, int fd, bool socket);
+
+/**
+ * @brief Stop receiving from an fd before closing it, its sends in flight are cancelled
+ */
+void io_engine_unwatch(io_engine_t *engine, int fd);
+
+/**
+ * @brief A watched fd is readable (rx_events): read it, an IO_RECV event unless it would block
+ */
+void io_engine_read(io_engine_t *engine, int fd);
+
+/**
+ * @brief Send len bytes of data
+ * @retval Bytes written at once, IO_ENGINE_QUEUED if the result comes as an IO_SEND event,
+ *         -1 on error (errno set, EAGAIN if the fd has no room)
+ */
+int io_engine_send(io_engine_t *engine, int fd, bool socket, const char *data, size_t len);
+
+/**
+ * @brief The engine fd is readable: hand every completion to the handler
+ */
+void io_engine_complete(io_engine_t *engine);
+
+/**
+ * @brief Submit the queued operations, once per event loop iteration
+ * @retval 0 on success, -1 on error
+ */
+int io_engine_submit(io_engine_t *engine);
+
+#endif /* IO_ENGINE_H */
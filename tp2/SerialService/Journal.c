@@ -0,0 +1,282 @@
+/**
+ * @brief Serial service persistent journal of switch and output events
+ * @author Gonzalo G. Fernandez
+ *
+ */
+
+#include "Journal.h"
+#include <errno.h>    // errno
+#include <fcntl.h>    // open
+#include <stdio.h>    // snprintf, rename
+#include <stdlib.h>   // calloc, free
+#include <string.h>   // memcmp, memcpy, strdup
+#include <sys/mman.h> // mmap, munmap, msync
+#include <sys/stat.h> // fstat
+#include <time.h>     // clock_gettime
+#include <unistd.h>   // ftruncate, close
+
+#define JOURNAL_MAGIC "SSJRNL01" /*!> Header magic, 8 bytes */
+#define JOURNAL_SNAPSHOT 0x80    /*!> Record kind flag: state at snapshot time, not an event */
+
+// Known state flags: kind is the known bit, kind << 2 the value bit
+#define JOURNAL_KNOWN(kind) (kind)
+#define JOURNAL_ON(kind) ((kind) << 2)
+
+static size_t journal_size(uint32_t capacity) {
+    return sizeof(journal_header_t) + (size_t)capacity * sizeof(journal_record_t);
+}
+
+/**
+ * @brief Map a journal file
+ * @retval Mapping, NULL on error
+ */
+static journal_header_t *journal_map(int fd, uint32_t capacity) {
+    void *map = mmap(NULL, journal_size(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    return (MAP_FAILED == map) ? NULL : map;
+}
+
+/**
+ * @brief Create an empty journal file, replacing any file at path
+ * @retval fd, -1 on error
+ */
+static int journal_create(const char *path, journal_header_t **header) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (0 > fd)
+        return -1;
+    if (0 > ftruncate(fd, journal_size(JOURNAL_RECORDS)) ||
+        NULL == (*header = journal_map(fd, JOURNAL_RECORDS))) {
+        close(fd);
+        return -1;
+    }
+    memcpy((*header)->magic, JOURNAL_MAGIC, sizeof((*header)->magic));
+    (*header)->record_size = sizeof(journal_record_t);
+    (*header)->capacity = JOURNAL_RECORDS;
+    return fd;
+}
+
+/**
+ * @brief Map an existing journal file, if it is a valid one
+ * @retval fd, -1 if missing or not valid
+ */
+static int journal_load(const char *path, journal_header_t **header) {
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    journal_header_t *h;
+    struct stat st;
+
+    if (0 > fd)
+        return -1;
+    h = (0 == fstat(fd, &st) && (size_t)st.st_size >= sizeof(journal_header_t))
+            ? journal_map(fd, 0)
+            : NULL;
+    if (NULL != h && 0 == memcmp(h->magic, JOURNAL_MAGIC, sizeof(h->magic)) &&
+        sizeof(journal_record_t) == h->record_size &&
+        (size_t)st.st_size == journal_size(h->capacity) && h->count <= h->capacity &&
+        h->snapshot + h->snapshot_len <= h->count) {
+        uint32_t capacity = h->capacity;
+        munmap(h, journal_size(0));
+        if (NULL != (*header = journal_map(fd, capacity)))
+            return fd;
+    } else if (NULL != h) {
+        munmap(h, journal_size(0));
+    }
+    close(fd);
+    return -1;
+}
+
+static void journal_apply(journal_t *journal, const journal_record_t *record) {
+    uint8_t kind = record->kind & ~JOURNAL_SNAPSHOT;
+    uint8_t *state;
+
+    if (JOURNAL_CHANNELS <= record->channel || (JOURNAL_SW != kind && JOURNAL_OUT != kind))
+        return;
+    state = &journal->state[record->channel];
+    if (0 == *state)
+        journal->known[journal->known_count++] = record->channel;
+    *state |= JOURNAL_KNOWN(kind);
+    *state = record->value ? *state | JOURNAL_ON(kind) : *state & ~JOURNAL_ON(kind);
+}
+
+/**
+ * @brief Append the known state of every channel as a snapshot block
+ * @note The caller makes sure it fits
+ */
+static void journal_write_snapshot(journal_t *journal, journal_header_t *header,
+                                   journal_record_t *records) {
+    uint64_t start = header->count, now = journal_now();
+    journal_record_t *record = &records[start];
+
+    for (size_t i = 0; i < journal->known_count; i++) {
+        uint32_t channel = journal->known[i];
+        for (uint8_t kind = JOURNAL_SW; kind <= JOURNAL_OUT; kind++) {
+            if (!(journal->state[channel] & JOURNAL_KNOWN(kind)))
+                continue;
+            *record++ = (journal_record_t){
+                .time = now,
+                .channel = channel,
+                .kind = kind | JOURNAL_SNAPSHOT,
+                .value = (journal->state[channel] & JOURNAL_ON(kind)) ? 1 : 0,
+            };
+        }
+    }
+    header->count = record - records;
+    header->snapshot = start;
+    header->snapshot_len = header->count - start;
+    journal->since_snapshot = 0;
+}
+
+/**
+ * @brief Replace a full journal with a new file holding only a snapshot
+ * @retval 0 on success, -1 on error
+ */
+static int journal_compact(journal_t *journal) {
+    char tmp[4096];
+    journal_header_t *header;
+    int fd;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", journal->path);
+    fd = journal_create(tmp, &header);
+    if (0 > fd)
+        return -1;
+    journal_write_snapshot(journal, header, (journal_record_t *)(header + 1));
+    msync(header, journal_size(header->capacity), MS_ASYNC);
+    if (0 > rename(tmp, journal->path)) {
+        munmap(header, journal_size(header->capacity));
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    munmap(journal->header, journal_size(journal->header->capacity));
+    close(journal->fd);
+    journal->fd = fd;
+    journal->header = header;
+    journal->records = (journal_record_t *)(header + 1);
+    journal->compactions++;
+    return 0;
+}
+
+/**
+ * @brief Snapshot in place, or compact when it does not fit
+ * @retval 0 on success, -1 on error
+ */
+static int journal_snapshot(journal_t *journal) {
+    journal_header_t *header = journal->header;
+
+    // A snapshot holds up to two records per known channel
+    if (header->count + 2 * journal->known_count > header->capacity)
+        return journal_compact(journal);
+    journal_write_snapshot(journal, header, journal->records);
+    return 0;
+}
+
+int journal_open(journal_t *journal, const char *path) {
+    journal_header_t *header;
+
+    *journal = (journal_t){.fd = -1};
+    journal->path = strdup(path);
+    journal->state = calloc(JOURNAL_CHANNELS, sizeof(uint8_t));
+    journal->known = calloc(JOURNAL_CHANNELS, sizeof(uint32_t));
+    if (NULL == journal->path || NULL == journal->state || NULL == journal->known) {
+        journal_close(journal);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // A missing or unreadable file starts a new journal
+    journal->fd = journal_load(path, &header);
+    if (0 > journal->fd)
+        journal->fd = journal_create(path, &header);
+    if (0 > journal->fd) {
+        journal_close(journal);
+        return -1;
+    }
+    journal->header = header;
+    journal->records = (journal_record_t *)(header + 1);
+
+    // Last snapshot, then the events after it
+    for (uint64_t i = header->snapshot; i < header->count; i++)
+        journal_apply(journal, &journal->records[i]);
+    journal->replayed = header->count - header->snapshot;
+    journal->since_snapshot = header->count - header->snapshot - header->snapshot_len;
+    return 0;
+}
+
+void journal_close(journal_t *journal) {
+    if (NULL != journal->header) {
+        msync(journal->header, journal_size(journal->header->capacity), MS_ASYNC);
+        munmap(journal->header, journal_size(journal->header->capacity));
+    }
+    if (0 <= journal->fd)
+        close(journal->fd);
+    free(journal->path);
+    free(journal->state);
+    free(journal->known);
+    *journal = (journal_t){.fd = -1};
+}
+
+uint64_t journal_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+int journal_append(journal_t *journal, journal_kind_t kind, unsigned channel, int value,
+                   uint64_t time) {
+    journal_header_t *header = journal->header;
+    journal_record_t *record;
+
+    if (JOURNAL_CHANNELS <= channel)
+        return 0;
+    if (header->count == header->capacity) {
+        if (0 > journal_compact(journal))
+            return -1;
+        header = journal->header;
+    }
+    record = &journal->records[header->count];
+    *record = (journal_record_t){.time = time, .channel = channel, .kind = kind, .value = !!value};
+    // The record is complete before the count includes it
+    __atomic_store_n(&header->count, header->count + 1, __ATOMIC_RELEASE);
+    journal_apply(journal, record);
+    if (JOURNAL_SNAPSHOT_INTERVAL <= ++journal->since_snapshot)
+        return journal_snapshot(journal);
+    return 0;
+}
+
+int journal_state(const journal_t *journal, journal_kind_t kind, unsigned channel) {
+    uint8_t state;
+
+    if (JOURNAL_CHANNELS <= channel)
+        return -1;
+    state = journal->state[channel];
+    if (!(state & JOURNAL_KNOWN(kind)))
+        return -1;
+    return (state & JOURNAL_ON(kind)) ? 1 : 0;
+}
+
+int journal_state_at(const journal_t *journal, journal_kind_t kind, unsigned channel,
+                     uint64_t time) {
+    const journal_record_t *records = journal->records;
+    uint64_t lo = 0, hi = journal->header->count;
+    bool in_snapshot = false;
+
+    // First record after time
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (records[mid].time <= time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    // Back to the last record of the channel, a whole snapshot block without it means unknown
+    for (uint64_t i = lo; i-- > 0;) {
+        bool snapshot = records[i].kind & JOURNAL_SNAPSHOT;
+        if (in_snapshot && !snapshot)
+            break;
+        in_snapshot = snapshot;
+        if (channel == records[i].channel && kind == (records[i].kind & ~JOURNAL_SNAPSHOT))
+            return records[i].value;
+    }
+    return -1;
+}
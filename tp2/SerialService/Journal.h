@@ -0,0 +1,116 @@
+/**
+ * @brief Serial service persistent journal of switch and output events
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - The journal is a file mapped in memory: a header and fixed size records appended in time
+ *   order. An append is a store in the mapping, no system call. The record is complete before the
+ *   header count includes it, so a crash never leaves a torn record in the replay.
+ * - Every JOURNAL_SNAPSHOT_INTERVAL events the state of every known channel is appended as a
+ *   snapshot block and the header points to it. Replay applies the last snapshot and the events
+ *   after it, so it reads at most one interval of events.
+ * - A full journal is compacted: a new file holding only a snapshot replaces it (rename), the
+ *   history before it is gone.
+ * - State queries at a past time find the last record up to that time by binary search (times
+ *   are wall clock, non decreasing) and scan back to the channel, at most one snapshot interval
+ *   away.
+ *
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "OutputScheduler.h" // OUTPUT_CHANNELS
+#include <stddef.h>          // size_t
+#include <stdint.h>          // uint8_t, uint64_t
+
+#define JOURNAL_CHANNELS OUTPUT_CHANNELS    /*!> Channels tracked */
+#define JOURNAL_RECORDS (1 << 20)           /*!> Records of a journal file, 16 bytes each */
+#define JOURNAL_SNAPSHOT_INTERVAL (1 << 16) /*!> Events between snapshots */
+
+/**
+ * @brief Event kinds
+ */
+typedef enum {
+    JOURNAL_SW = 1,  /*!> Switch state, from the serial port */
+    JOURNAL_OUT = 2, /*!> Output state, written to the serial port */
+} journal_kind_t;
+
+/**
+ * @brief Journal file header
+ */
+typedef struct {
+    char magic[8];         /*!> JOURNAL_MAGIC */
+    uint32_t record_size;  /*!> sizeof(journal_record_t) */
+    uint32_t capacity;     /*!> Records the file holds */
+    uint64_t count;        /*!> Records written */
+    uint64_t snapshot;     /*!> First record of the last snapshot */
+    uint64_t snapshot_len; /*!> Records of the last snapshot */
+    uint8_t reserved[24];  /*!> Header is 64 bytes */
+} journal_header_t;
+
+/**
+ * @brief Journal record
+ */
+typedef struct {
+    uint64_t time;    /*!> Wall clock time, ns since the epoch */
+    uint32_t channel; /*!> Channel number */
+    uint8_t kind;     /*!> journal_kind_t, JOURNAL_SNAPSHOT flag for snapshot records */
+    uint8_t value;    /*!> State, 0 or 1 */
+    uint8_t pad[2];   /*!> Record is 16 bytes */
+} journal_record_t;
+
+/**
+ * @brief Open journal
+ */
+typedef struct {
+    char *path;                /*!> Journal file */
+    int fd;                    /*!> Journal file descriptor, -1 when closed */
+    journal_header_t *header;  /*!> Mapping of the file */
+    journal_record_t *records; /*!> Records, right after the header */
+    uint8_t *state;            /*!> Known state per channel, see Journal.c */
+    uint32_t *known;           /*!> Channels with a known state, in the order they got it */
+    size_t known_count;        /*!> Length of known */
+    uint64_t since_snapshot;   /*!> Events since the last snapshot */
+    unsigned long replayed;    /*!> Records applied by the replay */
+    unsigned long compactions; /*!> Journal files replaced by a snapshot */
+} journal_t;
+
+/**
+ * @brief Open a journal, creating the file if needed, and replay it
+ * @retval 0 on success, -1 on error (errno set)
+ */
+int journal_open(journal_t *journal, const char *path);
+
+/**
+ * @brief Close the journal, the file stays
+ */
+void journal_close(journal_t *journal);
+
+/**
+ * @brief Wall clock time, ns since the epoch
+ */
+uint64_t journal_now(void);
+
+/**
+ * @brief Append an event, the known state of its channel changes
+ * @param time Wall clock time of the event, ns since the epoch
+ * @retval 0 on success, -1 if a full journal could not be compacted (errno set)
+ */
+int journal_append(journal_t *journal, journal_kind_t kind, unsigned channel, int value,
+                   uint64_t time);
+
+/**
+ * @brief Known state of a channel
+ * @retval 0 or 1, -1 if unknown
+ */
+int journal_state(const journal_t *journal, journal_kind_t kind, unsigned channel);
+
+/**
+ * @brief State of a channel at a past time, from the journal records
+ * @param time Wall clock time, ns since the epoch
+ * @retval 0 or 1, -1 if unknown at that time
+ */
+int journal_state_at(const journal_t *journal, journal_kind_t kind, unsigned channel,
+                     uint64_t time);
+
+#endif /* JOURNAL_H */
@@ -0,0 +1,175 @@
+/**
+ * @brief Compatibility view of the lamp state table as /tmp/outN.txt files
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Readers of the old files keep working: every lamp change in the table (see LampTable.h) is
+ *   written to its file, "1" or "0". The file is written aside and renamed over the old one, so
+ *   a reader never sees it empty or truncated.
+ * - On start, lamps never set in the table take the state of their file, so the table goes on
+ *   from the last file state. Later writes of other processes to the files (e.g. the switch
+ *   states of serialService -w) go to the table as well, from a thread watching the directory
+ *   (inotify). Files holding what the view wrote last are not imported, so a stale view never
+ *   overwrites a newer table change.
+ * - Sleeps on the table change counter, no polling.
+ * - Usage: lampShim [-n lamps] [-d directory]
+ *
+ */
+
+#include "LampTable.h"
+#include <fcntl.h>       // open
+#include <pthread.h>     // pthread_create
+#include <signal.h>      // sigaction
+#include <stdio.h>       // snprintf, rename
+#include <stdlib.h>      // atoi
+#include <sys/inotify.h> // inotify_init1, inotify_add_watch
+#include <unistd.h>      // getopt
+
+#define LAMP_SHIM_LAMPS 3      /*!> Default lamps, /tmp/out1.txt to /tmp/out3.txt */
+#define LAMP_SHIM_DIR "/tmp"   /*!> Default directory of the files */
+#define LAMP_SHIM_WAIT_MS 1000 /*!> Max wait for a change, to check for signals */
+
+static volatile sig_atomic_t stop = 0;
+static lamp_table_t *table;
+static const char *dir = LAMP_SHIM_DIR;
+static int lamps = LAMP_SHIM_LAMPS;
+static int written[LAMP_TABLE_CHANNELS]; /*!> State the view wrote last per file, -1 none */
+
+static void lamp_shim_stop(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+/**
+ * @brief Write the state of a lamp to its file
+ * @retval 0 on success, -1 on error
+ */
+static int lamp_shim_write(int lamp, int value) {
+    char path[256], tmp[264];
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/out%d.txt", dir, lamp);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fp = fopen(tmp, "w");
+    if (NULL == fp)
+        return -1;
+    fputc(value ? '1' : '0', fp);
+    if (0 != fclose(fp))
+        return -1;
+    return rename(tmp, path);
+}
+
+/**
+ * @brief State in the file of a lamp
+ * @retval 0 or 1, -1 if missing or not a state
+ */
+static int lamp_shim_read(int lamp) {
+    char path[256], state;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/out%d.txt", dir, lamp);
+    fd = open(path, O_RDONLY);
+    if (0 > fd)
+        return -1;
+    if (1 != read(fd, &state, 1))
+        state = '\0';
+    close(fd);
+    return ('0' == state || '1' == state) ? state - '0' : -1;
+}
+
+/**
+ * @brief Import thread: file writes of other processes go to the table
+ */
+static void *lamp_shim_import(void *arg) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int fd = *(int *)arg;
+    sigset_t sigset;
+    ssize_t len;
+
+    // Signals go to the main thread, its wait returns
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGINT);
+    sigaddset(&sigset, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+    while (0 < (len = read(fd, buffer, sizeof(buffer)))) {
+        for (char *p = buffer; p < buffer + len;) {
+            struct inotify_event *event = (struct inotify_event *)p;
+            int lamp = 0, end = 0, value;
+            p += sizeof(struct inotify_event) + event->len;
+            if (0 == event->len || 1 != sscanf(event->name, "out%d.txt%n", &lamp, &end) ||
+                0 == end || '\0' != event->name[end] || 1 > lamp || lamps < lamp)
+                continue;
+            value = lamp_shim_read(lamp);
+            if (0 <= value && value != __atomic_load_n(&written[lamp - 1], __ATOMIC_ACQUIRE))
+                lamp_table_set(table, lamp - 1, value);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    struct sigaction sa = {.sa_handler = lamp_shim_stop}; // No SA_RESTART: the wait returns
+    uint64_t exported[LAMP_TABLE_CHANNELS] = {0}; // Version + 1 in the file, 0 for none
+    pthread_t importer;
+    uint32_t changes;
+    int opt, fd_watch;
+
+    while (-1 != (opt = getopt(argc, argv, "n:d:"))) {
+        if ('n' == opt && 0 < atoi(optarg) && LAMP_TABLE_CHANNELS >= atoi(optarg)) {
+            lamps = atoi(optarg);
+        } else if ('d' == opt) {
+            dir = optarg;
+        } else {
+            fprintf(stderr, "Usage: %s [-n lamps] [-d directory]\r\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    table = lamp_table_open(NULL);
+    if (NULL == table) {
+        perror("ERROR: Unable to open lamp table");
+        exit(EXIT_FAILURE);
+    }
+    // Lamp N is channel N - 1
+    for (int channel = 0; channel < lamps; channel++) {
+        uint64_t version;
+        int value = lamp_shim_read(channel + 1);
+
+        written[channel] = -1;
+        lamp_table_get(table, channel, &version, NULL);
+        if (0 == version && 0 <= value)
+            lamp_table_set(table, channel, value);
+    }
+    fd_watch = inotify_init1(IN_CLOEXEC);
+    if (0 > fd_watch || 0 > inotify_add_watch(fd_watch, dir, IN_CLOSE_WRITE | IN_MOVED_TO) ||
+        0 != pthread_create(&importer, NULL, lamp_shim_import, &fd_watch)) {
+        perror("ERROR: Unable to watch lamp files");
+        exit(EXIT_FAILURE);
+    }
+    printf("Lamp table view on %s/out1.txt to out%d.txt\r\n", dir, lamps);
+    fflush(stdout);
+
+    changes = lamp_table_changes(table) - 1; // Everything is exported first
+    while (!stop) {
+        uint32_t now = lamp_table_wait(table, changes, LAMP_SHIM_WAIT_MS);
+        if (now == changes)
+            continue;
+        changes = now;
+        for (int channel = 0; channel < lamps; channel++) {
+            uint64_t version;
+            int value = lamp_table_get(table, channel, &version, NULL);
+            if (version + 1 == exported[channel])
+                continue;
+            // Set before the write, its own inotify event is not imported
+            __atomic_store_n(&written[channel], value, __ATOMIC_RELEASE);
+            if (0 > lamp_shim_write(channel + 1, value))
+                perror("ERROR: Unable to write lamp file");
+            else
+                exported[channel] = version + 1;
+        }
+    }
+    lamp_table_close(table);
+    printf("Lamp table view closed\r\n");
+    return 0;
+}
@@ -0,0 +1,148 @@
+/**
+ * @brief tp2 lamp state table in shared memory
+ * @author Gonzalo G. Fernandez
+ *
+ */
+
+#include "LampTable.h"
+#include <errno.h>       // errno
+#include <fcntl.h>       // O_CREAT, O_RDWR
+#include <limits.h>      // INT_MAX
+#include <linux/futex.h> // FUTEX_WAIT, FUTEX_WAKE
+#include <stdbool.h>
+#include <stdlib.h>      // malloc, free
+#include <sys/mman.h>    // shm_open, mmap
+#include <sys/stat.h>    // fstat, fchmod
+#include <sys/syscall.h> // SYS_futex
+#include <time.h>        // clock_gettime
+#include <unistd.h>      // ftruncate, close
+
+#define LAMP_TABLE_MAGIC 0x4c414d50 /*!> "LAMP" */
+
+static int futex_wait(uint32_t *addr, uint32_t val, const struct timespec *timeout) {
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static uint64_t lamp_table_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+lamp_table_t *lamp_table_open(const char *name) {
+    lamp_table_t *table = malloc(sizeof(lamp_table_t));
+    uint32_t zero = 0;
+    struct stat st;
+    void *map;
+    int fd;
+
+    if (NULL == table)
+        return NULL;
+    fd = shm_open(NULL != name ? name : LAMP_TABLE_NAME, O_RDWR | O_CREAT, 0666);
+    if (0 > fd) {
+        free(table);
+        return NULL;
+    }
+    // Readers and writers run as different users (CGI, services), whatever the umask
+    fchmod(fd, 0666);
+    // A new object is empty, ftruncate fills it with zeros: every lamp off, version 0
+    if (0 > fstat(fd, &st) || ((size_t)st.st_size < sizeof(lamp_shared_t) &&
+                               0 > ftruncate(fd, sizeof(lamp_shared_t)))) {
+        close(fd);
+        free(table);
+        return NULL;
+    }
+    map = mmap(NULL, sizeof(lamp_shared_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map) {
+        free(table);
+        return NULL;
+    }
+    table->shared = map;
+    if (__atomic_compare_exchange_n(&table->shared->magic, &zero, LAMP_TABLE_MAGIC, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        table->shared->channels = LAMP_TABLE_CHANNELS;
+    else if (LAMP_TABLE_MAGIC != zero) {
+        lamp_table_close(table);
+        errno = EINVAL;
+        return NULL;
+    }
+    return table;
+}
+
+void lamp_table_close(lamp_table_t *table) {
+    munmap(table->shared, sizeof(lamp_shared_t));
+    free(table);
+}
+
+int lamp_table_get(lamp_table_t *table, unsigned channel, uint64_t *version, uint64_t *time) {
+    lamp_record_t *record;
+    uint32_t seq, value;
+    uint64_t v, t;
+
+    if (LAMP_TABLE_CHANNELS <= channel)
+        return -1;
+    record = &table->shared->records[channel];
+    // Retry while a write is in progress or happened meanwhile
+    do {
+        seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+        value = __atomic_load_n(&record->value, __ATOMIC_RELAXED);
+        v = __atomic_load_n(&record->version, __ATOMIC_RELAXED);
+        t = __atomic_load_n(&record->time, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&record->seq, __ATOMIC_RELAXED));
+    if (NULL != version)
+        *version = v;
+    if (NULL != time)
+        *time = t;
+    return value;
+}
+
+int lamp_table_set(lamp_table_t *table, unsigned channel, int value) {
+    lamp_record_t *record;
+    uint32_t seq;
+    bool changed;
+
+    if (LAMP_TABLE_CHANNELS <= channel)
+        return -1;
+    record = &table->shared->records[channel];
+    // Lock: even to odd, other writers of the channel wait for it to be even again
+    seq = __atomic_load_n(&record->seq, __ATOMIC_RELAXED);
+    while ((seq & 1) || !__atomic_compare_exchange_n(&record->seq, &seq, seq + 1, true,
+                                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        seq = __atomic_load_n(&record->seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    changed = 0 == record->version || record->value != (uint32_t)!!value;
+    if (changed) {
+        __atomic_store_n(&record->value, !!value, __ATOMIC_RELAXED);
+        __atomic_store_n(&record->version, record->version + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&record->time, lamp_table_now(), __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&record->seq, seq + 2, __ATOMIC_RELEASE);
+
+    if (changed) {
+        __atomic_add_fetch(&table->shared->changes, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&table->shared->changes);
+    }
+    return changed ? 1 : 0;
+}
+
+uint32_t lamp_table_changes(lamp_table_t *table) {
+    return __atomic_load_n(&table->shared->changes, __ATOMIC_SEQ_CST);
+}
+
+uint32_t lamp_table_wait(lamp_table_t *table, uint32_t changes, int timeout_ms) {
+    struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    uint32_t now = lamp_table_changes(table);
+
+    // The kernel compares the word again, a change right before the wait returns at once
+    if (now == changes)
+        futex_wait(&table->shared->changes, changes, (0 > timeout_ms) ? NULL : &timeout);
+    return lamp_table_changes(table);
+}
@@ -0,0 +1,92 @@
+/**
+ * @brief tp2 lamp state table in shared memory
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - One POSIX shared memory object holds the state of every lamp (output channel): value,
+ *   version (changes so far) and the wall clock time of the last change. It replaces the
+ *   /tmp/outN.txt files, lamp N is channel N - 1.
+ * - Each channel record fills its own cache line and is protected by a seqlock: readers never
+ *   block and retry only while a write is in progress, writers of the same channel exclude each
+ *   other on the sequence word. A process killed in the middle of a write (a few stores) leaves
+ *   the channel locked.
+ * - Every change bumps a table wide change counter and wakes the processes waiting on it
+ *   (futex), so consumers wait for changes instead of polling.
+ * - Built as liblamptable.so for the Python tools (ctypes). lampShim keeps the /tmp/outN.txt
+ *   view up to date for readers of the old files.
+ *
+ */
+
+#ifndef LAMP_TABLE_H
+#define LAMP_TABLE_H
+
+#include <stdint.h> // uint32_t, uint64_t
+
+#define LAMP_TABLE_NAME "/tp2_lamps" /*!> Default shared memory object */
+#define LAMP_TABLE_CHANNELS 64       /*!> Channels in the table */
+
+/**
+ * @brief Channel record, one cache line
+ */
+typedef struct {
+    uint32_t seq;     /*!> Seqlock sequence, odd while a write is in progress */
+    uint32_t value;   /*!> Lamp state, 0 or 1 */
+    uint64_t version; /*!> Changes of the channel, 0 if never set */
+    uint64_t time;    /*!> Wall clock time of the last change, ns since the epoch */
+} __attribute__((aligned(64))) lamp_record_t;
+
+/**
+ * @brief Shared memory layout
+ */
+typedef struct {
+    uint32_t magic;                                /*!> LAMP_TABLE_MAGIC once initialized */
+    uint32_t channels;                             /*!> LAMP_TABLE_CHANNELS */
+    uint32_t changes __attribute__((aligned(64))); /*!> Change counter, futex word */
+    lamp_record_t records[LAMP_TABLE_CHANNELS];    /*!> Channel records */
+} lamp_shared_t;
+
+/**
+ * @brief Open table
+ */
+typedef struct {
+    lamp_shared_t *shared; /*!> Mapping of the shared memory object */
+} lamp_table_t;
+
+/**
+ * @brief Open the table, creating it (all lamps off, version 0) if needed
+ * @param name Shared memory object name, NULL for LAMP_TABLE_NAME
+ * @retval Table, NULL on error (errno set)
+ */
+lamp_table_t *lamp_table_open(const char *name);
+
+/**
+ * @brief Unmap the table, the shared memory object stays
+ */
+void lamp_table_close(lamp_table_t *table);
+
+/**
+ * @brief Read a channel
+ * @param version Changes of the channel, may be NULL
+ * @param time Time of the last change (ns since the epoch), may be NULL
+ * @retval 0 or 1, -1 for a channel out of range
+ */
+int lamp_table_get(lamp_table_t *table, unsigned channel, uint64_t *version, uint64_t *time);
+
+/**
+ * @brief Set a channel, waking the waiters if the value changes
+ * @retval 1 if changed, 0 if it already had the value, -1 for a channel out of range
+ */
+int lamp_table_set(lamp_table_t *table, unsigned channel, int value);
+
+/**
+ * @brief Change counter, to wait for the changes after it
+ */
+uint32_t lamp_table_changes(lamp_table_t *table);
+
+/**
+ * @brief Wait until the change counter differs from changes
+ * @param timeout_ms Max wait, negative to wait forever
+ * @retval Change counter, equal to changes on timeout or signal
+ */
+uint32_t lamp_table_wait(lamp_table_t *table, uint32_t changes, int timeout_ms);
+
+#endif /* LAMP_TABLE_H */
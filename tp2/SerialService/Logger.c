@@ -0,0 +1,159 @@
+/**
+ * @brief Serial service low overhead logger
+ * @author Gonzalo G. Fernandez
+ *
+ */
+
+#include "Logger.h"
+#include <pthread.h>     // pthread_create, pthread_join
+#include <stdarg.h>      // va_list
+#include <stdint.h>      // uint64_t
+#include <stdio.h>       // vsnprintf, fwrite
+#include <string.h>      // strcmp
+#include <sys/eventfd.h> // eventfd
+#include <time.h>        // clock_gettime, localtime_r
+#include <unistd.h>      // read, write, close
+
+#define LOGGER_BATCH 64 /*!> Records written to stdout at once */
+
+/**
+ * @brief Ring record
+ */
+typedef struct {
+    struct timespec time;      /*!> Wall clock time of the record */
+    logger_level_t level;      /*!> Record level */
+    char msg[LOGGER_MSG_SIZE]; /*!> Message, '\0' terminated */
+} logger_record_t;
+
+static const char *logger_names[] = {"off", "error", "warning", "info", "debug"};
+
+logger_level_t logger_level = LOGGER_INFO;
+
+static logger_record_t ring[LOGGER_RING_SIZE]; /*!> Records */
+static uint64_t head;                          /*!> Next record written, producer only */
+static uint64_t tail;                          /*!> Next record read, writer only */
+static unsigned long dropped;                  /*!> Records dropped, ring full */
+static int sleeping;                           /*!> Writer waits on wakeup */
+static int stopping;                           /*!> Writer must drain and exit */
+static int wakeup = -1;                        /*!> eventfd the writer sleeps on */
+static pthread_t writer;                       /*!> Writer thread */
+static bool running = false;                   /*!> Writer thread started */
+
+static void logger_wake(void) {
+    uint64_t one = 1;
+
+    if (sizeof(one) != write(wakeup, &one, sizeof(one)))
+        return; // counter saturated, the writer is awake anyway
+}
+
+/**
+ * @brief Write the records of the ring to stdout in batches
+ * @retval Records written
+ */
+static unsigned logger_drain(void) {
+    char out[LOGGER_BATCH * (LOGGER_MSG_SIZE + 32)];
+    uint64_t end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    unsigned written = 0;
+
+    while (tail != end) {
+        size_t len = 0;
+        for (unsigned i = 0; i < LOGGER_BATCH && tail != end; i++, written++) {
+            logger_record_t *record = &ring[tail % LOGGER_RING_SIZE];
+            struct tm tm;
+            localtime_r(&record->time.tv_sec, &tm);
+            len += strftime(out + len, sizeof(out) - len, "%H:%M:%S", &tm);
+            len += snprintf(out + len, sizeof(out) - len, ".%06ld %-7s %s\r\n",
+                            record->time.tv_nsec / 1000, logger_names[record->level],
+                            record->msg);
+            // Give the slot back once formatted
+            __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+        }
+        fwrite(out, 1, len, stdout);
+        fflush(stdout);
+    }
+    return written;
+}
+
+static void *logger_thread(void *arg) {
+    uint64_t count;
+
+    (void)arg;
+    while (1) {
+        if (0 < logger_drain())
+            continue;
+        if (__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+            logger_drain();
+            return NULL;
+        }
+        // Announce the sleep, then check again: a record published meanwhile either is seen
+        // here or its producer sees sleeping and wakes us up
+        __atomic_store_n(&sleeping, 1, __ATOMIC_SEQ_CST);
+        if (tail != __atomic_load_n(&head, __ATOMIC_SEQ_CST) ||
+            __atomic_load_n(&stopping, __ATOMIC_SEQ_CST)) {
+            __atomic_store_n(&sleeping, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        if (0 > read(wakeup, &count, sizeof(count)))
+            __atomic_store_n(&sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+}
+
+int logger_init(logger_level_t level) {
+    logger_level = level;
+    if (LOGGER_OFF == level)
+        return 0;
+    wakeup = eventfd(0, EFD_CLOEXEC);
+    if (0 > wakeup)
+        return -1;
+    if (0 != pthread_create(&writer, NULL, logger_thread, NULL)) {
+        close(wakeup);
+        wakeup = -1;
+        return -1;
+    }
+    running = true;
+    return 0;
+}
+
+void logger_close(void) {
+    if (!running)
+        return;
+    __atomic_store_n(&stopping, 1, __ATOMIC_SEQ_CST);
+    logger_wake();
+    pthread_join(writer, NULL);
+    close(wakeup);
+    running = false;
+    logger_level = LOGGER_OFF;
+}
+
+int logger_parse_level(const char *name) {
+    for (unsigned i = 0; i < sizeof(logger_names) / sizeof(logger_names[0]); i++) {
+        if (0 == strcmp(name, logger_names[i]))
+            return i;
+    }
+    return -1;
+}
+
+void logger_write(logger_level_t level, const char *fmt, ...) {
+    logger_record_t *record;
+    va_list args;
+
+    if (!running)
+        return;
+    if (LOGGER_RING_SIZE == head - __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) {
+        dropped++;
+        return;
+    }
+    record = &ring[head % LOGGER_RING_SIZE];
+    clock_gettime(CLOCK_REALTIME, &record->time);
+    record->level = level;
+    va_start(args, fmt);
+    vsnprintf(record->msg, sizeof(record->msg), fmt, args);
+    va_end(args);
+
+    __atomic_store_n(&head, head + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sleeping, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&sleeping, 0, __ATOMIC_SEQ_CST))
+        logger_wake();
+}
+
+unsigned long logger_dropped(void) { return dropped; }
@@ -0,0 +1,74 @@
+/**
+ * @brief Serial service low overhead logger
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Records (time, level, message) are formatted into a ring buffer in memory. A writer thread
+ *   drains it to stdout, so logging never blocks the event loop on a write.
+ * - Single producer: only the event loop thread logs. The ring is lock-free, the producer and
+ *   the writer only share the head and tail indexes. The writer sleeps on an eventfd and the
+ *   producer signals it only when it went to sleep, one syscall per burst, not per record.
+ * - When the ring is full the record is dropped and counted, the hot path never waits.
+ * - Records above the configured level are skipped before formatting, LOGGER_OFF disables
+ *   logging.
+ *
+ */
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdbool.h>
+
+#define LOGGER_RING_SIZE 1024 /*!> Records in the ring, power of 2 */
+#define LOGGER_MSG_SIZE 240   /*!> Max message length of a record */
+
+/**
+ * @brief Log levels
+ */
+typedef enum {
+    LOGGER_OFF,     /*!> Nothing is logged */
+    LOGGER_ERROR,   /*!> Errors */
+    LOGGER_WARNING, /*!> Dropped data, refused clients */
+    LOGGER_INFO,    /*!> Connections and protocol changes */
+    LOGGER_DEBUG,   /*!> Every forwarded batch */
+} logger_level_t;
+
+extern logger_level_t logger_level; /*!> Records up to this level are logged */
+
+/**
+ * @brief Log a record if the level is enabled, the arguments are not evaluated otherwise
+ */
+#define logger_printf(level, ...)                                                              \
+    do {                                                                                       \
+        if ((level) <= logger_level)                                                           \
+            logger_write((level), __VA_ARGS__);                                                \
+    } while (0)
+
+/**
+ * @brief Start the writer thread
+ * @retval 0 on success, -1 on error
+ */
+int logger_init(logger_level_t level);
+
+/**
+ * @brief Write what is left in the ring and stop the writer thread
+ */
+void logger_close(void);
+
+/**
+ * @brief Level by name: off, error, warning, info or debug
+ * @retval Level, -1 if unknown
+ */
+int logger_parse_level(const char *name);
+
+/**
+ * @brief Format a record into the ring, use logger_printf
+ */
+void logger_write(logger_level_t level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Records dropped because the ring was full
+ */
+unsigned long logger_dropped(void);
+
+#endif /* LOGGER_H */
@@ -0,0 +1,82 @@
+/**
+ * @brief Serial service metrics: latency histograms and plain text scrape output
+ * @author Gonzalo G. Fernandez
+ *
+ */
+
+#include "Metrics.h"
+#include <stdarg.h> // va_list
+#include <stdio.h>  // vsnprintf
+#include <stdlib.h> // realloc, free
+#include <time.h>   // clock_gettime
+
+#define METRICS_TEXT_MIN 4096 /*!> First allocation of a text buffer */
+
+uint64_t metrics_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void metrics_histogram_add(metrics_histogram_t *hist, uint64_t ns) {
+    uint64_t us = ns / 1000;
+    // Smallest i with us <= 2^i
+    unsigned bucket = (1 >= us) ? 0 : 64 - __builtin_clzll(us - 1);
+
+    if (METRICS_BUCKETS - 1 < bucket)
+        bucket = METRICS_BUCKETS - 1;
+    hist->buckets[bucket]++;
+    hist->count++;
+    hist->sum += ns;
+}
+
+int metrics_printf(metrics_text_t *text, const char *fmt, ...) {
+    va_list args;
+    int len;
+
+    while (1) {
+        size_t room = text->size - text->len;
+        va_start(args, fmt);
+        len = vsnprintf(text->data + text->len, room, fmt, args);
+        va_end(args);
+        if (0 > len)
+            return -1;
+        if ((size_t)len < room) {
+            text->len += len;
+            return 0;
+        }
+
+        // Does not fit, grow and format again
+        size_t size = (text->size < METRICS_TEXT_MIN) ? METRICS_TEXT_MIN : text->size * 2;
+        while (size - text->len <= (size_t)len)
+            size *= 2;
+        char *data = realloc(text->data, size);
+        if (NULL == data)
+            return -1;
+        text->data = data;
+        text->size = size;
+    }
+}
+
+void metrics_print_histogram(metrics_text_t *text, const char *name, const char *labels,
+                             const metrics_histogram_t *hist) {
+    const char *sep = ('\0' == *labels) ? "" : ",";
+    unsigned long cumulative = 0;
+
+    for (unsigned i = 0; i < METRICS_BUCKETS - 1; i++) {
+        cumulative += hist->buckets[i];
+        metrics_printf(text, "%s_bucket{%s%sle=\"%g\"} %lu\n", name, labels, sep,
+                       (double)(1UL << i) * 1e-6, cumulative);
+    }
+    metrics_printf(text, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, sep, hist->count);
+    metrics_printf(text, "%s_sum{%s} %.9f\n", name, labels, hist->sum * 1e-9);
+    metrics_printf(text, "%s_count{%s} %lu\n", name, labels, hist->count);
+}
+
+void metrics_text_free(metrics_text_t *text) {
+    free(text->data);
+    text->data = NULL;
+    text->len = 0;
+    text->size = 0;
+}
@@ -0,0 +1,69 @@
+/**
+ * @brief Serial service metrics: latency histograms and plain text scrape output
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Counters are plain variables of their owners, only the event loop thread updates them.
+ * - Latency histograms have power of 2 buckets from 1 us to about 1 s, adding a sample is a
+ *   couple of instructions.
+ * - The text output follows the Prometheus exposition format: "name{labels} value" lines with
+ *   "# TYPE" comments, histograms as cumulative "_bucket", "_sum" and "_count" series.
+ *
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+#define METRICS_BUCKETS 22 /*!> Buckets up to 2^20 us, and +Inf */
+
+/**
+ * @brief Latency histogram
+ */
+typedef struct {
+    unsigned long buckets[METRICS_BUCKETS]; /*!> Samples per bucket, bucket i up to 2^i us */
+    unsigned long count;                    /*!> Samples */
+    uint64_t sum;                           /*!> Sum of samples, ns */
+} metrics_histogram_t;
+
+/**
+ * @brief Growing text buffer
+ */
+typedef struct {
+    char *data;  /*!> Text, not '\0' terminated */
+    size_t len;  /*!> Length of data */
+    size_t size; /*!> Allocated bytes */
+} metrics_text_t;
+
+/**
+ * @brief Monotonic time, ns
+ */
+uint64_t metrics_now(void);
+
+/**
+ * @brief Add a latency sample
+ * @param ns Latency, ns
+ */
+void metrics_histogram_add(metrics_histogram_t *hist, uint64_t ns);
+
+/**
+ * @brief Append formatted text, the buffer grows as needed
+ * @retval 0 on success, -1 on allocation error
+ */
+int metrics_printf(metrics_text_t *text, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Append the series of a histogram, in seconds
+ * @param labels Labels without braces, e.g. "direction=\"x\"", or ""
+ */
+void metrics_print_histogram(metrics_text_t *text, const char *name, const char *labels,
+                             const metrics_histogram_t *hist);
+
+/**
+ * @brief Free the text buffer
+ */
+void metrics_text_free(metrics_text_t *text);
+
+#endif /* METRICS_H */
@@ -0,0 +1,159 @@
+/**
+ * @brief Serial service output command coalescing and baud rate aware scheduler
+ * @author Gonzalo G. Fernandez
+ *
+ */
+
+#include "OutputScheduler.h"
+#include <stdlib.h> // calloc, free
+
+#define OUTPUT_PENDING 0x01    /*!> Channel has a pending update */
+#define OUTPUT_VALUE 0x02      /*!> State of the pending update */
+#define OUTPUT_QUEUED 0x04     /*!> Channel is in the FIFO */
+#define OUTPUT_WRITTEN 0x08    /*!> A state was written to the serial port */
+#define OUTPUT_WRITTEN_ON 0x10 /*!> State written to the serial port */
+#define OUTPUT_BYPASS 0x20     /*!> Channel bypasses the scheduler */
+
+int output_scheduler_init(output_scheduler_t *sched, unsigned long baudrate,
+                          unsigned interval_ms) {
+    // Pages of the tables are only touched for the channels in use
+    sched->state = calloc(OUTPUT_CHANNELS, sizeof(uint8_t));
+    sched->stamp = calloc(OUTPUT_CHANNELS, sizeof(uint64_t));
+    sched->fifo = calloc(OUTPUT_CHANNELS, sizeof(unsigned));
+    if (NULL == sched->state || NULL == sched->stamp || NULL == sched->fifo) {
+        output_scheduler_free(sched);
+        return -1;
+    }
+    sched->head = 0;
+    sched->count = 0;
+    sched->rate = (double)baudrate / OUTPUT_BITS_PER_BYTE;
+    sched->burst = sched->rate * interval_ms / 1000;
+    if (sched->burst < FRAME_MAX_SIZE)
+        sched->burst = FRAME_MAX_SIZE;
+    sched->credits = sched->burst;
+    sched->last = 0;
+    sched->received = 0;
+    sched->sent = 0;
+    sched->coalesced = 0;
+    sched->cancelled = 0;
+    sched->bypassed = 0;
+    return 0;
+}
+
+void output_scheduler_free(output_scheduler_t *sched) {
+    free(sched->state);
+    free(sched->stamp);
+    free(sched->fifo);
+    sched->state = NULL;
+    sched->stamp = NULL;
+    sched->fifo = NULL;
+}
+
+void output_scheduler_set_bypass(output_scheduler_t *sched, unsigned channel) {
+    if (OUTPUT_CHANNELS > channel)
+        sched->state[channel] |= OUTPUT_BYPASS;
+}
+
+void output_scheduler_reset(output_scheduler_t *sched) {
+    for (unsigned channel = 0; channel < OUTPUT_CHANNELS; channel++)
+        sched->state[channel] &= ~(OUTPUT_WRITTEN | OUTPUT_WRITTEN_ON);
+}
+
+bool output_scheduler_put(output_scheduler_t *sched, const frame_t *frame) {
+    uint8_t *state;
+    bool written;
+
+    sched->received++;
+    if (OUTPUT_CHANNELS <= frame->channel)
+        return false;
+    state = &sched->state[frame->channel];
+    if (*state & OUTPUT_BYPASS) {
+        *state |= OUTPUT_WRITTEN;
+        *state = frame->value ? *state | OUTPUT_WRITTEN_ON : *state & ~OUTPUT_WRITTEN_ON;
+        sched->bypassed++;
+        return false;
+    }
+
+    if (*state & OUTPUT_PENDING) {
+        *state &= ~(OUTPUT_PENDING | OUTPUT_VALUE);
+        sched->coalesced++;
+    } else {
+        sched->stamp[frame->channel] = frame->stamp;
+    }
+    written = (*state & OUTPUT_WRITTEN) && (!(*state & OUTPUT_WRITTEN_ON) == !frame->value);
+    if (written) {
+        // Back to the state of the serial port, nothing to write. Left in the FIFO if queued.
+        sched->cancelled++;
+        return true;
+    }
+    *state |= OUTPUT_PENDING | (frame->value ? OUTPUT_VALUE : 0);
+    if (!(*state & OUTPUT_QUEUED)) {
+        *state |= OUTPUT_QUEUED;
+        sched->fifo[(sched->head + sched->count++) % OUTPUT_CHANNELS] = frame->channel;
+    }
+    return true;
+}
+
+bool output_scheduler_restore(output_scheduler_t *sched, const frame_t *frame) {
+    if (OUTPUT_CHANNELS > frame->channel && (sched->state[frame->channel] & OUTPUT_PENDING))
+        return true;
+    return output_scheduler_put(sched, frame);
+}
+
+bool output_scheduler_pending(const output_scheduler_t *sched) {
+    // A queued channel may have lost its update, take finds out
+    return 0 < sched->count;
+}
+
+void output_scheduler_refill(output_scheduler_t *sched, uint64_t now) {
+    if (0 != sched->last && now > sched->last) {
+        sched->credits += sched->rate * (now - sched->last) * 1e-9;
+        if (sched->credits > sched->burst)
+            sched->credits = sched->burst;
+    }
+    sched->last = now;
+}
+
+size_t output_scheduler_take(output_scheduler_t *sched, frame_t *out, size_t max) {
+    char ascii[FRAME_MAX_SIZE];
+    double budget = sched->credits;
+    size_t taken = 0;
+
+    while (0 < sched->count && taken < max) {
+        unsigned channel = sched->fifo[sched->head];
+        uint8_t *state = &sched->state[channel];
+        frame_t *frame = &out[taken];
+
+        if (!(*state & OUTPUT_PENDING)) { // Cancelled after it was queued
+            *state &= ~OUTPUT_QUEUED;
+            sched->head = (sched->head + 1) % OUTPUT_CHANNELS;
+            sched->count--;
+            continue;
+        }
+        frame->type = FRAME_OUT;
+        frame->channel = channel;
+        frame->value = (*state & OUTPUT_VALUE) ? 1 : 0;
+        frame->data = NULL;
+        frame->len = 0;
+        frame->stamp = sched->stamp[channel];
+        // ASCII is the longest encoding of a single update
+        budget -= frame_encode(frame, ascii);
+        if (0 > budget)
+            break;
+
+        *state &= ~(OUTPUT_PENDING | OUTPUT_VALUE | OUTPUT_QUEUED | OUTPUT_WRITTEN_ON);
+        *state |= OUTPUT_WRITTEN | (frame->value ? OUTPUT_WRITTEN_ON : 0);
+        sched->head = (sched->head + 1) % OUTPUT_CHANNELS;
+        sched->count--;
+        sched->sent++;
+        taken++;
+    }
+    return taken;
+}
+
+void output_scheduler_charge(output_scheduler_t *sched, size_t bytes) {
+    // Debt is bounded, bypass bursts delay the pending updates at most one interval
+    sched->credits -= bytes;
+    if (sched->credits < -sched->burst)
+        sched->credits = -sched->burst;
+}
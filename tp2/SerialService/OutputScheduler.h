@@ -0,0 +1,113 @@
+/**
+ * @brief Serial service output command coalescing and baud rate aware scheduler
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Output updates from the clients are not written to the serial port right away: each channel
+ *   keeps only its last requested state (last writer wins) and a FIFO keeps the order in which
+ *   channels got a pending state. A toggle storm on a channel becomes a single write.
+ * - Only net changes are written: an update back to the state last written to the serial port
+ *   (or equal to it) cancels the pending one.
+ * - Pending updates are drained while a byte budget allows it. The budget is refilled at the
+ *   serial link rate (baudrate / 10 bytes per second, 8N1) up to one flush interval of bytes,
+ *   so the link is never asked for more than it carries.
+ * - Bypass channels are latency critical: their updates skip the cache and are written at
+ *   once. Their bytes are charged to the budget as well, down to one interval of debt.
+ *
+ */
+
+#ifndef OUTPUT_SCHEDULER_H
+#define OUTPUT_SCHEDULER_H
+
+#include "BinaryProtocol.h"
+#include "FrameParser.h"
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uint8_t, uint64_t
+
+#define OUTPUT_CHANNELS (BINARY_CHANNEL_MAX + 1) /*!> Channels tracked, higher ones bypass */
+#define OUTPUT_BITS_PER_BYTE 10                  /*!> Start, 8 data and stop bits */
+
+/**
+ * @brief Output scheduler state
+ */
+typedef struct {
+    uint8_t *state;           /*!> Flags per channel, see OutputScheduler.c */
+    uint64_t *stamp;          /*!> Receive time of the oldest pending update per channel */
+    unsigned *fifo;           /*!> Channels with a pending update, in arrival order */
+    size_t head;              /*!> Oldest channel in fifo */
+    size_t count;             /*!> Channels in fifo */
+    double rate;              /*!> Budget refill, bytes per second */
+    double burst;             /*!> Max budget, bytes */
+    double credits;           /*!> Bytes that can be written now, down to -burst after bypass */
+    uint64_t last;            /*!> Last refill, ns */
+    unsigned long received;   /*!> Updates put */
+    unsigned long sent;       /*!> Updates drained */
+    unsigned long coalesced;  /*!> Pending updates replaced by a newer state */
+    unsigned long cancelled;  /*!> Updates with no net change */
+    unsigned long bypassed;   /*!> Updates on bypass channels */
+} output_scheduler_t;
+
+/**
+ * @brief Initialize scheduler state
+ * @param baudrate Serial link baudrate
+ * @param interval_ms Flush interval, the budget holds up to this time of link bytes
+ * @retval 0 on success, -1 on allocation error
+ */
+int output_scheduler_init(output_scheduler_t *sched, unsigned long baudrate,
+                          unsigned interval_ms);
+
+/**
+ * @brief Free scheduler state
+ */
+void output_scheduler_free(output_scheduler_t *sched);
+
+/**
+ * @brief Write the updates of a channel at once
+ */
+void output_scheduler_set_bypass(output_scheduler_t *sched, unsigned channel);
+
+/**
+ * @brief Forget the states written to the serial port, the next update of every channel is a
+ * change
+ */
+void output_scheduler_reset(output_scheduler_t *sched);
+
+/**
+ * @brief Cache an output update
+ * @retval true if the scheduler takes it, false if the channel bypasses the scheduler and the
+ * caller must write it now
+ */
+bool output_scheduler_put(output_scheduler_t *sched, const frame_t *frame);
+
+/**
+ * @brief Cache the state a channel had before a restart, unless a newer update is pending
+ * @retval Same as output_scheduler_put
+ */
+bool output_scheduler_restore(output_scheduler_t *sched, const frame_t *frame);
+
+/**
+ * @brief There are pending updates
+ */
+bool output_scheduler_pending(const output_scheduler_t *sched);
+
+/**
+ * @brief Add the budget earned since the last refill
+ * @param now Monotonic time, ns
+ */
+void output_scheduler_refill(output_scheduler_t *sched, uint64_t now);
+
+/**
+ * @brief Take the oldest pending updates whose ASCII encoding fits the budget
+ * @note The budget is not charged, the caller charges the bytes actually written
+ * @param out Updates taken, in FIFO order, stamped with the oldest update they replace
+ * @param max Room in out
+ * @retval Updates taken
+ */
+size_t output_scheduler_take(output_scheduler_t *sched, frame_t *out, size_t max);
+
+/**
+ * @brief Charge bytes written to the serial port to the budget
+ */
+void output_scheduler_charge(output_scheduler_t *sched, size_t bytes);
+
+#endif /* OUTPUT_SCHEDULER_H */
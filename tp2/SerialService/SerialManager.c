@@ -2,51 +2,188 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/serial.h> // serial_struct, ASYNC_LOW_LATENCY
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_NODELAY
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <termios.h>
 #include <unistd.h>
 
-static int s;
+static int s = -1;
+static const char *device; // termios device, NULL for the TCP emulator
+
+void serial_set_device(const char *path) { device = path; }
+
+static speed_t serial_speed(int baudrate) {
+    switch (baudrate) {
+    case 9600:
+        return B9600;
+    case 19200:
+        return B19200;
+    case 38400:
+        return B38400;
+    case 57600:
+        return B57600;
+    case 115200:
+        return B115200;
+    case 230400:
+        return B230400;
+    case 460800:
+        return B460800;
+    case 921600:
+        return B921600;
+    case 1000000:
+        return B1000000;
+    case 2000000:
+        return B2000000;
+    case 3000000:
+        return B3000000;
+    case 4000000:
+        return B4000000;
+    default:
+        return B0;
+    }
+}
+
+/**
+ * @brief USB serial adapters (FTDI) hold received bytes up to 16 ms by default, 1 ms is the
+ * lowest. Only for devices that have the attribute and a writable sysfs.
+ */
+static void serial_latency_timer(void) {
+    char path[128];
+    const char *name = strrchr(device, '/');
+    int fd;
+
+    snprintf(path, sizeof(path), "/sys/class/tty/%s/device/latency_timer",
+             name ? name + 1 : device);
+    fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (0 > fd)
+        return;
+    if (0 > write(fd, "1", 1))
+        fprintf(stderr, "WARNING unable to set %s\r\n", path);
+    close(fd);
+}
+
+static int serial_open_device(int baudrate) {
+    struct termios tio;
+    struct serial_struct info;
+    speed_t speed = serial_speed(baudrate);
+
+    if (B0 == speed) {
+        fprintf(stderr, "ERROR unsupported baudrate %d\r\n", baudrate);
+        errno = EINVAL;
+        return -1;
+    }
+    // Missing while the adapter is unplugged, the caller retries
+    s = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (0 > s)
+        return -1;
+    if (0 > tcgetattr(s, &tio)) {
+        perror("ERROR not a serial device");
+        close(s);
+        s = -1;
+        errno = ENOTTY;
+        return -1;
+    }
+    // Raw 8N1, no flow control. VMIN = VTIME = 0: a read returns what has arrived, the caller
+    // waits for data in its event loop.
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (0 > tcsetattr(s, TCSANOW, &tio)) {
+        perror("ERROR unable to configure serial device");
+        close(s);
+        s = -1;
+        errno = EINVAL;
+        return -1;
+    }
+    // Low latency where the driver supports it (a pty does not): received bytes are pushed to
+    // the reader at once instead of on the next flip buffer run
+    if (0 == ioctl(s, TIOCGSERIAL, &info)) {
+        info.flags |= ASYNC_LOW_LATENCY;
+        ioctl(s, TIOCSSERIAL, &info);
+    }
+    serial_latency_timer();
+    ioctl(s, TIOCEXCL); // no other process opens the device meanwhile
+    tcflush(s, TCIOFLUSH);
+    return 0;
+}
 
 int serial_open(int pn, int baudrate) {
-    struct sockaddr_in serveraddr, addr2;
-    int clnt_addr_size;
-    char buf[128];
-    s = socket(PF_INET, SOCK_STREAM, 0);
-    int flags = fcntl(s, F_GETFL);
-    fcntl(s, F_SETFL, flags | O_NONBLOCK);
+    struct sockaddr_in serveraddr;
+    int nodelay = 1;
+
+    if (NULL != device)
+        return serial_open_device(baudrate);
+
+    s = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (0 > s)
+        return -1;
+    // frames are small, send each one without waiting to fill a segment
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
     bzero((char *)&serveraddr, sizeof(serveraddr));
     serveraddr.sin_family = AF_INET;
     serveraddr.sin_port = htons(4040);
     if (inet_pton(AF_INET, "127.0.0.1", &(serveraddr.sin_addr)) <= 0) {
         fprintf(stderr, "ERROR invalid server IP\r\n");
+        serial_close();
+        errno = EINVAL;
         return -1;
     }
 
-    while (1) {
-        printf("conectando a emulador...\n");
-        int connectRes = connect(s, (const struct sockaddr *)&serveraddr, sizeof(serveraddr));
-        printf("connectRes:%d\n", connectRes);
-        if (connectRes >= 0) {
-            usleep(100000);
-            break;
-        }
-        sleep(1);
+    // non-blocking: the caller waits for the fd to be writable, then serial_connect_finish
+    if (0 == connect(s, (const struct sockaddr *)&serveraddr, sizeof(serveraddr)))
+        return 0;
+    if (EINPROGRESS == errno)
+        return 1;
+    serial_close();
+    return -1;
+}
+
+int serial_connect_finish(void) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+
+    if (0 > getsockopt(s, SOL_SOCKET, SO_ERROR, &error, &len))
+        return -1;
+    if (0 != error) {
+        errno = error;
+        return -1;
     }
-    printf("Emulador conectado\n");
     return 0;
 }
 
-void serial_send(char *pData, int size) { write(s, pData, size); }
+int serial_send(char *pData, int size) {
+    // the emulator may be gone, report EPIPE instead of raising SIGPIPE
+    if (NULL == device)
+        return send(s, pData, size, MSG_NOSIGNAL);
+    return write(s, pData, size);
+}
 
-void serial_close(void) { close(s); }
+void serial_close(void) {
+    close(s);
+    s = -1;
+}
 
 int serial_receive(char *buf, int size) {
     int n = read(s, buf, size);
+    // a tty reports the other end hung up (pty master closed, adapter unplugged) with EIO
+    if (0 > n && EIO == errno && NULL != device)
+        return 0;
     return n;
 }
+
+int serial_get_fd(void) { return s; }
+
+// the TCP emulator is a stream socket, a termios device is a tty
+int serial_is_socket(void) { return NULL == device; }
@@ -1,6 +1,22 @@
 
+/**
+ * @brief Serial port backends: the TCP hardware emulator (default) or a termios device
+ * @note serial_set_device before serial_open selects the termios backend, e.g. a USB adapter or
+ * the slave side of a pty pair standing in for the hardware. Both give a non-blocking fd.
+ * serial_send returns the bytes written, fewer (or -1 with EAGAIN) when the device is busy.
+ * serial_open never waits: it returns 0 when the port is open, 1 while the emulator connection
+ * is in progress (wait for the fd to be writable, then serial_connect_finish) and -1 on error.
+ * EINVAL or ENOTTY are configuration errors, anything else may succeed on a retry.
+ * serial_send and serial_receive are synchronous, one syscall per call. The service does its
+ * serial port I/O on serial_get_fd through an I/O engine instead (see IoEngine.h), read/write or
+ * io_uring with queued sends completing later; serial_is_socket tells it how to send.
+ */
 
+void serial_set_device(const char *device);
 int serial_open(int pn, int baudrate);
-void serial_send(char *pData, int size);
+int serial_connect_finish(void);
+int serial_send(char *pData, int size);
 void serial_close(void);
 int serial_receive(char *buf, int size);
+int serial_get_fd(void);
+int serial_is_socket(void);
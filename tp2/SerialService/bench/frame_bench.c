@@ -0,0 +1,173 @@
+/**
+ * @brief Serial service frame parser fuzz and throughput benchmark
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Fuzz: valid frames are mixed with random garbage (any byte but '\n', so garbage never
+ *   completes a frame) and with truncated frames, then fed in random sized chunks. Every valid
+ *   frame must come out, in order and with its channel and value, and nothing else.
+ * - Throughput: a stream of valid frames fed in SERIAL_BUFFER_SIZE reads, with the frames
+ *   appended to a batch like the service does.
+ * - Usage: frame_bench.out [frames]
+ *
+ */
+
+#include <stdio.h>  // printf
+#include <stdlib.h> // strtoul, rand, malloc
+#include <string.h> // memcpy
+#include <time.h>   // clock_gettime
+
+#include "FrameParser.h"
+
+#define BENCH_DEFAULT_FRAMES 1000000
+#define BENCH_READ_SIZE 4096
+#define BENCH_BATCH_SIZE (BENCH_READ_SIZE + FRAME_MAX_SIZE)
+
+/**
+ * @brief Expected frames and check state
+ */
+typedef struct {
+    frame_t *expected;            /*!> Valid frames in stream order */
+    unsigned long count;          /*!> Length of expected */
+    unsigned long next;           /*!> Next frame expected */
+    unsigned long wrong;          /*!> Frames delivered that do not match */
+    char batch[BENCH_BATCH_SIZE]; /*!> Frames appended like the service batches */
+    size_t batch_len;             /*!> Length of batch */
+    unsigned long batches;        /*!> Full batches */
+} bench_check_t;
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Write a valid frame, its fields are saved in expected
+ * @retval Frame length
+ */
+static int bench_frame(char *out, frame_t *expected) {
+    expected->type = (rand() % 2) ? FRAME_SW : FRAME_OUT;
+    expected->channel = rand() % 1000000;
+    expected->value = rand() % 2;
+    return sprintf(out, ">%s:%u,%d%s", FRAME_SW == expected->type ? "SW" : "OUT",
+                   expected->channel, expected->value, (rand() % 4) ? "\r\n" : "\n");
+}
+
+static void bench_check_frame(const frame_t *frame, void *ctx) {
+    bench_check_t *check = ctx;
+    const frame_t *expected = &check->expected[check->next];
+
+    if (check->next >= check->count) {
+        check->wrong++;
+        return;
+    }
+    if (frame->type != expected->type || frame->channel != expected->channel ||
+        frame->value != expected->value)
+        check->wrong++;
+    check->next++;
+}
+
+static void bench_batch_frame(const frame_t *frame, void *ctx) {
+    bench_check_t *check = ctx;
+
+    if (sizeof(check->batch) < check->batch_len + frame->len) {
+        check->batches++;
+        check->batch_len = 0;
+    }
+    memcpy(check->batch + check->batch_len, frame->data, frame->len);
+    check->batch_len += frame->len;
+}
+
+/**
+ * @brief Fuzz run
+ * @retval 0 if every valid frame was delivered and nothing else
+ */
+static int bench_fuzz(unsigned long frames) {
+    bench_check_t check = {0};
+    frame_parser_t parser;
+    char *stream = malloc(frames * 64);
+    size_t len = 0, fed = 0;
+    frame_t noise;
+    char tmp[FRAME_MAX_SIZE + 1];
+
+    check.expected = malloc(frames * sizeof(frame_t));
+    if (NULL == stream || NULL == check.expected)
+        return 1;
+
+    srand(1);
+    for (unsigned long i = 0; i < frames; i++) {
+        int kind = rand() % 8;
+        if (0 == kind) { // garbage
+            for (int n = rand() % 24; 0 < n; n--) {
+                char c = rand() % 256;
+                stream[len++] = ('\n' == c) ? '!' : c;
+            }
+        } else if (1 == kind) { // frame cut short, the next one must survive
+            int n = bench_frame(tmp, &noise);
+            n = 1 + rand() % (n - 2);
+            memcpy(stream + len, tmp, n);
+            len += n;
+        }
+        len += bench_frame(stream + len, &check.expected[check.count++]);
+    }
+
+    frame_parser_init(&parser);
+    while (fed < len) {
+        size_t chunk = 1 + rand() % 64;
+        if (chunk > len - fed)
+            chunk = len - fed;
+        frame_parser_feed(&parser, stream + fed, chunk, bench_check_frame, &check);
+        fed += chunk;
+    }
+
+    printf("Fuzz: %lu bytes, %lu valid frames, %lu delivered, %lu wrong, %lu errors, "
+           "%lu bytes skipped\r\n",
+           (unsigned long)len, check.count, check.next, check.wrong, parser.errors,
+           parser.skipped);
+    free(stream);
+    free(check.expected);
+    return (check.next == check.count && 0 == check.wrong) ? 0 : 1;
+}
+
+/**
+ * @brief Throughput run
+ */
+static void bench_throughput(unsigned long frames) {
+    bench_check_t check = {0};
+    frame_parser_t parser;
+    char *stream = malloc(frames * FRAME_MAX_SIZE);
+    size_t len = 0;
+    frame_t frame;
+    double start, elapsed;
+
+    if (NULL == stream)
+        return;
+    srand(2);
+    for (unsigned long i = 0; i < frames; i++)
+        len += bench_frame(stream + len, &frame);
+
+    frame_parser_init(&parser);
+    start = bench_now();
+    for (size_t fed = 0; fed < len; fed += BENCH_READ_SIZE) {
+        size_t chunk = (len - fed < BENCH_READ_SIZE) ? len - fed : BENCH_READ_SIZE;
+        frame_parser_feed(&parser, stream + fed, chunk, bench_batch_frame, &check);
+    }
+    elapsed = bench_now() - start;
+
+    printf("Throughput: %lu frames (%lu bytes) in %.3f s, %.1f Mframes/s, %.1f MB/s, "
+           "%lu batches\r\n",
+           parser.frames, (unsigned long)len, elapsed, parser.frames / elapsed * 1e-6,
+           len / elapsed * 1e-6, check.batches);
+    free(stream);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long frames = (1 < argc) ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_FRAMES;
+    int rcode;
+
+    rcode = bench_fuzz(frames);
+    bench_throughput(frames);
+    if (0 != rcode)
+        printf("ERROR: fuzz run failed\r\n");
+    return rcode;
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+# tp2 web load run: the device list served by SerialService (-H, with event streams and lamp
+# toggles) and by the python CGI server of tp2/web. Prints both results as one JSON object.
+# Usage: bench/http.sh build_dir service_binary [seconds] [connections] [streams]
+# SERVICE_ARGS are passed to the service, e.g. "-j journal".
+BUILD_DIR=$1
+SERVICE=$2
+SECONDS_RUN=${3:-5}
+CONNECTIONS=${4:-16}
+STREAMS=${5:-100}
+WEB_DIR=$(dirname "$0")/../../web
+
+"$SERVICE" -l warning -H 8080 -W "$WEB_DIR" $SERVICE_ARGS > /dev/null &
+SERVICE_PID=$!
+sleep 0.2
+"$BUILD_DIR"/http_bench.out 8080 /api/devices "$SECONDS_RUN" "$CONNECTIONS" "$STREAMS" \
+    > "$BUILD_DIR"/http_service.json
+RCODE=$?
+kill -INT $SERVICE_PID
+wait $SERVICE_PID
+
+(cd "$WEB_DIR" && exec python3 -m http.server --cgi 8001 > /dev/null 2>&1) &
+CGI_PID=$!
+sleep 1
+"$BUILD_DIR"/http_bench.out 8001 /cgi-bin/getDevices.py "$SECONDS_RUN" "$CONNECTIONS" \
+    > "$BUILD_DIR"/http_cgi.json || RCODE=$?
+kill $CGI_PID
+wait $CGI_PID 2> /dev/null
+
+printf '{"service_args": "%s", "service": %s, "cgi": %s}\n' "$SERVICE_ARGS" \
+    "$(cat "$BUILD_DIR"/http_service.json)" "$(cat "$BUILD_DIR"/http_cgi.json)" \
+    | tee "$BUILD_DIR"/http.json
+exit $RCODE
@@ -0,0 +1,305 @@
+/**
+ * @brief tp2 HTTP load generator for the device list, SerialService -H or the web CGI scripts
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Every connection (a thread each) sends GET path in a loop, one request at a time, and
+ *   measures the time to the whole answer. Kept alive when the server allows it, connected again
+ *   when it closes (HTTP/1.0, CGI).
+ * - With streams, that many connections also hold GET /api/events open and the main thread
+ *   toggles lamp 1 (POST /api/lamp) every HTTP_TOGGLE_MS: the fan-out latency is the time from
+ *   a toggle to its event on each stream.
+ * - Prints one JSON object on stdout: requests per second, latency percentiles, fan-out.
+ * - Usage: http_bench.out port path [seconds] [connections] [streams]
+ *
+ */
+
+#define _GNU_SOURCE // memmem, strcasestr
+
+#include <pthread.h> // pthread_create
+#include <stdbool.h>
+#include <stdio.h>  // printf
+#include <stdlib.h> // strtoul, qsort
+#include <string.h> // memmem, strcasestr
+
+#include <arpa/inet.h>   // inet_pton
+#include <netinet/in.h>  // sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <poll.h>        // poll
+#include <sys/socket.h>  // socket, connect
+#include <time.h>        // clock_gettime
+#include <unistd.h>      // close, usleep
+
+#define HTTP_MAX_CONNECTIONS 256
+#define HTTP_MAX_STREAMS 4096
+#define HTTP_MAX_SAMPLES (1 << 20) /*!> Latency samples kept per connection */
+#define HTTP_TOGGLE_MS 50          /*!> Lamp toggle period with streams */
+#define HTTP_BUFFER_SIZE 65536
+
+/**
+ * @brief One request connection
+ */
+typedef struct {
+    pthread_t thread;       /*!> Connection thread */
+    double *samples;        /*!> Latency of each answer, s */
+    size_t count;           /*!> Answers received */
+    unsigned long errors;   /*!> Failed requests */
+    unsigned long connects; /*!> Connections opened */
+} http_worker_t;
+
+static int port;
+static const char *path;
+static volatile int running = 1;
+static double toggle_time = 0; /*!> Time of the last toggle, 0 before the first one */
+
+static double http_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int http_connect(void) {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    int fd = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (0 > fd)
+        return -1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (0 > connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int http_send_all(int fd, const char *data, size_t len) {
+    while (0 < len) {
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (0 >= sent)
+            return -1;
+        data += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+/**
+ * @brief Send a request and read its whole answer
+ * @retval 1 if the connection stays open, 0 if the server closed it, -1 on error
+ */
+static int http_request(int fd, const char *request, size_t len) {
+    char buffer[HTTP_BUFFER_SIZE];
+    size_t got = 0, body = 0, length = 0;
+    bool parsed = false, has_length = false, keep = false;
+
+    if (0 > http_send_all(fd, request, len))
+        return -1;
+    while (1) {
+        ssize_t n = recv(fd, buffer + got, sizeof(buffer) - got - 1, 0);
+        if (0 > n)
+            return -1;
+        if (0 == n) // Answer ended by the close, CGI
+            return (parsed && !has_length) ? 0 : -1;
+        if (parsed) { // Body bytes are only counted
+            body += n;
+        } else {
+            char *end, *value;
+            size_t end_len = 4;
+            got += n;
+            buffer[got] = '\0';
+            end = strstr(buffer, "\r\n\r\n");
+            if (NULL == end && NULL != (end = strstr(buffer, "\n\n"))) // CGI script headers
+                end_len = 2;
+            if (NULL == end) {
+                if (sizeof(buffer) - 1 == got)
+                    return -1;
+                continue;
+            }
+            *end = '\0';
+            if (0 != strncmp(buffer, "HTTP/1.", 7) || 0 != strncmp(buffer + 8, " 200", 4))
+                return -1;
+            value = strcasestr(buffer, "\r\nContent-Length:");
+            if (NULL != value) {
+                has_length = true;
+                length = strtoul(value + 17, NULL, 10);
+            }
+            keep = '1' == buffer[7] && NULL == strcasestr(buffer, "Connection: close");
+            parsed = true;
+            body = got - (end + end_len - buffer);
+            got = 0;
+        }
+        if (has_length && body >= length)
+            return keep ? 1 : 0;
+    }
+}
+
+static void *http_worker(void *arg) {
+    http_worker_t *worker = arg;
+    char request[512];
+    int len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n",
+                       path);
+    int fd = -1;
+
+    while (running) {
+        double start;
+        int ret;
+        if (0 > fd) {
+            fd = http_connect();
+            if (0 > fd) {
+                worker->errors++;
+                usleep(1000);
+                continue;
+            }
+            worker->connects++;
+        }
+        start = http_now();
+        ret = http_request(fd, request, len);
+        if (0 > ret) {
+            worker->errors++;
+        } else if (HTTP_MAX_SAMPLES > worker->count) {
+            worker->samples[worker->count++] = http_now() - start;
+        }
+        if (1 != ret) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (0 <= fd)
+        close(fd);
+    return NULL;
+}
+
+static int http_compare(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double http_percentile(const double *sorted, size_t count, double p) {
+    return (0 == count) ? 0 : sorted[(size_t)((count - 1) * p)] * 1e3;
+}
+
+int main(int argc, char *argv[]) {
+    static http_worker_t workers[HTTP_MAX_CONNECTIONS];
+    static int streams[HTTP_MAX_STREAMS];
+    static struct pollfd fds[HTTP_MAX_STREAMS];
+    double seconds = 5, start, end, next_toggle, *fanout = NULL, *all;
+    unsigned connections = 16, stream_count = 0, toggles = 0;
+    size_t fanout_count = 0, total = 0;
+    unsigned long errors = 0, connects = 0;
+
+    if (3 > argc) {
+        fprintf(stderr, "Usage: %s port path [seconds] [connections] [streams]\n", argv[0]);
+        return 1;
+    }
+    port = atoi(argv[1]);
+    path = argv[2];
+    if (3 < argc)
+        seconds = atof(argv[3]);
+    if (4 < argc)
+        connections = strtoul(argv[4], NULL, 10);
+    if (5 < argc)
+        stream_count = strtoul(argv[5], NULL, 10);
+    if (0 == connections || HTTP_MAX_CONNECTIONS < connections ||
+        HTTP_MAX_STREAMS < stream_count) {
+        fprintf(stderr, "Up to %d connections and %d streams\n", HTTP_MAX_CONNECTIONS,
+                HTTP_MAX_STREAMS);
+        return 1;
+    }
+
+    // Streams first, their first event is the device list, not a toggle
+    for (unsigned i = 0; i < stream_count; i++) {
+        static const char request[] = "GET /api/events HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+        streams[i] = http_connect();
+        if (0 > streams[i] || 0 > http_send_all(streams[i], request, sizeof(request) - 1)) {
+            fprintf(stderr, "Unable to open event stream %u\n", i);
+            return 1;
+        }
+        fds[i] = (struct pollfd){.fd = streams[i], .events = POLLIN};
+    }
+    if (0 < stream_count)
+        fanout = malloc(HTTP_MAX_SAMPLES * sizeof(double));
+
+    start = http_now();
+    for (unsigned i = 0; i < connections; i++) {
+        workers[i].samples = malloc(HTTP_MAX_SAMPLES * sizeof(double));
+        pthread_create(&workers[i].thread, NULL, http_worker, &workers[i]);
+    }
+
+    // Toggles, and the stream events they cause
+    next_toggle = start + 0.2;
+    while ((end = http_now()) < start + seconds) {
+        char buffer[HTTP_BUFFER_SIZE];
+        if (0 < stream_count && end >= next_toggle) {
+            char request[256];
+            int fd = http_connect(), len;
+            len = snprintf(request, sizeof(request),
+                           "POST /api/lamp?id=dev_1&state=%s HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                           "Content-Length: 0\r\nConnection: close\r\n\r\n",
+                           (toggles % 2) ? "false" : "true");
+            toggle_time = http_now();
+            if (0 > fd || 0 > http_request(fd, request, len))
+                errors++;
+            if (0 <= fd)
+                close(fd);
+            toggles++;
+            next_toggle += HTTP_TOGGLE_MS * 1e-3;
+        }
+        if (0 == stream_count) {
+            usleep(10000);
+            continue;
+        }
+        if (0 >= poll(fds, stream_count, 1))
+            continue;
+        for (unsigned i = 0; i < stream_count; i++) {
+            ssize_t n;
+            if (!(fds[i].revents & POLLIN))
+                continue;
+            n = recv(fds[i].fd, buffer, sizeof(buffer), 0);
+            if (0 >= n) {
+                fds[i].fd = -1;
+                errors++;
+                continue;
+            }
+            // One sample per lamp event after a toggle, switch events are not counted
+            for (char *p = buffer; NULL != (p = memmem(p, buffer + n - p, "event: lamp", 11));
+                 p += 11) {
+                if (0 != toggle_time && HTTP_MAX_SAMPLES > fanout_count)
+                    fanout[fanout_count++] = http_now() - toggle_time;
+            }
+        }
+    }
+    running = 0;
+
+    for (unsigned i = 0; i < connections; i++) {
+        pthread_join(workers[i].thread, NULL);
+        errors += workers[i].errors;
+        connects += workers[i].connects;
+        total += workers[i].count;
+    }
+    all = malloc((total + 1) * sizeof(double));
+    total = 0;
+    for (unsigned i = 0; i < connections; i++) {
+        memcpy(all + total, workers[i].samples, workers[i].count * sizeof(double));
+        total += workers[i].count;
+        free(workers[i].samples);
+    }
+    qsort(all, total, sizeof(double), http_compare);
+    if (0 < fanout_count)
+        qsort(fanout, fanout_count, sizeof(double), http_compare);
+
+    printf("{\"port\": %d, \"path\": \"%s\", \"seconds\": %.3f, \"connections\": %u, "
+           "\"requests\": %zu, \"requests_per_s\": %.1f, \"connects\": %lu, \"errors\": %lu, "
+           "\"latency_ms\": {\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}, "
+           "\"streams\": %u, \"toggles\": %u, \"stream_events\": %zu, "
+           "\"fanout_ms\": {\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}}\n",
+           port, path, end - start, connections, total, total / (end - start), connects, errors,
+           http_percentile(all, total, 0.5), http_percentile(all, total, 0.99),
+           http_percentile(all, total, 1), stream_count, toggles, fanout_count,
+           http_percentile(fanout, fanout_count, 0.5), http_percentile(fanout, fanout_count, 0.99),
+           http_percentile(fanout, fanout_count, 1));
+    for (unsigned i = 0; i < stream_count; i++)
+        close(streams[i]);
+    free(all);
+    free(fanout);
+    return 0;
+}
@@ -0,0 +1,330 @@
+/**
+ * @brief Serial service I/O engines benchmark: syscalls per frame and throughput
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - The bench plays the service over loopback TCP connections, with each engine in turn and an
+ *   epoll loop like the service one (the io_uring engine only has its ring fd in it).
+ * - Receive: a thread writes bursts of ">OUT:" frames on every connection, as clients do, and
+ *   the loop receives and parses them until every frame arrived.
+ * - Send: the loop broadcasts batches of ">SW:" frames to every connection, as the serial reads
+ *   are, one send per connection and batch; a thread reads and counts them. The broadcast stays
+ *   within BENCH_WINDOW batches of what was read, so a socket is never full.
+ * - Syscalls are the engine ones (read, send, io_uring_enter) plus the epoll_wait calls, the
+ *   ones the service makes for the same traffic.
+ * - Usage: io_bench.out [connections] [batches] [frames_per_batch]
+ *
+ */
+
+#define _GNU_SOURCE // accept4
+
+#include <pthread.h> // pthread_create
+#include <stdio.h>   // printf
+#include <stdlib.h>  // strtoul, calloc
+#include <string.h>  // memcpy
+
+#include <arpa/inet.h>   // inet_pton
+#include <netinet/in.h>  // sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <poll.h>        // poll
+#include <sys/epoll.h>   // epoll_create1, epoll_ctl, epoll_wait
+#include <sys/socket.h>  // socket, bind, listen, accept4
+#include <time.h>        // clock_gettime
+#include <unistd.h>      // close
+
+#include "FrameParser.h"
+#include "IoEngine.h"
+
+#define BENCH_DEFAULT_CONNECTIONS 64
+#define BENCH_DEFAULT_BATCHES 10000
+#define BENCH_DEFAULT_FRAMES 8
+#define BENCH_MAX_CONNECTIONS 1024
+#define BENCH_MAX_FRAMES 256
+#define BENCH_WINDOW 64 /*!> Batches broadcast ahead of the reader */
+#define BENCH_MAX_EVENTS 64
+
+/**
+ * @brief One connection, both ends
+ */
+typedef struct {
+    int fd;                /*!> Service end, non-blocking */
+    int peer;              /*!> Client end, blocking */
+    frame_parser_t parser; /*!> Frames received on fd */
+    size_t offset;         /*!> Bytes of the current batch sent */
+    unsigned long batches; /*!> Batches sent */
+    bool sending;          /*!> Send in flight */
+} bench_conn_t;
+
+static bench_conn_t conns[BENCH_MAX_CONNECTIONS];
+static bench_conn_t *conn_table[BENCH_MAX_CONNECTIONS * 2 + 64]; /*!> Connections by fd */
+static unsigned conn_count;
+static unsigned long batch_count;
+static unsigned frames_per_batch;
+static char batch[BENCH_MAX_FRAMES * FRAME_MAX_SIZE]; /*!> Encoded batch, sent to everyone */
+static size_t batch_len;
+static unsigned long frames;         /*!> Frames received by the loop */
+static unsigned long errors;         /*!> Receive errors and ends of stream */
+static volatile unsigned long bytes; /*!> Bytes read by the reader thread */
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_frame(const frame_t *frame, void *ctx) {
+    (void)frame;
+    (void)ctx;
+    frames++;
+}
+
+static void bench_event(const io_event_t *event, void *ctx) {
+    bench_conn_t *conn = conn_table[event->fd];
+
+    (void)ctx;
+    if (IO_SEND == event->op) {
+        conn->sending = false;
+        if (0 > event->res) {
+            errors++;
+            return;
+        }
+        conn->offset += event->res;
+        if (conn->offset == batch_len) {
+            conn->offset = 0;
+            conn->batches++;
+        }
+        return;
+    }
+    if (0 >= event->res) {
+        errors++;
+        return;
+    }
+    frame_parser_feed(&conn->parser, event->data, event->res, bench_frame, NULL);
+}
+
+/**
+ * @brief Loopback connections, the service end non-blocking
+ * @retval 0 on success, -1 on error
+ */
+static int bench_connect(void) {
+    struct sockaddr_in addr = {.sin_family = AF_INET};
+    socklen_t len = sizeof(addr);
+    int server = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (0 > server || 0 > bind(server, (struct sockaddr *)&addr, sizeof(addr)) ||
+        0 > listen(server, BENCH_MAX_CONNECTIONS) ||
+        0 > getsockname(server, (struct sockaddr *)&addr, &len))
+        return -1;
+    for (unsigned i = 0; i < conn_count; i++) {
+        conns[i].peer = socket(AF_INET, SOCK_STREAM, 0);
+        if (0 > conns[i].peer || 0 > connect(conns[i].peer, (struct sockaddr *)&addr, len))
+            return -1;
+        conns[i].fd = accept4(server, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (0 > conns[i].fd || (int)(sizeof(conn_table) / sizeof(*conn_table)) <= conns[i].fd)
+            return -1;
+        setsockopt(conns[i].peer, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(conns[i].fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn_table[conns[i].fd] = &conns[i];
+    }
+    close(server);
+    return 0;
+}
+
+static void bench_disconnect(void) {
+    for (unsigned i = 0; i < conn_count; i++) {
+        conn_table[conns[i].fd] = NULL;
+        close(conns[i].fd);
+        close(conns[i].peer);
+    }
+}
+
+/**
+ * @brief Receive test writer: a burst of ">OUT:" frames on every connection, batch_count times
+ */
+static void *bench_writer(void *arg) {
+    char burst[BENCH_MAX_FRAMES * FRAME_MAX_SIZE];
+    size_t len = 0;
+
+    (void)arg;
+    for (unsigned i = 0; i < frames_per_batch; i++)
+        len += frame_encode(&(frame_t){.type = FRAME_OUT, .channel = i, .value = i % 2},
+                            burst + len);
+    for (unsigned long b = 0; b < batch_count; b++) {
+        for (unsigned i = 0; i < conn_count; i++) {
+            if ((ssize_t)len != send(conns[i].peer, burst, len, MSG_NOSIGNAL))
+                return NULL;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Send test reader: reads every connection until the whole broadcast arrived
+ */
+static void *bench_reader(void *arg) {
+    static struct pollfd fds[BENCH_MAX_CONNECTIONS];
+    unsigned long total = batch_count * conn_count * batch_len;
+    char buffer[65536];
+
+    (void)arg;
+    for (unsigned i = 0; i < conn_count; i++)
+        fds[i] = (struct pollfd){.fd = conns[i].peer, .events = POLLIN};
+    while (bytes < total && 0 < poll(fds, conn_count, 1000)) {
+        for (unsigned i = 0; i < conn_count; i++) {
+            ssize_t n;
+            if (!(fds[i].revents & POLLIN))
+                continue;
+            n = recv(fds[i].fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (0 < n)
+                __atomic_add_fetch(&bytes, n, __ATOMIC_RELEASE);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Wait in epoll and hand what is ready to the engine
+ * @retval epoll_wait calls made, 1
+ */
+static unsigned long bench_wait(io_engine_t *engine, int fd_epoll, int timeout) {
+    struct epoll_event events[BENCH_MAX_EVENTS];
+    int count = epoll_wait(fd_epoll, events, BENCH_MAX_EVENTS, timeout);
+
+    for (int i = 0; i < count; i++) {
+        if (events[i].data.fd == engine->fd)
+            io_engine_complete(engine);
+        else
+            io_engine_read(engine, events[i].data.fd);
+    }
+    io_engine_submit(engine);
+    return 1;
+}
+
+/**
+ * @brief One engine, both tests
+ * @retval 0 on success, -1 on error
+ */
+static int bench_engine(io_engine_kind_t kind) {
+    unsigned long total = batch_count * conn_count * frames_per_batch, waits = 0, syscalls;
+    unsigned long done = 0;
+    struct epoll_event ev = {.events = EPOLLIN};
+    io_engine_t engine;
+    pthread_t thread;
+    double start, seconds;
+    int fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+
+    if (0 > fd_epoll || 0 > bench_connect() ||
+        0 > io_engine_init(&engine, kind, sizeof(conn_table) / sizeof(*conn_table), bench_event,
+                           NULL)) {
+        perror("ERROR: Unable to set up the bench");
+        return -1;
+    }
+    if (0 <= engine.fd) {
+        ev.data.fd = engine.fd;
+        epoll_ctl(fd_epoll, EPOLL_CTL_ADD, engine.fd, &ev);
+    }
+    for (unsigned i = 0; i < conn_count; i++) {
+        frame_parser_init(&conns[i].parser);
+        io_engine_watch(&engine, conns[i].fd, true);
+        ev.events = engine.rx_events;
+        ev.data.fd = conns[i].fd;
+        if (0 != ev.events)
+            epoll_ctl(fd_epoll, EPOLL_CTL_ADD, conns[i].fd, &ev);
+    }
+    io_engine_submit(&engine);
+
+    // Receive
+    frames = errors = 0;
+    syscalls = engine.syscalls;
+    start = bench_now();
+    pthread_create(&thread, NULL, bench_writer, NULL);
+    while (frames < total && 0 == errors)
+        waits += bench_wait(&engine, fd_epoll, 1000);
+    seconds = bench_now() - start;
+    pthread_join(thread, NULL);
+    syscalls = engine.syscalls - syscalls + waits;
+    printf("%s receive: %lu frames in %.3f s, %.0f frames/s, %lu syscalls, %.4f per frame, "
+           "%lu receives, %.1f frames per receive\r\n",
+           engine.ops->name, frames, seconds, frames / seconds, syscalls,
+           (double)syscalls / (frames ? frames : 1), engine.receives,
+           (double)frames / (engine.receives ? engine.receives : 1));
+    if (frames != total)
+        return -1;
+
+    // Send
+    waits = 0;
+    bytes = 0;
+    syscalls = engine.syscalls;
+    start = bench_now();
+    pthread_create(&thread, NULL, bench_reader, NULL);
+    while (done < conn_count && 0 == errors) {
+        unsigned long read_batches =
+            __atomic_load_n(&bytes, __ATOMIC_ACQUIRE) / (batch_len * conn_count);
+        bool queued = false;
+        done = 0;
+        for (unsigned i = 0; i < conn_count; i++) {
+            bench_conn_t *conn = &conns[i];
+            int sent;
+            if (conn->batches == batch_count) {
+                done++;
+                continue;
+            }
+            if (conn->sending || conn->batches >= read_batches + BENCH_WINDOW)
+                continue;
+            sent = io_engine_send(&engine, conn->fd, true, batch + conn->offset,
+                                  batch_len - conn->offset);
+            if (IO_ENGINE_QUEUED == sent) {
+                conn->sending = queued = true;
+            } else if (0 <= sent) {
+                bench_event(&(io_event_t){.op = IO_SEND, .fd = conn->fd, .res = sent}, NULL);
+            }
+        }
+        // The batch of every connection in one submission, then the completions
+        if (queued) {
+            io_engine_submit(&engine);
+            waits += bench_wait(&engine, fd_epoll, 1000);
+        }
+    }
+    pthread_join(thread, NULL);
+    seconds = bench_now() - start;
+    syscalls = engine.syscalls - syscalls + waits;
+    total = batch_count * conn_count * frames_per_batch;
+    printf("%s send: %lu frames in %.3f s, %.0f frames/s, %lu syscalls, %.4f per frame, "
+           "%lu sends\r\n",
+           engine.ops->name, total, seconds, total / seconds, syscalls,
+           (double)syscalls / total, engine.sends);
+
+    for (unsigned i = 0; i < conn_count; i++)
+        io_engine_unwatch(&engine, conns[i].fd);
+    io_engine_free(&engine);
+    bench_disconnect();
+    close(fd_epoll);
+    for (unsigned i = 0; i < conn_count; i++)
+        conns[i] = (bench_conn_t){0};
+    return (0 == errors && bytes == batch_count * conn_count * batch_len) ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    int ret = 0;
+
+    conn_count = (1 < argc) ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_CONNECTIONS;
+    batch_count = (2 < argc) ? strtoul(argv[2], NULL, 10) : BENCH_DEFAULT_BATCHES;
+    frames_per_batch = (3 < argc) ? strtoul(argv[3], NULL, 10) : BENCH_DEFAULT_FRAMES;
+    if (0 == conn_count || BENCH_MAX_CONNECTIONS < conn_count || 0 == batch_count ||
+        0 == frames_per_batch || BENCH_MAX_FRAMES < frames_per_batch) {
+        fprintf(stderr, "Usage: %s [connections] [batches] [frames_per_batch]\r\n", argv[0]);
+        return 1;
+    }
+    for (unsigned i = 0; i < frames_per_batch; i++)
+        batch_len += frame_encode(&(frame_t){.type = FRAME_SW, .channel = i, .value = i % 2},
+                                  batch + batch_len);
+    printf("%u connections, %lu batches of %u frames each way\r\n", conn_count, batch_count,
+           frames_per_batch);
+    if (0 > bench_engine(IO_ENGINE_RW))
+        ret = 1;
+    if (0 > bench_engine(IO_ENGINE_URING))
+        ret = 1;
+    if (0 != ret)
+        printf("ERROR: engine check failed, %lu errors\r\n", errors);
+    return ret;
+}
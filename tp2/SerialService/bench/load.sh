@@ -0,0 +1,29 @@
+#!/bin/sh
+# tp2 end to end load run: load_emulator.out as the hardware, SerialService, load_client.out as
+# the InterfaceService. Prints the results of both generators as one JSON object.
+# Usage: bench/load.sh build_dir service_binary [frames_per_s] [seconds] [channels] [connections]
+# SERVICE_ARGS are passed to the service, e.g. "-b 921600 -i 1".
+BUILD_DIR=$1
+SERVICE=$2
+RATE=${3:-500}
+SECONDS_RUN=${4:-10}
+CHANNELS=${5:-1000}
+CONNECTIONS=${6:-1}
+
+"$BUILD_DIR"/load_emulator.out "$RATE" "$SECONDS_RUN" "$CHANNELS" \
+    > "$BUILD_DIR"/load_emulator.json &
+EMULATOR=$!
+sleep 0.2
+"$SERVICE" -l warning $SERVICE_ARGS > /dev/null &
+SERVICE_PID=$!
+"$BUILD_DIR"/load_client.out 0 "$CONNECTIONS" > "$BUILD_DIR"/load_client.json &
+CLIENT=$!
+
+wait $EMULATOR
+RCODE=$?
+kill -INT $CLIENT $SERVICE_PID
+wait $CLIENT $SERVICE_PID
+printf '{"service_args": "%s", "emulator": %s, "client": %s}\n' "$SERVICE_ARGS" \
+    "$(cat "$BUILD_DIR"/load_emulator.json)" "$(cat "$BUILD_DIR"/load_client.json)" \
+    | tee "$BUILD_DIR"/load.json
+exit $RCODE
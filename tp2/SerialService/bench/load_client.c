@@ -0,0 +1,167 @@
+/**
+ * @brief tp2 load generator standing in for the InterfaceService client
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Connects to SerialService and answers every ">SW:X,Y" with ">OUT:X,Y", the lamp command a
+ *   user toggling an output would send. The answers of one read go out in a single write.
+ * - More connections (second argument) only receive, to load the broadcast path. Every
+ *   connection checks its stream with the frame parser.
+ * - Runs for the given seconds, until SIGINT/SIGTERM or until the echo connection closes, then
+ *   prints one JSON object on stdout with the frames received per second.
+ * - Usage: load_client.out [seconds] [connections]
+ *
+ */
+
+#include <errno.h>  // errno
+#include <signal.h> // sigaction
+#include <stdio.h>  // printf
+#include <stdlib.h> // strtoul
+#include <string.h> // memcpy
+
+#include <arpa/inet.h>   // inet_pton
+#include <netinet/in.h>  // sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <poll.h>        // poll
+#include <sys/socket.h>  // socket, connect
+#include <time.h>        // clock_gettime
+#include <unistd.h>      // close, usleep
+
+#include "FrameParser.h"
+
+#define LOAD_DEFAULT_SECONDS 3600 /*!> Normally stopped by a signal */
+#define LOAD_MAX_CONNECTIONS 64
+#define LOAD_SERVICE_PORT 10000 /*!> Port SerialService listens on */
+#define LOAD_READ_SIZE 4096
+
+/**
+ * @brief One connection to SerialService
+ */
+typedef struct {
+    int fd;                /*!> Socket, -1 once closed */
+    frame_parser_t parser; /*!> Checks the received stream */
+    char *reply;           /*!> Answers of the current read, echo connection only */
+    size_t reply_len;      /*!> Length of reply */
+    unsigned long frames;  /*!> ">SW:" frames received */
+    double first;          /*!> Time of the first frame */
+    double last;           /*!> Time of the last frame */
+} load_conn_t;
+
+static volatile sig_atomic_t stop = 0;
+
+static void load_stop(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static double load_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void load_frame(const frame_t *frame, void *ctx) {
+    load_conn_t *conn = ctx;
+
+    if (FRAME_SW != frame->type)
+        return;
+    conn->frames++;
+    if (NULL == conn->reply)
+        return;
+    // ">SW:X,Y\r\n" becomes ">OUT:X,Y\r\n"
+    memcpy(conn->reply + conn->reply_len, ">OUT", 4);
+    memcpy(conn->reply + conn->reply_len + 4, frame->data + 3, frame->len - 3);
+    conn->reply_len += frame->len + 1;
+}
+
+static int load_connect(void) {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(LOAD_SERVICE_PORT)};
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0), opt = 1;
+
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (0 > connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    return fd;
+}
+
+/**
+ * @brief Read what a connection has and answer it, false when the connection is gone
+ */
+static bool load_receive(load_conn_t *conn) {
+    char buffer[LOAD_READ_SIZE];
+    ssize_t n = recv(conn->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    unsigned long frames = conn->frames;
+
+    if (0 >= n)
+        return 0 != n && (EAGAIN == errno || EINTR == errno);
+    conn->reply_len = 0;
+    frame_parser_feed(&conn->parser, buffer, n, load_frame, conn);
+    if (0 < conn->reply_len && 0 > send(conn->fd, conn->reply, conn->reply_len, MSG_NOSIGNAL))
+        return false;
+    if (frames != conn->frames) {
+        conn->last = load_now();
+        if (0 == frames)
+            conn->first = conn->last;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long seconds = (1 < argc) ? strtoul(argv[1], NULL, 10) : LOAD_DEFAULT_SECONDS;
+    unsigned count = (2 < argc) ? strtoul(argv[2], NULL, 10) : 1;
+    static load_conn_t conns[LOAD_MAX_CONNECTIONS];
+    struct pollfd fds[LOAD_MAX_CONNECTIONS];
+    // Every frame of a read (shortest ">SW:X,Y\n") and a frame split from the last read may need
+    // an answer, one byte longer
+    static char reply[(LOAD_READ_SIZE / 8 + 1) * (FRAME_MAX_SIZE + 1)];
+    struct sigaction sa = {.sa_handler = load_stop};
+    unsigned long frames = 0, errors = 0;
+    double end, first = 0, last = 0;
+
+    if (0 == seconds)
+        seconds = LOAD_DEFAULT_SECONDS;
+    if (0 == count || LOAD_MAX_CONNECTIONS < count)
+        count = 1;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    for (unsigned i = 0; i < count && !stop; i++) {
+        // SerialService may not be listening yet
+        while (!stop && 0 > (conns[i].fd = load_connect()))
+            usleep(10000);
+        frame_parser_init(&conns[i].parser);
+    }
+    conns[0].reply = reply;
+
+    end = load_now() + seconds;
+    while (!stop && -1 != conns[0].fd && load_now() < end) {
+        for (unsigned i = 0; i < count; i++)
+            fds[i] = (struct pollfd){.fd = conns[i].fd, .events = POLLIN};
+        if (0 >= poll(fds, count, 100))
+            continue;
+        for (unsigned i = 0; i < count; i++) {
+            if (fds[i].revents && !load_receive(&conns[i])) {
+                close(conns[i].fd);
+                conns[i].fd = -1;
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        if (-1 != conns[i].fd)
+            close(conns[i].fd);
+        frames += conns[i].frames;
+        errors += conns[i].parser.errors + conns[i].parser.skipped;
+        if (0 < conns[i].frames && (0 == first || conns[i].first < first))
+            first = conns[i].first;
+        if (conns[i].last > last)
+            last = conns[i].last;
+    }
+    printf("{\"generator\": \"client\", \"connections\": %u, \"frames\": %lu, \"answered\": %lu, "
+           "\"parse_errors\": %lu, \"frames_per_s\": %.1f}\n",
+           count, frames, conns[0].frames, errors,
+           (last > first) ? frames / (last - first) : 0.0);
+    return 0;
+}
@@ -0,0 +1,207 @@
+/**
+ * @brief tp2 load generator standing in for the hardware emulator (Emulador.py)
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Listens on the emulator port and, once SerialService connects, injects ">SW:" frames at a
+ *   fixed rate. SerialService writes every switch state back as ">OUT:" through its output
+ *   scheduler, so each ">OUT:" coming back closes the round trip through the service's read,
+ *   dispatch and write path. load_client.out answers every switch event with the ">OUT:"
+ *   command the InterfaceService would send, which coalesces with the service's own.
+ * - Frame i goes to channel i % channels with value (i / channels) % 2, so the frames in flight
+ *   are on different channels and the output scheduler never coalesces two of them, and every
+ *   reuse of a channel is a net change. A channel reused before its answer arrived counts as
+ *   lost.
+ * - Before the run a probe frame every PROBE_MS waits for the first answer, so the client may
+ *   start late. After the run answers are awaited for DRAIN_MS.
+ * - The result is printed as one JSON object on stdout.
+ * - Usage: load_emulator.out [frames_per_s] [seconds] [channels]
+ *
+ */
+
+#include <errno.h>  // errno
+#include <stdio.h>  // printf
+#include <stdlib.h> // strtoul, qsort, calloc
+#include <string.h> // strlen
+
+#include <arpa/inet.h>   // inet_pton
+#include <netinet/in.h>  // sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <poll.h>        // poll
+#include <sys/socket.h>  // socket, bind, listen, accept
+#include <time.h>        // clock_gettime
+#include <unistd.h>      // close
+
+#include "FrameParser.h"
+
+#define LOAD_DEFAULT_RATE 500
+#define LOAD_DEFAULT_SECONDS 10
+#define LOAD_DEFAULT_CHANNELS 1000
+#define LOAD_EMULATOR_PORT 4040 /*!> Port SerialService connects to */
+#define LOAD_MAX_BURST 256      /*!> Frames written at once when behind schedule */
+#define LOAD_PROBE_MS 100       /*!> Probe period while waiting for the client */
+#define LOAD_DRAIN_MS 1000      /*!> Wait for late answers after the run */
+
+/**
+ * @brief Run state
+ */
+typedef struct {
+    double *sent_at;        /*!> Send time of the frame in flight per channel, 0 when none */
+    int *value;             /*!> Value of the frame in flight per channel */
+    double *samples;        /*!> Round trip times, us */
+    unsigned long received; /*!> Answers matched, length of samples */
+    unsigned long capacity; /*!> Size of samples */
+    unsigned long stray;    /*!> Answers matching no frame in flight */
+    unsigned channels;      /*!> Channels used */
+} load_run_t;
+
+static double load_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int load_compare(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void load_answer(const frame_t *frame, void *ctx) {
+    load_run_t *run = ctx;
+    unsigned channel = frame->channel;
+
+    if (FRAME_OUT != frame->type || channel >= run->channels || 0 == run->sent_at[channel] ||
+        frame->value != run->value[channel]) {
+        run->stray++;
+        return;
+    }
+    if (run->received < run->capacity)
+        run->samples[run->received++] = (load_now() - run->sent_at[channel]) * 1e6;
+    run->sent_at[channel] = 0;
+}
+
+/**
+ * @brief Read the answers the serial link has, false when SerialService is gone
+ */
+static bool load_receive(int fd, frame_parser_t *parser, load_run_t *run, int timeout_ms) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    char buffer[4096];
+    ssize_t n;
+
+    if (0 >= poll(&pfd, 1, timeout_ms))
+        return true;
+    while (0 < (n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)))
+        frame_parser_feed(parser, buffer, n, load_answer, run);
+    return 0 != n && (EAGAIN == errno || EINTR == errno);
+}
+
+static int load_send(int fd, load_run_t *run, unsigned long first, unsigned long count) {
+    char frames[LOAD_MAX_BURST * FRAME_MAX_SIZE];
+    double now = load_now();
+    size_t len = 0;
+
+    for (unsigned long i = first; i < first + count; i++) {
+        unsigned channel = i % run->channels;
+        run->value[channel] = (i / run->channels) % 2;
+        run->sent_at[channel] = now;
+        len += sprintf(frames + len, ">SW:%u,%d\r\n", channel, run->value[channel]);
+    }
+    return ((ssize_t)len == send(fd, frames, len, MSG_NOSIGNAL)) ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(LOAD_EMULATOR_PORT)};
+    unsigned long rate = (1 < argc) ? strtoul(argv[1], NULL, 10) : LOAD_DEFAULT_RATE;
+    unsigned long seconds = (2 < argc) ? strtoul(argv[2], NULL, 10) : LOAD_DEFAULT_SECONDS;
+    load_run_t run = {.channels = (3 < argc) ? strtoul(argv[3], NULL, 10) : LOAD_DEFAULT_CHANNELS};
+    unsigned long sent = 0, first, lost;
+    frame_parser_t parser;
+    double start, end, elapsed;
+    int server, hw, opt = 1;
+    bool up = true;
+
+    if (0 == rate)
+        rate = LOAD_DEFAULT_RATE;
+    if (0 == seconds)
+        seconds = LOAD_DEFAULT_SECONDS;
+    if (0 == run.channels || 100000 <= run.channels)
+        run.channels = LOAD_DEFAULT_CHANNELS;
+    run.capacity = rate * seconds;
+    run.sent_at = calloc(run.channels, sizeof(double));
+    run.value = calloc(run.channels, sizeof(int));
+    run.samples = calloc(run.capacity, sizeof(double));
+    if (NULL == run.sent_at || NULL == run.value || NULL == run.samples) {
+        perror("ERROR: Unable to allocate the run");
+        return 1;
+    }
+
+    server = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (0 > bind(server, (struct sockaddr *)&addr, sizeof(addr)) || 0 > listen(server, 1)) {
+        perror("ERROR: Unable to listen on the emulator port");
+        return 1;
+    }
+    hw = accept(server, NULL, NULL);
+    if (0 > hw) {
+        perror("ERROR: Unable to accept SerialService");
+        return 1;
+    }
+    setsockopt(hw, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    frame_parser_init(&parser);
+
+    // Wait for the client: probes until one is answered
+    while (0 == run.received && up) {
+        if (0 > load_send(hw, &run, sent++, 1))
+            up = false;
+        up = up && load_receive(hw, &parser, &run, LOAD_PROBE_MS);
+    }
+    run.received = 0;
+    run.stray = 0;
+    for (unsigned i = 0; i < run.channels; i++)
+        run.sent_at[i] = 0;
+
+    // Paced run: frames due so far are written at once, answers read in between. The sequence
+    // goes on from the probes, so no frame repeats the last value of its channel.
+    first = sent;
+    start = load_now();
+    end = start + seconds;
+    for (double now = start; up && now < end; now = load_now()) {
+        unsigned long due = first + (unsigned long)((now - start) * rate);
+        if (due > first + run.capacity)
+            due = first + run.capacity;
+        if (due > sent) {
+            unsigned long count = (due - sent > LOAD_MAX_BURST) ? LOAD_MAX_BURST : due - sent;
+            if (0 > load_send(hw, &run, sent, count))
+                break;
+            sent += count;
+        }
+        up = load_receive(hw, &parser, &run, (due > sent) ? 0 : 1);
+    }
+    elapsed = load_now() - start;
+    for (double drain = load_now() + LOAD_DRAIN_MS * 1e-3; up && run.received < sent - first;) {
+        double left = drain - load_now();
+        if (0 >= left)
+            break;
+        up = load_receive(hw, &parser, &run, left * 1e3 + 1);
+    }
+    close(hw);
+    close(server);
+
+    sent -= first;
+    lost = sent - run.received;
+    qsort(run.samples, run.received, sizeof(double), load_compare);
+    printf("{\"generator\": \"emulator\", \"rate\": %lu, \"seconds\": %lu, \"channels\": %u, "
+           "\"sent\": %lu, \"received\": %lu, \"lost\": %lu, \"stray\": %lu, "
+           "\"parse_errors\": %lu, \"frames_per_s\": %.1f",
+           rate, seconds, run.channels, sent, run.received, lost, run.stray, parser.errors,
+           run.received / elapsed);
+    if (0 < run.received)
+        printf(", \"latency_us\": {\"min\": %.1f, \"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f}",
+               run.samples[0], run.samples[run.received / 2],
+               run.samples[run.received * 99 / 100], run.samples[run.received - 1]);
+    printf("}\n");
+    free(run.sent_at);
+    free(run.value);
+    free(run.samples);
+    return up || 0 < run.received ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+/**
+ * @brief Serial service ASCII vs binary protocol benchmark
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Random channel updates are encoded in bursts, like a flush of the service batches, in ASCII
+ *   and in binary. Bytes per update give the updates per second a serial link carries at the
+ *   given baud rate (8N1, 10 bits per byte).
+ * - The binary stream is decoded back and the final state of every channel is checked. Then one
+ *   bit is flipped in 1 of every 100 frames, every corrupted frame must be dropped.
+ * - Usage: protocol_bench.out [baudrate] [channels] [updates]
+ *
+ */
+
+#include <stdint.h> // uint8_t
+#include <stdio.h>  // printf
+#include <stdlib.h> // strtoul, rand, malloc
+#include <string.h> // memset
+#include <time.h>   // clock_gettime
+
+#include "BinaryProtocol.h"
+#include "FrameParser.h"
+
+#define BENCH_DEFAULT_BAUDRATE 115200
+#define BENCH_DEFAULT_CHANNELS 3
+#define BENCH_DEFAULT_UPDATES 1000000
+#define BENCH_BITS_PER_BYTE 10 /*!> Start, 8 data and stop bits */
+
+/**
+ * @brief Decoded state check
+ */
+typedef struct {
+    int8_t *state;         /*!> Last value per channel, -1 never set */
+    unsigned long updates; /*!> Updates decoded */
+} bench_state_t;
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_state_frame(const frame_t *frame, void *ctx) {
+    bench_state_t *check = ctx;
+
+    check->state[frame->channel] = frame->value;
+    check->updates++;
+}
+
+/**
+ * @brief Encode updates in bursts and report bytes per update and link rate of both encodings
+ * @retval 0 if the binary stream decodes to the same channel states
+ */
+static int bench_burst(const frame_t *updates, unsigned long count, unsigned burst,
+                       unsigned long channels, unsigned long baudrate) {
+    char *ascii = malloc(count * FRAME_MAX_SIZE), *binary = malloc(count * BINARY_UPDATE_MAX);
+    int8_t *expected = malloc(channels);
+    bench_state_t check = {malloc(channels), 0};
+    binary_parser_t parser;
+    size_t ascii_len = 0, binary_len = 0;
+    double start, encode_time, decode_time;
+    uint8_t seq = 0;
+    int rcode = 0;
+
+    if (NULL == ascii || NULL == binary || NULL == expected || NULL == check.state)
+        return 1;
+    memset(expected, -1, channels);
+    memset(check.state, -1, channels);
+    for (unsigned long i = 0; i < count; i++) {
+        ascii_len += frame_encode(&updates[i], ascii + ascii_len);
+        expected[updates[i].channel] = updates[i].value;
+    }
+
+    start = bench_now();
+    for (unsigned long i = 0; i < count; i += burst)
+        binary_len += binary_encode(updates + i, (count - i < burst) ? count - i : burst, &seq,
+                                    binary + binary_len);
+    encode_time = bench_now() - start;
+
+    binary_parser_init(&parser);
+    start = bench_now();
+    binary_parser_feed(&parser, binary, binary_len, bench_state_frame, &check);
+    decode_time = bench_now() - start;
+    if (0 != memcmp(expected, check.state, channels) || 0 != parser.errors || 0 != parser.lost)
+        rcode = 1;
+
+    printf("Burst %4u: ASCII %5.2f B/update %7.0f updates/s | binary %5.2f B/update "
+           "%7.0f updates/s (x%.1f) | encode %.1f M/s, decode %.1f M/s%s\r\n",
+           burst, (double)ascii_len / count,
+           (double)baudrate / BENCH_BITS_PER_BYTE / ascii_len * count, (double)binary_len / count,
+           (double)baudrate / BENCH_BITS_PER_BYTE / binary_len * count,
+           (double)ascii_len / binary_len, count / encode_time * 1e-6,
+           check.updates / decode_time * 1e-6, rcode ? " ERROR: state mismatch" : "");
+    free(ascii);
+    free(binary);
+    free(expected);
+    free(check.state);
+    return rcode;
+}
+
+/**
+ * @brief Corrupt 1 of every 100 frames with a single bit flip, all of them must be dropped
+ * @retval 0 if every corrupted frame was dropped
+ */
+static int bench_corruption(const frame_t *updates, unsigned long count, unsigned long channels) {
+    char *binary = malloc(count * BINARY_UPDATE_MAX);
+    bench_state_t check = {malloc(channels), 0};
+    binary_parser_t parser;
+    unsigned long frames = 0, corrupted = 0;
+    size_t len = 0;
+    uint8_t seq = 0;
+
+    if (NULL == binary || NULL == check.state)
+        return 1;
+    srand(3);
+    for (unsigned long i = 0; i < count; i++, frames++) {
+        size_t size = binary_encode(&updates[i], 1, &seq, binary + len);
+        if (0 == rand() % 100) {
+            // Not the SOF, a lost SOF only hides the frame
+            binary[len + 1 + rand() % (size - 1)] ^= 1 << (rand() % 8);
+            corrupted++;
+        }
+        len += size;
+    }
+    binary_parser_init(&parser);
+    binary_parser_feed(&parser, binary, len, bench_state_frame, &check);
+
+    printf("Corruption: %lu of %lu frames corrupted, %lu valid, %lu dropped, %lu lost by SEQ\r\n",
+           corrupted, frames, parser.frames, parser.errors, parser.lost);
+    free(binary);
+    free(check.state);
+    return (parser.frames == frames - corrupted) ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long baudrate = (1 < argc) ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_BAUDRATE;
+    unsigned long channels = (2 < argc) ? strtoul(argv[2], NULL, 10) : BENCH_DEFAULT_CHANNELS;
+    unsigned long count = (3 < argc) ? strtoul(argv[3], NULL, 10) : BENCH_DEFAULT_UPDATES;
+    static const unsigned bursts[] = {1, 3, 8, 64, 1024};
+    frame_t *updates;
+    int rcode = 0;
+
+    if (0 == channels || BINARY_CHANNEL_MAX < channels - 1 || 0 == count || 0 == baudrate) {
+        fprintf(stderr, "Usage: %s [baudrate] [channels] [updates]\r\n", argv[0]);
+        return 1;
+    }
+    if (NULL == (updates = malloc(count * sizeof(frame_t))))
+        return 1;
+    srand(1);
+    for (unsigned long i = 0; i < count; i++) {
+        updates[i].type = FRAME_OUT;
+        updates[i].channel = rand() % channels;
+        updates[i].value = rand() % 2;
+    }
+
+    printf("%lu baud, %lu channels, %lu updates\r\n", baudrate, channels, count);
+    for (unsigned i = 0; i < sizeof(bursts) / sizeof(bursts[0]); i++)
+        rcode |= bench_burst(updates, count, bursts[i], channels, baudrate);
+    rcode |= bench_corruption(updates, count, channels);
+    free(updates);
+    if (0 != rcode)
+        printf("ERROR: protocol check failed\r\n");
+    return rcode;
+}
@@ -0,0 +1,167 @@
+/**
+ * @brief Serial service channel registry update and snapshot benchmark
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - Single updates: random channels set to random states, as the clients and the web do.
+ * - Range updates: random ranges and "all off / all on" done by the registry a word at a time,
+ *   against the same ranges done one channel at a time, with the changed channels walked as the
+ *   service forwards them.
+ * - Snapshots: copies of the state and known bitsets.
+ * - Every state is checked against a plain byte per channel reference, and every changed bitset
+ *   against the channels that really changed.
+ * - Usage: registry_bench.out [channels] [updates]
+ *
+ */
+
+#include <stdio.h>  // printf
+#include <stdlib.h> // strtoul, rand, malloc
+#include <string.h> // memset
+#include <time.h>   // clock_gettime
+
+#include "ChannelRegistry.h"
+
+#define BENCH_DEFAULT_CHANNELS 65536
+#define BENCH_DEFAULT_UPDATES 1000000
+#define BENCH_RANGES 10000 /*!> Range updates of each run */
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Compare the registry with the reference states
+ * @retval Channels that differ
+ */
+static unsigned long bench_check(const channel_registry_t *registry, const signed char *states) {
+    unsigned long wrong = 0;
+
+    for (unsigned i = 0; i < registry->count; i++)
+        wrong += channel_registry_get(registry, i) != states[i];
+    return wrong;
+}
+
+/**
+ * @brief Random range of channels, one in eight is every channel
+ */
+static void bench_range(unsigned channels, unsigned *first, unsigned *last) {
+    if (0 == rand() % 8) {
+        *first = 0;
+        *last = channels - 1;
+        return;
+    }
+    *first = rand() % channels;
+    *last = *first + rand() % (channels - *first);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long channels = (1 < argc) ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_CHANNELS;
+    unsigned long count = (2 < argc) ? strtoul(argv[2], NULL, 10) : BENCH_DEFAULT_UPDATES;
+    unsigned long wrong = 0, changes = 0, walked = 0, snapshots;
+    channel_registry_t registry, naive;
+    unsigned *channel_list, *first_list, *last_list;
+    uint64_t *changed, *state, *known;
+    signed char *states;
+    double start, single_s, range_s, walk_s, naive_s, snapshot_s;
+    int *value_list;
+
+    if (0 == channels || CHANNEL_REGISTRY_MAX < channels || 0 == count) {
+        fprintf(stderr, "Usage: %s [channels] [updates]\r\n", argv[0]);
+        return 1;
+    }
+    channel_list = malloc(count * sizeof(unsigned));
+    value_list = malloc(count * sizeof(int));
+    first_list = malloc(BENCH_RANGES * sizeof(unsigned));
+    last_list = malloc(BENCH_RANGES * sizeof(unsigned));
+    states = malloc(channels);
+    changed = calloc(CHANNEL_REGISTRY_WORDS(channels), sizeof(uint64_t));
+    state = calloc(CHANNEL_REGISTRY_WORDS(channels), sizeof(uint64_t));
+    known = calloc(CHANNEL_REGISTRY_WORDS(channels), sizeof(uint64_t));
+    if (NULL == channel_list || NULL == value_list || NULL == first_list || NULL == last_list ||
+        NULL == states || NULL == changed || NULL == state || NULL == known ||
+        0 > channel_registry_init(&registry, channels) ||
+        0 > channel_registry_init(&naive, channels))
+        return 1;
+    memset(states, -1, channels);
+    srand(1);
+    for (unsigned long i = 0; i < count; i++) {
+        channel_list[i] = rand() % channels;
+        value_list[i] = rand() % 2;
+    }
+    for (unsigned i = 0; i < BENCH_RANGES; i++)
+        bench_range(channels, &first_list[i], &last_list[i]);
+    printf("%lu channels, %zu bytes of state, %zu bytes of metadata\r\n", channels,
+           2 * registry.words * sizeof(uint64_t), channels * sizeof(channel_info_t));
+
+    // Single updates
+    start = bench_now();
+    for (unsigned long i = 0; i < count; i++)
+        channel_registry_set(&registry, channel_list[i], value_list[i]);
+    single_s = bench_now() - start;
+    for (unsigned long i = 0; i < count; i++)
+        states[channel_list[i]] = value_list[i];
+    wrong += bench_check(&registry, states);
+    printf("Single: %lu updates, %.1f ns per update, %lu changed\r\n", count,
+           single_s * 1e9 / count, registry.changes);
+
+    // Range updates a word at a time, then the changed channels walked as the service forwards
+    // them: the walk is O(changes), paid only for the channels that really changed
+    range_s = walk_s = 0;
+    for (unsigned i = 0; i < BENCH_RANGES; i++) {
+        size_t range_changes;
+        start = bench_now();
+        range_changes = channel_registry_set_range(&registry, first_list[i], last_list[i], i % 2,
+                                                   changed);
+        range_s += bench_now() - start;
+        changes += range_changes;
+        start = bench_now();
+        for (unsigned c = channel_registry_next(changed, first_list[i], channels); c < channels;
+             c = channel_registry_next(changed, c + 1, channels))
+            walked++;
+        walk_s += bench_now() - start;
+    }
+
+    // The same ranges a channel at a time
+    for (unsigned long i = 0; i < count; i++)
+        channel_registry_set(&naive, channel_list[i], value_list[i]);
+    start = bench_now();
+    for (unsigned i = 0; i < BENCH_RANGES; i++) {
+        for (unsigned c = first_list[i]; c <= last_list[i]; c++)
+            channel_registry_set(&naive, c, i % 2);
+    }
+    naive_s = bench_now() - start;
+    for (unsigned i = 0; i < BENCH_RANGES; i++)
+        memset(states + first_list[i], i % 2, last_list[i] - first_list[i] + 1);
+    wrong += bench_check(&registry, states) + bench_check(&naive, states);
+    wrong += walked != changes;
+    printf("Range: %d updates, %.1f ns per update (%.1f ns one channel at a time, %.1fx), "
+           "%lu channels changed, %.2f ns per changed channel walked\r\n",
+           BENCH_RANGES, range_s * 1e9 / BENCH_RANGES, naive_s * 1e9 / BENCH_RANGES,
+           naive_s / range_s, changes, walk_s * 1e9 / (changes ? changes : 1));
+
+    // Snapshots
+    snapshots = count / 100 + 1;
+    start = bench_now();
+    for (unsigned long i = 0; i < snapshots; i++) {
+        channel_registry_snapshot(&registry, state, known);
+        __asm__ volatile("" : : "r"(state), "r"(known) : "memory"); // Copies are not dropped
+    }
+    snapshot_s = bench_now() - start;
+    wrong += 0 != memcmp(state, registry.state, registry.words * sizeof(uint64_t));
+    printf("Snapshot: %lu copies, %.1f ns per copy\r\n", snapshots, snapshot_s * 1e9 / snapshots);
+
+    channel_registry_free(&registry);
+    channel_registry_free(&naive);
+    free(channel_list);
+    free(value_list);
+    free(first_list);
+    free(last_list);
+    free(states);
+    free(changed);
+    free(state);
+    free(known);
+    if (0 != wrong)
+        printf("ERROR: registry check failed, %lu wrong\r\n", wrong);
+    return (0 == wrong) ? 0 : 1;
+}
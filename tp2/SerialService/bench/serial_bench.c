@@ -0,0 +1,159 @@
+/**
+ * @brief Serial port backends round trip latency benchmark
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - The bench plays the hardware on the other end of the serial port: the master side of a pty
+ *   pair for the termios backend, or a TCP server on the emulator port for the TCP backend.
+ * - Each round trip writes a frame from the hardware end, waits for it on the serial port fd
+ *   with epoll like the service does, echoes it with serial_send and reads it back on the
+ *   hardware end.
+ * - The emulator port must be free for the TCP run (Emulador.py not running).
+ * - Usage: serial_bench.out [round_trips]
+ *
+ */
+
+#define _GNU_SOURCE // posix_openpt, ptsname
+
+#include <stdio.h>  // printf
+#include <stdlib.h> // strtoul, qsort, malloc
+#include <string.h> // strlen
+
+#include <arpa/inet.h>   // inet_pton
+#include <fcntl.h>       // O_RDWR
+#include <netinet/in.h>  // sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <sys/epoll.h>   // epoll_create1, epoll_ctl, epoll_wait
+#include <sys/socket.h>  // socket, bind, listen, accept
+#include <termios.h>     // cfmakeraw
+#include <time.h>        // clock_gettime
+#include <unistd.h>
+
+#include "SerialManager.h"
+
+#define BENCH_DEFAULT_ROUND_TRIPS 10000
+#define BENCH_EMULATOR_PORT 4040 /*!> Port the TCP backend connects to */
+#define BENCH_FRAME ">SW:1,1\r\n"
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int bench_compare(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Round trips over an open serial port, hw is the hardware end
+ * @retval 0 on success
+ */
+static int bench_round_trips(const char *name, int hw, unsigned long count) {
+    const char *frame = BENCH_FRAME;
+    size_t len = strlen(frame);
+    double *samples = malloc(count * sizeof(double));
+    struct epoll_event ev = {.events = EPOLLIN}, out;
+    char buffer[64];
+    int fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+
+    ev.data.fd = serial_get_fd();
+    if (NULL == samples || 0 > fd_epoll || 0 > epoll_ctl(fd_epoll, EPOLL_CTL_ADD, ev.data.fd, &ev))
+        return 1;
+    for (unsigned long i = 0; i < count; i++) {
+        double start = bench_now();
+        size_t received = 0;
+
+        if ((ssize_t)len != write(hw, frame, len))
+            return 1;
+        while (received < len) {
+            int n;
+            if (1 != epoll_wait(fd_epoll, &out, 1, 1000))
+                return 1;
+            n = serial_receive(buffer + received, sizeof(buffer) - received);
+            if (0 < n)
+                received += n;
+        }
+        serial_send(buffer, received);
+        for (received = 0; received < len;) {
+            ssize_t n = read(hw, buffer, sizeof(buffer));
+            if (0 >= n)
+                return 1;
+            received += n;
+        }
+        samples[i] = (bench_now() - start) * 1e6;
+    }
+
+    qsort(samples, count, sizeof(double), bench_compare);
+    printf("%s: %lu round trips, min %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\r\n", name,
+           count, samples[0], samples[count / 2], samples[count * 99 / 100], samples[count - 1]);
+    free(samples);
+    close(fd_epoll);
+    return 0;
+}
+
+/**
+ * @brief termios backend on the slave side of a pty pair
+ */
+static int bench_pty(unsigned long count) {
+    struct termios tio;
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC), rcode;
+
+    if (0 > master || 0 > grantpt(master) || 0 > unlockpt(master)) {
+        perror("ERROR: Unable to open pty");
+        return 1;
+    }
+    // No line discipline processing on the hardware end either
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+
+    serial_set_device(ptsname(master));
+    if (0 > serial_open(0, 115200))
+        return 1;
+    rcode = bench_round_trips("pty", master, count);
+    serial_close();
+    close(master);
+    return rcode;
+}
+
+/**
+ * @brief TCP emulator backend
+ */
+static int bench_tcp(unsigned long count) {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(BENCH_EMULATOR_PORT)};
+    int server = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0), hw, rcode, opt = 1;
+
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (0 > bind(server, (struct sockaddr *)&addr, sizeof(addr)) || 0 > listen(server, 1)) {
+        perror("ERROR: Unable to listen on the emulator port");
+        return 1;
+    }
+
+    serial_set_device(NULL);
+    if (0 > serial_open(0, 115200))
+        return 1;
+    hw = accept(server, NULL, NULL);
+    if (0 > hw)
+        return 1;
+    setsockopt(hw, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    rcode = bench_round_trips("tcp", hw, count);
+    serial_close();
+    close(hw);
+    close(server);
+    return rcode;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long count = (1 < argc) ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_ROUND_TRIPS;
+    int rcode;
+
+    if (0 == count)
+        count = BENCH_DEFAULT_ROUND_TRIPS;
+    rcode = bench_pty(count);
+    rcode |= bench_tcp(count);
+    if (0 != rcode)
+        printf("ERROR: serial latency run failed\r\n");
+    return rcode;
+}
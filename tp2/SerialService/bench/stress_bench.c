@@ -0,0 +1,238 @@
+/**
+ * @brief Serial service stress run: switch floods and client churn against a running service
+ * @author Gonzalo G. Fernandez
+ * @note
+ * - The bench plays the hardware emulator (TCP server on the emulator port) and starts the
+ *   service binary given as first argument, e.g. the ThreadSanitizer build (make tsan).
+ * - While the hardware end floods switch frames, clients connect and disconnect at random after
+ *   a short life, each one sending output frames. Every byte both ends receive goes through the
+ *   frame parser: a torn or mixed frame is an error.
+ * - At the end the service gets SIGINT and must exit with status 0. Built with
+ *   -fsanitize=thread, any data race report turns the exit status into 66.
+ * - The emulator and service ports must be free (Emulador.py and serialService not running).
+ * - Usage: stress_bench.out service_binary [seconds] [clients]
+ *
+ */
+
+#include <errno.h>  // errno
+#include <signal.h> // kill, SIGINT
+#include <stdio.h>  // printf
+#include <stdlib.h> // strtoul, rand
+#include <string.h> // strlen
+
+#include <arpa/inet.h>   // inet_pton
+#include <fcntl.h>       // open
+#include <netinet/in.h>  // sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <poll.h>        // poll
+#include <sys/socket.h>  // socket, bind, listen, accept, connect
+#include <sys/wait.h>    // waitpid
+#include <time.h>        // clock_gettime
+#include <unistd.h>      // fork, execv
+
+#include "FrameParser.h"
+
+#define BENCH_DEFAULT_SECONDS 10
+#define BENCH_DEFAULT_CLIENTS 16
+#define BENCH_MAX_CLIENTS 256
+#define BENCH_EMULATOR_PORT 4040 /*!> Port the service connects to */
+#define BENCH_SERVICE_PORT 10000 /*!> Port the service listens on */
+#define BENCH_CHANNELS 64        /*!> Channels used by the generated frames */
+#define BENCH_SW_PER_ROUND 32    /*!> Switch frames written per loop round */
+#define BENCH_MAX_LIFE_MS 200    /*!> Longest client connection */
+
+/**
+ * @brief One end receiving frames from the service
+ */
+typedef struct {
+    int fd;                /*!> Socket, -1 when closed */
+    double close_at;       /*!> Time the client disconnects */
+    frame_parser_t parser; /*!> Checks the received stream */
+} bench_peer_t;
+
+static unsigned long frames_sw;  /*!> Switch frames received by the clients */
+static unsigned long frames_out; /*!> Output frames received by the hardware end */
+static unsigned long errors;     /*!> Torn frames or bytes outside frames */
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_frame(const frame_t *frame, void *ctx) {
+    frame_type_t expected = *(frame_type_t *)ctx;
+
+    if (expected != frame->type)
+        errors++;
+    else if (FRAME_SW == frame->type)
+        frames_sw++;
+    else
+        frames_out++;
+}
+
+/**
+ * @brief Read what a peer has, false when the connection is gone
+ */
+static bool bench_receive(bench_peer_t *peer, frame_type_t expected) {
+    char buffer[4096];
+    ssize_t n;
+
+    while (0 < (n = recv(peer->fd, buffer, sizeof(buffer), MSG_DONTWAIT)))
+        frame_parser_feed(&peer->parser, buffer, n, bench_frame, &expected);
+    return 0 != n && (EAGAIN == errno || EINTR == errno);
+}
+
+static void bench_disconnect(bench_peer_t *peer) {
+    errors += peer->parser.errors + peer->parser.skipped;
+    close(peer->fd);
+    peer->fd = -1;
+}
+
+static int bench_connect(int port) {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0), opt = 1;
+
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (0 > connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    return fd;
+}
+
+/**
+ * @brief Start the service as a child process, its output to /dev/null
+ */
+static pid_t bench_service(const char *path) {
+    char *argv[] = {(char *)path, "-l", "warning", NULL};
+    pid_t pid = fork();
+
+    if (0 == pid) {
+        int null = open("/dev/null", O_WRONLY);
+        signal(SIGPIPE, SIG_DFL); // A write to a closed client must not kill the service
+        dup2(null, STDOUT_FILENO);
+        execv(path, argv);
+        perror("ERROR: Unable to start the service");
+        _exit(127);
+    }
+    return pid;
+}
+
+int main(int argc, char *argv[]) {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(BENCH_EMULATOR_PORT)};
+    double seconds = (2 < argc) ? strtoul(argv[2], NULL, 10) : BENCH_DEFAULT_SECONDS;
+    unsigned count = (3 < argc) ? strtoul(argv[3], NULL, 10) : BENCH_DEFAULT_CLIENTS;
+    static bench_peer_t clients[BENCH_MAX_CLIENTS];
+    struct pollfd fds[BENCH_MAX_CLIENTS + 1];
+    bench_peer_t hw = {.fd = -1};
+    unsigned long connects = 0, refused = 0, sent_sw = 0, sent_out = 0;
+    int server, opt = 1, status;
+    double end;
+    pid_t pid;
+
+    if (2 > argc) {
+        printf("Usage: %s service_binary [seconds] [clients]\r\n", argv[0]);
+        return 1;
+    }
+    if (0 == count || BENCH_MAX_CLIENTS < count)
+        count = BENCH_DEFAULT_CLIENTS;
+    signal(SIGPIPE, SIG_IGN);
+    server = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (0 > bind(server, (struct sockaddr *)&addr, sizeof(addr)) || 0 > listen(server, 1)) {
+        perror("ERROR: Unable to listen on the emulator port");
+        return 1;
+    }
+    pid = bench_service(argv[1]);
+    if (0 > pid || 0 > (hw.fd = accept(server, NULL, NULL))) {
+        perror("ERROR: Service did not connect");
+        return 1;
+    }
+    setsockopt(hw.fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    frame_parser_init(&hw.parser);
+    // The service may not be listening yet
+    while (0 > (opt = bench_connect(BENCH_SERVICE_PORT)))
+        usleep(10000);
+    close(opt);
+    for (unsigned i = 0; i < count; i++)
+        clients[i].fd = -1;
+
+    srand(1);
+    end = bench_now() + seconds;
+    for (double now = bench_now(); now < end; now = bench_now()) {
+        char frames[BENCH_SW_PER_ROUND * FRAME_MAX_SIZE];
+        size_t len = 0;
+
+        // Hardware end: a burst of switch events, whole frames only
+        for (unsigned i = 0; i < BENCH_SW_PER_ROUND; i++)
+            len += sprintf(frames + len, ">SW:%d,%d\r\n", rand() % BENCH_CHANNELS, rand() % 2);
+        if ((ssize_t)len == send(hw.fd, frames, len, MSG_NOSIGNAL))
+            sent_sw += BENCH_SW_PER_ROUND;
+
+        // Client churn
+        for (unsigned i = 0; i < count; i++) {
+            bench_peer_t *client = &clients[i];
+            if (-1 == client->fd) {
+                if (0 != rand() % 4)
+                    continue;
+                client->fd = bench_connect(BENCH_SERVICE_PORT);
+                if (-1 == client->fd) {
+                    refused++;
+                    continue;
+                }
+                connects++;
+                frame_parser_init(&client->parser);
+                client->close_at = now + (rand() % BENCH_MAX_LIFE_MS) * 1e-3;
+            } else if (now > client->close_at) {
+                bench_disconnect(client);
+                continue;
+            }
+            len = sprintf(frames, ">OUT:%d,%d\r\n", rand() % BENCH_CHANNELS, rand() % 2);
+            if ((ssize_t)len == send(client->fd, frames, len, MSG_DONTWAIT | MSG_NOSIGNAL))
+                sent_out++;
+        }
+
+        // Whatever arrived meanwhile
+        fds[0] = (struct pollfd){.fd = hw.fd, .events = POLLIN};
+        for (unsigned i = 0; i < count; i++)
+            fds[i + 1] = (struct pollfd){.fd = clients[i].fd, .events = POLLIN};
+        poll(fds, count + 1, 1);
+        if (fds[0].revents && !bench_receive(&hw, FRAME_OUT)) {
+            printf("ERROR: Service closed the serial port\r\n");
+            errors++;
+            break;
+        }
+        for (unsigned i = 0; i < count; i++) {
+            if (fds[i + 1].revents && !bench_receive(&clients[i], FRAME_SW))
+                bench_disconnect(&clients[i]); // Dropped by the service, e.g. slow client
+        }
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        if (-1 != clients[i].fd)
+            bench_disconnect(&clients[i]);
+    }
+    kill(pid, SIGINT);
+    waitpid(pid, &status, 0);
+    bench_receive(&hw, FRAME_OUT);
+    errors += hw.parser.errors + hw.parser.skipped;
+    close(hw.fd);
+    close(server);
+
+    printf("%.0f s: %lu client connects (%lu refused), SW %lu sent %lu received, "
+           "OUT %lu sent %lu received, %lu errors\r\n",
+           seconds, connects, refused, sent_sw, frames_sw, sent_out, frames_out, errors);
+    if (!WIFEXITED(status) || 0 != WEXITSTATUS(status)) {
+        printf("ERROR: service exit status %d\r\n",
+               WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+        return 1;
+    }
+    if (0 < errors) {
+        printf("ERROR: torn frames\r\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+#!/bin/sh
+# tp2 check of the hardware switches on the web: an emulator stand-in sends ">SW:0,1" to
+# SerialService -H and the event stream must carry the "lamp" event of lamp 1, then
+# /api/devices must report lamp 1 on and the device must get ">OUT:0,1" back with no
+# InterfaceService connected. Exits 1 on failure.
+# Usage: bench/switch_events.sh service_binary [http_port]
+SERVICE=$1
+PORT=${2:-18080}
+EVENTS=$(mktemp)
+OUTPUTS=$(mktemp)
+
+python3 -c '
+import socket, sys, time
+server = socket.socket()
+server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+server.bind(("127.0.0.1", 4040))
+server.listen(1)
+conn, _ = server.accept()
+time.sleep(1)
+conn.sendall(b">SW:0,1\r\n")
+conn.settimeout(2)
+received = b""
+try:
+    while b">OUT:0,1\r\n" not in received:
+        data = conn.recv(256)
+        if not data:
+            break
+        received += data
+except socket.timeout:
+    pass
+open(sys.argv[1], "wb").write(received)
+time.sleep(1)
+' "$OUTPUTS" &
+EMULATOR=$!
+sleep 0.2
+"$SERVICE" -l warning -H "$PORT" > /dev/null &
+SERVICE_PID=$!
+sleep 0.3
+curl -sN --max-time 2 "http://127.0.0.1:$PORT/api/events" > "$EVENTS"
+DEVICES=$(curl -s "http://127.0.0.1:$PORT/api/devices")
+kill -INT $SERVICE_PID
+wait $SERVICE_PID $EMULATOR
+
+RCODE=0
+if ! grep -A1 '^event: lamp' "$EVENTS" | grep -q '"id": "1", "state": "1"'; then
+    echo "No lamp event for >SW:0,1:"
+    cat "$EVENTS"
+    RCODE=1
+fi
+if ! echo "$DEVICES" | grep -q '"id": "1", "name": "Lampara 1", [^}]*"state": "1"'; then
+    echo "Lamp 1 not on in /api/devices: $DEVICES"
+    RCODE=1
+fi
+if ! grep -q '^>OUT:0,1' "$OUTPUTS"; then
+    echo "Output 0 not driven for >SW:0,1: $(cat "$OUTPUTS")"
+    RCODE=1
+fi
+[ 0 = $RCODE ] && echo "Switch events: ok"
+rm -f "$EVENTS" "$OUTPUTS"
+exit $RCODE
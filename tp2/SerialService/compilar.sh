@@ -1 +1,3 @@
-gcc -pthread main.c SerialManager.c -o serialService
+gcc -Wall -Werror -pthread main.c SerialManager.c IoEngine.c ClientManager.c FrameParser.c BinaryProtocol.c OutputScheduler.c Logger.c Journal.c FileBridge.c HttpServer.c ChannelRegistry.c Metrics.c -o serialService
+gcc -Wall -Werror -fPIC -shared LampTable.c -o liblamptable.so
+gcc -Wall -Werror -pthread LampShim.c LampTable.c -o lampShim
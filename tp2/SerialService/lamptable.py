@@ -0,0 +1,47 @@
+# 	 SOPG 2018. TP 2.
+#    Lamp state table in shared memory (see LampTable.h), for the Python tools.
+#    Lamp N is channel N - 1. Needs liblamptable.so (make) next to this file.
+import ctypes
+import os.path
+
+_lib = ctypes.CDLL(os.path.join(os.path.dirname(os.path.abspath(__file__)), "liblamptable.so"),
+		use_errno=True)
+_lib.lamp_table_open.restype = ctypes.c_void_p
+_lib.lamp_table_open.argtypes = [ctypes.c_char_p]
+_lib.lamp_table_close.argtypes = [ctypes.c_void_p]
+_lib.lamp_table_get.argtypes = [ctypes.c_void_p, ctypes.c_uint,
+		ctypes.POINTER(ctypes.c_uint64), ctypes.POINTER(ctypes.c_uint64)]
+_lib.lamp_table_set.argtypes = [ctypes.c_void_p, ctypes.c_uint, ctypes.c_int]
+_lib.lamp_table_changes.restype = ctypes.c_uint32
+_lib.lamp_table_changes.argtypes = [ctypes.c_void_p]
+_lib.lamp_table_wait.restype = ctypes.c_uint32
+_lib.lamp_table_wait.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_int]
+
+class LampTable(object):
+	def __init__(self):
+		self.table = _lib.lamp_table_open(None)
+		if not self.table:
+			errno = ctypes.get_errno()
+			raise OSError(errno, os.strerror(errno))
+
+	def get(self, channel):
+		# (value, version, time in ns since the epoch)
+		version = ctypes.c_uint64()
+		when = ctypes.c_uint64()
+		value = _lib.lamp_table_get(self.table, channel, ctypes.byref(version), ctypes.byref(when))
+		return (value, version.value, when.value)
+
+	def set(self, channel, value):
+		return _lib.lamp_table_set(self.table, channel, 1 if value else 0)
+
+	def changes(self):
+		return _lib.lamp_table_changes(self.table)
+
+	def wait(self, changes, timeoutMs):
+		# Change counter, equal to changes on timeout
+		return _lib.lamp_table_wait(self.table, changes, timeoutMs)
+
+	def close(self):
+		if self.table:
+			_lib.lamp_table_close(self.table)
+			self.table = None
@@ -1,137 +1,331 @@
 /**
  * @brief Serial service
  * @author Gonzalo G. Fernandez
+ * @note
+ * - Single thread event loop (epoll) over the serial port, the TCP server socket, the client
+ *   connection and a signalfd for SIGINT/SIGTERM. Every fd is non-blocking and the loop sleeps in
+ *   epoll_wait until one of them is ready, so a switch event is forwarded as soon as it arrives
+ *   and the service uses no CPU while idle.
+ * - The event loop thread is the only owner of every fd: it is the only one reading, writing and
+ *   closing them. Output the serial device does not take at once waits in a buffer written on
+ *   EPOLLOUT. A closed client leaves the event loop at once but its fd is closed at the end of
+ *   the loop iteration, so no event of the iteration can reach a new connection reusing it.
+ * - Many clients at once (up to -c, default SERIAL_MAX_CLIENTS). Data from the serial port is
+ *   broadcast to every client through its own bounded send queue (see ClientManager.h); a full
+ *   queue drops its oldest message (-o drop, default) or disconnects the client (-o disconnect).
+ *   Frames from any client are merged into the serial port output.
+ * - Both directions go through the frame parser (see FrameParser.h): only valid frames are
+ *   forwarded, ">SW:" from the serial port and ">OUT:" from the clients. The frames of one serial
+ *   read are broadcast as a single batch, and the frames of every client served in one event
+ *   loop wakeup are written to the serial port with a single write.
+ * - The serial device and each client may negotiate the binary protocol (see BinaryProtocol.h).
+ *   Frames are decoded to channel updates and encoded again for every peer in its own protocol,
+ *   so ASCII and binary peers can be mixed.
+ * - Output updates go through the output scheduler (see OutputScheduler.h): only the net change
+ *   of each channel is written, within the byte budget of the serial link baudrate (-b). The
+ *   first update after a quiet flush interval (-i ms) is written at once, later ones wait for
+ *   the interval timer so bursts coalesce. Bypass channels (-p, comma separated) are never held.
+ * - The serial port is the TCP hardware emulator, or a termios device (-d, see SerialManager.h).
+ *   It is opened without blocking the event loop: the emulator connection completes on
+ *   EPOLLOUT and a failed attempt or a lost link is retried on a timer, from
+ *   SERIAL_RECONNECT_MIN_MS doubling up to SERIAL_RECONNECT_MAX_MS. Clients stay connected
+ *   meanwhile, and their commands wait in the output scheduler until the link is back.
+ * - With -j, every switch and output state goes to a persistent journal (see Journal.h). On
+ *   start the journal replay restores the last known states: the outputs are written to the
+ *   serial device every time it connects and each new client gets the switch states. The state
+ *   of a channel at a past time is served on the stats socket:
+ *   curl "http://127.0.0.1:10001/journal?channel=1&time=1700000000.5"
+ * - With -w, the service watches the lamp state files of a directory itself (inotify, see
+ *   FileBridge.h): a file change is an output update as if a client sent it, and switch updates
+ *   are written back to the files. Web toggles reach the serial port in milliseconds without
+ *   InterfaceService, which can still connect as a client.
+ * - The requested state of every lamp lives in the channel registry (see ChannelRegistry.h):
+ *   -L lamps (default SERIAL_CHANNELS, up to CHANNEL_REGISTRY_MAX), lamp N being channel N - 1,
+ *   with their types and descriptions read from -M. A range of lamps is set at once, only the
+ *   lamps that change are forwarded.
+ * - With -H, an HTTP server (see HttpServer.h) replaces the web CGI scripts: GET /api/devices
+ *   answers the device list from the registry (a page of it with first and count), POST
+ *   /api/lamp (id, state) sets a lamp as a client ">OUT:" would, a range ("id=N-M") or every
+ *   lamp ("id=all"), and GET /api/events is a server-sent events stream: the device list, then
+ *   one event per lamp change, per range set and per switch update. A ">SW:X,Y" from the serial
+ *   port sets lamp X + 1 and writes it to the device, its "lamp" event reaches the page.
+ *   Static files are served from -W.
+ * - The serial port and client receives and the serial port sends go through an I/O engine
+ *   (-e, see IoEngine.h): rw, a read or write per readiness (default), or uring, io_uring
+ *   multishot receives into registered buffers and every send of a loop iteration submitted at
+ *   once. Without io_uring the service falls back to rw.
+ * - Metrics (frames, bytes, errors, queues, latency histograms, see Metrics.h) are served in
+ *   plain text on a local stats socket: curl http://127.0.0.1:10001/metrics. Its connections are
+ *   HTTP connections (see HttpServer.h), a split request waits for the rest and a long answer
+ *   is written as the socket takes it. Events go through
+ *   the ring buffer logger (see Logger.h) at the level given by -l, every forwarded batch at
+ *   debug level.
+ * - Usage: serialService [-c max_clients] [-o drop|disconnect] [-b baudrate] [-i interval_ms]
+ *   [-p channel,...] [-d device] [-l off|error|warning|info|debug] [-j journal_file]
+ *   [-w lamp_files_dir] [-H http_port] [-W web_dir] [-L channels] [-M channels_file]
+ *   [-e rw|uring]
  *
  */
 
+#define _GNU_SOURCE // accept4
+
+#include "BinaryProtocol.h"
+#include "ChannelRegistry.h"
+#include "ClientManager.h"
+#include "FileBridge.h"
+#include "FrameParser.h"
+#include "HttpServer.h"
+#include "IoEngine.h"
+#include "Journal.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "OutputScheduler.h"
 #include "SerialManager.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-#include <arpa/inet.h>  // inet_pton, inet_ntop
-#include <errno.h>      // errno
-#include <netinet/in.h> // sockaddr_in
-#include <pthread.h>    // pthread_create, pthread_join, pthread_mutex, pthread_sigmask
-#include <signal.h>     // sigaction
+#include <arpa/inet.h>    // inet_pton, inet_ntop
+#include <errno.h>        // errno
+#include <fcntl.h>        // fcntl
+#include <netinet/in.h>   // sockaddr_in
+#include <signal.h>       // sigprocmask
 #include <string.h>
-#include <strings.h>    // bzero
-#include <sys/socket.h> // socket, bind, listen, accept
+#include <strings.h>      // bzero
+#include <sys/epoll.h>    // epoll_create1, epoll_ctl, epoll_wait
+#include <sys/resource.h> // getrlimit
+#include <sys/signalfd.h> // signalfd
+#include <sys/socket.h>   // socket, bind, listen, accept
+#include <sys/timerfd.h>  // timerfd_create, timerfd_settime
+#include <sys/uio.h>      // writev
+#include <time.h>         // clock_gettime
 #include <unistd.h>
 
 #define SERIAL_PORT_BAUDRATE 115200        /*!> Serial service device baudrate */
-#define SERIAL_MSG_LENGTH 12               /*!> Serial protocol message length */
 #define SERIAL_SERVICE_SERVER_PORT 10000   /*!> TCP server port */
 #define SERIAL_SERVICE_IP_ADDR "127.0.0.1" /*!> TCP server IP address */
+#define SERIAL_STATS_PORT 10001            /*!> Metrics scrape port, on SERIAL_SERVICE_IP_ADDR */
+#define SERIAL_BUFFER_SIZE 4096            /*!> Journal states sent at once to a new client */
+#define SERIAL_TX_BUFFER_SIZE 65536        /*!> Serial port output waiting for the device */
+#define SERIAL_MAX_EVENTS 64               /*!> epoll events handled per wakeup */
+#define SERIAL_MAX_CLIENTS 1024            /*!> Default max concurrent clients */
+#define SERIAL_BATCH_UPDATES 1024          /*!> Channel updates forwarded at once */
+#define SERIAL_FLUSH_INTERVAL_MS 10        /*!> Default output scheduler flush interval */
+#define SERIAL_RECONNECT_MIN_MS 1          /*!> First serial port retry delay */
+#define SERIAL_RECONNECT_MAX_MS 500        /*!> Longest serial port retry delay */
+#define SERIAL_HTTP_MAX 4096               /*!> Max concurrent HTTP connections */
+#define SERIAL_CHANNELS 3                  /*!> Default lamps of the registry (-L) */
+
+/**
+ * @brief Channel updates waiting to be forwarded together, and their encodings
+ */
+typedef struct {
+    frame_type_t type;                                     /*!> Frame type of this direction */
+    void (*flush)(void);                                   /*!> Forward the batch */
+    frame_t updates[SERIAL_BATCH_UPDATES];                 /*!> Updates in arrival order */
+    size_t count;                                          /*!> Length of updates */
+    char ascii[SERIAL_BATCH_UPDATES * FRAME_MAX_SIZE];     /*!> ASCII encoding */
+    size_t ascii_len;                                      /*!> Length of ascii */
+    char binary[SERIAL_BATCH_UPDATES * BINARY_UPDATE_MAX]; /*!> Binary encoding */
+    size_t binary_len;                                     /*!> Length of binary */
+    uint8_t seq;                                           /*!> SEQ of the next binary frame */
+    unsigned long frames;                                  /*!> Updates forwarded */
+    unsigned long ignored;                                 /*!> Other direction frames, dropped */
+} frame_batch_t;
+
+bool serial_lock;               /*!> Flag for serial connected */
+bool serial_connecting = false; /*!> Emulator connection in progress */
+bool server_lock;               /*!> Flag for TCP/IP server running */
+
+int fd_socket = -1; /*!> Server socket file descriptor (to accept new connection) */
+int fd_epoll = -1;  /*!> Event loop file descriptor */
+int fd_signal = -1; /*!> signalfd for SIGINT and SIGTERM */
+int fd_timer = -1;  /*!> timerfd of the output scheduler flush interval */
+int fd_retry = -1;  /*!> timerfd of the next serial port connection attempt */
+int fd_stats = -1;  /*!> Metrics scrape socket */
+int fd_bridge = -1; /*!> inotify of the lamp state files */
+int fd_http = -1;   /*!> HTTP server socket */
+
+client_t **clients;                                   /*!> Connected clients */
+int client_count = 0;                                 /*!> Length of clients */
+int client_max;                                       /*!> Max connected clients */
+client_t **client_table;                              /*!> Connected clients by socket fd */
+client_t **client_closing;                            /*!> Clients closed in this iteration */
+int client_closing_count = 0;                         /*!> Length of client_closing */
+int client_table_size;                                /*!> Length of client_table, max open fds */
+client_overflow_t client_policy = CLIENT_DROP_OLDEST; /*!> Full client queue policy */
+bool *stats_table;                                    /*!> HTTP connections of fd_stats */
 
-bool serial_lock; /*!> Flag for serial connected */
-bool client_lock; /*!> Flag for client connected */
-bool server_lock; /*!> Flag for TCP/IP server running */
+frame_parser_t serial_parser;         /*!> Frames received from the serial port */
+binary_parser_t serial_binary_parser; /*!> Serial port frames after binary negotiation */
+bool serial_binary = false;           /*!> Serial port negotiated the binary protocol */
+frame_batch_t egress_batch;           /*!> Switch updates of one serial read, to clients */
+frame_batch_t ingress_batch;          /*!> Output updates from clients, to the serial port */
+unsigned long client_errors;          /*!> Malformed frames received from clients */
+unsigned long client_lost;            /*!> Binary frames from clients lost on the way */
+unsigned long client_bytes;           /*!> Bytes sent to clients already closed */
+unsigned long client_dropped;         /*!> Messages dropped for clients already closed */
+unsigned long client_connects;        /*!> Clients accepted */
+unsigned long client_refused;         /*!> Clients refused, too many */
+unsigned long client_rx_bytes;        /*!> Bytes read from clients */
+unsigned long serial_rx_bytes;        /*!> Bytes read from the serial port */
+unsigned long serial_tx_bytes;        /*!> Bytes written to the serial port */
+unsigned long serial_connects;        /*!> Serial port connections */
+unsigned long serial_disconnects;     /*!> Serial port connections lost */
+unsigned long serial_attempts;        /*!> Serial port connection attempts */
+unsigned long serial_errors;          /*!> Malformed frames of previous serial connections */
+unsigned long serial_lost;            /*!> Binary frames lost in previous serial connections */
+unsigned serial_backoff_ms;           /*!> Delay of the next serial port retry */
+uint64_t service_start;               /*!> Service start time, ns */
+uint64_t serial_ready;                /*!> Service start to first serial connection, ns */
+uint64_t serial_down_stamp;           /*!> Time the serial link was lost, ns */
+metrics_histogram_t serial_recovery;  /*!> Serial link lost to connected again */
+metrics_histogram_t egress_latency;   /*!> Serial port read to client socket */
+metrics_histogram_t ingress_latency;  /*!> Client read to serial port write */
+uint64_t read_stamp;                  /*!> Time of the read being parsed, ns */
 
-bool sigint_flag;  /*!> Flag for SIGINT signal */
-bool sigterm_flag; /*!> Flag for SIGTERM signal */
+char serial_tx[SERIAL_TX_BUFFER_SIZE]; /*!> Serial port output the device did not take yet */
+size_t serial_tx_len;                  /*!> Length of serial_tx */
+bool serial_tx_waiting = false;        /*!> Waiting for the serial port to be writable */
+bool serial_tx_sending = false;        /*!> A send of serial_tx is in flight (io_uring) */
+unsigned long serial_tx_dropped;       /*!> Writes dropped, serial_tx full */
 
-int fd_conn;   /*!> File descriptor for connection (to listen the client) */
-int fd_socket; /*!> Server socket file descriptor (to accept new connection) */
+output_scheduler_t output_scheduler;                  /*!> Output updates waiting for the link */
+unsigned long serial_baudrate = SERIAL_PORT_BAUDRATE; /*!> Serial link baudrate */
+unsigned flush_interval = SERIAL_FLUSH_INTERVAL_MS;   /*!> Output flush interval, ms */
+bool output_timer_armed = false;                      /*!> Flush interval timer running */
 
-pthread_t serial_thread;                                  /*!> serial thread, emulator read loop */
-pthread_mutex_t client_mutex = PTHREAD_MUTEX_INITIALIZER; /*!> Client connection flag mutex */
+journal_t journal;       /*!> Switch and output states journal */
+bool journal_on = false; /*!> Journal open */
+file_bridge_t bridge;    /*!> Lamp state files bridge, open if fd_bridge is valid */
 
-// Functions definition
-int serial_server_connect(void);
+channel_registry_t registry; /*!> Requested state and metadata of every lamp */
+uint64_t *registry_changed;  /*!> Channels changed by the last range update */
+
+io_engine_t io_engine;                          /*!> Serial port and client receives and sends */
+io_engine_kind_t io_engine_kind = IO_ENGINE_RW; /*!> Engine chosen with -e */
+
+http_conn_t **http_table;     /*!> Open HTTP connections by socket fd */
+int http_count = 0;           /*!> Open HTTP connections */
+http_conn_t **http_streams;   /*!> Server-sent events streams */
+int http_stream_count = 0;    /*!> Length of http_streams */
+http_conn_t **http_closing;   /*!> HTTP connections closed in this iteration */
+int http_closing_count = 0;   /*!> Length of http_closing */
+const char *http_root = NULL; /*!> Static files directory, NULL for none */
+unsigned long http_requests;  /*!> HTTP requests answered */
+unsigned long http_errors;    /*!> HTTP requests refused (bad, not allowed, no route) */
+unsigned long http_events;    /*!> Events sent to streams */
+unsigned long http_slow;      /*!> Streams closed, too much unsent output */
 
 /**
  * @brief Serial service exit process
  */
 void serial_service_exit(int exit_code) {
-    if (serial_lock) {
+    logger_close(); // The last records go before the summary
+    printf("Serial port updates: %lu forwarded, %lu ignored, %lu malformed, %lu lost\r\n",
+           egress_batch.frames, egress_batch.ignored,
+           serial_errors + serial_parser.errors + serial_binary_parser.errors,
+           serial_lost + serial_binary_parser.lost);
+    printf("Client updates: %lu forwarded, %lu ignored, %lu malformed, %lu lost\r\n",
+           ingress_batch.frames, ingress_batch.ignored, client_errors, client_lost);
+    printf("Output scheduler: %lu received, %lu written, %lu coalesced, %lu cancelled, "
+           "%lu bypassed\r\n",
+           output_scheduler.received, output_scheduler.sent, output_scheduler.coalesced,
+           output_scheduler.cancelled, output_scheduler.bypassed);
+    printf("Serial link: ready %.3f ms after start, %lu connects in %lu attempts, "
+           "%lu recoveries of %.3f ms average\r\n",
+           serial_ready * 1e-6, serial_connects, serial_attempts, serial_recovery.count,
+           serial_recovery.count ? serial_recovery.sum * 1e-6 / serial_recovery.count : 0.0);
+    if (journal_on) {
+        printf("Journal: %lu records, %lu compactions\r\n", (unsigned long)journal.header->count,
+               journal.compactions);
+        journal_close(&journal);
+    }
+    if (0 <= fd_bridge) {
+        printf("Lamp files: %lu changes, %lu outputs forwarded, %lu switch states written, "
+               "%lu errors\r\n",
+               bridge.events, bridge.updates, bridge.writes, bridge.errors);
+        file_bridge_close(&bridge);
+    }
+    printf("Channels: %u, %lu updates, %lu range updates, %lu state changes\r\n", registry.count,
+           registry.updates, registry.bulk, registry.changes);
+    if (0 <= fd_http) {
+        printf("HTTP: %lu requests, %lu errors, %lu stream events, %lu slow streams closed\r\n",
+               http_requests, http_errors, http_events, http_slow);
+        close(fd_http);
+    }
+    // HTTP and scrape connections
+    while (0 < http_closing_count)
+        http_conn_destroy(http_closing[--http_closing_count]);
+    for (int fd = 0; NULL != http_table && fd < client_table_size; fd++) {
+        if (NULL != http_table[fd])
+            http_conn_destroy(http_table[fd]);
+    }
+    if (serial_lock || serial_connecting) {
         serial_close();
         printf("Serial port closed\r\n");
     }
-    if (client_lock) {
-        if (0 > close(fd_conn))
-            perror("ERROR: Unable to close client socket");
-        else
-            printf("Closed server socket\r\n");
-        printf("Client socket closed\r\n");
+    while (0 < client_closing_count)
+        client_destroy(client_closing[--client_closing_count]);
+    if (0 < client_count) {
+        while (0 < client_count)
+            client_destroy(clients[--client_count]);
+        printf("Client sockets closed\r\n");
     }
     if (server_lock) {
         if (0 > close(fd_socket))
             perror("ERROR: Unable to close server socket");
         else
-            printf("Closed server socket\r\n");
-        printf("Server socket closed\r\n");
+            printf("Server socket closed\r\n");
+    }
+    if (0 <= fd_signal)
+        close(fd_signal);
+    if (0 <= fd_timer)
+        close(fd_timer);
+    if (0 <= fd_retry)
+        close(fd_retry);
+    if (0 <= fd_stats)
+        close(fd_stats);
+    if (NULL != io_engine.ops) {
+        printf("I/O engine %s: %lu syscalls, %lu receives, %lu sends, %lu submissions\r\n",
+               io_engine.ops->name, io_engine.syscalls, io_engine.receives, io_engine.sends,
+               io_engine.submits);
+        io_engine_free(&io_engine);
     }
+    output_scheduler_free(&output_scheduler);
+    channel_registry_free(&registry);
+    free(registry_changed);
+    if (0 <= fd_epoll)
+        close(fd_epoll);
     exit(exit_code);
 }
 
 /**
- * @brief Block signals used by serial service to start threads safely
- * @param mask_how SIG_BLOCK or SIG_UNBLOCK depending the behavior expected
- * @reval int
+ * @brief Block the signals used by serial service, they are read from a signalfd
+ * @retval signalfd, -1 on error
  */
-int serial_mask_signal(int mask_how) {
-    int rcode;
+int serial_signal_setup(void) {
     sigset_t sigset;
-    rcode = sigemptyset(&sigset);
-    if (0 != rcode) {
-        return rcode;
-    }
-    rcode = sigaddset(&sigset, SIGINT);
-    if (0 != rcode) {
-        return rcode;
-    }
-    rcode = sigaddset(&sigset, SIGTERM);
-    if (0 != rcode) {
-        return rcode;
-    }
-    return pthread_sigmask(mask_how, &sigset, NULL);
-}
 
-void sa_serial_handler(int signo) {
-    if (SIGINT == signo) {
-        sigint_flag = true;
-    } else if (SIGTERM == signo) {
-        sigterm_flag = true;
-    }
+    if (0 != sigemptyset(&sigset) || 0 != sigaddset(&sigset, SIGINT) ||
+        0 != sigaddset(&sigset, SIGTERM))
+        return -1;
+    if (0 != sigprocmask(SIG_BLOCK, &sigset, NULL))
+        return -1;
+    return signalfd(-1, &sigset, SFD_NONBLOCK | SFD_CLOEXEC);
 }
 
 /**
- * @brief Thread to listen serial port
- * @note The thread starts with an open serial port
+ * @brief Add a file descriptor to the event loop, or change its events
+ * @param op EPOLL_CTL_ADD or EPOLL_CTL_MOD
+ * @retval 0 on success, -1 on error
  */
-void *serial_port_listen(void *args) {
-    printf("Serial port polling\r\n");
-
-    serial_lock = true;
-    char rx_buffer[SERIAL_MSG_LENGTH];
-    int read_size;
-    bool client_status;
-
-    while (1) {
-        usleep(100000);
-        // Non-blocking serial read (mutex since it's a shared resource)
-        read_size = serial_receive(rx_buffer, SERIAL_MSG_LENGTH);
-        if (0 > read_size)
-            continue; // No reading
-        if (0 == read_size) {
-            serial_lock = false;
-            printf("WARNING: Serial port closed\r\n");
-            pthread_exit(NULL);
-        }
-
-        printf("Serial service egress: %s", rx_buffer);
-        pthread_mutex_lock(&client_mutex);
-        client_status = client_lock;
-        pthread_mutex_unlock(&client_mutex);
-        if (!client_status)
-            continue;
+int serial_event_set(int op, int fd, uint32_t events) {
+    struct epoll_event ev;
 
-        // write: write to client (the accepted connection)
-        if (0 > write(fd_conn, (void *)rx_buffer, SERIAL_MSG_LENGTH)) {
-            perror("WARNING: Unable to send message to client");
-        }
-    }
+    ev.events = events;
+    ev.data.fd = fd;
+    return epoll_ctl(fd_epoll, op, fd, &ev);
 }
 
 /**
@@ -146,28 +340,30 @@ void server_close(void) {
 }
 
 /**
- * @brief TCP/IP server listen thread
+ * @brief TCP/IP server setup, non-blocking listening socket
+ * @retval 0 on success, -1 on error
  */
 int serial_server_listen(void) {
     printf("Serial service TCP/IP server setup\r\n");
 
     int rcode; // to check return values
 
-    socklen_t addr_len;            // store sockaddr structure size
     struct sockaddr_in serveraddr; // server address (_in internet)
-    struct sockaddr_in clientaddr; // client address (_in internet)
-
-    pthread_t conn_thread; // connection thread, read loop
 
     // socket: socket creation
-    fd_socket = socket(AF_INET, SOCK_STREAM, 0);
+    fd_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (0 > fd_socket) {
         perror("ERROR: Unable to create TCP server socket");
-        return 0;
+        return -1;
     }
 
     server_lock = true; // set server running flag
 
+    // restart without waiting for connections of the previous run in TIME_WAIT
+    rcode = 1;
+    if (0 > setsockopt(fd_socket, SOL_SOCKET, SO_REUSEADDR, &rcode, sizeof(rcode)))
+        perror("WARNING: Unable to set server socket address reuse");
+
     // set server address structure
     bzero((void *)&serveraddr, sizeof(serveraddr)); // initialize with \0 the structure
     serveraddr.sin_family = AF_INET;                // intenet family
@@ -178,175 +374,1596 @@ int serial_server_listen(void) {
     if (0 == rcode) {
         printf("ERROR: Invalid network address for server\r\n");
         server_close();
-        return 0;
+        return -1;
     } else if (0 > rcode) {
         perror("ERROR: Unable to set server IP address");
         server_close();
-        return 0;
+        return -1;
     }
 
     // bind: port and IP assignment
     if (0 > bind(fd_socket, (struct sockaddr *)&serveraddr, sizeof(serveraddr))) {
         perror("ERROR: Unable to bind TCP server socket");
         server_close();
-        return 0;
+        return -1;
     }
 
     // listen: server ready to accept connections
-    // backlog: given the application architecture,
-    // the maximum length of the pending connections queue is one.
-    if (0 > listen(fd_socket, 1)) {
+    if (0 > listen(fd_socket, SOMAXCONN)) {
         perror("ERROR: Socket unable to listen for connections");
         server_close();
-        return 0;
+        return -1;
     }
 
-    // accept: pop pending connections from backlog (blocking)
+    if (0 > serial_event_set(EPOLL_CTL_ADD, fd_socket, EPOLLIN)) {
+        perror("ERROR: Unable to add server socket to event loop");
+        server_close();
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Close a client connection: out of the client list and the event loop now, the fd is
+ * closed by serial_client_reap
+ */
+void serial_client_close(client_t *client) {
+    client_t *last;
+
+    if (CLIENT_CLOSING == client->state)
+        return;
+    last = clients[--client_count];
+
+    // Swap remove from the client list
+    last->index = client->index;
+    clients[last->index] = last;
+    client_table[client->fd] = NULL;
+    client_errors += client->parser.errors + client->binary_parser.errors;
+    client_lost += client->binary_parser.lost;
+    client_bytes += client->bytes;
+    client_dropped += client->dropped;
+    if (0 < client->dropped)
+        logger_printf(LOGGER_WARNING, "%lu messages dropped for client", client->dropped);
+    if (0 > epoll_ctl(fd_epoll, EPOLL_CTL_DEL, client->fd, NULL))
+        perror("ERROR: Unable to remove client from event loop");
+    io_engine_unwatch(&io_engine, client->fd);
+    client->state = CLIENT_CLOSING;
+    client_closing[client_closing_count++] = client;
+}
+
+/**
+ * @brief Close the fds of the clients closed in this event loop iteration
+ */
+void serial_client_reap(void) {
+    while (0 < client_closing_count)
+        client_destroy(client_closing[--client_closing_count]);
+}
+
+/**
+ * @brief Wait for the client socket to be writable only while its queue is not empty
+ */
+void serial_client_update_events(client_t *client) {
+    bool pending = client_pending(client);
+    uint32_t events = pending ? io_engine.rx_events | EPOLLOUT : io_engine.rx_events;
+
+    if (pending == client->waiting)
+        return;
+    if (0 > serial_event_set(EPOLL_CTL_MOD, client->fd, events))
+        perror("ERROR: Unable to update client events");
+    client->waiting = pending;
+}
+
+/**
+ * @brief Send the journal switch states to a new client
+ * @retval 0 on success, -1 if the client must be disconnected
+ */
+int serial_client_restore(client_t *client) {
+    char data[SERIAL_BUFFER_SIZE];
+    size_t len = 0;
+    frame_t frame = {.type = FRAME_SW};
+
+    for (size_t i = 0; journal_on && i < journal.known_count; i++) {
+        frame.channel = journal.known[i];
+        frame.value = journal_state(&journal, JOURNAL_SW, frame.channel);
+        if (0 > frame.value)
+            continue;
+        if (len + FRAME_MAX_SIZE > sizeof(data)) {
+            if (0 > client_send(client, data, len, 0, client_policy))
+                return -1;
+            len = 0;
+        }
+        len += frame_encode(&frame, data + len);
+    }
+    if (0 < len && 0 > client_send(client, data, len, 0, client_policy))
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Accept the pending connections, the server socket is ready
+ */
+void serial_server_accept(void) {
+    socklen_t addr_len;            // store sockaddr structure size
+    struct sockaddr_in clientaddr; // client address (_in internet)
     char ip_client[32];
+    client_t *client;
+    int fd_conn;
+
     while (1) {
         addr_len = sizeof(struct sockaddr_in);
-        fd_conn = accept(fd_socket, (struct sockaddr *)&clientaddr, &addr_len);
+        fd_conn = accept4(fd_socket, (struct sockaddr *)&clientaddr, &addr_len,
+                          SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (0 > fd_conn) {
-            perror("ERROR: Refused pending connection, unable to accept");
-            if (sigint_flag || sigterm_flag) {
-                server_close();
-                return 1;
-            }
+            if (EAGAIN != errno && EINTR != errno)
+                perror("ERROR: Refused pending connection, unable to accept");
+            return;
+        }
+        if (client_count == client_max || fd_conn >= client_table_size) {
+            logger_printf(LOGGER_WARNING, "Too many clients, connection refused");
+            client_refused++;
+            close(fd_conn);
             continue;
         }
 
         // log msg on connection. inet_ntop: convert IPv4 and IPv6 addresses from binary to text
         // form
         if (NULL !=
-            inet_ntop(AF_INET, (void *)&clientaddr.sin_addr, ip_client, sizeof(ip_client))) {
-            printf("New connection with client IP %s\r\n", ip_client);
+            inet_ntop(AF_INET, (void *)&clientaddr.sin_addr, ip_client, sizeof(ip_client)))
+            logger_printf(LOGGER_INFO, "New connection with client IP %s (%d clients)",
+                          ip_client, client_count + 1);
+
+        client = client_create(fd_conn);
+        if (NULL == client) {
+            perror("ERROR: Unable to allocate client");
+            close(fd_conn);
+            continue;
+        }
+        if (0 > serial_event_set(EPOLL_CTL_ADD, fd_conn, io_engine.rx_events)) {
+            perror("ERROR: Unable to add client socket to event loop");
+            client_destroy(client);
+            continue;
+        }
+        if (0 > io_engine_watch(&io_engine, fd_conn, true)) {
+            perror("ERROR: Unable to receive from client");
+            client_destroy(client); // close also removes it from the event loop
+            continue;
+        }
+        client->index = client_count;
+        client->latency = &egress_latency;
+        clients[client_count++] = client;
+        client_table[fd_conn] = client;
+        client_connects++;
+        if (0 > serial_client_restore(client)) {
+            serial_client_close(client);
+            continue;
+        }
+        serial_client_update_events(client);
+    }
+}
+
+/**
+ * @brief Append a channel update to a batch
+ */
+void serial_batch_add(frame_batch_t *batch, const frame_t *frame) {
+    if (frame->type != batch->type) {
+        batch->ignored++;
+        return;
+    }
+    if (SERIAL_BATCH_UPDATES == batch->count)
+        batch->flush();
+    batch->updates[batch->count++] = *frame;
+    batch->frames++;
+}
+
+/**
+ * @brief Encode a batch in ASCII, and in binary if requested
+ */
+void serial_batch_encode(frame_batch_t *batch, bool binary) {
+    batch->ascii_len = 0;
+    for (size_t i = 0; i < batch->count; i++)
+        batch->ascii_len += frame_encode(&batch->updates[i], batch->ascii + batch->ascii_len);
+    if (binary)
+        batch->binary_len = binary_encode(batch->updates, batch->count, &batch->seq, batch->binary);
+}
+
+/**
+ * @brief Answer a binary protocol negotiation frame ">BIN:V,Y"
+ * @param reply Answer, room for FRAME_MAX_SIZE bytes
+ * @retval true if the peer switches to the binary protocol after the answer
+ */
+bool serial_negotiate(const frame_t *frame, char *reply, size_t *reply_len) {
+    frame_t answer = *frame;
+
+    answer.value = (1 == frame->value && BINARY_VERSION == frame->channel);
+    *reply_len = frame_encode(&answer, reply);
+    return answer.value;
+}
+
+/**
+ * @brief Arm the serial port retry timer, each retry waits twice as long as the previous one
+ */
+void serial_port_retry(void) {
+    struct itimerspec spec = {0};
+
+    spec.it_value.tv_sec = serial_backoff_ms / 1000;
+    spec.it_value.tv_nsec = (serial_backoff_ms % 1000) * 1000000L;
+    if (0 > timerfd_settime(fd_retry, 0, &spec, NULL))
+        perror("ERROR: Unable to set serial port retry timer");
+    serial_backoff_ms *= 2;
+    if (SERIAL_RECONNECT_MAX_MS < serial_backoff_ms)
+        serial_backoff_ms = SERIAL_RECONNECT_MAX_MS;
+}
+
+/**
+ * @brief The serial port is gone, drop its state and start reconnecting
+ */
+void serial_port_close(void) {
+    logger_printf(LOGGER_WARNING, "Serial port closed, reconnecting");
+    io_engine_unwatch(&io_engine, serial_get_fd()); // Its send in flight too
+    serial_close(); // close also removes it from the event loop
+    serial_lock = false;
+    serial_disconnects++;
+    serial_tx_len = 0;
+    serial_tx_waiting = false;
+    serial_tx_sending = false;
+    serial_down_stamp = metrics_now();
+    serial_backoff_ms = SERIAL_RECONNECT_MIN_MS;
+    serial_port_retry();
+}
+
+/**
+ * @brief Wait for the serial port to be writable only while output waits with no send in flight
+ */
+void serial_port_update_events(void) {
+    bool pending = 0 < serial_tx_len && !serial_tx_sending;
+    uint32_t events = pending ? io_engine.rx_events | EPOLLOUT : io_engine.rx_events;
+
+    if (pending == serial_tx_waiting)
+        return;
+    if (0 > serial_event_set(EPOLL_CTL_MOD, serial_get_fd(), events))
+        perror("ERROR: Unable to update serial port events");
+    serial_tx_waiting = pending;
+}
+
+/**
+ * @brief Serial port send done: drop the bytes written from the buffered output
+ * @param res Bytes written, -errno on error
+ */
+void serial_port_sent(int res) {
+    serial_tx_sending = false;
+    if (0 > res) {
+        if (-EAGAIN != res && -EINTR != res) {
+            logger_printf(LOGGER_ERROR, "Unable to write to serial port: %s", strerror(-res));
+            serial_port_close();
+            return;
         }
+        res = 0;
+    }
+    serial_tx_bytes += res;
+    serial_tx_len -= res;
+    memmove(serial_tx, serial_tx + res, serial_tx_len);
+    serial_port_update_events();
+}
 
-        // Connection read loop (one client architecture)
-        if (0 != serial_server_connect()) {
-            server_close();
-            return 1;
+/**
+ * @brief Send the buffered output, the engine writes it at once or queues it
+ * @note A queued send reads serial_tx until it is done: output written meanwhile is appended
+ * and sent next, the buffer only moves in serial_port_sent
+ */
+void serial_port_send(void) {
+    int written;
+
+    if (serial_tx_sending || 0 == serial_tx_len)
+        return;
+    written = io_engine_send(&io_engine, serial_get_fd(), serial_is_socket(), serial_tx,
+                             serial_tx_len);
+    if (IO_ENGINE_QUEUED == written) {
+        serial_tx_sending = true;
+        serial_port_update_events();
+        return;
+    }
+    serial_port_sent((0 > written) ? -errno : written);
+}
+
+/**
+ * @brief Write to the serial port, what the device does not take now is written on EPOLLOUT
+ * @note When the buffer is full the whole write is dropped, the device never gets half a frame
+ */
+void serial_write(const char *data, size_t len) {
+    if (!serial_lock)
+        return;
+    if (len > sizeof(serial_tx) - serial_tx_len) {
+        serial_tx_dropped++;
+        logger_printf(LOGGER_WARNING, "Serial port busy, %zu bytes dropped", len);
+        return;
+    }
+    memcpy(serial_tx + serial_tx_len, data, len);
+    serial_tx_len += len;
+    // Output already waiting goes first, on EPOLLOUT or once the send in flight is done
+    if (serial_tx_len == len)
+        serial_port_send();
+}
+
+/**
+ * @brief Append the updates of a batch to the journal
+ */
+void serial_journal_batch(const frame_batch_t *batch, journal_kind_t kind) {
+    uint64_t now;
+
+    if (!journal_on)
+        return;
+    now = journal_now();
+    for (size_t i = 0; i < batch->count; i++) {
+        if (0 > journal_append(&journal, kind, batch->updates[i].channel, batch->updates[i].value,
+                               now)) {
+            logger_printf(LOGGER_ERROR, "Unable to compact journal, closed: %s", strerror(errno));
+            journal_close(&journal);
+            journal_on = false;
+            return;
         }
     }
 }
 
 /**
- * @brief TCPIP server connection thread
+ * @brief Take an HTTP connection out of the event loop, its fd is closed at the end of the
+ * loop iteration (see serial_client_close)
+ */
+void serial_http_close(http_conn_t *conn) {
+    if (conn != http_table[conn->fd])
+        return;
+    if (0 <= conn->index) { // Swap remove from the stream list
+        http_streams[conn->index] = http_streams[--http_stream_count];
+        http_streams[conn->index]->index = conn->index;
+        conn->index = -1;
+    }
+    http_table[conn->fd] = NULL;
+    stats_table[conn->fd] = false;
+    http_count--;
+    if (0 > epoll_ctl(fd_epoll, EPOLL_CTL_DEL, conn->fd, NULL))
+        perror("ERROR: Unable to remove HTTP connection from event loop");
+    http_closing[http_closing_count++] = conn;
+}
+
+/**
+ * @brief Close the HTTP connections closed in this event loop iteration
  */
-int serial_server_connect(void) {
-    printf("Serial service transmit over TCP/IP server\r\n");
+void serial_http_reap(void) {
+    while (0 < http_closing_count)
+        http_conn_destroy(http_closing[--http_closing_count]);
+}
 
-    int rcode; // to check return values
+/**
+ * @brief Read requests, or wait for the socket to take the pending output first
+ */
+void serial_http_update_events(http_conn_t *conn) {
+    bool pending = http_conn_pending(conn);
 
-    pthread_mutex_lock(&client_mutex);
-    client_lock = true;
-    pthread_mutex_unlock(&client_mutex);
+    if (pending == conn->waiting)
+        return;
+    if (0 > serial_event_set(EPOLL_CTL_MOD, conn->fd, pending ? EPOLLOUT : EPOLLIN))
+        perror("ERROR: Unable to update HTTP connection events");
+    conn->waiting = pending;
+}
 
-    char tx_buffer[SERIAL_MSG_LENGTH];
-    ssize_t read_size;
+/**
+ * @brief Send an event to every server-sent events stream
+ * @param data Event data, a single line
+ */
+void serial_http_broadcast(const char *event, const char *data) {
+    metrics_text_t text = {0};
 
-    while (1) {
-        rcode = 0;
-
-        // read: read from client (the accepted connection) (blocking)
-        read_size = read(fd_conn, (void *)tx_buffer, SERIAL_MSG_LENGTH);
-        if (0 > read_size) {
-            perror("ERROR: reading from client");
-            if (sigint_flag || sigterm_flag) {
-                if (0 > close(fd_conn))
-                    perror("ERROR: Unable to close server socket");
-                else
-                    printf("Closed server socket\r\n");
-                rcode = 1;
-            }
-            break;
-        } else if (0 == read_size) {
-            printf("Client disconnected\r\n");
+    if (0 == http_stream_count || 0 > http_event_format(&text, event, data)) {
+        metrics_text_free(&text);
+        return;
+    }
+    // Backwards, a closed stream is replaced by the last one
+    for (int i = http_stream_count - 1; i >= 0; i--) {
+        http_conn_t *conn = http_streams[i];
+        if (0 > http_stream_send(conn, text.data, text.len)) {
+            logger_printf(LOGGER_WARNING, "Closing slow event stream");
+            http_slow++;
+            serial_http_close(conn);
+            continue;
+        }
+        http_events++;
+        serial_http_update_events(conn);
+    }
+    metrics_text_free(&text);
+}
+
+/**
+ * @brief Write count lamp channels from first as JSON, the device list of the web getDevices.py
+ */
+void serial_devices_format(metrics_text_t *text, unsigned first, unsigned count) {
+    metrics_printf(text, "[");
+    for (unsigned i = first; i - first < count && i < registry.count; i++) {
+        const channel_info_t *info = &registry.info[i];
+        metrics_printf(text,
+                       "%s{\"id\": \"%u\", \"name\": \"%s %u\", \"description\": \"%s\", "
+                       "\"state\": \"%d\", \"type\": \"%u\"}",
+                       (first < i) ? ", " : "", i + 1,
+                       (CHANNEL_BLIND == info->type) ? "Persiana" : "Lampara", i + 1,
+                       channel_registry_description(&registry, i),
+                       1 == channel_registry_get(&registry, i), info->type);
+    }
+    metrics_printf(text, "]");
+}
+
+/**
+ * @brief An output update was requested, or a switch set a lamp: its lamp state changes for the
+ *        HTTP streams
+ */
+void serial_lamp_update(const frame_t *update) {
+    char data[64];
+
+    if (!channel_registry_set(&registry, update->channel, update->value) ||
+        0 == http_stream_count)
+        return;
+    snprintf(data, sizeof(data), "{\"id\": \"%u\", \"state\": \"%d\"}", update->channel + 1,
+             update->value);
+    serial_http_broadcast("lamp", data);
+}
+
+/**
+ * @brief Set lamp channels first to last at once, only the channels that change are forwarded
+ * @retval Channels changed
+ */
+size_t serial_lamp_range(unsigned first, unsigned last, int value) {
+    frame_t update = {.type = FRAME_OUT, .value = value, .stamp = metrics_now()};
+    size_t changed = channel_registry_set_range(&registry, first, last, value, registry_changed);
+    char data[96];
+
+    if (0 == changed)
+        return 0;
+    for (unsigned channel = channel_registry_next(registry_changed, first, registry.count);
+         channel < registry.count;
+         channel = channel_registry_next(registry_changed, channel + 1, registry.count)) {
+        update.channel = channel;
+        if (!output_scheduler_put(&output_scheduler, &update))
+            serial_batch_add(&ingress_batch, &update); // Bypass channel
+    }
+    snprintf(data, sizeof(data), "{\"first\": \"%u\", \"last\": \"%u\", \"state\": \"%d\"}",
+             first + 1, (last < registry.count) ? last + 1 : registry.count, value);
+    serial_http_broadcast("range", data);
+    return changed;
+}
+
+/**
+ * @brief Broadcast the switch updates batch to every client, in the protocol of each one
+ */
+void serial_egress_flush(void) {
+    bool binary = false;
+
+    serial_journal_batch(&egress_batch, JOURNAL_SW);
+    for (size_t i = 0; 0 <= fd_bridge && i < egress_batch.count; i++) {
+        const frame_t *update = &egress_batch.updates[i];
+        if (FILE_BRIDGE_LAMPS > update->channel &&
+            0 > file_bridge_write(&bridge, update->channel, update->value))
+            logger_printf(LOGGER_WARNING, "Unable to write lamp file: %s", strerror(errno));
+    }
+    for (size_t i = 0; i < egress_batch.count; i++) {
+        frame_t output = egress_batch.updates[i];
+        char data[64];
+        // ">SW:X,Y" is the new state of lamp X + 1: requested and written to the device, as
+        // InterfaceService does. Its own ">OUT:" answer coalesces with this one
+        output.type = FRAME_OUT;
+        serial_lamp_update(&output);
+        if (!output_scheduler_put(&output_scheduler, &output))
+            serial_batch_add(&ingress_batch, &output); // Bypass channel
+        if (0 == http_stream_count)
+            continue;
+        snprintf(data, sizeof(data), "{\"channel\": %u, \"state\": %d}",
+                 egress_batch.updates[i].channel, egress_batch.updates[i].value);
+        serial_http_broadcast("switch", data);
+    }
+    for (int i = 0; i < client_count && !binary; i++)
+        binary = clients[i]->binary;
+    serial_batch_encode(&egress_batch, binary);
+    // Without the last "\r\n", the logger ends the record
+    logger_printf(LOGGER_DEBUG, "Serial service egress: %.*s", (int)egress_batch.ascii_len - 2,
+                  egress_batch.ascii);
+
+    // Backwards, a disconnected client is replaced by the last one
+    for (int i = client_count - 1; i >= 0; i--) {
+        client_t *client = clients[i];
+        const char *data = client->binary ? egress_batch.binary : egress_batch.ascii;
+        size_t len = client->binary ? egress_batch.binary_len : egress_batch.ascii_len;
+        if (0 > client_send(client, data, len, egress_batch.updates[0].stamp, client_policy)) {
+            logger_printf(LOGGER_WARNING, "Disconnecting slow client");
+            serial_client_close(client);
+            continue;
+        }
+        serial_client_update_events(client);
+    }
+    egress_batch.count = 0;
+}
+
+/**
+ * @brief Write the output updates batch to the serial port
+ */
+void serial_ingress_flush(void) {
+    const char *data;
+    size_t len;
+    uint64_t now;
+
+    serial_batch_encode(&ingress_batch, serial_binary);
+    data = serial_binary ? ingress_batch.binary : ingress_batch.ascii;
+    len = serial_binary ? ingress_batch.binary_len : ingress_batch.ascii_len;
+    logger_printf(LOGGER_DEBUG, "Serial service ingress: %.*s", (int)ingress_batch.ascii_len - 2,
+                  ingress_batch.ascii);
+    if (serial_lock) {
+        serial_write(data, len);
+        serial_journal_batch(&ingress_batch, JOURNAL_OUT);
+        now = metrics_now();
+        for (size_t i = 0; i < ingress_batch.count; i++) {
+            if (0 != ingress_batch.updates[i].stamp) // Not restored from the journal
+                metrics_histogram_add(&ingress_latency, now - ingress_batch.updates[i].stamp);
+        }
+    }
+    output_scheduler_charge(&output_scheduler, len);
+    ingress_batch.count = 0;
+}
+
+/**
+ * @brief Start or stop the output flush interval timer
+ */
+void serial_output_timer(bool on) {
+    struct itimerspec spec = {0};
+
+    if (on == output_timer_armed)
+        return;
+    if (on) {
+        spec.it_value.tv_sec = flush_interval / 1000;
+        spec.it_value.tv_nsec = (flush_interval % 1000) * 1000000L;
+        spec.it_interval = spec.it_value;
+    }
+    if (0 > timerfd_settime(fd_timer, 0, &spec, NULL))
+        perror("ERROR: Unable to set output flush timer");
+    else
+        output_timer_armed = on;
+}
+
+/**
+ * @brief Write the pending output updates the serial link budget allows
+ * @param tick Flush interval timer expired
+ */
+void serial_output_drain(bool tick) {
+    frame_t updates[SERIAL_BATCH_UPDATES];
+    struct timespec now;
+    size_t count, drained = 0;
+
+    // Between ticks updates wait, so a burst coalesces
+    if (!tick && output_timer_armed)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    output_scheduler_refill(&output_scheduler, now.tv_sec * 1000000000ULL + now.tv_nsec);
+    // Backpressure: nothing more while the device has not taken the last write
+    while (serial_lock && 0 == serial_tx_len &&
+           0 < (count = output_scheduler_take(&output_scheduler, updates, SERIAL_BATCH_UPDATES))) {
+        for (size_t i = 0; i < count; i++)
+            serial_batch_add(&ingress_batch, &updates[i]);
+        serial_ingress_flush(); // Charges the budget for the next take
+        drained += count;
+    }
+    // Keep the timer one more interval after the last write, the next update waits for it. A
+    // busy device restarts the drain when it is writable.
+    serial_output_timer(0 < drained || (serial_lock && 0 == serial_tx_len &&
+                                        output_scheduler_pending(&output_scheduler)));
+}
+
+/**
+ * @brief Frame parsers handler for the serial port
+ */
+void serial_port_frame(const frame_t *frame, void *ctx) {
+    frame_t update = *frame;
+    char reply[FRAME_MAX_SIZE];
+    size_t reply_len;
+
+    (void)ctx;
+    if (FRAME_BIN != frame->type) {
+        update.stamp = read_stamp;
+        serial_batch_add(&egress_batch, &update);
+        return;
+    }
+    if (serial_negotiate(frame, reply, &reply_len)) {
+        serial_binary = true;
+        frame_parser_stop(&serial_parser); // The rest of the stream is binary
+        logger_printf(LOGGER_INFO, "Serial port switched to binary protocol");
+    }
+    if (0 < ingress_batch.count) // Frames queued in ASCII go before the answer
+        serial_ingress_flush();
+    serial_write(reply, reply_len);
+}
+
+/**
+ * @brief Frame parsers handler for a client
+ * @param ctx Client
+ */
+void serial_client_frame(const frame_t *frame, void *ctx) {
+    client_t *client = ctx;
+    frame_t update = *frame;
+    char reply[FRAME_MAX_SIZE];
+    size_t reply_len;
+
+    update.stamp = read_stamp;
+    if (FRAME_OUT == frame->type)
+        serial_lamp_update(&update);
+    if (FRAME_OUT == frame->type && output_scheduler_put(&output_scheduler, &update))
+        return;
+    if (FRAME_BIN != frame->type) { // Bypass channels and frames of the other direction
+        serial_batch_add(&ingress_batch, &update);
+        return;
+    }
+    // A send error shows up again on the next write, the client is not closed while parsing
+    if (serial_negotiate(frame, reply, &reply_len)) {
+        client->binary = true;
+        frame_parser_stop(&client->parser); // The rest of the stream is binary
+    }
+    client_send(client, reply, reply_len, 0, client_policy);
+    serial_client_update_events(client);
+}
+
+/**
+ * @brief Lamp state files changed: their states are output updates, as from a client
+ */
+void serial_bridge_read(void) {
+    frame_t updates[FILE_BRIDGE_LAMPS];
+    size_t count;
+
+    read_stamp = metrics_now();
+    count = file_bridge_read(&bridge, updates, FILE_BRIDGE_LAMPS);
+    for (size_t i = 0; i < count; i++) {
+        updates[i].stamp = read_stamp;
+        serial_lamp_update(&updates[i]);
+        if (!output_scheduler_put(&output_scheduler, &updates[i]))
+            serial_batch_add(&ingress_batch, &updates[i]); // Bypass channel
+    }
+}
+
+/**
+ * @brief Serial port received data: broadcast its frames to every client
+ * @param read_size Bytes at rx_buffer, 0 if the port closed, -errno on error
+ */
+void serial_port_input(const char *rx_buffer, int read_size) {
+    size_t consumed;
+
+    if (0 > read_size) {
+        errno = -read_size;
+        perror("ERROR: reading from serial port");
+        serial_port_close();
+        return;
+    }
+    if (0 == read_size) {
+        serial_port_close();
+        return;
+    }
+
+    read_stamp = metrics_now();
+    serial_rx_bytes += read_size;
+    consumed = frame_parser_feed(&serial_parser, rx_buffer, read_size, serial_port_frame, NULL);
+    if (consumed < (size_t)read_size)
+        binary_parser_feed(&serial_binary_parser, rx_buffer + consumed, read_size - consumed,
+                           serial_port_frame, NULL);
+    if (0 < egress_batch.count)
+        serial_egress_flush();
+}
+
+/**
+ * @brief Serial port writable, or its send done: write the buffered output
+ */
+void serial_port_write(void) {
+    serial_port_send();
+    if (serial_lock && 0 == serial_tx_len) // Output held back by the busy device
+        serial_output_drain(true);
+}
+
+/**
+ * @brief Queue the journal output states for the serial device
+ */
+void serial_output_restore(void) {
+    frame_t frame = {.type = FRAME_OUT};
+
+    for (size_t i = 0; journal_on && i < journal.known_count; i++) {
+        frame.channel = journal.known[i];
+        frame.value = journal_state(&journal, JOURNAL_OUT, frame.channel);
+        if (0 <= frame.value && !output_scheduler_restore(&output_scheduler, &frame))
+            serial_batch_add(&ingress_batch, &frame); // Bypass channel
+    }
+}
+
+/**
+ * @brief Serial port connected: a new peer, protocol state starts over
+ */
+void serial_port_up(void) {
+    uint64_t now = metrics_now();
+
+    if (0 > io_engine_watch(&io_engine, serial_get_fd(), serial_is_socket())) {
+        perror("ERROR: Unable to receive from serial port");
+        serial_close(); // close also removes it from the event loop
+        serial_port_retry();
+        return;
+    }
+    serial_lock = true;
+    serial_connects++;
+    serial_backoff_ms = SERIAL_RECONNECT_MIN_MS;
+    serial_errors += serial_parser.errors + serial_binary_parser.errors;
+    serial_lost += serial_binary_parser.lost;
+    frame_parser_init(&serial_parser);
+    binary_parser_init(&serial_binary_parser);
+    serial_binary = false;
+    ingress_batch.seq = 0;
+    // The device may have restarted: the next command of every channel is written, and the
+    // journal states of the channels without one
+    output_scheduler_reset(&output_scheduler);
+    serial_output_restore();
+    if (1 == serial_connects) {
+        serial_ready = now - service_start;
+        logger_printf(LOGGER_INFO, "Serial port up %.3f ms after start, %lu attempts",
+                      serial_ready * 1e-6, serial_attempts);
+    } else {
+        metrics_histogram_add(&serial_recovery, now - serial_down_stamp);
+        logger_printf(LOGGER_INFO, "Serial port up again after %.3f ms",
+                      (now - serial_down_stamp) * 1e-6);
+    }
+    serial_output_drain(true); // Commands received while the link was down
+}
+
+/**
+ * @brief Try to open the serial port, a failure is retried on the retry timer
+ */
+void serial_port_connect(void) {
+    int rcode = serial_open(0, serial_baudrate);
+
+    serial_attempts++;
+    if (0 > rcode) {
+        if (EINVAL == errno || ENOTTY == errno) {
+            logger_printf(LOGGER_ERROR, "Unable to open serial port: %s", strerror(errno));
+            serial_service_exit(EXIT_FAILURE);
+        }
+        logger_printf(LOGGER_DEBUG, "Serial port attempt failed: %s", strerror(errno));
+        serial_port_retry();
+        return;
+    }
+    // In progress: connected or refused when writable
+    if (0 > serial_event_set(EPOLL_CTL_ADD, serial_get_fd(),
+                             (0 == rcode) ? io_engine.rx_events : EPOLLOUT)) {
+        perror("ERROR: Unable to add serial port to event loop");
+        serial_close();
+        serial_port_retry();
+        return;
+    }
+    if (0 == rcode)
+        serial_port_up();
+    else
+        serial_connecting = true;
+}
+
+/**
+ * @brief Emulator connection attempt finished
+ */
+void serial_port_connected(void) {
+    serial_connecting = false;
+    if (0 > serial_connect_finish()) {
+        logger_printf(LOGGER_DEBUG, "Serial port attempt failed: %s", strerror(errno));
+        serial_close(); // close also removes it from the event loop
+        serial_port_retry();
+        return;
+    }
+    if (0 > serial_event_set(EPOLL_CTL_MOD, serial_get_fd(), io_engine.rx_events)) {
+        perror("ERROR: Unable to add serial port to event loop");
+        serial_close();
+        serial_port_retry();
+        return;
+    }
+    serial_port_up();
+}
+
+/**
+ * @brief Serial port retry timer expired
+ */
+void serial_retry_read(void) {
+    uint64_t expirations;
+
+    if (sizeof(expirations) == read(fd_retry, &expirations, sizeof(expirations)) &&
+        !serial_lock && !serial_connecting)
+        serial_port_connect();
+}
+
+/**
+ * @brief Client received data: queue its frames for the serial port
+ * @param read_size Bytes at rx_buffer, 0 if the client closed, -errno on error
+ */
+void serial_client_input(client_t *client, const char *rx_buffer, int read_size) {
+    size_t consumed;
+
+    if (0 > read_size) {
+        errno = -read_size;
+        perror("ERROR: reading from client");
+        serial_client_close(client);
+        return;
+    } else if (0 == read_size) {
+        logger_printf(LOGGER_INFO, "Client disconnected (%d clients)", client_count - 1);
+        serial_client_close(client);
+        return;
+    }
+    read_stamp = metrics_now();
+    client_rx_bytes += read_size;
+
+    // Written once every ready client is read, see main loop
+    consumed =
+        frame_parser_feed(&client->parser, rx_buffer, read_size, serial_client_frame, client);
+    if (consumed < (size_t)read_size)
+        binary_parser_feed(&client->binary_parser, rx_buffer + consumed, read_size - consumed,
+                           serial_client_frame, client);
+}
+
+/**
+ * @brief Client connection writable: send its queued data
+ */
+void serial_client_write(client_t *client) {
+    if (0 > client_flush(client)) {
+        perror("WARNING: Unable to send message to client");
+        serial_client_close(client);
+        return;
+    }
+    serial_client_update_events(client);
+}
+
+/**
+ * @brief I/O engine handler: data received from the serial port or a client, or a send done
+ */
+void serial_io_event(const io_event_t *event, void *ctx) {
+    (void)ctx;
+    if (serial_lock && event->fd == serial_get_fd()) {
+        if (IO_RECV == event->op) {
+            serial_port_input(event->data, event->res);
+            return;
+        }
+        serial_port_sent(event->res);
+        // What was written meanwhile, or the output held back; a full port waits for EPOLLOUT
+        if (serial_lock && -EAGAIN != event->res)
+            serial_port_write();
+    } else if (IO_RECV == event->op && NULL != client_table[event->fd]) {
+        serial_client_input(client_table[event->fd], event->data, event->res);
+    }
+}
+
+/**
+ * @brief Metrics scrape socket setup, non-blocking listening socket
+ * @retval 0 on success, -1 on error
+ */
+int serial_stats_listen(void) {
+    struct sockaddr_in addr;
+    int opt = 1;
+
+    fd_stats = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (0 > fd_stats) {
+        perror("ERROR: Unable to create stats socket");
+        return -1;
+    }
+    if (0 > setsockopt(fd_stats, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)))
+        perror("WARNING: Unable to set stats socket address reuse");
+    bzero((void *)&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(SERIAL_STATS_PORT);
+    inet_pton(AF_INET, SERIAL_SERVICE_IP_ADDR, (void *)&addr.sin_addr);
+    if (0 > bind(fd_stats, (struct sockaddr *)&addr, sizeof(addr)) ||
+        0 > listen(fd_stats, SOMAXCONN) ||
+        0 > serial_event_set(EPOLL_CTL_ADD, fd_stats, EPOLLIN)) {
+        perror("ERROR: Unable to listen on stats socket");
+        close(fd_stats);
+        fd_stats = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Write the service metrics in plain text
+ */
+void serial_stats_format(metrics_text_t *text) {
+    unsigned long bytes = client_bytes, dropped = client_dropped, errors = client_errors;
+    unsigned long lost = client_lost;
+    unsigned depth_max = 0;
+
+    for (int i = 0; i < client_count; i++) {
+        bytes += clients[i]->bytes;
+        dropped += clients[i]->dropped;
+        errors += clients[i]->parser.errors + clients[i]->binary_parser.errors;
+        lost += clients[i]->binary_parser.lost;
+    }
+
+    metrics_printf(text, "# TYPE serial_service_frames_total counter\n");
+    metrics_printf(text, "serial_service_frames_total{direction=\"%s\",result=\"%s\"} %lu\n",
+                   "serial_to_client", "forwarded", egress_batch.frames);
+    metrics_printf(text, "serial_service_frames_total{direction=\"%s\",result=\"%s\"} %lu\n",
+                   "serial_to_client", "ignored", egress_batch.ignored);
+    metrics_printf(text, "serial_service_frames_total{direction=\"%s\",result=\"%s\"} %lu\n",
+                   "client_to_serial", "forwarded", ingress_batch.frames);
+    metrics_printf(text, "serial_service_frames_total{direction=\"%s\",result=\"%s\"} %lu\n",
+                   "client_to_serial", "ignored", ingress_batch.ignored);
+    metrics_printf(text, "# TYPE serial_service_bytes_total counter\n"
+                         "serial_service_bytes_total{link=\"serial\",direction=\"rx\"} %lu\n"
+                         "serial_service_bytes_total{link=\"serial\",direction=\"tx\"} %lu\n"
+                         "serial_service_bytes_total{link=\"client\",direction=\"rx\"} %lu\n"
+                         "serial_service_bytes_total{link=\"client\",direction=\"tx\"} %lu\n",
+                   serial_rx_bytes, serial_tx_bytes, client_rx_bytes, bytes);
+    metrics_printf(text, "# TYPE serial_service_parse_errors_total counter\n"
+                         "serial_service_parse_errors_total{link=\"serial\"} %lu\n"
+                         "serial_service_parse_errors_total{link=\"client\"} %lu\n",
+                   serial_errors + serial_parser.errors + serial_binary_parser.errors, errors);
+    metrics_printf(text, "# TYPE serial_service_frames_lost_total counter\n"
+                         "serial_service_frames_lost_total{link=\"serial\"} %lu\n"
+                         "serial_service_frames_lost_total{link=\"client\"} %lu\n",
+                   serial_lost + serial_binary_parser.lost, lost);
+    metrics_printf(text, "# TYPE serial_service_output_updates_total counter\n"
+                         "serial_service_output_updates_total{result=\"written\"} %lu\n"
+                         "serial_service_output_updates_total{result=\"coalesced\"} %lu\n"
+                         "serial_service_output_updates_total{result=\"cancelled\"} %lu\n"
+                         "serial_service_output_updates_total{result=\"bypassed\"} %lu\n",
+                   output_scheduler.sent, output_scheduler.coalesced, output_scheduler.cancelled,
+                   output_scheduler.bypassed);
+    metrics_printf(text, "# TYPE serial_service_serial_tx_buffered_bytes gauge\n"
+                         "serial_service_serial_tx_buffered_bytes %zu\n"
+                         "# TYPE serial_service_serial_tx_dropped_total counter\n"
+                         "serial_service_serial_tx_dropped_total %lu\n",
+                   serial_tx_len, serial_tx_dropped);
+    if (journal_on)
+        metrics_printf(text, "# TYPE serial_service_journal_records gauge\n"
+                             "serial_service_journal_records %lu\n"
+                             "# TYPE serial_service_journal_compactions_total counter\n"
+                             "serial_service_journal_compactions_total %lu\n",
+                       (unsigned long)journal.header->count, journal.compactions);
+    if (0 <= fd_bridge)
+        metrics_printf(text, "# TYPE serial_service_lamp_file_changes_total counter\n"
+                             "serial_service_lamp_file_changes_total %lu\n"
+                             "# TYPE serial_service_lamp_file_updates_total counter\n"
+                             "serial_service_lamp_file_updates_total{direction=\"file_to_serial\"} "
+                             "%lu\n"
+                             "serial_service_lamp_file_updates_total{direction=\"serial_to_file\"} "
+                             "%lu\n"
+                             "# TYPE serial_service_lamp_file_errors_total counter\n"
+                             "serial_service_lamp_file_errors_total %lu\n",
+                       bridge.events, bridge.updates, bridge.writes, bridge.errors);
+    metrics_printf(text, "# TYPE serial_service_io_syscalls_total counter\n"
+                         "serial_service_io_syscalls_total{engine=\"%s\"} %lu\n"
+                         "# TYPE serial_service_io_operations_total counter\n"
+                         "serial_service_io_operations_total{op=\"receive\"} %lu\n"
+                         "serial_service_io_operations_total{op=\"send\"} %lu\n"
+                         "serial_service_io_operations_total{op=\"submit\"} %lu\n"
+                         "# TYPE serial_service_io_starved_total counter\n"
+                         "serial_service_io_starved_total %lu\n",
+                   io_engine.ops->name, io_engine.syscalls, io_engine.receives, io_engine.sends,
+                   io_engine.submits, io_engine.starved);
+    metrics_printf(text, "# TYPE serial_service_channels gauge\n"
+                         "serial_service_channels %u\n"
+                         "# TYPE serial_service_channel_updates_total counter\n"
+                         "serial_service_channel_updates_total{kind=\"single\"} %lu\n"
+                         "serial_service_channel_updates_total{kind=\"range\"} %lu\n"
+                         "# TYPE serial_service_channel_changes_total counter\n"
+                         "serial_service_channel_changes_total %lu\n",
+                   registry.count, registry.updates, registry.bulk, registry.changes);
+    if (0 <= fd_http)
+        metrics_printf(text, "# TYPE serial_service_http_requests_total counter\n"
+                             "serial_service_http_requests_total{result=\"ok\"} %lu\n"
+                             "serial_service_http_requests_total{result=\"error\"} %lu\n"
+                             "# TYPE serial_service_http_connections gauge\n"
+                             "serial_service_http_connections %d\n"
+                             "# TYPE serial_service_http_streams gauge\n"
+                             "serial_service_http_streams %d\n"
+                             "# TYPE serial_service_http_stream_events_total counter\n"
+                             "serial_service_http_stream_events_total %lu\n"
+                             "# TYPE serial_service_http_slow_streams_total counter\n"
+                             "serial_service_http_slow_streams_total %lu\n",
+                       http_requests - http_errors, http_errors, http_count, http_stream_count,
+                       http_events, http_slow);
+    metrics_printf(text, "# TYPE serial_service_serial_up gauge\n"
+                         "serial_service_serial_up %d\n"
+                         "# TYPE serial_service_serial_connects_total counter\n"
+                         "serial_service_serial_connects_total %lu\n"
+                         "# TYPE serial_service_serial_disconnects_total counter\n"
+                         "serial_service_serial_disconnects_total %lu\n"
+                         "# TYPE serial_service_serial_connect_attempts_total counter\n"
+                         "serial_service_serial_connect_attempts_total %lu\n"
+                         "# TYPE serial_service_serial_ready_seconds gauge\n"
+                         "serial_service_serial_ready_seconds %.9f\n",
+                   serial_lock, serial_connects, serial_disconnects, serial_attempts,
+                   serial_ready * 1e-9);
+    metrics_printf(text, "# TYPE serial_service_serial_recovery_seconds histogram\n");
+    metrics_print_histogram(text, "serial_service_serial_recovery_seconds", "",
+                            &serial_recovery);
+    metrics_printf(text, "# TYPE serial_service_clients gauge\n"
+                         "serial_service_clients %d\n"
+                         "# TYPE serial_service_client_connects_total counter\n"
+                         "serial_service_client_connects_total %lu\n"
+                         "# TYPE serial_service_client_refused_total counter\n"
+                         "serial_service_client_refused_total %lu\n"
+                         "# TYPE serial_service_client_dropped_messages_total counter\n"
+                         "serial_service_client_dropped_messages_total %lu\n",
+                   client_count, client_connects, client_refused, dropped);
+    metrics_printf(text, "# TYPE serial_service_client_queue_depth gauge\n");
+    for (int i = 0; i < client_count; i++) {
+        metrics_printf(text, "serial_service_client_queue_depth{fd=\"%d\"} %u\n", clients[i]->fd,
+                       clients[i]->count);
+        if (clients[i]->count > depth_max)
+            depth_max = clients[i]->count;
+    }
+    metrics_printf(text, "# TYPE serial_service_client_queue_depth_max gauge\n"
+                         "serial_service_client_queue_depth_max %u\n",
+                   depth_max);
+    metrics_printf(text, "# TYPE serial_service_latency_seconds histogram\n");
+    metrics_print_histogram(text, "serial_service_latency_seconds",
+                            "direction=\"serial_to_client\"", &egress_latency);
+    metrics_print_histogram(text, "serial_service_latency_seconds",
+                            "direction=\"client_to_serial\"", &ingress_latency);
+    metrics_printf(text, "# TYPE serial_service_log_dropped_total counter\n"
+                         "serial_service_log_dropped_total %lu\n",
+                   logger_dropped());
+}
+
+/**
+ * @brief Format the journal states of a channel at a time as JSON
+ * @param query "channel=X&time=T", T in seconds since the epoch, now if missing
+ */
+void serial_journal_format(metrics_text_t *text, const char *query) {
+    const char *channel_arg = strstr(query, "channel="), *time_arg = strstr(query, "time=");
+    unsigned channel = channel_arg ? strtoul(channel_arg + strlen("channel="), NULL, 10) : 0;
+    uint64_t time = time_arg ? strtod(time_arg + strlen("time="), NULL) * 1e9 : journal_now();
+    int sw = -1, out = -1;
+
+    if (journal_on) {
+        sw = journal_state_at(&journal, JOURNAL_SW, channel, time);
+        out = journal_state_at(&journal, JOURNAL_OUT, channel, time);
+    }
+    // -1: unknown at that time
+    metrics_printf(text, "{\"channel\": %u, \"time\": %.6f, \"sw\": %d, \"out\": %d}\n",
+                   channel, time * 1e-9, sw, out);
+}
+
+/**
+ * @brief Answer a scrape request: a journal query (GET /journal?channel=X&time=T) or, for any
+ *        other request, the metrics
+ * @retval 0 on success, -1 if the connection must be closed
+ */
+int serial_stats_route(http_conn_t *conn, const http_request_t *request) {
+    metrics_text_t body = {0};
+    const char *type = "text/plain; version=0.0.4";
+    int ret;
+
+    if (0 == strcmp(request->path, "/journal")) {
+        serial_journal_format(&body, request->query);
+        type = "application/json";
+    } else {
+        serial_stats_format(&body);
+    }
+    ret = (NULL == body.data) ? -1
+                              : http_respond(conn, request, 200, type, body.data, body.len);
+    metrics_text_free(&body);
+    return ret;
+}
+
+/**
+ * @brief Create the HTTP server socket, on every interface like the web server it replaces
+ * @retval 0 on success, -1 on error
+ */
+int serial_http_listen(int port) {
+    struct sockaddr_in addr;
+    int opt = 1;
+
+    fd_http = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (0 > fd_http) {
+        perror("ERROR: Unable to create HTTP socket");
+        return -1;
+    }
+    if (0 > setsockopt(fd_http, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)))
+        perror("WARNING: Unable to set HTTP socket address reuse");
+    bzero((void *)&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (0 > bind(fd_http, (struct sockaddr *)&addr, sizeof(addr)) ||
+        0 > listen(fd_http, SOMAXCONN) ||
+        0 > serial_event_set(EPOLL_CTL_ADD, fd_http, EPOLLIN)) {
+        perror("ERROR: Unable to listen on HTTP socket");
+        close(fd_http);
+        fd_http = -1;
+        return -1;
+    }
+    printf("HTTP server on port %d\r\n", port);
+    return 0;
+}
+
+/**
+ * @brief Add an accepted socket to the event loop as an HTTP connection, closed on error
+ * @retval 0 on success, -1 on error
+ */
+int serial_http_add(int fd) {
+    http_conn_t *conn;
+
+    if (SERIAL_HTTP_MAX == http_count || fd >= client_table_size) {
+        logger_printf(LOGGER_WARNING, "Too many HTTP connections, connection refused");
+        close(fd);
+        return -1;
+    }
+    conn = http_conn_create(fd);
+    if (NULL == conn || 0 > serial_event_set(EPOLL_CTL_ADD, fd, EPOLLIN)) {
+        perror("ERROR: Unable to add HTTP connection to event loop");
+        if (NULL != conn)
+            http_conn_destroy(conn);
+        else
+            close(fd);
+        return -1;
+    }
+    http_table[fd] = conn;
+    http_count++;
+    return 0;
+}
+
+/**
+ * @brief Accept the pending HTTP connections
+ */
+void serial_http_accept(void) {
+    int fd;
+
+    while (0 <= (fd = accept4(fd_http, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)))
+        serial_http_add(fd);
+}
+
+/**
+ * @brief Accept the pending scrape connections, HTTP connections answered by serial_stats_route
+ */
+void serial_stats_accept(void) {
+    int fd;
+
+    while (0 <= (fd = accept4(fd_stats, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC))) {
+        if (0 == serial_http_add(fd))
+            stats_table[fd] = true;
+    }
+}
+
+/**
+ * @brief Answer a request with an error
+ * @retval 0 on success, -1 if the connection must be closed
+ */
+int serial_http_error(http_conn_t *conn, const http_request_t *request, int status) {
+    const char *text = (404 == status) ? "Not found\n" : (405 == status) ? "Not allowed\n"
+                                                                          : "Bad request\n";
+
+    http_errors++;
+    return http_respond(conn, request, status, NULL, text, strlen(text));
+}
+
+/**
+ * @brief Set lamps: "id" is a lamp ("dev_N" as the web sends it, or N), a range of lamps ("N-M")
+ *        or "all", "state" true or false
+ */
+int serial_http_lamp(http_conn_t *conn, const http_request_t *request) {
+    const char *params = request->form ? request->body : request->query, *digits;
+    char id[32], state[8], reply[128], *end;
+    unsigned long first, last;
+    int value, len;
+
+    if (HTTP_POST != request->method)
+        return serial_http_error(conn, request, 405);
+    if (NULL == http_param(params, "id", id, sizeof(id)) ||
+        NULL == http_param(params, "state", state, sizeof(state)))
+        return serial_http_error(conn, request, 400);
+    value = 0 == strcmp(state, "true") || 0 == strcmp(state, "1");
+    if (0 == strcmp(id, "all")) {
+        first = 1;
+        last = registry.count;
+    } else {
+        digits = strrchr(id, '_');
+        first = last = strtoul((NULL != digits) ? digits + 1 : id, &end, 10);
+        if ('-' == *end)
+            last = strtoul(end + 1, &end, 10);
+        if ('\0' != *end)
+            return serial_http_error(conn, request, 400);
+    }
+    if (1 > first || first > last || registry.count < last)
+        return serial_http_error(conn, request, 400);
+
+    if (first == last) {
+        frame_t update = {.type = FRAME_OUT, .channel = first - 1, .value = value};
+        update.stamp = metrics_now();
+        serial_lamp_update(&update);
+        if (!output_scheduler_put(&output_scheduler, &update))
+            serial_batch_add(&ingress_batch, &update); // Bypass channel
+        len = snprintf(reply, sizeof(reply), "{\"id\": \"%lu\", \"state\": \"%d\"}", first,
+                       value);
+    } else {
+        size_t changed = serial_lamp_range(first - 1, last - 1, value);
+        len = snprintf(reply, sizeof(reply),
+                       "{\"first\": \"%lu\", \"last\": \"%lu\", \"state\": \"%d\", "
+                       "\"changed\": %zu}",
+                       first, last, value, changed);
+    }
+    return http_respond(conn, request, 200, "application/json", reply, len);
+}
+
+/**
+ * @brief Answer a request: the device list, a lamp change, the event stream or a static file
+ * @retval 0 on success, -1 if the connection must be closed
+ */
+int serial_http_route(http_conn_t *conn, const http_request_t *request) {
+    metrics_text_t body = {0};
+    char path[4096];
+    int ret;
+
+    if (stats_table[conn->fd]) // Scrape socket, not counted as HTTP API requests
+        return serial_stats_route(conn, request);
+    http_requests++;
+    if (0 == strcmp(request->path, "/api/lamp"))
+        return serial_http_lamp(conn, request);
+    if (HTTP_GET != request->method)
+        return serial_http_error(conn, request, 405);
+    if (0 == strcmp(request->path, "/api/devices")) {
+        // A page of the list with "first" (lamp number) and "count", every lamp otherwise
+        unsigned long first = 1, count = registry.count;
+        char param[16];
+        if (NULL != http_param(request->query, "first", param, sizeof(param)))
+            first = strtoul(param, NULL, 10);
+        if (NULL != http_param(request->query, "count", param, sizeof(param)))
+            count = strtoul(param, NULL, 10);
+        if (1 > first)
+            return serial_http_error(conn, request, 400);
+        serial_devices_format(&body, first - 1, count);
+        ret = (NULL == body.data) ? -1
+                                  : http_respond(conn, request, 200, "application/json",
+                                                 body.data, body.len);
+    } else if (0 == strcmp(request->path, "/api/events")) {
+        // The stream starts with the device list, then one event per change
+        metrics_text_t event = {0};
+        serial_devices_format(&body, 0, registry.count);
+        ret = (NULL == body.data || 0 > http_event_format(&event, "devices", body.data) ||
+               0 > http_stream_start(conn) || 0 > http_stream_send(conn, event.data, event.len))
+                  ? -1
+                  : 0;
+        metrics_text_free(&event);
+        if (0 == ret) {
+            conn->index = http_stream_count;
+            http_streams[http_stream_count++] = conn;
+        }
+    } else if (NULL != http_root && NULL == strstr(request->path, "..")) {
+        snprintf(path, sizeof(path), "%s%s", http_root,
+                 (0 == strcmp(request->path, "/")) ? "/index.html" : request->path);
+        ret = http_respond_file(conn, request, path);
+    } else {
+        ret = serial_http_error(conn, request, 404);
+    }
+    metrics_text_free(&body);
+    return ret;
+}
+
+/**
+ * @brief Answer the complete requests received, while the socket takes the answers
+ * @retval 0 on success, -1 if the connection was closed
+ */
+int serial_http_serve(http_conn_t *conn) {
+    http_request_t request;
+    int parsed;
+
+    while (!conn->stream && !conn->closing && !http_conn_pending(conn) &&
+           0 != (parsed = http_request_parse(conn, &request))) {
+        if (0 > parsed) {
+            serial_http_error(conn, NULL, 400); // Closes once written
             break;
         }
-        printf("Serial service ingress: %s", tx_buffer);
-        serial_send(tx_buffer, SERIAL_MSG_LENGTH);
+        if (0 > serial_http_route(conn, &request)) {
+            serial_http_close(conn);
+            return -1;
+        }
+        http_request_done(conn);
+    }
+    if (conn->stream) // Nothing more is read from a stream
+        conn->in_len = 0;
+    if (conn->closing && !http_conn_pending(conn)) {
+        serial_http_close(conn);
+        return -1;
     }
+    serial_http_update_events(conn);
+    return 0;
+}
+
+/**
+ * @brief HTTP connection readable: answer its requests
+ */
+void serial_http_read(http_conn_t *conn) {
+    bool closed = 0 > http_conn_read(conn);
+
+    if (0 == serial_http_serve(conn) && closed)
+        serial_http_close(conn);
+}
+
+/**
+ * @brief HTTP connection writable: write the pending output, then the requests waiting for it
+ */
+void serial_http_write(http_conn_t *conn) {
+    if (0 > http_conn_flush(conn))
+        serial_http_close(conn);
+    else
+        serial_http_serve(conn);
+}
 
-    pthread_mutex_lock(&client_mutex);
-    client_lock = false;
-    pthread_mutex_unlock(&client_mutex);
-    return rcode;
+/**
+ * @brief Output flush interval expired
+ */
+void serial_timer_read(void) {
+    uint64_t expirations;
+
+    if (sizeof(expirations) == read(fd_timer, &expirations, sizeof(expirations)))
+        serial_output_drain(true);
 }
 
-int main(void) {
+/**
+ * @brief Read pending signals
+ * @retval true if SIGINT or SIGTERM was received
+ */
+bool serial_signal_read(void) {
+    struct signalfd_siginfo info;
 
+    while (sizeof(info) == read(fd_signal, &info, sizeof(info))) {
+        if (SIGINT == info.ssi_signo || SIGTERM == info.ssi_signo)
+            return true;
+    }
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+
+    service_start = metrics_now();
     printf("Inicio Serial Service\r\n");
 
-    int rcode;            // to check return values
-    sigint_flag = false;  // SIGINT flag initialization
-    sigterm_flag = false; // SIGTERM flag initialization
-    serial_lock = false;  // init lock, emulator not connected
-    client_lock = false;  // init lock, client not connected
-
-    // Setup signal management
-    struct sigaction sa_serial;
-    sa_serial.sa_handler = sa_serial_handler;
-    sa_serial.sa_flags = 0;
-    if (0 != sigemptyset(&sa_serial.sa_mask)) {
-        perror("ERROR: Unable to create signal empty set");
+    struct epoll_event events[SERIAL_MAX_EVENTS];
+    struct rlimit limit;
+    bool stop = false;
+    char *bypass = NULL, *journal_path = NULL, *bridge_dir = NULL, *registry_path = NULL;
+    int count, opt, level = LOGGER_INFO, http_port = 0;
+    unsigned registry_count = SERIAL_CHANNELS;
+
+    serial_lock = false; // init lock, emulator not connected
+    client_max = SERIAL_MAX_CLIENTS;
+    frame_parser_init(&serial_parser);
+    binary_parser_init(&serial_binary_parser);
+    egress_batch.type = FRAME_SW;
+    egress_batch.flush = serial_egress_flush;
+    ingress_batch.type = FRAME_OUT;
+    ingress_batch.flush = serial_ingress_flush;
+
+    while (-1 != (opt = getopt(argc, argv, "c:o:b:i:p:d:l:j:w:H:W:L:M:e:"))) {
+        if ('c' == opt && 0 < atoi(optarg)) {
+            client_max = atoi(optarg);
+        } else if ('o' == opt && 0 == strcmp(optarg, "drop")) {
+            client_policy = CLIENT_DROP_OLDEST;
+        } else if ('o' == opt && 0 == strcmp(optarg, "disconnect")) {
+            client_policy = CLIENT_DISCONNECT;
+        } else if ('b' == opt && 0 < atol(optarg)) {
+            serial_baudrate = atol(optarg);
+        } else if ('i' == opt && 0 < atoi(optarg)) {
+            flush_interval = atoi(optarg);
+        } else if ('p' == opt) {
+            bypass = optarg;
+        } else if ('d' == opt) {
+            serial_set_device(optarg);
+        } else if ('l' == opt && 0 <= logger_parse_level(optarg)) {
+            level = logger_parse_level(optarg);
+        } else if ('j' == opt) {
+            journal_path = optarg;
+        } else if ('w' == opt) {
+            bridge_dir = optarg;
+        } else if ('H' == opt && 0 < atoi(optarg) && 65536 > atoi(optarg)) {
+            http_port = atoi(optarg);
+        } else if ('W' == opt) {
+            http_root = optarg;
+        } else if ('L' == opt && 0 < atol(optarg) && CHANNEL_REGISTRY_MAX >= atol(optarg)) {
+            registry_count = atol(optarg);
+        } else if ('M' == opt) {
+            registry_path = optarg;
+        } else if ('e' == opt && 0 == strcmp(optarg, "rw")) {
+            io_engine_kind = IO_ENGINE_RW;
+        } else if ('e' == opt && 0 == strcmp(optarg, "uring")) {
+            io_engine_kind = IO_ENGINE_URING;
+        } else {
+            fprintf(stderr,
+                    "Usage: %s [-c max_clients] [-o drop|disconnect] [-b baudrate] "
+                    "[-i interval_ms] [-p channel,...] [-d device] "
+                    "[-l off|error|warning|info|debug] [-j journal_file] "
+                    "[-w lamp_files_dir] [-H http_port] [-W web_dir] [-L channels] "
+                    "[-M channels_file] [-e rw|uring]\r\n",
+                    argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (0 > output_scheduler_init(&output_scheduler, serial_baudrate, flush_interval)) {
+        perror("ERROR: Unable to allocate output scheduler");
         exit(EXIT_FAILURE);
     }
-    if (0 != sigaction(SIGINT, &sa_serial, NULL)) {
-        perror("ERROR: Unable to set signal handler");
+    while (NULL != bypass && '\0' != *bypass) {
+        char *end;
+        output_scheduler_set_bypass(&output_scheduler, strtoul(bypass, &end, 10));
+        bypass = (',' == *end) ? end + 1 : NULL;
+    }
+
+    registry_changed = calloc(CHANNEL_REGISTRY_WORDS(registry_count), sizeof(uint64_t));
+    if (0 > channel_registry_init(&registry, registry_count) || NULL == registry_changed) {
+        perror("ERROR: Unable to allocate channel registry");
         exit(EXIT_FAILURE);
     }
-    if (0 != sigaction(SIGTERM, &sa_serial, NULL)) {
-        perror("ERROR: Unable to set signal handler");
+    if (NULL != registry_path && 0 > channel_registry_load(&registry, registry_path)) {
+        perror("ERROR: Unable to read channel metadata");
         exit(EXIT_FAILURE);
     }
+    if (NULL != journal_path) {
+        uint64_t start = metrics_now();
+        if (0 > journal_open(&journal, journal_path)) {
+            perror("ERROR: Unable to open journal");
+            exit(EXIT_FAILURE);
+        }
+        journal_on = true;
+        for (unsigned i = 0; i < registry.count; i++) {
+            int value = journal_state(&journal, JOURNAL_OUT, i);
+            if (0 <= value)
+                channel_registry_set(&registry, i, value);
+        }
+        printf("Journal %s: %lu records replayed, %zu channels restored in %.3f ms\r\n",
+               journal_path, journal.replayed, journal.known_count,
+               (metrics_now() - start) * 1e-6);
+    }
 
-    // Open serial port
-    if (0 > serial_open(0, SERIAL_PORT_BAUDRATE)) {
-        printf("ERROR: Unable to open serial port\r\n");
-        exit(EXIT_SUCCESS);
+    // Clients are looked up by fd, one entry per possible open file
+    client_table_size = (0 == getrlimit(RLIMIT_NOFILE, &limit) && RLIM_INFINITY != limit.rlim_cur)
+                            ? (int)limit.rlim_cur
+                            : 65536;
+    clients = calloc(client_max, sizeof(client_t *));
+    client_table = calloc(client_table_size, sizeof(client_t *));
+    client_closing = calloc(client_max, sizeof(client_t *));
+    stats_table = calloc(client_table_size, sizeof(bool));
+    http_table = calloc(client_table_size, sizeof(http_conn_t *));
+    http_streams = calloc(SERIAL_HTTP_MAX, sizeof(http_conn_t *));
+    http_closing = calloc(SERIAL_HTTP_MAX, sizeof(http_conn_t *));
+    if (NULL == clients || NULL == client_table || NULL == client_closing ||
+        NULL == stats_table || NULL == http_table || NULL == http_streams ||
+        NULL == http_closing) {
+        perror("ERROR: Unable to allocate client table");
+        exit(EXIT_FAILURE);
     }
 
-    rcode = serial_mask_signal(SIG_BLOCK);
-    if (0 != rcode) {
-        if (rcode != -1)
-            errno = rcode;
-        perror("ERROR: Unable to block signals in main thread");
+    // Setup signal management: SIGINT and SIGTERM are handled by the event loop
+    fd_signal = serial_signal_setup();
+    if (0 > fd_signal) {
+        perror("ERROR: Unable to set signal handler");
         exit(EXIT_FAILURE);
     }
 
-    // Create serial thread
-    rcode = pthread_create(&serial_thread, NULL, serial_port_listen, NULL);
-    if (0 != rcode) {
-        errno = rcode;
-        perror("ERROR: Unable to create serial polling thread");
+    fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (0 > fd_epoll) {
+        perror("ERROR: Unable to create event loop");
+        serial_service_exit(EXIT_FAILURE);
+    }
+    if (0 > serial_event_set(EPOLL_CTL_ADD, fd_signal, EPOLLIN)) {
+        perror("ERROR: Unable to add signals to event loop");
+        serial_service_exit(EXIT_FAILURE);
+    }
+    // Serial port and client I/O, the ring fd (io_uring) in the event loop for its completions
+    if (IO_ENGINE_URING == io_engine_kind &&
+        0 > io_engine_init(&io_engine, io_engine_kind, client_table_size, serial_io_event, NULL)) {
+        // Kernel older than 6.0, or io_uring disabled (kernel.io_uring_disabled, seccomp)
+        perror("WARNING: Unable to start io_uring engine, using read/write");
+        io_engine_kind = IO_ENGINE_RW;
+    }
+    if (IO_ENGINE_RW == io_engine_kind &&
+        0 > io_engine_init(&io_engine, io_engine_kind, client_table_size, serial_io_event, NULL)) {
+        perror("ERROR: Unable to start I/O engine");
+        serial_service_exit(EXIT_FAILURE);
+    }
+    if (0 <= io_engine.fd && 0 > serial_event_set(EPOLL_CTL_ADD, io_engine.fd, EPOLLIN)) {
+        perror("ERROR: Unable to add I/O engine to event loop");
+        serial_service_exit(EXIT_FAILURE);
+    }
+    printf("I/O engine: %s\r\n", io_engine.ops->name);
+
+    fd_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (0 > fd_timer || 0 > serial_event_set(EPOLL_CTL_ADD, fd_timer, EPOLLIN)) {
+        perror("ERROR: Unable to add output flush timer to event loop");
         serial_service_exit(EXIT_FAILURE);
     }
 
-    // Unblock signals, the main thread can handle them safely
-    rcode = serial_mask_signal(SIG_UNBLOCK);
-    if (0 != rcode) {
-        if (rcode != -1)
-            errno = rcode;
-        perror("ERROR: Unable to unblock signals in main thread");
+    fd_retry = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (0 > fd_retry || 0 > serial_event_set(EPOLL_CTL_ADD, fd_retry, EPOLLIN)) {
+        perror("ERROR: Unable to add serial port retry timer to event loop");
         serial_service_exit(EXIT_FAILURE);
     }
 
-    // Create TCP/IP server listen thread
-    rcode = serial_server_listen();
+    if (NULL != bridge_dir) {
+        fd_bridge = file_bridge_open(&bridge, bridge_dir);
+        if (0 > fd_bridge || 0 > serial_event_set(EPOLL_CTL_ADD, fd_bridge, EPOLLIN)) {
+            perror("ERROR: Unable to watch lamp files");
+            serial_service_exit(EXIT_FAILURE);
+        }
+        // The file states wait in the output scheduler for the serial port
+        serial_bridge_read();
+        printf("Watching lamp files %s/outN.txt\r\n", bridge_dir);
+    }
 
-    // Cancel serial port polling thread
-    if (0 != pthread_cancel(serial_thread)) {
-        perror("ERROR: Unable to cancel serial port polling thread");
+    // Create TCP/IP server, clients are accepted while the serial port connects
+    if (0 > serial_server_listen())
+        serial_service_exit(EXIT_FAILURE);
+    if (0 > serial_stats_listen())
+        serial_service_exit(EXIT_FAILURE);
+    if (0 < http_port && 0 > serial_http_listen(http_port))
+        serial_service_exit(EXIT_FAILURE);
+
+    // Started once the setup messages are out, later events go through the ring
+    fflush(stdout);
+    if (0 > logger_init(level)) {
+        perror("ERROR: Unable to start logger");
+        serial_service_exit(EXIT_FAILURE);
     }
 
-    // Wait for serial port polling thread to finish
-    if (0 != pthread_join(serial_thread, NULL)) {
-        perror("ERROR: Unable to join serial port polling thread");
+    // Open serial port, completed by the event loop
+    serial_backoff_ms = SERIAL_RECONNECT_MIN_MS;
+    serial_port_connect();
+
+    while (!stop) {
+        count = epoll_wait(fd_epoll, events, SERIAL_MAX_EVENTS, -1);
+        if (0 > count) {
+            if (EINTR == errno)
+                continue;
+            perror("ERROR: Event loop wait");
+            serial_service_exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < count && !stop; i++) {
+            int fd = events[i].data.fd;
+            if (fd == fd_signal) {
+                stop = serial_signal_read();
+            } else if (fd == fd_timer) {
+                serial_timer_read();
+            } else if (fd == fd_retry) {
+                serial_retry_read();
+            } else if (fd == fd_bridge) {
+                serial_bridge_read();
+            } else if (fd == fd_stats) {
+                serial_stats_accept();
+            } else if (fd == fd_http) {
+                serial_http_accept();
+            } else if (NULL != http_table[fd]) {
+                // Looked up again, the connection may be closed by the read
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    serial_http_read(http_table[fd]);
+                if (NULL != http_table[fd] && events[i].events & EPOLLOUT)
+                    serial_http_write(http_table[fd]);
+            } else if (fd == fd_socket) {
+                serial_server_accept();
+            } else if (serial_connecting && fd == serial_get_fd()) {
+                serial_port_connected();
+            } else if (fd == io_engine.fd) {
+                io_engine_complete(&io_engine); // serial_io_event
+            } else if (serial_lock && fd == serial_get_fd()) {
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    io_engine_read(&io_engine, fd); // serial_io_event
+                if (serial_lock && events[i].events & EPOLLOUT)
+                    serial_port_write();
+            } else if (NULL != client_table[fd]) {
+                // Looked up again, the client may be closed by the read
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    io_engine_read(&io_engine, fd); // serial_io_event
+                if (NULL != client_table[fd] && events[i].events & EPOLLOUT)
+                    serial_client_write(client_table[fd]);
+            }
+        }
+        serial_output_drain(false);
+        if (0 < ingress_batch.count) // Bypass updates
+            serial_ingress_flush();
+        // Every send and receive queued in this iteration, one syscall (io_uring)
+        if (0 > io_engine_submit(&io_engine))
+            logger_printf(LOGGER_ERROR, "Unable to submit I/O: %s", strerror(errno));
+        serial_client_reap();
+        serial_http_reap();
     }
 
     // Serial service exit process
-    serial_service_exit(rcode);
+    serial_service_exit(EXIT_SUCCESS);
 
     return 0;
 }
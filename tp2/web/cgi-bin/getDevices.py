@@ -15,21 +15,19 @@
 #    You should have received a copy of the GNU General Public License
 #    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 import json
+import os.path
+import sys
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), "../../SerialService"))
+from lamptable import LampTable
 
 print("Content-Type: text/html")
 print("")
 
-fp = open("/tmp/out1.txt", 'r')
-out1State = fp.read()
-fp.close()
-
-fp = open("/tmp/out2.txt", 'r')
-out2State = fp.read()
-fp.close()
-
-fp = open("/tmp/out3.txt", 'r')
-out3State = fp.read()
-fp.close()
+table = LampTable()
+out1State = table.get(0)[0]
+out2State = table.get(1)[0]
+out3State = table.get(2)[0]
+table.close()
 
 out = []
 
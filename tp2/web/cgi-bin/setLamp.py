@@ -17,6 +17,10 @@
 print("Content-Type: text/html")
 print("")
 import cgi
+import os.path
+import sys
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), "../../SerialService"))
+from lamptable import LampTable
 
 
 arguments = cgi.FieldStorage()
@@ -28,12 +32,9 @@ try:
 	else:
 		lampVal = False
 
-	fp = open("/tmp/out"+str(lampNum)+".txt", 'w+')
-	if lampVal:
-		fp.write("1")
-	else:
-		fp.write("0")
-	fp.close()
+	table = LampTable()
+	table.set(lampNum-1, lampVal)
+	table.close()
 	print("["+str(lampNum)+","+str(lampVal)+"]")
 
 except Exception as e:
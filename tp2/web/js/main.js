@@ -51,6 +51,11 @@ var ViewMainPage = /** @class */ (function () {
         var el = this.myf.getElementById(id);
         return el.checked;
     };
+    ViewMainPage.prototype.setSwitchStateById = function (id, state) {
+        var el = this.myf.getElementById(id);
+        if (el != null)
+            el.checked = state;
+    };
     return ViewMainPage;
 }());
 var Main = /** @class */ (function () {
@@ -59,8 +64,15 @@ var Main = /** @class */ (function () {
     Main.prototype.handleEvent = function (evt) {
         var sw = this.myf.getElementByEvent(evt);
         console.log("click en device:" + sw.id);
-        var data = { "id": sw.id, "state": this.view.getSwitchStateById(sw.id) };
-        this.myf.requestPOST("cgi-bin/setLamp.py", data, this);
+        var state = this.view.getSwitchStateById(sw.id);
+        if (this.api) {
+            // SerialService -H: los parametros van en la URL
+            this.myf.requestPOST("api/lamp?id=" + sw.id + "&state=" + state, {}, this);
+        }
+        else {
+            var data = { "id": sw.id, "state": state };
+            this.myf.requestPOST("cgi-bin/setLamp.py", data, this);
+        }
     };
     Main.prototype.handleGETResponse = function (status, response) {
         if (status == 200) {
@@ -81,6 +93,35 @@ var Main = /** @class */ (function () {
         var _this = this;
         this.myf = new MyFramework();
         this.view = new ViewMainPage(this.myf);
+        this.api = typeof EventSource != "undefined";
+        if (!this.api) {
+            this.poll();
+            return;
+        }
+        // SerialService -H envia la lista de dispositivos y despues cada cambio
+        var events = new EventSource("api/events");
+        events.addEventListener("devices", function (evt) {
+            _this.handleGETResponse(200, evt.data);
+        });
+        events.addEventListener("lamp", function (evt) {
+            var lamp = JSON.parse(evt.data);
+            _this.view.setSwitchStateById("dev_" + lamp.id, lamp.state == "1");
+        });
+        events.addEventListener("range", function (evt) {
+            var range = JSON.parse(evt.data);
+            for (var i = parseInt(range.first); i <= parseInt(range.last); i++)
+                _this.view.setSwitchStateById("dev_" + i, range.state == "1");
+        });
+        events.onerror = function () {
+            // Servidor sin eventos (CGI): se vuelve a consultar cada segundo
+            if (events.readyState == EventSource.CLOSED) {
+                _this.api = false;
+                _this.poll();
+            }
+        };
+    };
+    Main.prototype.poll = function () {
+        var _this = this;
         setInterval(function () { _this.myf.requestGET("cgi-bin/getDevices.py", _this); }, 1000);
     };
     return Main;
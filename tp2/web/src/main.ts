@@ -70,19 +70,35 @@ class ViewMainPage
         let el:HTMLInputElement = <HTMLInputElement>this.myf.getElementById(id);
         return el.checked;
     }
+
+    setSwitchStateById(id:string,state:boolean):void {
+        let el:HTMLInputElement = <HTMLInputElement>this.myf.getElementById(id);
+        if(el!=null)
+            el.checked = state;
+    }
 }
 class Main implements GETResponseListener, EventListenerObject, POSTResponseListener
 {
     myf:MyFramework;
     view:ViewMainPage;
+    api:boolean;
 
     handleEvent(evt:Event):void
     {
         let sw: HTMLElement = this.myf.getElementByEvent(evt);
         console.log("click en device:"+sw.id);
 
-        let data:object = {"id":sw.id,"state":this.view.getSwitchStateById(sw.id)};
-        this.myf.requestPOST("cgi-bin/setLamp.py",data,this);
+        let state:boolean = this.view.getSwitchStateById(sw.id);
+        if(this.api)
+        {
+            // SerialService -H: los parametros van en la URL
+            this.myf.requestPOST("api/lamp?id="+sw.id+"&state="+state,{},this);
+        }
+        else
+        {
+            let data:object = {"id":sw.id,"state":state};
+            this.myf.requestPOST("cgi-bin/setLamp.py",data,this);
+        }
     }
 
     handleGETResponse(status:number,response:string):void{
@@ -112,6 +128,39 @@ class Main implements GETResponseListener, EventListenerObject, POSTResponseList
 
       this.view = new ViewMainPage(this.myf);
 
+      this.api = typeof EventSource != "undefined";
+      if(!this.api)
+      {
+          this.poll();
+          return;
+      }
+
+      // SerialService -H envia la lista de dispositivos y despues cada cambio
+      let events:EventSource = new EventSource("api/events");
+      events.addEventListener("devices",(evt:MessageEvent)=>{
+          this.handleGETResponse(200,evt.data);
+      });
+      events.addEventListener("lamp",(evt:MessageEvent)=>{
+          let lamp = JSON.parse(evt.data);
+          this.view.setSwitchStateById("dev_"+lamp.id,lamp.state=="1");
+      });
+      events.addEventListener("range",(evt:MessageEvent)=>{
+          let range = JSON.parse(evt.data);
+          for(let i:number=parseInt(range.first);i<=parseInt(range.last);i++)
+              this.view.setSwitchStateById("dev_"+i,range.state=="1");
+      });
+      events.onerror = ()=>{
+          // Servidor sin eventos (CGI): se vuelve a consultar cada segundo
+          if(events.readyState == EventSource.CLOSED)
+          {
+              this.api = false;
+              this.poll();
+          }
+      };
+    }
+
+    poll():void
+    {
       setInterval(()=>{this.myf.requestGET("cgi-bin/getDevices.py",this)},1000);
     }
 }